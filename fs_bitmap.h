@@ -25,10 +25,16 @@ typedef enum _tag_bitmap_status {
     FS_BITMAP_ERROR_MEMORY_ALLOCATE_FAILURE = 1,
     FS_BITMAP_ERROR_DRIVE_RW_FAILURE = 2,
     FS_BITMAP_ERROR_OUT_OF_RANGE=3, /* Note: No write bitmap, 0 - 4095 */
+    FS_BITMAP_ERROR_NO_REFERENCE=4, /* Note: clone needs fs_clusref, fs_cluster_setref */
+    FS_BITMAP_ERROR_PUNCH_UNSUPPORTED=5, /* Note: the clusters are erased, but the host storage is not released. */
+    FS_BITMAP_ERROR_REFERENCE_IN_USE=6, /* Note: fs_extent_mountref needs an empty fs_clusref */
 } bitmap_status;
 
+struct _tag_FSCLUSREF;
+
 typedef struct _tag_FSBITMAP {
     FSDISK *fdp;
+    struct _tag_FSCLUSREF *ref; /* fs_clusref: NULL, no shared cluster. */
     bitmap_status status;
 } FSBITMAP;
 
@@ -42,10 +48,15 @@ static inline bool_t fs_bitmap_seterror(FSBITMAP *bp, bitmap_status status) {
     return b_false;
 }
 
+static inline bitmap_status fs_bitmap_getstatus(FSBITMAP *bp) {
+    return bp->status;
+}
+
 static inline bool_t fs_bitmap_open(FSBITMAP **bp, FSDISK *fdp) {
     *bp = (FSBITMAP *)fs_malloc(sizeof(FSBITMAP));
     if(!*bp) return b_false;
     (*bp)->fdp = fdp;
+    (*bp)->ref = NULL;
     return fs_bitmap_setsuccess(*bp);
 }
 
@@ -121,6 +132,20 @@ static inline bool_t fs_bitmap_getmask_allusedrange(FSBITMAP *bp, sector_t begin
     return fs_bitmap_setsuccess(bp);
 }
 
+static inline bool_t fs_bitmap_getmask_chunkused(FSBITMAP *bp, index_t chunk, bool_t *used) { /* some sectors in the data chunk "fsindex%04d.dat" are used. */
+    if(chunk==0) {*used=b_true; return fs_bitmap_setsuccess(bp);} /* Note: BCR, 0 - 4095 */
+    const counter_t rwsec=SECTORS_PER_CHUNK/_BITS_PER_SECTOR;
+    const sector_t  metabegin=-1*(chunk*rwsec);
+    byte_t rbuf[(SECTORS_PER_CHUNK/_BITS_PER_SECTOR)*BYTES_PER_SECTOR];
+    memset(rbuf, 0x00, sizeof(rbuf)); /* Note: No fsimeta, no used. */
+    if(!fs_disk_read(bp->fdp, metabegin, rwsec, rbuf)) return fs_bitmap_seterror(bp, FS_BITMAP_ERROR_DRIVE_RW_FAILURE);
+    *used=b_false;
+    for(index_t i=0; i<(index_t)sizeof(rbuf); ++i) {
+        if(rbuf[i]) {*used=b_true; break;}
+    }
+    return fs_bitmap_setsuccess(bp);
+}
+
 static inline bool_t fs_bitmap_getmask_freesector(FSBITMAP *bp, counter_t num, sector_t offset, sector_t *begin) {
     *begin=_BITS_PER_SECTOR; /* after 4096. */
     sector_t ite=(offset<_BITS_PER_SECTOR)? _BITS_PER_SECTOR: offset;
@@ -22,6 +22,11 @@
 *
 */
 
+typedef enum _tag_compress_type {
+    compress_none = 0x00,
+    compress_lz = 0x01,
+} compress_type;
+
 #pragma pack(push, 1)
 typedef struct _tag_BLOCKCHAIN_PARAMETER_BLOCK {
     union {
@@ -43,6 +48,8 @@ typedef struct _tag_BLOCKCHAIN_PARAMETER_BLOCK {
             cluster_t bad_allocate_offset; /* [BADA] bad allocate chain list offset */
             cluster_t meta_xor_offset; /* [SXOR] meta-data xor table record offset */
             cluster_t data_xor_offset; /* [SXOR] data-area xor table record offset */
+            cluster_t cmap_offset; /* [CMAP] compressed cluster map offset */
+            byte_t compress_type; /* compress_none or compress_lz */
             byte_t reserved2[1];
         };
         struct {
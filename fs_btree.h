@@ -9,17 +9,79 @@
 #include "fs_memory.h"
 #include "fs_const.h"
 #include "fs_datastream.h"
+#include "fs_keyarena.h"
+#include "fs_endian.h"
+#include "fs_cpu.h"
+#include "fs_thread.h"
 
 /*
 * ** fs_btree **
 *
 * B-tree for Cluster (Cluster datastream + B-tree plus) on memory.
 *
+* inline key: each node has the first BTREE_PREFIX_SIZE bytes of its keys (prefix_ptr, and prefix of a leaf).
+* With the default (strcmp) comparators, most comparisons end in the prefix. Otherwise, the key is read
+* in place from the key arena, so a search does not allocate.
+*
+* key arena: the keys are packed in FSKEYARENA (fs_keyarena.h) with their size, nodes and leaves hold the offsets.
+* ksize==BTREE_KEY_VARIABLE: the size of a key is strlen+1, so the memory is the bytes of the keys, not ksize each.
+*
+* linked leaf: the leaves are linked in the order of the tree (prev, next). BTREE_CURSOR walks through them
+* without going back to the root: seek(key), next, prev, and range [lo, hi).
+* The order is the one of fkeylt: (default: strcmp descending, see fs_btree_default_fkeylt)
+* Note: after insert or remove, a cursor must seek again.
+*
+* bulk load: the sorted keys (in the order of fkeylt, no duplicates) make the leaves one by one (fs_btree_bulk_add),
+* and fs_btree_bulk_end builds the nodes bottom-up, level by level: each node has "fill" percent of dimension children.
+* No search from the root and no split.
+*
+* slab: a node is one block, [B_NODE][begin_ptr][node_ptr][prefix_ptr], and a leaf is one block too.
+* The blocks are cut from the slabs of the tree, (BTREE_POOL, aligned to BTREE_CACHE_LINE) a freed block goes to
+* the free list, and is used again by the next alloc. fs_btree_clear releases the slabs. (not node by node)
+*
+* key type: (fs_btree_setkeytype) btree_key_memcmp, btree_key_hash32 (32 bytes) and btree_key_u64 are binary keys
+* of ksize bytes in ascending order, compared in place without fkeyequ/fkeylt: one three-way compare with the prefix,
+* (big endian words, the rest from the arena only if the prefix is the same) and the search in a node is branch-free.
+* btree_key_u64: the whole key is in the prefix, the slots of key<=x are counted. (AVX2 if fs_cpu_has)
+*
+* concurrent mode: (fs_btree_setconcurrent) optimistic lock coupling. Each node has a version, a writer latches
+* the nodes it modifies (and the root pointer) and the unlatch bumps the version. fs_btree_olc_getdata reads the
+* nodes without a latch and validates the versions, it restarts from the root if one has changed.
+* The writers (fs_btree_olc_insert, fs_btree_olc_remove) are one at a time, a split node stays latched until
+* its parent has the new node. The freed nodes and the old tables of the arena and vch are retired with the epoch,
+* and freed after the readers of that epoch have left. (reader: 0 to BTREE_READERS_MAX-1, one thread each)
+* Note: the other functions (getdata, cursor, bulk, batch, clear) are not for the time of the readers.
+*
+* batch: (fs_btree_getdata_batch, fs_btree_insert_batch) the keys are sorted in the order of the tree, and one descent
+* from the root splits them at each node into the runs of its children. The children of the runs are prefetched
+* before the first run goes down. An insert batch merges all new leaves of a node in one pass, and a node is
+* rewritten once: it is split into as many nodes as needed, (dimension or less each) and the parent takes them all.
+*
+* reclaim: a removed leaf gives its data slot back to vch, (fs_datastream_release) and the next insert uses it again.
+* Its key stays in the arena as dead bytes (fs_btree_getdeadbytes), the separators of the nodes may still point to it.
+* fs_btree_compact copies the live keys (of the leaves and the separators) and data to a new arena and vch, and fixes
+* the offsets and indices in place: the nodes and leaves stay. (not for the time of the readers)
+*
 */
 
+#if defined(FS_CPU_X86) && (defined(COMPILER_MSC) || defined(COMPILER_INTEL) || defined(COMPILER_CLANG) || (defined(COMPILER_GNU) && 5<=__GNUC__))
+# define FS_BTREE_AVX2
+# include <immintrin.h>
+#endif
+
 #define INDEX_ERROR -1
 #define INVALID_B_NODE ((B_NODE *)-1)
 #define NO_ACCEPT_B_NODE ((B_NODE *)-2)
+#define BTREE_PREFIX_SIZE 16
+#define BTREE_KEY_VARIABLE 0
+#define BTREE_CACHE_LINE 64
+#define BTREE_SLAB_SIZE 65536
+#define BTREE_SLAB_ALLOC_UNIT 64
+#define BTREE_OLC_OBSOLETE 1
+#define BTREE_OLC_LOCKED 2
+#define BTREE_READERS_MAX THREAD_WORKERS_MAX
+#define BTREE_EPOCH_IDLE 0
+#define BTREE_RETIRE_ALLOC_UNIT 256
 
 typedef enum _tag_node_type {
     n_unused,
@@ -27,6 +89,13 @@ typedef enum _tag_node_type {
     n_leaf,
 } node_type;
 
+typedef enum _tag_btree_keytype {
+    btree_key_string = 0, /* fkeyequ, fkeylt */
+    btree_key_memcmp = 1,
+    btree_key_hash32 = 2,
+    btree_key_u64 = 3, /* uint64_t, the host byte order */
+} btree_keytype;
+
 typedef enum _tag_merge_status {
     m_no_connect,
     m_connected,
@@ -38,18 +107,27 @@ typedef enum _tag_rem_status {
     r_node_removed,
     r_node_need_merge,
     r_node_error,
+    r_node_memory, /* removed, but its data slot is not given back to vch */
 } rem_status;
 
 typedef struct _tag_B_NODE {
     node_type type;
+    counter_t version; /* concurrent: BTREE_OLC_LOCKED, BTREE_OLC_OBSOLETE, +4 by each unlatch */
     union {
         struct {
             counter_t num;
             struct _tag_B_NODE **node_ptr;
-            counter_t *begin_ptr;
+            counter_t *begin_ptr; /* key offset (FSKEYARENA) */
+            str_t *prefix_ptr; /* [dimension][BTREE_PREFIX_SIZE]: the key of begin_ptr, after the common bytes */
+            counter_t common; /* the bytes that the keys of the slots have in common */
+            counter_t common_offset; /* a key with the common bytes */
         } node;
         struct {
             counter_t vch_index;
+            counter_t key_offset;
+            struct _tag_B_NODE *prev;
+            struct _tag_B_NODE *next;
+            str_t prefix[BTREE_PREFIX_SIZE];
         } leaf;
     } tree;
 } B_NODE;
@@ -58,26 +136,67 @@ typedef struct _tag_B_INSERT {
     B_NODE **p_node;
     B_NODE **n_node;
     counter_t *n_index;
+    B_NODE **s_node; /* concurrent: the split node, still latched */
 } B_INSERT;
 
+typedef struct _tag_BTREE_CURSOR {
+    struct _tag_FSBTREE *fbp;
+    B_NODE *leaf; /* NULL: end */
+    const str_t *lo; /* range: NULL is no limit */
+    const str_t *hi;
+} BTREE_CURSOR;
+
 typedef enum _tag_btree_status {
     BTREE_SUCCESS = 0,
     BTREE_NO_DATA = 1,
     BTREE_ERROR_MEMORY_ALLOCATE_FAILURE = 2,
     BTREE_NO_ACCEPT = 3,
     BTREE_ERROR_TREE = 4,
+    BTREE_ERROR_UNSORTED = 5,
 } btree_status;
 
+typedef struct _tag_BTREE_POOL {
+    byte_t **slab; /* fs_malloc, the blocks are from the first aligned address */
+    index_t num;
+    index_t capacity;
+    fsize_t size; /* block */
+    counter_t blocks; /* blocks of a slab */
+    counter_t used; /* blocks of the last slab */
+    void *free_list; /* the first bytes of a free block: the next free block */
+} BTREE_POOL;
+
+typedef struct _tag_BTREE_RETIRED {
+    void *ptr;
+    BTREE_POOL *pool; /* NULL: fs_free */
+    counter_t epoch;
+} BTREE_RETIRED;
+
+typedef struct _tag_BTREE_EPOCH {
+    byte_t *line_mem; /* fs_malloc, BTREE_CACHE_LINE each: [global][root_version][the readers] */
+    counter_t *global;
+    counter_t *slot; /* [BTREE_READERS_MAX]: the epoch of the reader or BTREE_EPOCH_IDLE */
+    BTREE_RETIRED *retired;
+    index_t num;
+    index_t capacity;
+} BTREE_EPOCH;
+
 typedef struct _tag_FSBTREE {
-    FSDATASTREAM *key;
+    FSKEYARENA *key;
     FSDATASTREAM *vch;
     fsize_t ksize;
     fsize_t dsize;
+    btree_keytype keytype;
     B_NODE *root;
     counter_t overlap_index;
     counter_t dimension;
     counter_t halfdim;
     counter_t allocnode_count;
+    BTREE_POOL leaf_pool;
+    BTREE_POOL node_pool;
+    bool_t concurrent;
+    counter_t *root_version; /* concurrent: the latch of root */
+    BTREE_EPOCH epoch;
+    FSMUTEX writer;
     index_t (*fkeyequ)(const str_t *a, const str_t *b); /* equal: true_t */
     index_t (*fkeylt)(const str_t *a, const str_t *b);  /* a<=b: true_t */
     btree_status status;
@@ -120,23 +239,240 @@ static inline btree_status fs_btree_getstatus(FSBTREE *fbp) {
     return fbp->status;
 }
 
-static inline bool_t fs_btree_open(FSBTREE **fbp, counter_t dimension, fsize_t ksize, fsize_t dsize) { /* ksize(string): key size(bytes, include '\0'), dsize(binary): data size(bytes) */
+/*
+* slab pool
+*/
+static inline fsize_t fs_btree_pool_align(fsize_t size, fsize_t align) {
+    return (size+align-1)/align*align;
+}
+
+static inline void fs_btree_pool_init(BTREE_POOL *pool, fsize_t size) {
+    pool->slab = NULL;
+    pool->num = 0;
+    pool->capacity = 0;
+    pool->size = fs_btree_pool_align(size, BTREE_CACHE_LINE);
+    pool->blocks = (BTREE_SLAB_SIZE/pool->size<16)? 16: BTREE_SLAB_SIZE/pool->size;
+    pool->used = 0;
+    pool->free_list = NULL;
+}
+
+static inline byte_t *fs_btree_pool_getbase(const BTREE_POOL *pool, index_t i) {
+    return (byte_t *)(((uintptr_t)pool->slab[i]+BTREE_CACHE_LINE-1) & ~(uintptr_t)(BTREE_CACHE_LINE-1));
+}
+
+static inline void *fs_btree_pool_alloc(BTREE_POOL *pool) {
+    if(pool->free_list) {
+        void *block = pool->free_list;
+        pool->free_list = *(void **)block;
+        return block;
+    }
+    if(pool->num==0 || pool->used==pool->blocks) {
+        if(pool->num==pool->capacity) {
+            const index_t capacity = pool->capacity+BTREE_SLAB_ALLOC_UNIT;
+            byte_t **tmp = (byte_t **)fs_malloc((fsize_t)(sizeof(byte_t *)*capacity));
+            if(!tmp) return NULL;
+            if(pool->slab) memcpy(tmp, pool->slab, sizeof(byte_t *)*pool->num);
+            fs_free(pool->slab, b_true);
+            pool->slab = tmp;
+            pool->capacity = capacity;
+        }
+        pool->slab[pool->num] = (byte_t *)fs_malloc((fsize_t)(pool->blocks*pool->size+BTREE_CACHE_LINE));
+        if(!pool->slab[pool->num]) return NULL;
+        ++(pool->num);
+        pool->used = 0;
+    }
+    return fs_btree_pool_getbase(pool, pool->num-1)+(pool->used++)*pool->size;
+}
+
+static inline void fs_btree_pool_free(BTREE_POOL *pool, void *block) {
+    *(void **)block = pool->free_list;
+    pool->free_list = block;
+}
+
+static inline void fs_btree_pool_clear(BTREE_POOL *pool) {
+    for(index_t i=0; i<pool->num; ++i) fs_free(pool->slab[i], b_true);
+    pool->num = 0;
+    pool->used = 0;
+    pool->free_list = NULL;
+}
+
+static inline void fs_btree_pool_close(BTREE_POOL *pool) {
+    fs_btree_pool_clear(pool);
+    fs_free(pool->slab, b_true);
+    pool->slab = NULL;
+    pool->capacity = 0;
+}
+
+static inline fsize_t fs_btree_getnodehead(void) {
+    return fs_btree_pool_align(sizeof(B_NODE), sizeof(counter_t));
+}
+
+static inline counter_t fs_btree_getslabs(const FSBTREE *fbp) {
+    return fbp->leaf_pool.num+fbp->node_pool.num;
+}
+
+/*
+* concurrent: latch (version of a node, or root_version) and epoch
+*/
+static inline void fs_btree_latch(FSBTREE *fbp, volatile counter_t *version) {
+    if(!fbp->concurrent) return;
+    for(;;) {
+        const counter_t v = fs_atomic_load(version);
+        if((v&BTREE_OLC_LOCKED)==0 && fs_atomic_cas(version, v, v+BTREE_OLC_LOCKED)) return;
+        fs_thread_pause();
+    }
+}
+
+static inline void fs_btree_unlatch(FSBTREE *fbp, volatile counter_t *version) {
+    if(fbp->concurrent) fs_atomic_add(version, BTREE_OLC_LOCKED);
+}
+
+/* the node is no longer in the tree: the readers on it restart. */
+static inline void fs_btree_unlatch_obsolete(FSBTREE *fbp, volatile counter_t *version) {
+    if(fbp->concurrent) fs_atomic_add(version, BTREE_OLC_LOCKED|BTREE_OLC_OBSOLETE);
+}
+
+/* reader: wait for the writer, b_false: obsolete */
+static inline bool_t fs_btree_readlatch(const volatile counter_t *version, counter_t *v) {
+    counter_t x;
+    while((x=fs_atomic_load(version))&BTREE_OLC_LOCKED) fs_thread_pause();
+    *v = x;
+    return (x&BTREE_OLC_OBSOLETE)==0;
+}
+
+/* reader: b_true: nothing has changed since fs_btree_readlatch, so the reads between are consistent. */
+static inline bool_t fs_btree_validate(const volatile counter_t *version, counter_t v) {
+    fs_atomic_acquire();
+    return fs_atomic_load(version)==v;
+}
+
+/* the root pointer, read by the readers of concurrent mode (relaxed, validated by root_version) */
+static inline void fs_btree_putroot(FSBTREE *fbp, B_NODE *root) {
+    fs_atomic_storeptr_relaxed((void *volatile *)&fbp->root, root);
+}
+
+static inline void fs_btree_setroot(FSBTREE *fbp, B_NODE *root) {
+    fs_btree_latch(fbp, fbp->root_version);
+    fs_btree_putroot(fbp, root);
+    fs_btree_unlatch(fbp, fbp->root_version);
+}
+
+static inline counter_t *fs_btree_epoch_getslot(const FSBTREE *fbp, index_t reader) {
+    return fbp->epoch.slot+reader*(BTREE_CACHE_LINE/sizeof(counter_t));
+}
+
+static inline void fs_btree_epoch_enter(FSBTREE *fbp, index_t reader) {
+    fs_atomic_exchange(fs_btree_epoch_getslot(fbp, reader), fs_atomic_load(fbp->epoch.global));
+}
+
+static inline void fs_btree_epoch_leave(FSBTREE *fbp, index_t reader) {
+    fs_atomic_store(fs_btree_epoch_getslot(fbp, reader), BTREE_EPOCH_IDLE);
+}
+
+/* the oldest epoch of the readers in the tree (or global) */
+static inline counter_t fs_btree_epoch_getmin(FSBTREE *fbp) {
+    counter_t min = fs_atomic_load(fbp->epoch.global);
+    for(index_t i=0; i<BTREE_READERS_MAX; ++i) {
+        const counter_t e = fs_atomic_load(fs_btree_epoch_getslot(fbp, i));
+        if(e!=BTREE_EPOCH_IDLE && e<min) min = e;
+    }
+    return min;
+}
+
+static inline void fs_btree_epoch_free(void *ptr, BTREE_POOL *pool) {
+    if(pool) fs_btree_pool_free(pool, ptr);
+    else fs_free(ptr, b_true);
+}
+
+/* writer: the next epoch, and frees the retired of the epochs that no reader is in. all: without the readers */
+static inline void fs_btree_epoch_reclaim(FSBTREE *fbp, bool_t all) {
+    BTREE_EPOCH *ep = &fbp->epoch;
+    if(!fbp->concurrent || ep->num==0) return;
+    const counter_t global = fs_atomic_add(ep->global, 1);
+    const counter_t min = (all)? global: fs_btree_epoch_getmin(fbp);
+    index_t n = 0;
+    for(index_t i=0; i<ep->num; ++i) {
+        if(ep->retired[i].epoch<min) fs_btree_epoch_free(ep->retired[i].ptr, ep->retired[i].pool);
+        else ep->retired[n++] = ep->retired[i];
+    }
+    ep->num = n;
+}
+
+/* writer: ptr is unreachable from the tree, or in a node latched by the writer. */
+static inline void fs_btree_epoch_retire(FSBTREE *fbp, void *ptr, BTREE_POOL *pool) {
+    BTREE_EPOCH *ep = &fbp->epoch;
+    if(ep->num==ep->capacity) {
+        const index_t capacity = ep->capacity+BTREE_RETIRE_ALLOC_UNIT;
+        BTREE_RETIRED *tmp = (BTREE_RETIRED *)fs_malloc((fsize_t)(sizeof(BTREE_RETIRED)*capacity));
+        if(!tmp) { /* no list: waits for the readers in the tree */
+            const counter_t e = fs_atomic_add(ep->global, 1);
+            while(fs_btree_epoch_getmin(fbp)<e) fs_thread_pause();
+            fs_btree_epoch_reclaim(fbp, b_true);
+            fs_btree_epoch_free(ptr, pool);
+            return;
+        }
+        if(ep->retired) memcpy(tmp, ep->retired, sizeof(BTREE_RETIRED)*ep->num);
+        fs_free(ep->retired, b_true);
+        ep->retired = tmp;
+        ep->capacity = capacity;
+    }
+    ep->retired[ep->num].ptr = ptr;
+    ep->retired[ep->num].pool = pool;
+    ep->retired[ep->num].epoch = *(ep->global);
+    ++(ep->num);
+}
+
+static inline void fs_btree_epoch_retiretable(void *ctx, void *ptr) {
+    fs_btree_epoch_retire((FSBTREE *)ctx, ptr, NULL);
+}
+
+static inline bool_t fs_btree_open(FSBTREE **fbp, counter_t dimension, fsize_t ksize, fsize_t dsize) { /* ksize(string): key size(bytes, include '\0') or BTREE_KEY_VARIABLE, dsize(binary): data size(bytes) */
     (*fbp) = (FSBTREE *)fs_malloc(sizeof(FSBTREE));
     if(!*fbp) return b_false;
-    if(!fs_datastream_open(&(*fbp)->key)) return fs_free(*fbp, fs_btree_seterror(*fbp, BTREE_ERROR_MEMORY_ALLOCATE_FAILURE));
-    if(!fs_datastream_open(&(*fbp)->vch)) return fs_free(*fbp, fs_datastream_close((*fbp)->key, fs_btree_seterror(*fbp, BTREE_ERROR_MEMORY_ALLOCATE_FAILURE)));
+    if(!fs_keyarena_open(&(*fbp)->key)) return fs_free(*fbp, fs_btree_seterror(*fbp, BTREE_ERROR_MEMORY_ALLOCATE_FAILURE));
+    if(!fs_datastream_open(&(*fbp)->vch)) return fs_free(*fbp, fs_keyarena_close((*fbp)->key, fs_btree_seterror(*fbp, BTREE_ERROR_MEMORY_ALLOCATE_FAILURE)));
     (*fbp)->ksize=ksize;
     (*fbp)->dsize=dsize;
+    (*fbp)->keytype=btree_key_string;
     (*fbp)->root=NULL;
     (*fbp)->overlap_index=-1;
     (*fbp)->dimension=dimension;
     (*fbp)->halfdim=(dimension+1)/2;
     (*fbp)->allocnode_count=0;
+    fs_btree_pool_init(&(*fbp)->leaf_pool, sizeof(B_NODE));
+    fs_btree_pool_init(&(*fbp)->node_pool, fs_btree_getnodehead()+(fsize_t)(dimension*(sizeof(counter_t)+sizeof(B_NODE *)+BTREE_PREFIX_SIZE)));
+    (*fbp)->concurrent=b_false;
+    (*fbp)->root_version=NULL;
+    (*fbp)->epoch.line_mem=NULL;
+    (*fbp)->epoch.global=NULL;
+    (*fbp)->epoch.slot=NULL;
+    (*fbp)->epoch.retired=NULL;
+    (*fbp)->epoch.num=0;
+    (*fbp)->epoch.capacity=0;
     (*fbp)->fkeyequ=&fs_btree_default_fkeyequ;
     (*fbp)->fkeylt=&fs_btree_default_fkeylt;
     return fs_btree_setsuccess(*fbp);
 }
 
+/* concurrent mode: before the readers and the writers start. */
+static inline bool_t fs_btree_setconcurrent(FSBTREE *fbp) {
+    if(fbp->concurrent) return fs_btree_setsuccess(fbp);
+    fbp->epoch.line_mem = (byte_t *)fs_malloc((fsize_t)((BTREE_READERS_MAX+3)*BTREE_CACHE_LINE));
+    if(!fbp->epoch.line_mem) return fs_btree_seterror(fbp, BTREE_ERROR_MEMORY_ALLOCATE_FAILURE);
+    byte_t *line = (byte_t *)(((uintptr_t)fbp->epoch.line_mem+BTREE_CACHE_LINE-1) & ~(uintptr_t)(BTREE_CACHE_LINE-1));
+    fbp->epoch.global = (counter_t *)line;
+    fbp->root_version = (counter_t *)(line+BTREE_CACHE_LINE);
+    fbp->epoch.slot = (counter_t *)(line+2*BTREE_CACHE_LINE);
+    *(fbp->epoch.global) = BTREE_EPOCH_IDLE+1;
+    *(fbp->root_version) = 0;
+    for(index_t i=0; i<BTREE_READERS_MAX; ++i) *fs_btree_epoch_getslot(fbp, i) = BTREE_EPOCH_IDLE;
+    fs_mutex_init(&fbp->writer);
+    fs_keyarena_setretire(fbp->key, &fs_btree_epoch_retiretable, fbp);
+    fs_fragvector_setretire(fbp->vch->vch, &fs_btree_epoch_retiretable, fbp);
+    fbp->concurrent = b_true;
+    return fs_btree_setsuccess(fbp);
+}
+
 static inline index_t fs_btree_free(SRND *srnd, index_t ret) {
     return (index_t)fs_datastream_free(srnd, (bool_t)ret);
 }
@@ -154,36 +490,385 @@ static inline void fs_btree_debugprint(FSBTREE *fbp, const B_NODE *node, const s
 #endif
 }
 
+/*
+* key access: in place in the key arena. (no allocation, no copy)
+*/
+static inline const str_t *fs_btree_getkey(FSBTREE *fbp, counter_t offset) {
+    return (const str_t *)fs_keyarena_get(fbp->key, offset, NULL);
+}
+
+static inline fsize_t fs_btree_getkeysize(FSBTREE *fbp, const str_t *key) {
+    return (fbp->ksize==BTREE_KEY_VARIABLE)? (fsize_t)strlen(key)+1: fbp->ksize;
+}
+
+/* all bytes of the keys in the arena, with the size of each */
+static inline counter_t fs_btree_getkeybytes(FSBTREE *fbp) {
+    return fs_keyarena_getbytes(fbp->key);
+}
+
+/* the removed keys in the arena, and the free slots of vch (VECTOR_DATA each): fs_btree_compact releases them. */
+static inline counter_t fs_btree_getdeadbytes(FSBTREE *fbp) {
+    return fs_keyarena_getdead(fbp->key)+(counter_t)fs_datastream_getfree(fbp->vch)*fs_datastream_getslots(fbp->dsize)*(counter_t)sizeof(VECTOR_DATA);
+}
+
+static inline fsize_t fs_btree_getprefixsize(FSBTREE *fbp) {
+    return (fbp->ksize==BTREE_KEY_VARIABLE || BTREE_PREFIX_SIZE<fbp->ksize)? BTREE_PREFIX_SIZE: fbp->ksize;
+}
+
+static inline void fs_btree_setprefix(FSBTREE *fbp, str_t *prefix, const str_t *key) {
+    fsize_t size = fs_btree_getkeysize(fbp, key);
+    if(BTREE_PREFIX_SIZE<size) size = BTREE_PREFIX_SIZE;
+    memset(prefix, 0x00, BTREE_PREFIX_SIZE);
+    memcpy(prefix, key, size);
+}
+
+static inline str_t *fs_btree_getprefix(const B_NODE *node, counter_t i) {
+    return node->tree.node.prefix_ptr+i*BTREE_PREFIX_SIZE;
+}
+
+/*
+* the fields of a node that a writer changes under the readers of concurrent mode: the readers (and the locate)
+* load them relaxed, and validate the version after. (the same plain loads without the readers)
+*/
+static inline counter_t fs_btree_getnum(const B_NODE *node) {
+    return fs_atomic_load_relaxed(&node->tree.node.num);
+}
+
+static inline B_NODE *fs_btree_getchild(const B_NODE *node, counter_t i) {
+    return (B_NODE *)fs_atomic_loadptr_relaxed((void *const volatile *)&node->tree.node.node_ptr[i]);
+}
+
+static inline counter_t fs_btree_getbegin(const B_NODE *node, counter_t i) {
+    return fs_atomic_load_relaxed(&node->tree.node.begin_ptr[i]);
+}
+
+static inline counter_t fs_btree_getcommonsize(const B_NODE *node) {
+    return fs_atomic_load_relaxed(&node->tree.node.common);
+}
+
+static inline counter_t fs_btree_getcommonoffset(const B_NODE *node) {
+    return fs_atomic_load_relaxed(&node->tree.node.common_offset);
+}
+
+/* the prefix of slot i: concurrent, a copy to buf by the relaxed loads. */
+static inline const str_t *fs_btree_readprefix(const FSBTREE *fbp, const B_NODE *node, counter_t i, str_t *buf) {
+    if(!fbp->concurrent) return fs_btree_getprefix(node, i);
+    fs_atomic_read_relaxed(buf, fs_btree_getprefix(node, i), BTREE_PREFIX_SIZE);
+    return buf;
+}
+
+/* the writer: the same fields by the relaxed stores. */
+static inline void fs_btree_setnum(B_NODE *node, counter_t num) {
+    fs_atomic_store_relaxed(&node->tree.node.num, num);
+}
+
+static inline void fs_btree_setchild(B_NODE *node, counter_t i, B_NODE *child) {
+    fs_atomic_storeptr_relaxed((void *volatile *)&node->tree.node.node_ptr[i], child);
+}
+
+static inline void fs_btree_setbegin(B_NODE *node, counter_t i, counter_t offset) {
+    fs_atomic_store_relaxed(&node->tree.node.begin_ptr[i], offset);
+}
+
+static inline void fs_btree_setslotprefix(FSBTREE *fbp, B_NODE *node, counter_t i, const str_t *key) {
+    str_t buf[BTREE_PREFIX_SIZE];
+    fs_btree_setprefix(fbp, buf, key);
+    fs_atomic_write_relaxed(fs_btree_getprefix(node, i), buf, BTREE_PREFIX_SIZE);
+}
+
+/*
+* prefix compression: the keys of the slots of a node have "common" bytes at the head, (kept once, as common_offset)
+* and the inline prefix of a slot is the BTREE_PREFIX_SIZE bytes after them. So the bytes in the prefix are the ones
+* that tell the slots apart. (the default comparators, btree_key_memcmp and btree_key_hash32 only)
+*/
+static inline bool_t fs_btree_compressible(FSBTREE *fbp) {
+    if(fbp->keytype==btree_key_string) return fbp->fkeylt==&fs_btree_default_fkeylt && fbp->fkeyequ==&fs_btree_default_fkeyequ;
+    return fbp->keytype!=btree_key_u64;
+}
+
+/* the common bytes can be: the prefix must be in the key. */
+static inline counter_t fs_btree_commonmax(FSBTREE *fbp) {
+    if(!fs_btree_compressible(fbp)) return 0;
+    return (fbp->ksize==BTREE_KEY_VARIABLE)? (counter_t)0x7FFFFFFF: (counter_t)(fbp->ksize-fs_btree_getprefixsize(fbp));
+}
+
+/* the bytes of a and b in common, max or less. (a string stops at '\0') */
+static inline counter_t fs_btree_lcp(FSBTREE *fbp, const str_t *a, const str_t *b, counter_t max) {
+    counter_t n = 0;
+    if(fbp->keytype==btree_key_string) {
+        while(n<max && a[n]==b[n] && a[n]!='\0') ++n;
+    } else {
+        while(n<max && a[n]==b[n]) ++n;
+    }
+    return n;
+}
+
+/* the common bytes of the slots [0, num), and their prefixes after them. */
+static inline void fs_btree_setcommon(FSBTREE *fbp, B_NODE *node) {
+    const str_t *first = fs_btree_getkey(fbp, node->tree.node.begin_ptr[0]);
+    counter_t common = fs_btree_commonmax(fbp);
+    if(0<common) common = fs_btree_lcp(fbp, first, first, common);
+    for(counter_t i=1; 0<common && i<node->tree.node.num; ++i) common = fs_btree_lcp(fbp, first, fs_btree_getkey(fbp, node->tree.node.begin_ptr[i]), common);
+    fs_atomic_store_relaxed(&node->tree.node.common, common);
+    fs_atomic_store_relaxed(&node->tree.node.common_offset, node->tree.node.begin_ptr[0]);
+    for(counter_t i=0; i<node->tree.node.num; ++i) fs_btree_setslotprefix(fbp, node, i, fs_btree_getkey(fbp, node->tree.node.begin_ptr[i])+common);
+}
+
+/* slot: child, index of the key. (no prefix: fs_btree_setcommon after the slots of the node are set) */
+static inline void fs_btree_putslot(B_NODE *node, counter_t i, B_NODE *child, counter_t offset) {
+    fs_btree_setchild(node, i, child);
+    fs_btree_setbegin(node, i, offset);
+}
+
+/* the key of the slot i, in the slots [0, num): its prefix, or the common bytes again if it does not have them. */
+static inline void fs_btree_setkey(FSBTREE *fbp, B_NODE *node, counter_t i, counter_t offset) {
+    const str_t *key = fs_btree_getkey(fbp, offset);
+    const counter_t common = node->tree.node.common;
+    fs_btree_setbegin(node, i, offset);
+    if(0<common && fs_btree_lcp(fbp, fs_btree_getkey(fbp, node->tree.node.common_offset), key, common)<common) fs_btree_setcommon(fbp, node);
+    else fs_btree_setslotprefix(fbp, node, i, key+common);
+}
+
+static inline void fs_btree_setslot(FSBTREE *fbp, B_NODE *node, counter_t i, B_NODE *child, counter_t offset) {
+    fs_btree_setchild(node, i, child);
+    fs_btree_setkey(fbp, node, i, offset);
+}
+
+/* moveslot, movekey: the prefix as it is, so in the same node, or fs_btree_setcommon after. */
+static inline void fs_btree_moveslot(B_NODE *dest, counter_t d, const B_NODE *src, counter_t s) {
+    fs_btree_setchild(dest, d, src->tree.node.node_ptr[s]);
+    fs_btree_setbegin(dest, d, src->tree.node.begin_ptr[s]);
+    fs_atomic_write_relaxed(fs_btree_getprefix(dest, d), fs_btree_getprefix(src, s), BTREE_PREFIX_SIZE);
+}
+
+static inline void fs_btree_movekey(B_NODE *dest, counter_t d, const B_NODE *src, counter_t s) {
+    fs_btree_setbegin(dest, d, src->tree.node.begin_ptr[s]);
+    fs_atomic_write_relaxed(fs_btree_getprefix(dest, d), fs_btree_getprefix(src, s), BTREE_PREFIX_SIZE);
+}
+
+/*
+* compare with the prefix: only for the default comparators. (strcmp)
+* b_true: decided in the prefix, *cmp is the sign of strcmp(stored key, key).
+*/
+static inline bool_t fs_btree_prefixcmp(FSBTREE *fbp, const str_t *prefix, const str_t *key, index_t *cmp) {
+    if(fbp->fkeylt!=&fs_btree_default_fkeylt || fbp->fkeyequ!=&fs_btree_default_fkeyequ) return b_false;
+    const fsize_t size = fs_btree_getprefixsize(fbp);
+    for(fsize_t i=0; i<size; ++i) {
+        const unsigned char a=(unsigned char)prefix[i], b=(unsigned char)key[i];
+        if(a!=b) {
+            *cmp = (a<b)? -1: 1;
+            return b_true;
+        }
+        if(a=='\0') {
+            *cmp = 0;
+            return b_true;
+        }
+    }
+    return b_false;
+}
+
+/*
+* key type: three-way compare of the binary keys. (ascending)
+*/
+static inline index_t fs_btree_cmp_u64(uint64_t a, uint64_t b) {
+    return (index_t)(a>b)-(index_t)(a<b);
+}
+
+static inline uint64_t fs_btree_load_u64(const str_t *key) {
+    uint64_t val;
+    memcpy(&val, key, sizeof(val));
+    return val;
+}
+
+/* memcmp of size bytes (size<=BTREE_PREFIX_SIZE), by big endian words. */
+static inline index_t fs_btree_cmp_prefix(const str_t *a, const str_t *b, fsize_t size) {
+    if(size==BTREE_PREFIX_SIZE) {
+        const index_t c = fs_btree_cmp_u64(ReadBE64((const byte_t *)a), ReadBE64((const byte_t *)b));
+        return (c!=0)? c: fs_btree_cmp_u64(ReadBE64((const byte_t *)a+8), ReadBE64((const byte_t *)b+8));
+    }
+    const index_t c = memcmp(a, b, size);
+    return (index_t)(0<c)-(index_t)(c<0);
+}
+
+/* the whole keys */
+static inline index_t fs_btree_typedcmp(btree_keytype type, fsize_t ksize, const str_t *a, const str_t *b) {
+    if(type==btree_key_u64) return fs_btree_cmp_u64(fs_btree_load_u64(a), fs_btree_load_u64(b));
+    const index_t c = memcmp(a, b, ksize);
+    return (index_t)(0<c)-(index_t)(c<0);
+}
+
+/* sign of (stored - key): the prefix (the bytes after common) first, the rest from the arena. */
+static inline index_t fs_btree_typedcmp_prefix(FSBTREE *fbp, const str_t *prefix, counter_t offset, const str_t *key, counter_t common) {
+    if(fbp->keytype==btree_key_u64) return fs_btree_cmp_u64(fs_btree_load_u64(prefix), fs_btree_load_u64(key));
+    const fsize_t size = fs_btree_getprefixsize(fbp);
+    const index_t c = fs_btree_cmp_prefix(prefix, key+common, size);
+    if(c!=0 || fbp->ksize<=common+size) return c;
+    return fs_btree_typedcmp(btree_key_memcmp, fbp->ksize-(fsize_t)common-size, fs_btree_getkey(fbp, offset)+common+size, key+common+size);
+}
+
+/* fkeylt/fkeyequ of the tree, with the key type: a<=b, a==b */
+static inline index_t fs_btree_fkeylt(FSBTREE *fbp, const str_t *a, const str_t *b) {
+    return (fbp->keytype==btree_key_string)? fbp->fkeylt(a, b): fs_btree_typedcmp(fbp->keytype, fbp->ksize, a, b)<=0;
+}
+
+static inline index_t fs_btree_fkeyequ(FSBTREE *fbp, const str_t *a, const str_t *b) {
+    return (fbp->keytype==btree_key_string)? fbp->fkeyequ(a, b): fs_btree_typedcmp(fbp->keytype, fbp->ksize, a, b)==0;
+}
+
+/* the tree must be empty. hash32: ksize 32, u64: ksize 8, memcmp: fixed ksize. */
+static inline bool_t fs_btree_setkeytype(FSBTREE *fbp, btree_keytype type) {
+    if(fbp->root) return fs_btree_seterror(fbp, BTREE_ERROR_TREE);
+    if((type==btree_key_hash32 && fbp->ksize!=32) || (type==btree_key_u64 && fbp->ksize!=(fsize_t)sizeof(uint64_t)) || (type==btree_key_memcmp && fbp->ksize==BTREE_KEY_VARIABLE)) return fs_btree_seterror(fbp, BTREE_NO_ACCEPT);
+    fbp->keytype=type;
+    return fs_btree_setsuccess(fbp);
+}
+
+/* fkeylt(stored, key), reverse: fkeylt(key, stored) */
+static inline index_t fs_btree_keylt(FSBTREE *fbp, const str_t *prefix, counter_t offset, const str_t *key, bool_t reverse) {
+    index_t cmp;
+    if(fbp->keytype!=btree_key_string) {
+        cmp = fs_btree_typedcmp_prefix(fbp, prefix, offset, key, 0);
+        return (reverse)? 0<=cmp: cmp<=0;
+    }
+    if(fs_btree_prefixcmp(fbp, prefix, key, &cmp)) return (reverse)? cmp<=0: 0<=cmp;
+    const str_t *stored = fs_btree_getkey(fbp, offset);
+    return (reverse)? fbp->fkeylt(key, stored): fbp->fkeylt(stored, key);
+}
+
+static inline index_t fs_btree_keyequ(FSBTREE *fbp, const str_t *prefix, counter_t offset, const str_t *key) {
+    index_t cmp;
+    if(fbp->keytype!=btree_key_string) return fs_btree_typedcmp_prefix(fbp, prefix, offset, key, 0)==0;
+    if(fs_btree_prefixcmp(fbp, prefix, key, &cmp)) return cmp==0;
+    return fbp->fkeyequ(key, fs_btree_getkey(fbp, offset));
+}
+
+/* sign of (the common bytes of p - key) in them: 0 if key has them. */
+static inline index_t fs_btree_commoncmp(FSBTREE *fbp, const B_NODE *p, const str_t *key) {
+    const counter_t common = fs_btree_getcommonsize(p);
+    if(common==0) return 0;
+    const str_t *stored = fs_btree_getkey(fbp, fs_btree_getcommonoffset(p));
+    const counter_t n = fs_btree_lcp(fbp, stored, key, common);
+    if(n==common) return 0;
+    return ((unsigned char)stored[n]<(unsigned char)key[n])? -1: 1;
+}
+
+/* key: with the common bytes of p (fs_btree_commoncmp==0) */
+static inline index_t fs_btree_slotlt(FSBTREE *fbp, const B_NODE *p, counter_t i, const str_t *key) {
+    str_t buf[BTREE_PREFIX_SIZE];
+    const counter_t common = fs_btree_getcommonsize(p);
+    const str_t *prefix = fs_btree_readprefix(fbp, p, i, buf);
+    const counter_t begin = fs_btree_getbegin(p, i);
+    if(common==0) return fs_btree_keylt(fbp, prefix, begin, key, b_false);
+    if(fbp->keytype!=btree_key_string) return fs_btree_typedcmp_prefix(fbp, prefix, begin, key, common)<=0;
+    index_t cmp;
+    if(fs_btree_prefixcmp(fbp, prefix, key+common, &cmp)) return 0<=cmp;
+    return fbp->fkeylt(fs_btree_getkey(fbp, begin), key);
+}
+
+/* u64: the slots [1, num) of prefix<=key. (sorted, so it is the locate) the prefix is a relaxed load for the readers. */
+static inline counter_t fs_btree_countle_u64(const B_NODE *p, counter_t num, uint64_t key) {
+    counter_t count = 0;
+    for(counter_t i=1; i<num; ++i) count += ((uint64_t)fs_atomic_load_relaxed((const volatile counter_t *)fs_btree_getprefix(p, i))<=key);
+    return count;
+}
+
+#ifdef FS_BTREE_AVX2
+FS_TARGET("avx2") static inline counter_t fs_btree_countle_u64_avx2(const B_NODE *p, counter_t num, uint64_t key) {
+    const __m256i bias = _mm256_set1_epi64x((long long)0x8000000000000000ULL); /* unsigned by signed compare */
+    const __m256i k = _mm256_xor_si256(_mm256_set1_epi64x((long long)key), bias);
+    __m256i gt = _mm256_setzero_si256(); /* -1 for each slot of key<slot */
+    counter_t i = 1;
+    for(; i+4<=num; i+=4) { /* 4 slots: [u64][pad] x 4, the pads are dropped by unpacklo */
+        const __m256i a = _mm256_loadu_si256((const __m256i *)fs_btree_getprefix(p, i));
+        const __m256i b = _mm256_loadu_si256((const __m256i *)fs_btree_getprefix(p, i+2));
+        const __m256i v = _mm256_xor_si256(_mm256_unpacklo_epi64(a, b), bias);
+        gt = _mm256_add_epi64(gt, _mm256_cmpgt_epi64(v, k));
+    }
+    int64_t lane[4];
+    _mm256_storeu_si256((__m256i *)lane, gt);
+    counter_t count = (i-1)+(counter_t)(lane[0]+lane[1]+lane[2]+lane[3]);
+    for(; i<num; ++i) count += (fs_btree_load_u64(fs_btree_getprefix(p, i))<=key);
+    return count;
+}
+#endif
+
+static inline counter_t fs_btree_getlocate_typed(FSBTREE *fbp, const B_NODE *p, counter_t num, const str_t *key) {
+    if(fbp->keytype==btree_key_u64) {
+#ifdef FS_BTREE_AVX2
+        if(!fbp->concurrent && fs_cpu_has(CPU_AVX2)) return fs_btree_countle_u64_avx2(p, num, fs_btree_load_u64(key)); /* the vector loads are not for the readers */
+#endif
+        return fs_btree_countle_u64(p, num, fs_btree_load_u64(key));
+    }
+    const index_t c = fs_btree_commoncmp(fbp, p, key); /* not 0: all slots are before or after key */
+    if(c!=0) return (c<0)? num-1: 0;
+    /* branch-free: the last slot of slot<=key, or 0 */
+    const counter_t common = fs_btree_getcommonsize(p);
+    counter_t base = 0;
+    counter_t n = num;
+    while(1<n) {
+        const counter_t half = n>>1;
+        str_t buf[BTREE_PREFIX_SIZE];
+        const index_t le = fs_btree_typedcmp_prefix(fbp, fs_btree_readprefix(fbp, p, base+half, buf), fs_btree_getbegin(p, base+half), key, common)<=0;
+        base += (counter_t)le*half;
+        n -= half;
+    }
+    return base;
+}
+
 static inline counter_t fs_btree_getlocate(FSBTREE *fbp, const B_NODE *p, const str_t *key) { /* Note: B-tree "plus" */
-    assert(2<=p->tree.node.num);
-    if(p->tree.node.num==2) {
-        SRND *srnd;
-        if(!fs_datastream_rgetdata(fbp->key, &srnd, fbp->ksize, (index_t)p->tree.node.begin_ptr[1])) return INDEX_ERROR;
-        return fbp->fkeylt((const str_t *)fs_datastream_getdata(srnd), key)? 1: 0;
+    const counter_t num = fs_btree_getnum(p); /* once: a reader may see a node that a writer is changing */
+    if(num<2) return (num==1)? 0: INDEX_ERROR; /* 1: dimension 2 (halfdim 1) */
+    if(fbp->dimension<num) return INDEX_ERROR;
+    if(fbp->keytype!=btree_key_string) return fs_btree_getlocate_typed(fbp, p, num, key);
+    const index_t c = fs_btree_commoncmp(fbp, p, key); /* not 0: all slots are before or after key */
+    if(c!=0) return (0<c)? num-1: 0;
+    if(num==2) {
+        const index_t a = fs_btree_slotlt(fbp, p, 1, key);
+        if(a==INDEX_ERROR) return INDEX_ERROR;
+        return a? 1: 0;
     } else {
         counter_t left=0;
-        counter_t right=p->tree.node.num-1;
+        counter_t right=num-1;
         while(left<right) {
-            SRND *srnd0, *srnd1;
             counter_t center = (left+right)>>1;
-            if(!fs_datastream_rgetdata(fbp->key, &srnd0, fbp->ksize, (index_t)p->tree.node.begin_ptr[center])) return INDEX_ERROR;
-            index_t a = fbp->fkeylt((const str_t *)fs_datastream_getdata(srnd0), key); fs_btree_free(srnd0, b_true);
-            if(!fs_datastream_rgetdata(fbp->key, &srnd1, fbp->ksize, (index_t)p->tree.node.begin_ptr[center+1])) return fs_btree_free(srnd0, INDEX_ERROR);
-            index_t b = fbp->fkeylt((const str_t *)fs_datastream_getdata(srnd1), key); fs_btree_free(srnd1, b_true);
+            const index_t a = fs_btree_slotlt(fbp, p, center, key);
+            if(a==INDEX_ERROR) return INDEX_ERROR;
+            const index_t b = fs_btree_slotlt(fbp, p, center+1, key);
+            if(b==INDEX_ERROR) return INDEX_ERROR;
             if(a&&(b==0)) return center;
             if(a==0) right=center-1;
             else left=center+1;
         }
         if(0<left) return left;
-        SRND *srnd0, *srnd1;
-        if(!fs_datastream_rgetdata(fbp->key, &srnd0, fbp->ksize, (index_t)p->tree.node.begin_ptr[0])) return INDEX_ERROR;
-        index_t a = fbp->fkeylt((const str_t *)fs_datastream_getdata(srnd0), key);
-        if(!fs_datastream_rgetdata(fbp->key, &srnd1, fbp->ksize, (index_t)p->tree.node.begin_ptr[1])) return fs_btree_free(srnd0, INDEX_ERROR);
-        index_t b = fbp->fkeylt((const str_t *)fs_datastream_getdata(srnd1), key);
-        return fs_btree_free(srnd0, fs_btree_free(srnd1, (a<b)? 1: 0));
+        const index_t a = fs_btree_slotlt(fbp, p, 0, key);
+        if(a==INDEX_ERROR) return INDEX_ERROR;
+        const index_t b = fs_btree_slotlt(fbp, p, 1, key);
+        if(b==INDEX_ERROR) return INDEX_ERROR;
+        return (a<b)? 1: 0;
     }
 }
 
+static inline index_t fs_btree_leafequ(FSBTREE *fbp, const B_NODE *leaf, const str_t *key) {
+    return fs_btree_keyequ(fbp, leaf->tree.leaf.prefix, leaf->tree.leaf.key_offset, key);
+}
+
+/* the leaf of key in a node of leaves, index: the located slot. NULL: nothing */
+static inline B_NODE *fs_btree_nodeleaf(FSBTREE *fbp, const B_NODE *node, counter_t index, const str_t *key) {
+    B_NODE *p=node->tree.node.node_ptr[index];
+    if(fbp->keytype!=btree_key_string) { /* the three-way compare: the located leaf only */
+        const index_t equ = fs_btree_leafequ(fbp, p, key);
+        return (equ)? p: NULL;
+    }
+    for(index_t i=0; i<node->tree.node.num; ++i) {
+        p=node->tree.node.node_ptr[i];
+        assert(p->type==n_leaf);
+        const index_t equ = fs_btree_leafequ(fbp, p, key);
+        if(equ==INDEX_ERROR) return INVALID_B_NODE;
+        if(equ) return p;
+    }
+    return NULL;
+}
+
 static inline B_NODE *fs_btree_search(FSBTREE *fbp, const str_t *key) { /* Note: B-tree "plus" */
     if(fbp->root==NULL) return NULL;
     else if(fbp->root->type==n_node) {
@@ -197,48 +882,135 @@ static inline B_NODE *fs_btree_search(FSBTREE *fbp, const str_t *key) { /* Note:
             p=p->tree.node.node_ptr[index];
         }
         assert(node&&node->type==n_node);
-        for(index_t i=0; i<node->tree.node.num; ++i) {
-            p=node->tree.node.node_ptr[i];
-            assert(p->type==n_leaf);
-            SRND *srnd;
-            if(!fs_datastream_rgetdata(fbp->key, &srnd, fbp->ksize, (index_t)p->tree.leaf.vch_index)) return INVALID_B_NODE;
-            if(fbp->fkeyequ(key, (const str_t *)fs_datastream_getdata(srnd))) return (B_NODE *)fs_btree_ptrfree(srnd, p);
-        }
-        return NULL;
+        return fs_btree_nodeleaf(fbp, node, index, key);
     } else if(fbp->root->type==n_leaf) {
-        SRND *srnd;
-        if(!fs_datastream_rgetdata(fbp->key, &srnd, fbp->ksize, (index_t)fbp->root->tree.leaf.vch_index)) return INVALID_B_NODE;
-        return fbp->fkeyequ((const str_t *)fs_datastream_getdata(srnd), key)? (B_NODE *)fs_btree_ptrfree(srnd, fbp->root): NULL;
+        const index_t equ = fs_btree_leafequ(fbp, fbp->root, key);
+        if(equ==INDEX_ERROR) return INVALID_B_NODE;
+        return (equ)? fbp->root: NULL;
     } else
         return INVALID_B_NODE;
 }
 
+/* data: NULL if no data or an error */
 static inline bool_t fs_btree_getdata(FSBTREE *fbp, const str_t *key, SRND **data) {
+    *data = NULL;
     B_NODE *node = fs_btree_search(fbp, key);
     if(node==NULL) return fs_btree_setsuccess_nodata(fbp);
     return fs_datastream_rgetdata(fbp->vch, data, fbp->dsize, (index_t)node->tree.leaf.vch_index)? fs_btree_setsuccess(fbp): fs_btree_seterror(fbp, BTREE_ERROR_MEMORY_ALLOCATE_FAILURE);
 }
 
-static inline index_t fs_btree_getlastindex(FSBTREE *fbp) {
-    return fs_datastream_rgetsize(fbp->key, fbp->ksize)-1;
+/* the data of the leaf (dsize bytes) to data, as fs_datastream_rgetdata. */
+static inline void fs_btree_copydata(FSBTREE *fbp, const B_NODE *leaf, byte_t *data) {
+    index_t index = (index_t)leaf->tree.leaf.vch_index;
+    for(fsize_t size=fbp->dsize; 0<size; ) {
+        const fsize_t cpsize = (size>(fsize_t)sizeof(((VECTOR_DATA *)NULL)->data))? (fsize_t)sizeof(((VECTOR_DATA *)NULL)->data): size;
+        memcpy(data, fs_fragvector_getdata(fbp->vch->vch, index++)->data, cpsize);
+        data+=cpsize;
+        size-=cpsize;
+    }
+}
+
+/*
+* concurrent: reader
+*/
+/* the leaf of key: the copy of its data. (leaves do not change, a removed one is retired) */
+static inline btree_status fs_btree_olc_leafdata(FSBTREE *fbp, const B_NODE *leaf, const str_t *key, byte_t *data) {
+    const index_t equ = fs_btree_leafequ(fbp, leaf, key);
+    if(equ==INDEX_ERROR) return BTREE_ERROR_TREE;
+    if(!equ) return BTREE_NO_DATA;
+    fs_btree_copydata(fbp, leaf, data);
+    return BTREE_SUCCESS;
+}
+
+/*
+* b_false: a node has changed, restart from the root. Each pointer is used after its node is validated.
+* The fields that a writer changes are relaxed loads, (fs_btree_getnum, fs_btree_getchild) not ordered but not torn.
+*/
+static inline bool_t fs_btree_olc_search(FSBTREE *fbp, const str_t *key, byte_t *data, btree_status *status) {
+    counter_t rv, v, cv;
+    fs_btree_readlatch(fbp->root_version, &rv);
+    B_NODE *p = (B_NODE *)fs_atomic_loadptr_relaxed((void *const volatile *)&fbp->root);
+    if(!fs_btree_validate(fbp->root_version, rv)) return b_false;
+    if(p==NULL || p->type==n_leaf) {
+        *status = (p)? fs_btree_olc_leafdata(fbp, p, key, data): BTREE_NO_DATA;
+        return fs_btree_validate(fbp->root_version, rv);
+    }
+    if(!fs_btree_readlatch(&p->version, &v) || !fs_btree_validate(fbp->root_version, rv)) return b_false;
+    for(;;) {
+        const counter_t num = fs_btree_getnum(p);
+        const counter_t index = (num<2)? 0: fs_btree_getlocate(fbp, p, key); /* num 1: before the merge */
+        if(index<0 || num<=index || fbp->dimension<num) {
+            *status = BTREE_ERROR_TREE;
+            return fs_btree_validate(&p->version, v);
+        }
+        B_NODE *child = fs_btree_getchild(p, index);
+        if(!fs_btree_validate(&p->version, v)) return b_false;
+        if(child->type==n_leaf) {
+            if(fbp->keytype!=btree_key_string) { /* the located leaf only */
+                *status = fs_btree_olc_leafdata(fbp, child, key, data);
+                return fs_btree_validate(&p->version, v);
+            }
+            for(counter_t i=0; i<num; ++i) { /* as fs_btree_search: the leaves of the node */
+                child = fs_btree_getchild(p, i);
+                if(!fs_btree_validate(&p->version, v)) return b_false;
+                *status = fs_btree_olc_leafdata(fbp, child, key, data);
+                if(*status!=BTREE_NO_DATA) break;
+            }
+            return fs_btree_validate(&p->version, v);
+        }
+        if(!fs_btree_readlatch(&child->version, &cv) || !fs_btree_validate(&p->version, v)) return b_false;
+        p = child;
+        v = cv;
+    }
+}
+
+/*
+* concurrent: the data of key (dsize bytes) to data, without a latch. reader: 0 to BTREE_READERS_MAX-1, one thread each.
+* return: BTREE_SUCCESS, BTREE_NO_DATA or BTREE_ERROR_TREE (fbp->status is for the writer)
+*/
+static inline btree_status fs_btree_olc_getdata(FSBTREE *fbp, index_t reader, const str_t *key, byte_t *data) {
+    btree_status status = BTREE_NO_DATA;
+    fs_btree_epoch_enter(fbp, reader);
+    while(!fs_btree_olc_search(fbp, key, data, &status)) fs_thread_pause();
+    fs_btree_epoch_leave(fbp, reader);
+    return status;
 }
 
 static inline B_NODE *fs_btree_alloc(FSBTREE *fbp, node_type type, const str_t *key, const byte_t *data) {
-    B_NODE *p = (B_NODE *)fs_malloc(sizeof(B_NODE));
-    if(!p) return INVALID_B_NODE;
+    B_NODE *p;
     if(type==n_leaf) { /* leaf insert */
-        if(!fs_datastream_lshift(fbp->vch, data, fbp->dsize)) return INVALID_B_NODE;
-        if(!fs_datastream_lshift(fbp->key, (const byte_t *)key, fbp->ksize)) return INVALID_B_NODE;
+        p = (B_NODE *)fs_btree_pool_alloc(&fbp->leaf_pool);
+        if(!p) return INVALID_B_NODE;
+        index_t index;
+        if(!fs_datastream_lstore(fbp->vch, data, fbp->dsize, &index)) {
+            fs_btree_pool_free(&fbp->leaf_pool, p);
+            return INVALID_B_NODE;
+        }
+        if(!fs_keyarena_add(fbp->key, (const byte_t *)key, fs_btree_getkeysize(fbp, key), &p->tree.leaf.key_offset)) {
+            fs_datastream_release(fbp->vch, index);
+            fs_btree_pool_free(&fbp->leaf_pool, p);
+            return INVALID_B_NODE;
+        }
         p->type=n_leaf;
-        p->tree.leaf.vch_index=fs_btree_getlastindex(fbp);
+        p->version=0;
+        p->tree.leaf.vch_index=index;
+        p->tree.leaf.prev=NULL;
+        p->tree.leaf.next=NULL;
+        fs_btree_setprefix(fbp, p->tree.leaf.prefix, key);
     } else if(type==n_node) { /* node insert */
-        p->tree.node.node_ptr = (B_NODE **)fs_malloc((fsize_t)(fbp->dimension*sizeof(B_NODE *)));
-        if(!p->tree.node.node_ptr) return INVALID_B_NODE;
-        p->tree.node.begin_ptr = (counter_t *)fs_malloc((fsize_t)(fbp->dimension*sizeof(counter_t)));
-        if(!p->tree.node.begin_ptr) return INVALID_B_NODE;
+        byte_t *block = (byte_t *)fs_btree_pool_alloc(&fbp->node_pool);
+        if(!block) return INVALID_B_NODE;
+        p = (B_NODE *)block;
+        p->tree.node.begin_ptr = (counter_t *)(block+fs_btree_getnodehead());
+        p->tree.node.node_ptr = (B_NODE **)(p->tree.node.begin_ptr+fbp->dimension);
+        p->tree.node.prefix_ptr = (str_t *)(p->tree.node.node_ptr+fbp->dimension);
         p->type=n_node;
+        p->version=0;
         for(index_t i=0; i<fbp->dimension; ++i) p->tree.node.node_ptr[i]=NULL;
         for(index_t i=0; i<fbp->dimension; ++i) p->tree.node.begin_ptr[i]=0LL;
+        memset(p->tree.node.prefix_ptr, 0x00, (size_t)(fbp->dimension*BTREE_PREFIX_SIZE));
+        p->tree.node.common=0;
+        p->tree.node.common_offset=0;
         p->tree.node.num=0;
     } else
         return INVALID_B_NODE;
@@ -246,8 +1018,57 @@ static inline B_NODE *fs_btree_alloc(FSBTREE *fbp, node_type type, const str_t *
     return p;
 }
 
+static inline void fs_btree_linkleaf(B_NODE *prev, B_NODE *leaf, B_NODE *next) {
+    leaf->tree.leaf.prev=prev;
+    leaf->tree.leaf.next=next;
+    if(prev) prev->tree.leaf.next=leaf;
+    if(next) next->tree.leaf.prev=leaf;
+}
+
+static inline void fs_btree_unlinkleaf(B_NODE *leaf) {
+    if(leaf->tree.leaf.prev) leaf->tree.leaf.prev->tree.leaf.next=leaf->tree.leaf.next;
+    if(leaf->tree.leaf.next) leaf->tree.leaf.next->tree.leaf.prev=leaf->tree.leaf.prev;
+}
+
+/* xn (the key xl) after the slot pos of c_node. c_node is full: split, the new node to *(ibp->n_node) */
+static inline bool_t fs_btree_insertslot(FSBTREE *fbp, B_INSERT *ibp, B_NODE *c_node, counter_t pos, B_NODE *xn, counter_t xl) {
+    if(c_node->tree.node.num < fbp->dimension) {
+        for(counter_t i=c_node->tree.node.num-1; pos<i; --i) fs_btree_moveslot(c_node, i+1, c_node, i);
+        fs_btree_setnum(c_node, c_node->tree.node.num+1);
+        fs_btree_setslot(fbp, c_node, pos+1, xn, xl);
+        return b_true;
+    } else {
+        B_NODE *alloc=fs_btree_alloc(fbp, n_node, NULL, NULL);
+        if(alloc==INVALID_B_NODE) return b_false;
+        if(pos<fbp->halfdim-1) {
+            for(counter_t i=fbp->halfdim-1, j=0; i< fbp->dimension; ++i,++j) fs_btree_moveslot(alloc, j, c_node, i);
+            for(counter_t i= fbp->halfdim-2; pos<i; --i) fs_btree_moveslot(c_node, i+1, c_node, i);
+            fs_btree_putslot(c_node, pos+1, xn, xl);
+        } else {
+            counter_t j = fbp->dimension - fbp->halfdim;
+            for(counter_t i=fbp->dimension-1; fbp->halfdim<=i; --i) {
+                if(i==pos) {
+                    fs_btree_putslot(alloc, j--, xn, xl);
+                }
+                fs_btree_moveslot(alloc, j--, c_node, i);
+            }
+            if(pos<fbp->halfdim) {
+                fs_btree_putslot(alloc, 0, xn, xl);
+            }
+        }
+        fs_btree_setnum(c_node, fbp->halfdim);
+        alloc->tree.node.num = (fbp->dimension+1)-fbp->halfdim;
+        fs_btree_setcommon(fbp, c_node);
+        fs_btree_setcommon(fbp, alloc);
+        *(ibp->n_node) = alloc;
+        *(ibp->n_index) = alloc->tree.node.begin_ptr[0];
+        return b_true;
+    }
+}
+
 static inline B_NODE *fs_btree_insert1(FSBTREE *fbp, B_INSERT *ibp, const str_t *key, const byte_t *data) {
     *(ibp->n_node)=NULL;
+    *(ibp->s_node)=NULL;
     B_NODE *c_node=*(ibp->p_node);
     if(c_node->type==n_leaf) {
         B_NODE *result = fs_btree_search(fbp, key);
@@ -259,162 +1080,150 @@ static inline B_NODE *fs_btree_insert1(FSBTREE *fbp, B_INSERT *ibp, const str_t
             B_NODE *alloc=fs_btree_alloc(fbp, n_leaf, key, data);
             if(alloc==INVALID_B_NODE) return INVALID_B_NODE;
             if(alloc==NO_ACCEPT_B_NODE) return NO_ACCEPT_B_NODE;
-            SRND *srnd;
-            if(!fs_datastream_rgetdata(fbp->key, &srnd, fbp->ksize, (index_t)c_node->tree.leaf.vch_index)) return INVALID_B_NODE;
-            if(fbp->fkeylt(key, (const str_t *)fs_datastream_getdata(srnd))) {
+            const index_t lt = fs_btree_keylt(fbp, c_node->tree.leaf.prefix, c_node->tree.leaf.key_offset, key, b_true);
+            if(lt==INDEX_ERROR) return INVALID_B_NODE;
+            if(lt) {
+                fs_btree_linkleaf(c_node->tree.leaf.prev, alloc, c_node);
                 *(ibp->p_node)=alloc;
-                *(ibp->n_index)=c_node->tree.leaf.vch_index;
+                *(ibp->n_index)=c_node->tree.leaf.key_offset;
                 *(ibp->n_node)=c_node;
             } else {
                 assert((*(ibp->p_node))==c_node);
-                *(ibp->n_index)=alloc->tree.leaf.vch_index;
+                fs_btree_linkleaf(c_node, alloc, c_node->tree.leaf.next);
+                *(ibp->n_index)=alloc->tree.leaf.key_offset;
                 *(ibp->n_node)=alloc;
             }
-            return (B_NODE *)fs_btree_ptrfree(srnd, alloc);
+            return alloc;
         }
     } else if(c_node->type==n_node) {
         B_NODE *xn = NULL;
+        B_NODE *xs = NULL;
         counter_t xl = 0;
         const counter_t pos = fs_btree_getlocate(fbp, c_node, key);
+        const bool_t leaf = (c_node->tree.node.node_ptr[pos]->type==n_leaf);
         B_INSERT ribp;
-        ribp.p_node=&(c_node->tree.node.node_ptr[pos]); ribp.n_node=&xn; ribp.n_index=&xl;
+        ribp.p_node=&(c_node->tree.node.node_ptr[pos]); ribp.n_node=&xn; ribp.n_index=&xl; ribp.s_node=&xs;
+        if(leaf) fs_btree_latch(fbp, &c_node->version); /* the slot of the leaf may be replaced */
         B_NODE *retv = fs_btree_insert1(fbp, &ribp, key, data);
-        if(retv==INVALID_B_NODE) return INVALID_B_NODE;
-        if(retv==NO_ACCEPT_B_NODE) return NO_ACCEPT_B_NODE;
-        if(xn==NULL) return retv;
-        if(c_node->tree.node.num < fbp->dimension) {
-            for(counter_t i=c_node->tree.node.num-1; pos<i; --i) {
-                c_node->tree.node.node_ptr[i+1] = c_node->tree.node.node_ptr[i];
-                c_node->tree.node.begin_ptr[i+1] = c_node->tree.node.begin_ptr[i];
-            }
-            c_node->tree.node.node_ptr[pos+1]=xn;
-            c_node->tree.node.begin_ptr[pos+1]=xl;
-            ++(c_node->tree.node.num);
-            return retv;
-        } else {
-            B_NODE *alloc=fs_btree_alloc(fbp, n_node, NULL, NULL);
-            if(alloc==INVALID_B_NODE) return INVALID_B_NODE;
-            if(alloc==NO_ACCEPT_B_NODE) return NO_ACCEPT_B_NODE;
-            if(pos<fbp->halfdim-1) {
-                for(counter_t i=fbp->halfdim-1, j=0; i< fbp->dimension; ++i,++j) {
-                    alloc->tree.node.node_ptr[j] = c_node->tree.node.node_ptr[i];
-                    alloc->tree.node.begin_ptr[j] = c_node->tree.node.begin_ptr[i];
-                }
-                for(counter_t i= fbp->halfdim-2; pos<i; --i) {
-                    c_node->tree.node.node_ptr[i+1] = c_node->tree.node.node_ptr[i];
-                    c_node->tree.node.begin_ptr[i+1] = c_node->tree.node.begin_ptr[i];
-                }
-                c_node->tree.node.node_ptr[pos+1] = xn;
-                c_node->tree.node.begin_ptr[pos+1] = xl;
-            } else {
-                counter_t j = fbp->dimension - fbp->halfdim;
-                for(counter_t i=fbp->dimension-1; fbp->halfdim<=i; --i) {
-                    if(i==pos) {
-                        alloc->tree.node.node_ptr[j] = xn;
-                        alloc->tree.node.begin_ptr[j--] = xl;
-                    }
-                    alloc->tree.node.node_ptr[j] = c_node->tree.node.node_ptr[i];
-                    alloc->tree.node.begin_ptr[j--] = c_node->tree.node.begin_ptr[i];
-                }
-                if(pos<fbp->halfdim) {
-                    alloc->tree.node.node_ptr[0] = xn;
-                    alloc->tree.node.begin_ptr[0] = xl;
-                }
-            }
-            c_node->tree.node.num = fbp->halfdim;
-            alloc->tree.node.num = (fbp->dimension+1)-fbp->halfdim;
-            *(ibp->n_node) = alloc;
-            *(ibp->n_index) = alloc->tree.node.begin_ptr[0];
+        if(retv==INVALID_B_NODE || retv==NO_ACCEPT_B_NODE || xn==NULL) {
+            if(leaf) fs_btree_unlatch(fbp, &c_node->version);
             return retv;
         }
+        if(!leaf) fs_btree_latch(fbp, &c_node->version);
+        const bool_t ret = fs_btree_insertslot(fbp, ibp, c_node, pos, xn, xl);
+        if(xs) fs_btree_unlatch(fbp, &xs->version); /* c_node has the new node */
+        if(ret && *(ibp->n_node)) *(ibp->s_node)=c_node; /* split: until the parent has the new node */
+        else fs_btree_unlatch(fbp, &c_node->version);
+        return (ret)? retv: INVALID_B_NODE;
     } else {
         assert(!"fs_btree_insert1: bug c_node->type==n_unused");
         return b_false;
     }
 }
 
+/* new root: the old root and xn */
+static inline bool_t fs_btree_insertroot(FSBTREE *fbp, B_NODE *xn, counter_t xl) {
+    B_NODE *pn=fs_btree_alloc(fbp, n_node, NULL, NULL);
+    if(pn==INVALID_B_NODE) return b_false;
+    B_NODE *tmp=fbp->root;
+    while(tmp->type==n_node) tmp=tmp->tree.node.node_ptr[0];
+    assert(tmp->type==n_leaf);
+    pn->tree.node.num = 2;
+    fs_btree_putslot(pn, 0, fbp->root, tmp->tree.leaf.key_offset);
+    fs_btree_putslot(pn, 1, xn, xl);
+    fs_btree_setcommon(fbp, pn);
+    fs_btree_putroot(fbp, pn);
+    return b_true;
+}
+
 static inline bool_t fs_btree_insert(FSBTREE *fbp, const str_t *key, const byte_t *data) {
     if(fbp->root==NULL) {
-        fbp->root = fs_btree_alloc(fbp, n_leaf, key, data);
-        if(fbp->root==INVALID_B_NODE) return fs_btree_seterror(fbp, BTREE_ERROR_MEMORY_ALLOCATE_FAILURE);
-        /* if(fbp->root==NO_ACCEPT_B_NODE) return fs_btree_seterror(fbp, BTREE_ERROR_NO_ACCEPT); */
+        B_NODE *root = fs_btree_alloc(fbp, n_leaf, key, data);
+        if(root==INVALID_B_NODE) return fs_btree_seterror(fbp, BTREE_ERROR_MEMORY_ALLOCATE_FAILURE);
+        /* if(root==NO_ACCEPT_B_NODE) return fs_btree_seterror(fbp, BTREE_ERROR_NO_ACCEPT); */
+        fs_btree_setroot(fbp, root);
         return fs_btree_setsuccess(fbp);
     } else {
         B_NODE *xn=NULL;
+        B_NODE *xs=NULL;
         counter_t xl=0;
         B_INSERT ribp;
-        ribp.p_node=&fbp->root; ribp.n_node=&xn; ribp.n_index=&xl;
+        ribp.p_node=&fbp->root; ribp.n_node=&xn; ribp.n_index=&xl; ribp.s_node=&xs;
+        const bool_t leaf = (fbp->root->type==n_leaf);
+        if(leaf) fs_btree_latch(fbp, fbp->root_version);
         B_NODE *retv = fs_btree_insert1(fbp, &ribp, key, data);
-        if(retv==INVALID_B_NODE) return fs_btree_seterror(fbp, BTREE_ERROR_MEMORY_ALLOCATE_FAILURE);
-        if(retv==NO_ACCEPT_B_NODE) return fs_btree_setsuccess_noaccept(fbp);
-        if(xn) {
-            B_NODE *pn=fs_btree_alloc(fbp, n_node, NULL, NULL);
-            if(pn==INVALID_B_NODE) return fs_btree_seterror(fbp, BTREE_ERROR_MEMORY_ALLOCATE_FAILURE);
-            B_NODE *tmp=fbp->root;
-            while(tmp->type==n_node) tmp=tmp->tree.node.node_ptr[0];
-            assert(tmp->type==n_leaf);
-            pn->tree.node.num = 2;
-            pn->tree.node.node_ptr[0] = fbp->root;
-            pn->tree.node.node_ptr[1] = xn;
-            pn->tree.node.begin_ptr[0] = tmp->tree.leaf.vch_index;
-            pn->tree.node.begin_ptr[1] = xl;
-            fbp->root = pn;
+        bool_t ret = b_true;
+        if(retv!=INVALID_B_NODE && retv!=NO_ACCEPT_B_NODE && xn) {
+            if(!leaf) fs_btree_latch(fbp, fbp->root_version);
+            ret = fs_btree_insertroot(fbp, xn, xl);
+            if(xs) fs_btree_unlatch(fbp, &xs->version);
+            if(!leaf) fs_btree_unlatch(fbp, fbp->root_version);
         }
+        if(leaf) fs_btree_unlatch(fbp, fbp->root_version);
+        if(retv==INVALID_B_NODE || !ret) return fs_btree_seterror(fbp, BTREE_ERROR_MEMORY_ALLOCATE_FAILURE);
+        if(retv==NO_ACCEPT_B_NODE) return fs_btree_setsuccess_noaccept(fbp);
         return fs_btree_setsuccess(fbp);
     }
 }
 
-static inline void fs_btree_freenode(B_NODE *node) {
-    if(node->type==n_node) {
-        fs_free(node->tree.node.begin_ptr, b_true);
-        fs_free(node->tree.node.node_ptr, b_true);
-        fs_free(node, b_true);
-    } else if(node->type==n_leaf)
-        fs_free(node, b_true);
+/* concurrent: the block is retired, and freed after the readers. */
+static inline void fs_btree_poolrelease(FSBTREE *fbp, BTREE_POOL *pool, B_NODE *node) {
+    if(fbp->concurrent) fs_btree_epoch_retire(fbp, node, pool);
+    else fs_btree_pool_free(pool, node);
+}
+
+static inline void fs_btree_freenode(FSBTREE *fbp, B_NODE *node) {
+    if(node->type==n_node)
+        fs_btree_poolrelease(fbp, &fbp->node_pool, node);
+    else if(node->type==n_leaf)
+        fs_btree_poolrelease(fbp, &fbp->leaf_pool, node);
     else
         assert(!"fs_btree_freenode: bug node->type==n_unused");
 }
 
+/* a removed leaf: its data slot is used again, and its key is dead. b_false: the slot is not kept (memory), the leaf is freed */
+static inline bool_t fs_btree_freeleaf(FSBTREE *fbp, B_NODE *leaf) {
+    const bool_t ret = fs_datastream_release(fbp->vch, (index_t)leaf->tree.leaf.vch_index);
+    fs_keyarena_release(fbp->key, leaf->tree.leaf.key_offset);
+    fs_btree_freenode(fbp, leaf);
+    return ret;
+}
+
+/* p: latched by the caller */
 static inline merge_status fs_btree_merge(FSBTREE *fbp, B_NODE *p, counter_t x) {
     B_NODE *a = p->tree.node.node_ptr[x];
     B_NODE *b = p->tree.node.node_ptr[x+1];
-    b->tree.node.begin_ptr[0] = p->tree.node.begin_ptr[x+1];
+    fs_btree_latch(fbp, &a->version);
+    fs_btree_latch(fbp, &b->version);
+    fs_btree_movekey(b, 0, p, x+1);
     const counter_t an = a->tree.node.num;
     const counter_t bn = b->tree.node.num;
     if(an+bn<=fbp->dimension) {
-        for(index_t i=0; i<bn; ++i) {
-            a->tree.node.node_ptr[i+an] = b->tree.node.node_ptr[i];
-            a->tree.node.begin_ptr[i+an] = b->tree.node.begin_ptr[i];
-        }
-        a->tree.node.num+=bn;
-        fs_btree_freenode(b);
+        for(index_t i=0; i<bn; ++i) fs_btree_moveslot(a, i+an, b, i);
+        fs_btree_setnum(a, an+bn);
+        fs_btree_setcommon(fbp, a);
+        fs_btree_unlatch(fbp, &a->version);
+        fs_btree_unlatch_obsolete(fbp, &b->version);
+        fs_btree_freenode(fbp, b);
         return m_connected;
     } else {
         counter_t n=(an+bn)>>1;
         if(n < an) {
             counter_t move=an-n;
-            for(counter_t i=bn-1; 0<=i; --i) {
-                b->tree.node.node_ptr[i+move] = b->tree.node.node_ptr[i];
-                b->tree.node.begin_ptr[i+move] = b->tree.node.begin_ptr[i];
-            }
-            for(index_t i=0; i<move; ++i) {
-                b->tree.node.node_ptr[i] = a->tree.node.node_ptr[i+n];
-                b->tree.node.begin_ptr[i] = a->tree.node.begin_ptr[i+n];
-            }
+            for(counter_t i=bn-1; 0<=i; --i) fs_btree_moveslot(b, i+move, b, i);
+            for(index_t i=0; i<move; ++i) fs_btree_moveslot(b, i, a, i+n);
         } else {
             counter_t move=n-an;
-            for(index_t i=0; i<move; ++i) {
-                a->tree.node.node_ptr[i+an] = b->tree.node.node_ptr[i];
-                a->tree.node.begin_ptr[i+an] = b->tree.node.begin_ptr[i];
-            }
-            for(index_t i=0; i<bn-move; ++i) {
-                b->tree.node.node_ptr[i] = b->tree.node.node_ptr[i+move];
-                b->tree.node.begin_ptr[i] = b->tree.node.begin_ptr[i+move];
-            }
+            for(index_t i=0; i<move; ++i) fs_btree_moveslot(a, i+an, b, i);
+            for(index_t i=0; i<bn-move; ++i) fs_btree_moveslot(b, i, b, i+move);
         }
-        a->tree.node.num = n;
-        b->tree.node.num = an + bn - n;
-        p->tree.node.begin_ptr[x+1] = b->tree.node.begin_ptr[0];
+        fs_btree_setnum(a, n);
+        fs_btree_setnum(b, an + bn - n);
+        fs_btree_setcommon(fbp, a);
+        fs_btree_setcommon(fbp, b);
+        fs_btree_unlatch(fbp, &a->version);
+        fs_btree_unlatch(fbp, &b->version);
+        fs_btree_setkey(fbp, p, x+1, b->tree.node.begin_ptr[0]);
         return m_no_connect;
     }
 }
@@ -422,34 +1231,38 @@ static inline merge_status fs_btree_merge(FSBTREE *fbp, B_NODE *p, counter_t x)
 static inline rem_status fs_btree_remove1(FSBTREE *fbp, B_NODE *node, const str_t *key, rem_status *result) {
     *result = r_node_ok;
     if(node->type==n_leaf) {
-        SRND *srnd;
-        if(!fs_datastream_rgetdata(fbp->key, &srnd, fbp->ksize, (index_t)node->tree.leaf.vch_index)) return r_node_error;
-        if(fbp->fkeyequ((const char *)fs_datastream_getdata(srnd), key)) {
+        const index_t equ = fs_btree_leafequ(fbp, node, key);
+        if(equ==INDEX_ERROR) return r_node_error;
+        if(equ) {
             *result = r_node_removed;
-            fs_btree_freenode(node);
-            return (rem_status)fs_btree_free(srnd, (rem_status)r_node_ok);
+            fs_btree_unlinkleaf(node);
+            return fs_btree_freeleaf(fbp, node)? r_node_ok: r_node_memory;
         } else
-            return (rem_status)fs_btree_free(srnd, (rem_status)r_node_no);
+            return r_node_no;
     } else if(node->type==n_node) {
         merge_status mstatus = m_no_connect;
         rem_status rstatus = r_node_no;
         counter_t pos = fs_btree_getlocate(fbp, node, key);
+        const bool_t leaf = (node->tree.node.node_ptr[pos]->type==n_leaf);
+        if(leaf) fs_btree_latch(fbp, &node->version); /* the leaf is retired before its slot is removed */
         rem_status retv = fs_btree_remove1(fbp, node->tree.node.node_ptr[pos], key, &rstatus);
-        if(rstatus==r_node_error) return r_node_error;
-        if(rstatus==r_node_ok) return retv;
+        if(rstatus==r_node_error || rstatus==r_node_ok) {
+            if(leaf) fs_btree_unlatch(fbp, &node->version);
+            return (rstatus==r_node_error)? r_node_error: retv;
+        }
+        if(!leaf) fs_btree_latch(fbp, &node->version);
         if(rstatus==r_node_need_merge) {
             counter_t sub = (pos==0)? 0: pos-1;
             mstatus = fs_btree_merge(fbp, node, sub);
             if(mstatus==m_connected) pos=sub+1;
         }
         if(rstatus==r_node_removed || mstatus==m_connected) {
-            for(counter_t i=pos; i<node->tree.node.num-1; ++i) {
-                node->tree.node.node_ptr[i] = node->tree.node.node_ptr[i+1];
-                node->tree.node.begin_ptr[i] = node->tree.node.begin_ptr[i+1];
-            }
-            if(--(node->tree.node.num)<fbp->halfdim)
+            for(counter_t i=pos; i<node->tree.node.num-1; ++i) fs_btree_moveslot(node, i, node, i+1);
+            fs_btree_setnum(node, node->tree.node.num-1);
+            if(node->tree.node.num<fbp->halfdim)
                 *result = r_node_need_merge;
         }
+        fs_btree_unlatch(fbp, &node->version);
         return retv;
     } else
         return r_node_error;
@@ -459,38 +1272,763 @@ static inline bool_t fs_btree_remove(FSBTREE *fbp, const str_t *key) {
     if(fbp->root==NULL) return fs_btree_setsuccess_nodata(fbp);
     else {
         rem_status result = r_node_no;
+        const bool_t leaf = (fbp->root->type==n_leaf);
+        if(leaf) fs_btree_latch(fbp, fbp->root_version);
         rem_status retv = fs_btree_remove1(fbp, fbp->root, key, &result);
-        if(result==r_node_removed) fbp->root = NULL;
+        if(result==r_node_removed) fs_btree_putroot(fbp, NULL);
         else if(result==r_node_need_merge && fbp->root->tree.node.num==1) {
             B_NODE *p = fbp->root;
-            fbp->root = fbp->root->tree.node.node_ptr[0];
-            fs_btree_freenode(p);
+            fs_btree_latch(fbp, fbp->root_version);
+            fs_btree_latch(fbp, &p->version);
+            fs_btree_putroot(fbp, p->tree.node.node_ptr[0]);
+            fs_btree_unlatch_obsolete(fbp, &p->version);
+            fs_btree_unlatch(fbp, fbp->root_version);
+            fs_btree_freenode(fbp, p);
         }
+        if(leaf) fs_btree_unlatch(fbp, fbp->root_version);
+        if(retv==r_node_memory) return fs_btree_seterror(fbp, BTREE_ERROR_MEMORY_ALLOCATE_FAILURE); /* the slot is back by fs_btree_compact */
         return (retv==r_node_ok)? fs_btree_setsuccess(fbp): fs_btree_setsuccess_nodata(fbp);
     }
 }
 
-static inline bool_t fs_btree_clear1(FSBTREE *fbp, B_NODE *node) {
-    if(node&&node->type==n_node) {
-        for(index_t i=0; i<node->tree.node.num; ++i) {
-            B_NODE *next = node->tree.node.node_ptr[i];
-            if(next->type==n_leaf) fs_btree_freenode(next);
-            else if(next->type==n_node) {
-                if(!fs_btree_clear1(fbp, next)) return fs_btree_seterror(fbp, BTREE_ERROR_TREE);
-            } else assert(!"fs_btree_clear1: bug next->type==n_unused");
-        }
-        fs_btree_freenode(node);
+/*
+* concurrent: writer, one at a time. (with the readers of fs_btree_olc_getdata)
+* return: the status of the insert or remove. (BTREE_SUCCESS, BTREE_NO_ACCEPT, BTREE_NO_DATA or an error)
+*/
+static inline btree_status fs_btree_olc_insert(FSBTREE *fbp, const str_t *key, const byte_t *data) {
+    fs_mutex_lock(&fbp->writer);
+    fs_btree_insert(fbp, key, data);
+    const btree_status status = fs_btree_getstatus(fbp);
+    fs_btree_epoch_reclaim(fbp, b_false);
+    fs_mutex_unlock(&fbp->writer);
+    return status;
+}
+
+static inline btree_status fs_btree_olc_remove(FSBTREE *fbp, const str_t *key) {
+    fs_mutex_lock(&fbp->writer);
+    fs_btree_remove(fbp, key);
+    const btree_status status = fs_btree_getstatus(fbp);
+    fs_btree_epoch_reclaim(fbp, b_false);
+    fs_mutex_unlock(&fbp->writer);
+    return status;
+}
+
+/*
+* cursor
+*/
+static inline B_NODE *fs_btree_firstleaf(FSBTREE *fbp) {
+    B_NODE *p = fbp->root;
+    if(p==NULL) return NULL;
+    while(p->type==n_node) p=p->tree.node.node_ptr[0];
+    return p;
+}
+
+static inline B_NODE *fs_btree_lastleaf(FSBTREE *fbp) {
+    B_NODE *p = fbp->root;
+    if(p==NULL) return NULL;
+    while(p->type==n_node) p=p->tree.node.node_ptr[p->tree.node.num-1];
+    return p;
+}
+
+/* the first leaf of key<=leaf, NULL: nothing. */
+static inline B_NODE *fs_btree_lowerbound(FSBTREE *fbp, const str_t *key) {
+    B_NODE *p = fbp->root;
+    if(p==NULL) return NULL;
+    while(p->type==n_node) {
+        const counter_t index = fs_btree_getlocate(fbp, p, key);
+        if(index==INDEX_ERROR) return INVALID_B_NODE;
+        p=p->tree.node.node_ptr[index];
+    }
+    /* p: the last leaf of leaf<=key, or the first leaf */
+    if(fs_btree_leafequ(fbp, p, key)) return p;
+    return fs_btree_keylt(fbp, p->tree.leaf.prefix, p->tree.leaf.key_offset, key, b_false)? p->tree.leaf.next: p;
+}
+
+static inline bool_t fs_btree_cursor_inrange(const BTREE_CURSOR *cp) {
+    FSBTREE *fbp = cp->fbp;
+    const B_NODE *leaf = cp->leaf;
+    if(leaf==NULL) return b_false;
+    if(cp->lo && !fs_btree_keylt(fbp, leaf->tree.leaf.prefix, leaf->tree.leaf.key_offset, cp->lo, b_true)) return b_false;
+    if(cp->hi && (fs_btree_leafequ(fbp, leaf, cp->hi) || !fs_btree_keylt(fbp, leaf->tree.leaf.prefix, leaf->tree.leaf.key_offset, cp->hi, b_false))) return b_false;
+    return b_true;
+}
+
+static inline bool_t fs_btree_cursor_settle(BTREE_CURSOR *cp) {
+    if(!fs_btree_cursor_inrange(cp)) cp->leaf=NULL;
+    return (cp->leaf)? fs_btree_setsuccess(cp->fbp): fs_btree_setsuccess_nodata(cp->fbp);
+}
+
+/* range [lo, hi): lo and hi must be alive while the cursor is used. NULL is no limit. */
+static inline bool_t fs_btree_range(FSBTREE *fbp, BTREE_CURSOR *cp, const str_t *lo, const str_t *hi) {
+    cp->fbp=fbp;
+    cp->lo=lo;
+    cp->hi=hi;
+    cp->leaf=(lo)? fs_btree_lowerbound(fbp, lo): fs_btree_firstleaf(fbp);
+    if(cp->leaf==INVALID_B_NODE) {
+        cp->leaf=NULL;
+        return fs_btree_seterror(fbp, BTREE_ERROR_TREE);
     }
-    return (fs_btree_getstatus(fbp)!=BTREE_ERROR_TREE)? fs_btree_setsuccess(fbp): b_false;
+    return fs_btree_cursor_settle(cp);
+}
+
+/* seek: the first key of key<=leaf, and to the end. (key NULL: the first) */
+static inline bool_t fs_btree_seek(FSBTREE *fbp, BTREE_CURSOR *cp, const str_t *key) {
+    return fs_btree_range(fbp, cp, key, NULL);
 }
 
+static inline bool_t fs_btree_seeklast(FSBTREE *fbp, BTREE_CURSOR *cp) {
+    cp->fbp=fbp;
+    cp->lo=NULL;
+    cp->hi=NULL;
+    cp->leaf=fs_btree_lastleaf(fbp);
+    return fs_btree_cursor_settle(cp);
+}
+
+/* status BTREE_NO_DATA: the end of the range */
+static inline bool_t fs_btree_next(BTREE_CURSOR *cp) {
+    if(cp->leaf) cp->leaf=cp->leaf->tree.leaf.next;
+    return fs_btree_cursor_settle(cp);
+}
+
+static inline bool_t fs_btree_prev(BTREE_CURSOR *cp) {
+    if(cp->leaf) cp->leaf=cp->leaf->tree.leaf.prev;
+    return fs_btree_cursor_settle(cp);
+}
+
+static inline bool_t fs_btree_cursor_valid(const BTREE_CURSOR *cp) {
+    return cp->leaf!=NULL;
+}
+
+static inline const str_t *fs_btree_cursor_getkey(const BTREE_CURSOR *cp) {
+    return fs_btree_getkey(cp->fbp, cp->leaf->tree.leaf.key_offset);
+}
+
+static inline bool_t fs_btree_cursor_getdata(const BTREE_CURSOR *cp, SRND **data) {
+    *data = NULL;
+    return fs_datastream_rgetdata(cp->fbp->vch, data, cp->fbp->dsize, (index_t)cp->leaf->tree.leaf.vch_index)? fs_btree_setsuccess(cp->fbp): fs_btree_seterror(cp->fbp, BTREE_ERROR_MEMORY_ALLOCATE_FAILURE);
+}
+
+/* all nodes and leaves: the slabs are released, and the keys and the data too. */
 static inline bool_t fs_btree_clear(FSBTREE *fbp) {
-    return fs_btree_clear1(fbp, fbp->root);
+    fs_btree_epoch_reclaim(fbp, b_true);
+    fs_btree_pool_clear(&fbp->leaf_pool);
+    fs_btree_pool_clear(&fbp->node_pool);
+    fs_btree_setroot(fbp, NULL);
+    fs_keyarena_clear(fbp->key);
+    fs_datastream_clear(fbp->vch);
+    return fs_btree_setsuccess(fbp);
+}
+
+/*
+* compact
+*/
+typedef struct _tag_BTREE_COMPACT {
+    FSBTREE *fbp;
+    FSKEYARENA *key; /* new */
+    FSDATASTREAM *vch; /* new */
+    counter_t *offset; /* the new offsets (and indices) in the order of the walk */
+    counter_t num;
+    byte_t *data; /* dsize */
+} BTREE_COMPACT;
+
+static inline counter_t fs_btree_compact_count(const B_NODE *p) {
+    if(p->type==n_leaf) return 2;
+    counter_t num = p->tree.node.num;
+    for(counter_t i=0; i<p->tree.node.num; ++i) num += fs_btree_compact_count(p->tree.node.node_ptr[i]);
+    return num;
+}
+
+static inline bool_t fs_btree_compact_key(BTREE_COMPACT *cp, counter_t offset) {
+    fsize_t size;
+    const byte_t *key = fs_keyarena_get(cp->fbp->key, offset, &size);
+    return fs_keyarena_add(cp->key, key, size, &cp->offset[cp->num++]);
+}
+
+/*
+* the keys and the data of p to the new arena and vch. (the tree is not changed)
+* first: the old and new offsets of the first leaf, a separator of the same offset is not copied.
+*/
+static inline bool_t fs_btree_compact_copy(BTREE_COMPACT *cp, const B_NODE *p, counter_t *first_old, counter_t *first_new) {
+    FSBTREE *fbp = cp->fbp;
+    if(p->type==n_leaf) {
+        index_t index;
+        if(!fs_btree_compact_key(cp, p->tree.leaf.key_offset)) return b_false;
+        fs_btree_copydata(fbp, p, cp->data);
+        if(!fs_datastream_lstore(cp->vch, cp->data, fbp->dsize, &index)) return b_false;
+        cp->offset[cp->num++] = index;
+        *first_old = p->tree.leaf.key_offset;
+        *first_new = cp->offset[cp->num-2];
+        return b_true;
+    }
+    for(counter_t i=0; i<p->tree.node.num; ++i) {
+        counter_t old_offset, new_offset;
+        if(!fs_btree_compact_copy(cp, p->tree.node.node_ptr[i], &old_offset, &new_offset)) return b_false;
+        if(p->tree.node.begin_ptr[i]==old_offset) cp->offset[cp->num++] = new_offset;
+        else if(!fs_btree_compact_key(cp, p->tree.node.begin_ptr[i])) return b_false;
+        if(i==0) {
+            *first_old = old_offset;
+            *first_new = new_offset;
+        }
+    }
+    return b_true;
+}
+
+/* the new offsets to the tree, in the same order as fs_btree_compact_copy. */
+static inline void fs_btree_compact_fix(BTREE_COMPACT *cp, B_NODE *p) {
+    if(p->type==n_leaf) {
+        p->tree.leaf.key_offset = cp->offset[cp->num++];
+        p->tree.leaf.vch_index = cp->offset[cp->num++];
+        return;
+    }
+    for(counter_t i=0; i<p->tree.node.num; ++i) {
+        fs_btree_compact_fix(cp, p->tree.node.node_ptr[i]);
+        p->tree.node.begin_ptr[i] = cp->offset[cp->num++];
+    }
+    p->tree.node.common_offset = p->tree.node.begin_ptr[0]; /* the same bytes */
+}
+
+/* the live keys and data to a new arena and vch. If it fails, (memory) the tree is not changed. */
+static inline bool_t fs_btree_compact(FSBTREE *fbp) {
+    fs_btree_epoch_reclaim(fbp, b_true);
+    if(fbp->root==NULL) {
+        fs_keyarena_clear(fbp->key);
+        fs_datastream_clear(fbp->vch);
+        return fs_btree_setsuccess(fbp);
+    }
+    BTREE_COMPACT compact;
+    compact.fbp = fbp;
+    compact.num = 0;
+    compact.offset = (counter_t *)fs_malloc((fsize_t)(fs_btree_compact_count(fbp->root)*sizeof(counter_t)));
+    if(!compact.offset) return fs_btree_seterror(fbp, BTREE_ERROR_MEMORY_ALLOCATE_FAILURE);
+    compact.data = (byte_t *)fs_malloc(fbp->dsize);
+    if(!compact.data) return fs_free(compact.offset, fs_btree_seterror(fbp, BTREE_ERROR_MEMORY_ALLOCATE_FAILURE));
+    if(!fs_keyarena_open(&compact.key)) return fs_free(compact.data, fs_free(compact.offset, fs_btree_seterror(fbp, BTREE_ERROR_MEMORY_ALLOCATE_FAILURE)));
+    if(!fs_datastream_open(&compact.vch)) return fs_keyarena_close(compact.key, fs_free(compact.data, fs_free(compact.offset, fs_btree_seterror(fbp, BTREE_ERROR_MEMORY_ALLOCATE_FAILURE))));
+    counter_t first_old, first_new;
+    if(!fs_btree_compact_copy(&compact, fbp->root, &first_old, &first_new)) {
+        fs_datastream_close(compact.vch, b_true);
+        fs_keyarena_close(compact.key, b_true);
+        return fs_free(compact.data, fs_free(compact.offset, fs_btree_seterror(fbp, BTREE_ERROR_MEMORY_ALLOCATE_FAILURE)));
+    }
+    compact.num = 0;
+    fs_btree_compact_fix(&compact, fbp->root);
+    if(fbp->concurrent) {
+        fs_keyarena_setretire(compact.key, &fs_btree_epoch_retiretable, fbp);
+        fs_fragvector_setretire(compact.vch->vch, &fs_btree_epoch_retiretable, fbp);
+    }
+    fs_keyarena_close(fbp->key, b_true);
+    fs_datastream_close(fbp->vch, b_true);
+    fbp->key = compact.key;
+    fbp->vch = compact.vch;
+    return fs_free(compact.data, fs_free(compact.offset, fs_btree_setsuccess(fbp)));
+}
+
+/*
+* bulk load
+*/
+typedef struct _tag_BTREE_BULK {
+    FSBTREE *fbp;
+    B_NODE *first;
+    B_NODE *last;
+    counter_t num;
+    counter_t fill; /* children of a node */
+} BTREE_BULK;
+
+/* b_false: a data slot is not kept (memory), the leaves are freed */
+static inline bool_t fs_btree_bulk_freeleaf(BTREE_BULK *bulk) {
+    bool_t ret = b_true;
+    for(B_NODE *p=bulk->first; p; ) {
+        B_NODE *next = p->tree.leaf.next;
+        if(!fs_btree_freeleaf(bulk->fbp, p)) ret = b_false;
+        p = next;
+    }
+    bulk->first=NULL;
+    bulk->last=NULL;
+    bulk->num=0;
+    return ret;
+}
+
+/* fill: percent (50 - 100) of dimension, and 2 children at least. The tree must be empty. */
+static inline bool_t fs_btree_bulk_begin(FSBTREE *fbp, BTREE_BULK *bulk, index_t fill) {
+    if(fbp->root) return fs_btree_seterror(fbp, BTREE_ERROR_TREE);
+    counter_t n = fbp->dimension*fill/100;
+    if(n<fbp->halfdim) n=fbp->halfdim;
+    if(n<2) n=2; /* a node of 1 child has no separator, and a level would never be smaller */
+    if(fbp->dimension<n) n=fbp->dimension;
+    if(n<2) return fs_btree_seterror(fbp, BTREE_ERROR_TREE);
+    bulk->fbp=fbp;
+    bulk->first=NULL;
+    bulk->last=NULL;
+    bulk->num=0;
+    bulk->fill=n;
+    return fs_btree_setsuccess(fbp);
+}
+
+/* key: after the previous key. Otherwise, BTREE_ERROR_UNSORTED (and all leaves are freed). */
+static inline bool_t fs_btree_bulk_add(BTREE_BULK *bulk, const str_t *key, const byte_t *data) {
+    FSBTREE *fbp = bulk->fbp;
+    B_NODE *last = bulk->last;
+    if(last && (fs_btree_leafequ(fbp, last, key) || !fs_btree_keylt(fbp, last->tree.leaf.prefix, last->tree.leaf.key_offset, key, b_false))) {
+        fs_btree_bulk_freeleaf(bulk);
+        return fs_btree_seterror(fbp, BTREE_ERROR_UNSORTED);
+    }
+    B_NODE *leaf = fs_btree_alloc(fbp, n_leaf, key, data);
+    if(leaf==INVALID_B_NODE) {
+        fs_btree_bulk_freeleaf(bulk);
+        return fs_btree_seterror(fbp, BTREE_ERROR_MEMORY_ALLOCATE_FAILURE);
+    }
+    fs_btree_linkleaf(last, leaf, NULL);
+    if(!last) bulk->first=leaf;
+    bulk->last=leaf;
+    ++(bulk->num);
+    return fs_btree_setsuccess(fbp);
+}
+
+/*
+* n children to the nodes of fill children. The last two nodes share the rest, so that every node has halfdim or more.
+* return: the number of nodes, last2 and last1: the children of the last two nodes.
+*/
+static inline counter_t fs_btree_bulk_groups(FSBTREE *fbp, counter_t n, counter_t fill, counter_t *last2, counter_t *last1) {
+    const counter_t full = n/fill;
+    const counter_t rest = n%fill;
+    *last2 = fill;
+    if(n<=fill) {
+        *last1 = n;
+        return 1;
+    } else if(rest==0) {
+        *last1 = fill;
+        return full;
+    } else if(fbp->halfdim<=rest) {
+        *last1 = rest;
+        return full+1;
+    } else if(fill+rest<=fbp->dimension) {
+        *last1 = fill+rest;
+        return full;
+    } else {
+        *last2 = (fill+rest)>>1;
+        *last1 = fill+rest-*last2;
+        return full+1;
+    }
+}
+
+static inline counter_t fs_btree_bulk_getbegin(const B_NODE *child) {
+    return (child->type==n_leaf)? child->tree.leaf.key_offset: child->tree.node.begin_ptr[0];
+}
+
+/* nodes only: the leaves are freed by fs_btree_bulk_freeleaf. */
+static inline void fs_btree_bulk_freenode(FSBTREE *fbp, B_NODE *node) {
+    if(node->type!=n_node) return;
+    for(index_t i=0; i<node->tree.node.num; ++i) fs_btree_bulk_freenode(fbp, node->tree.node.node_ptr[i]);
+    fs_btree_freenode(fbp, node);
+}
+
+static inline bool_t fs_btree_bulk_end(BTREE_BULK *bulk) {
+    FSBTREE *fbp = bulk->fbp;
+    if(bulk->num==0) return fs_btree_setsuccess(fbp);
+    counter_t last2, last1;
+    counter_t n = fs_btree_bulk_groups(fbp, bulk->num, bulk->fill, &last2, &last1);
+    B_NODE **level = (B_NODE **)fs_malloc((fsize_t)((n+1)*sizeof(B_NODE *)));
+    if(!level) {
+        fs_btree_bulk_freeleaf(bulk);
+        return fs_btree_seterror(fbp, BTREE_ERROR_MEMORY_ALLOCATE_FAILURE);
+    }
+    level[0] = bulk->first;
+    n = bulk->num;
+    for(bool_t leaf=b_true; 1<n; leaf=b_false) {
+        const counter_t groups = fs_btree_bulk_groups(fbp, n, bulk->fill, &last2, &last1);
+        B_NODE *child = bulk->first;
+        counter_t c = 0;
+        for(counter_t g=0; g<groups; ++g) { /* level[g] is written after level[c] is read: g<=c */
+            const counter_t size = (g==groups-1)? last1: (g==groups-2)? last2: bulk->fill;
+            B_NODE *node = fs_btree_alloc(fbp, n_node, NULL, NULL);
+            if(node==INVALID_B_NODE) {
+                for(counter_t i=0; i<g; ++i) fs_btree_bulk_freenode(fbp, level[i]);
+                for(counter_t i=c; !leaf && i<n; ++i) fs_btree_bulk_freenode(fbp, level[i]);
+                fs_btree_bulk_freeleaf(bulk);
+                return fs_free(level, fs_btree_seterror(fbp, BTREE_ERROR_MEMORY_ALLOCATE_FAILURE));
+            }
+            for(counter_t i=0; i<size; ++i) {
+                if(!leaf) child = level[c++];
+                fs_btree_putslot(node, i, child, fs_btree_bulk_getbegin(child));
+                if(leaf) child = child->tree.leaf.next;
+            }
+            node->tree.node.num = size;
+            fs_btree_setcommon(fbp, node);
+            level[g] = node;
+        }
+        n = groups;
+    }
+    fs_btree_setroot(fbp, level[0]);
+    bulk->first=NULL;
+    bulk->last=NULL;
+    return fs_free(level, fs_btree_setsuccess(fbp));
+}
+
+/*
+* batch
+*/
+typedef struct _tag_BTREE_SLOT {
+    B_NODE *child;
+    counter_t offset;
+} BTREE_SLOT;
+
+typedef struct _tag_BTREE_BATCH {
+    FSBTREE *fbp;
+    const str_t *const *keys;
+    const byte_t *data; /* insert: [num][dsize] */
+    byte_t *out; /* getdata: [num][dsize] */
+    bool_t *found;
+    btree_status *status;
+    counter_t *order; /* the indices of the keys, sorted */
+    counter_t *pos; /* the slot of order[j] in the node */
+    counter_t *cnt; /* at the first of a run: the new siblings of its child */
+    counter_t *end; /* at the first of a run: the end of the run */
+    BTREE_SLOT *slot; /* the new siblings, of the run [j, end) from slot[j]. slot[-1]: the root */
+    BTREE_SLOT *merged; /* [dimension+num]: the slots of a node and its new ones */
+    B_NODE *spare; /* the nodes reserved for the splits, linked by node_ptr[0] */
+    counter_t spares;
+    bool_t error;
+} BTREE_BATCH;
+
+/* stable merge sort of the indices by fkeylt: the first of the same keys stays first. */
+static inline void fs_btree_batch_sort(FSBTREE *fbp, const str_t *const *keys, counter_t *order, counter_t *tmp, counter_t num) {
+    for(counter_t i=0; i<num; ++i) order[i]=i;
+    for(counter_t width=1; width<num; width<<=1) {
+        for(counter_t lo=0; lo<num; lo+=2*width) {
+            const counter_t mid = (lo+width<num)? lo+width: num;
+            const counter_t hi = (lo+2*width<num)? lo+2*width: num;
+            counter_t a=lo, b=mid, t=lo;
+            while(a<mid && b<hi) tmp[t++] = fs_btree_fkeylt(fbp, keys[order[a]], keys[order[b]])? order[a++]: order[b++];
+            while(a<mid) tmp[t++]=order[a++];
+            while(b<hi) tmp[t++]=order[b++];
+        }
+        memcpy(order, tmp, (size_t)num*sizeof(counter_t));
+    }
+}
+
+/* pos of the keys [lo, hi) in p, and the child of each run is prefetched. */
+static inline bool_t fs_btree_batch_locate(BTREE_BATCH *bp, const B_NODE *p, counter_t lo, counter_t hi) {
+    counter_t last = INDEX_ERROR;
+    for(counter_t j=lo; j<hi; ++j) {
+        const counter_t pos = fs_btree_getlocate(bp->fbp, p, bp->keys[bp->order[j]]);
+        if(pos==INDEX_ERROR) return b_false;
+        bp->pos[j] = pos;
+        if(pos!=last) fs_cpu_prefetch(p->tree.node.node_ptr[pos]);
+        last = pos;
+    }
+    return b_true;
+}
+
+static inline counter_t fs_btree_batch_runend(const BTREE_BATCH *bp, counter_t j, counter_t hi) {
+    counter_t k = j+1;
+    while(k<hi && bp->pos[k]==bp->pos[j]) ++k;
+    return k;
+}
+
+static inline void fs_btree_batch_setdata(BTREE_BATCH *bp, counter_t i, const B_NODE *leaf) {
+    if(leaf==NULL) return;
+    fs_btree_copydata(bp->fbp, leaf, bp->out+i*bp->fbp->dsize);
+    bp->found[i] = b_true;
+}
+
+static inline bool_t fs_btree_batch_get1(BTREE_BATCH *bp, B_NODE *p, counter_t lo, counter_t hi) {
+    FSBTREE *fbp = bp->fbp;
+    if(p->type==n_leaf) { /* the root */
+        for(counter_t j=lo; j<hi; ++j) {
+            const index_t equ = fs_btree_leafequ(fbp, p, bp->keys[bp->order[j]]);
+            if(equ==INDEX_ERROR) return b_false;
+            fs_btree_batch_setdata(bp, bp->order[j], (equ)? p: NULL);
+        }
+        return b_true;
+    }
+    if(!fs_btree_batch_locate(bp, p, lo, hi)) return b_false;
+    if(p->tree.node.node_ptr[0]->type==n_leaf) {
+        for(counter_t j=lo; j<hi; ++j) {
+            B_NODE *leaf = fs_btree_nodeleaf(fbp, p, bp->pos[j], bp->keys[bp->order[j]]);
+            if(leaf==INVALID_B_NODE) return b_false;
+            fs_btree_batch_setdata(bp, bp->order[j], leaf);
+        }
+        return b_true;
+    }
+    for(counter_t j=lo; j<hi; ) {
+        const counter_t k = fs_btree_batch_runend(bp, j, hi);
+        if(!fs_btree_batch_get1(bp, p->tree.node.node_ptr[bp->pos[j]], j, k)) return b_false;
+        j = k;
+    }
+    return b_true;
+}
+
+/* keys[num]: the data of keys[i] to data+i*dsize, found[i]: b_false if no data. */
+static inline bool_t fs_btree_getdata_batch(FSBTREE *fbp, counter_t num, const str_t *const *keys, byte_t *data, bool_t *found) {
+    for(counter_t i=0; i<num; ++i) found[i] = b_false;
+    if(fbp->root==NULL || num<=0) return fs_btree_setsuccess(fbp);
+    counter_t *work = (counter_t *)fs_malloc((fsize_t)(2*num*sizeof(counter_t)));
+    if(!work) return fs_btree_seterror(fbp, BTREE_ERROR_MEMORY_ALLOCATE_FAILURE);
+    BTREE_BATCH batch;
+    batch.fbp = fbp;
+    batch.keys = keys;
+    batch.out = data;
+    batch.found = found;
+    batch.order = work;
+    batch.pos = work+num;
+    fs_btree_batch_sort(fbp, keys, batch.order, batch.pos, num);
+    const bool_t ret = fs_btree_batch_get1(&batch, fbp->root, 0, num);
+    return fs_free(work, (ret)? fs_btree_setsuccess(fbp): fs_btree_seterror(fbp, BTREE_ERROR_TREE));
+}
+
+static inline void fs_btree_batch_getslot(const B_NODE *p, counter_t i, BTREE_SLOT *slot) {
+    slot->child = p->tree.node.node_ptr[i];
+    slot->offset = p->tree.node.begin_ptr[i];
+}
+
+
+static inline void fs_btree_batch_leafslot(B_NODE *leaf, BTREE_SLOT *slot) {
+    slot->child = leaf;
+    slot->offset = leaf->tree.leaf.key_offset;
+}
+
+/* the nodes of n slots (dimension or less each) */
+static inline counter_t fs_btree_batch_nodes(const FSBTREE *fbp, counter_t n) {
+    return (n+fbp->dimension-1)/fbp->dimension;
+}
+
+/*
+* spare: the new nodes of an insert batch are allocated before the tree is changed, so a memory error leaves
+* the tree as it is. fs_btree_batch_need counts them at most, (all keys new) and the rest are released after.
+*/
+static inline void fs_btree_batch_release(BTREE_BATCH *bp) {
+    while(bp->spare) {
+        B_NODE *node = bp->spare;
+        bp->spare = node->tree.node.node_ptr[0];
+        fs_btree_pool_free(&bp->fbp->node_pool, node); /* not in the tree: no reader has it */
+        --(bp->fbp->allocnode_count);
+    }
+    bp->spares = 0;
+}
+
+static inline bool_t fs_btree_batch_reserve(BTREE_BATCH *bp, counter_t need) {
+    for(; bp->spares<need; ++(bp->spares)) {
+        B_NODE *node = fs_btree_alloc(bp->fbp, n_node, NULL, NULL);
+        if(node==INVALID_B_NODE) {
+            fs_btree_batch_release(bp);
+            return b_false;
+        }
+        node->tree.node.node_ptr[0] = bp->spare;
+        bp->spare = node;
+    }
+    return b_true;
+}
+
+static inline B_NODE *fs_btree_batch_spare(BTREE_BATCH *bp) {
+    B_NODE *node = bp->spare;
+    bp->spare = node->tree.node.node_ptr[0];
+    node->tree.node.node_ptr[0] = NULL;
+    --(bp->spares);
+    return node;
+}
+
+/* the keys [lo, hi) into the subtree of p: the new siblings of p at most, and the new nodes of the subtree to need. */
+static inline counter_t fs_btree_batch_need(BTREE_BATCH *bp, const B_NODE *p, counter_t lo, counter_t hi, counter_t *need) {
+    if(!fs_btree_batch_locate(bp, p, lo, hi)) return INDEX_ERROR;
+    counter_t add = hi-lo;
+    if(p->tree.node.node_ptr[0]->type==n_node) {
+        add = 0;
+        for(counter_t j=lo; j<hi; ) {
+            const counter_t k = fs_btree_batch_runend(bp, j, hi);
+            const counter_t n = fs_btree_batch_need(bp, p->tree.node.node_ptr[bp->pos[j]], j, k, need);
+            if(n==INDEX_ERROR) return INDEX_ERROR;
+            add += n;
+            j = k;
+        }
+    }
+    const counter_t n = fs_btree_batch_nodes(bp->fbp, p->tree.node.num+add)-1;
+    *need += n;
+    return n;
+}
+
+/*
+* n slots to p and the new nodes (the spares): ceil(n/dimension) nodes, (n/nodes each, so halfdim or more) p is the first.
+* return: the number of the new nodes, (their slots to out) INDEX_ERROR: not enough spares, p is not changed
+* Note: out may be in slot, before the slots of each new node. (out[g-1] is written after slot[s] of the group g is read)
+*/
+static inline counter_t fs_btree_batch_split(BTREE_BATCH *bp, B_NODE *p, const BTREE_SLOT *slot, counter_t n, BTREE_SLOT *out) {
+    FSBTREE *fbp = bp->fbp;
+    const counter_t k = fs_btree_batch_nodes(fbp, n);
+    if(bp->spares<k-1) return INDEX_ERROR;
+    counter_t s = 0;
+    for(counter_t g=0; g<k; ++g) {
+        const counter_t size = n/k+((g<n%k)? 1: 0);
+        B_NODE *node = (g==0)? p: fs_btree_batch_spare(bp);
+        const BTREE_SLOT first = slot[s];
+        for(counter_t i=0; i<size; ++i) fs_btree_putslot(node, i, slot[s+i].child, slot[s+i].offset);
+        node->tree.node.num = size;
+        fs_btree_setcommon(fbp, node);
+        if(0<g) {
+            out[g-1] = first;
+            out[g-1].child = node;
+        }
+        s += size;
+    }
+    return k-1;
+}
+
+/* the leaves of p and the new leaves of the keys [lo, hi), in order to merged. return: the number, INDEX_ERROR */
+static inline counter_t fs_btree_batch_leaves(BTREE_BATCH *bp, B_NODE *p, counter_t lo, counter_t hi, BTREE_SLOT *merged) {
+    FSBTREE *fbp = bp->fbp;
+    counter_t t = 0;
+    counter_t j = lo;
+    for(counter_t i=0; i<p->tree.node.num; ++i) {
+        B_NODE *leaf = p->tree.node.node_ptr[i];
+        bool_t placed = b_false;
+        for(; j<hi && bp->pos[j]==i; ++j) {
+            const counter_t x = bp->order[j];
+            const str_t *key = bp->keys[x];
+            B_NODE *equ = fs_btree_nodeleaf(fbp, p, i, key);
+            if(equ==INVALID_B_NODE) return INDEX_ERROR;
+            if(equ) {
+                fbp->overlap_index = equ->tree.leaf.vch_index;
+                bp->status[x] = BTREE_NO_ACCEPT;
+                continue;
+            }
+            if(!placed) { /* the keys before the leaf (as fs_btree_insert1), and then the leaf */
+                const index_t lt = fs_btree_keylt(fbp, leaf->tree.leaf.prefix, leaf->tree.leaf.key_offset, key, b_true);
+                if(lt==INDEX_ERROR) return INDEX_ERROR;
+                if(!lt) {
+                    fs_btree_batch_leafslot(leaf, &merged[t++]);
+                    placed = b_true;
+                }
+            }
+            B_NODE *alloc = fs_btree_alloc(fbp, n_leaf, key, bp->data+x*fbp->dsize);
+            if(alloc==INVALID_B_NODE) {
+                bp->status[x] = BTREE_ERROR_MEMORY_ALLOCATE_FAILURE;
+                bp->error = b_true;
+                continue;
+            }
+            if(t==0) fs_btree_linkleaf(leaf->tree.leaf.prev, alloc, leaf);
+            else fs_btree_linkleaf(merged[t-1].child, alloc, merged[t-1].child->tree.leaf.next);
+            fs_btree_batch_leafslot(alloc, &merged[t++]);
+            bp->status[x] = BTREE_SUCCESS;
+        }
+        if(!placed) fs_btree_batch_leafslot(leaf, &merged[t++]); /* the slot 0 may have the key of the next */
+    }
+    return t;
+}
+
+/* the keys [lo, hi) into the subtree of p. return: the new siblings of p (to bp->slot+lo), INDEX_ERROR */
+static inline counter_t fs_btree_batch_insert1(BTREE_BATCH *bp, B_NODE *p, counter_t lo, counter_t hi) {
+    if(!fs_btree_batch_locate(bp, p, lo, hi)) return INDEX_ERROR;
+    const counter_t num = p->tree.node.num;
+    BTREE_SLOT *merged = bp->merged; /* the children are done before p uses it */
+    counter_t total = 0;
+    if(p->tree.node.node_ptr[0]->type==n_leaf) {
+        total = fs_btree_batch_leaves(bp, p, lo, hi, merged);
+        if(total==INDEX_ERROR) return INDEX_ERROR;
+    } else {
+        counter_t add = 0;
+        for(counter_t j=lo; j<hi; ) {
+            const counter_t pos = bp->pos[j];
+            const counter_t k = fs_btree_batch_runend(bp, j, hi);
+            const counter_t n = fs_btree_batch_insert1(bp, p->tree.node.node_ptr[pos], j, k);
+            if(n==INDEX_ERROR) return INDEX_ERROR;
+            bp->pos[j] = pos; /* the run [j, k) was used by the child */
+            bp->cnt[j] = n;
+            bp->end[j] = k;
+            add += n;
+            j = k;
+        }
+        if(add==0) return 0;
+        counter_t j = lo;
+        for(counter_t i=0; i<num; ++i) {
+            fs_btree_batch_getslot(p, i, &merged[total++]);
+            if(j<hi && bp->pos[j]==i) {
+                memcpy(&merged[total], &bp->slot[j], (size_t)bp->cnt[j]*sizeof(BTREE_SLOT));
+                total += bp->cnt[j];
+                j = bp->end[j];
+            }
+        }
+    }
+    return fs_btree_batch_split(bp, p, merged, total, bp->slot+lo);
+}
+
+/* keys[num], data: [num][dsize], status[i]: BTREE_SUCCESS, BTREE_NO_ACCEPT (in the tree, or the same key before it) or an error. */
+static inline bool_t fs_btree_insert_batch(FSBTREE *fbp, counter_t num, const str_t *const *keys, const byte_t *data, btree_status *status) {
+    if(num<=0) return fs_btree_setsuccess(fbp);
+    byte_t *work = fs_malloc((fsize_t)(num*4*sizeof(counter_t)+(num+1+fbp->dimension+num)*sizeof(BTREE_SLOT)));
+    if(!work) return fs_btree_seterror(fbp, BTREE_ERROR_MEMORY_ALLOCATE_FAILURE);
+    BTREE_BATCH batch;
+    batch.fbp = fbp;
+    batch.keys = keys;
+    batch.data = data;
+    batch.status = status;
+    batch.order = (counter_t *)work;
+    batch.pos = batch.order+num;
+    batch.cnt = batch.pos+num;
+    batch.end = batch.cnt+num;
+    batch.slot = (BTREE_SLOT *)(batch.end+num)+1;
+    batch.merged = batch.slot+num;
+    batch.spare = NULL;
+    batch.spares = 0;
+    batch.error = b_false;
+    for(counter_t i=0; i<num; ++i) status[i] = BTREE_ERROR_MEMORY_ALLOCATE_FAILURE;
+    fs_btree_batch_sort(fbp, keys, batch.order, batch.pos, num);
+    counter_t n = 0;
+    for(counter_t j=0; j<num; ++j) { /* the same keys: the first only */
+        if(0<n && fs_btree_fkeyequ(fbp, keys[batch.order[n-1]], keys[batch.order[j]])) status[batch.order[j]] = BTREE_NO_ACCEPT;
+        else batch.order[n++] = batch.order[j];
+    }
+    counter_t j = 0;
+    for(; j<n && (fbp->root==NULL || fbp->root->type==n_leaf); ++j) { /* up to the first node */
+        const counter_t x = batch.order[j];
+        if(!fs_btree_insert(fbp, keys[x], data+x*fbp->dsize)) batch.error = b_true;
+        status[x] = fs_btree_getstatus(fbp);
+    }
+    if(j<n) {
+        counter_t need = 0;
+        counter_t add = fs_btree_batch_need(&batch, fbp->root, j, n, &need);
+        if(add==INDEX_ERROR) return fs_free(work, fs_btree_seterror(fbp, BTREE_ERROR_TREE));
+        for(counter_t r=add; 0<r; ) { /* the new levels: the new root and its siblings */
+            const counter_t k = fs_btree_batch_nodes(fbp, r+1);
+            need += k;
+            r = k-1;
+        }
+        if(!fs_btree_batch_reserve(&batch, need)) return fs_free(work, fs_btree_seterror(fbp, BTREE_ERROR_MEMORY_ALLOCATE_FAILURE));
+        add = fs_btree_batch_insert1(&batch, fbp->root, j, n);
+        if(add==INDEX_ERROR) {
+            fs_btree_batch_release(&batch);
+            return fs_free(work, fs_btree_seterror(fbp, BTREE_ERROR_TREE));
+        }
+        if(0<add) { /* new levels: slot[j-1] is the root, and slot[j, j+add) are its siblings */
+            BTREE_SLOT *top = batch.slot+j-1;
+            B_NODE *first = fbp->root;
+            while(first->type==n_node) first = first->tree.node.node_ptr[0];
+            fs_btree_batch_leafslot(first, top);
+            top->child = fbp->root;
+            for(counter_t m=add+1; 1<m; ) {
+                B_NODE *pn = fs_btree_batch_spare(&batch);
+                const BTREE_SLOT head = top[0];
+                const counter_t k = fs_btree_batch_split(&batch, pn, top, m, top+1);
+                assert(k!=INDEX_ERROR); /* reserved by fs_btree_batch_need */
+                top[0] = head;
+                top[0].child = pn;
+                m = k+1;
+            }
+            fs_btree_setroot(fbp, top->child);
+        }
+        fs_btree_batch_release(&batch);
+    }
+    return fs_free(work, (batch.error)? fs_btree_seterror(fbp, BTREE_ERROR_MEMORY_ALLOCATE_FAILURE): fs_btree_setsuccess(fbp));
 }
 
 static inline bool_t fs_btree_close(FSBTREE *fbp, bool_t ret) {
-    fs_btree_clear(fbp);
-    return fs_free(fbp, fs_datastream_close(fbp->key, fs_datastream_close(fbp->vch, ret)));
+    if(fbp->concurrent) {
+        fs_btree_epoch_reclaim(fbp, b_true);
+        fs_free(fbp->epoch.retired, b_true);
+        fs_free(fbp->epoch.line_mem, b_true);
+        fs_mutex_destroy(&fbp->writer);
+    }
+    fs_btree_pool_close(&fbp->leaf_pool);
+    fs_btree_pool_close(&fbp->node_pool);
+    return fs_free(fbp, fs_keyarena_close(fbp->key, fs_datastream_close(fbp->vch, ret)));
 }
 
 #endif
@@ -0,0 +1,666 @@
+// Copyright (c) 2020 The SorachanCoin Developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SORACHANCOIN_FS_BTREE_PAGE
+#define SORACHANCOIN_FS_BTREE_PAGE
+
+#include "fs_const.h"
+#include "fs_memory.h"
+#include "fs_types.h"
+#include "fs_endian.h"
+#include "fs_bpb.h"
+#include "fs_cluster.h"
+#include "fs_keyarena.h"
+#include "fs_btree.h"
+
+/*
+* ** fs_btree_page **
+*
+* B+tree on disk: the pages are clusters, the header is at BPB.index_root_offset. [INDX]
+* header: [INDX][area(LE64)][pages(LE64)][root(LE64)][num(LE64)][height(LE32)][ksize(LE32)][dsize(LE32)][keytype(LE32)]
+* page: [type(1)][reserved(1)][count(LE16)][next(LE64)] and the entries,
+*   leaf entry: [key size(varint)][key][data(dsize)], the leaf pages are linked by next. (in the order of fkeylt)
+*   node entry: [child page(LE64)][key size(varint)][key], the key is the first key of the child.
+*   With the default comparators, the key of a node entry is cut to the bytes that tell the child from the one before:
+*   the shortest key after the last key of that one, and before or equal to the first key of the child. (suffix truncation)
+* In "area", the leaf pages are first, and then each level of the nodes up to the root.
+*
+* fs_btreepage_checkpoint writes FSBTREE (on memory) as a new image, and then the header:
+* the old image is released after that, so the header always has a whole image. (copy on write)
+* The image is not made on memory: all levels are made at once from the leaves, and the pages are written out
+* by BTREEPAGE_WRITE_PAGES of each level. (the first pass counts the pages of each level, for the layout of the area)
+* A page is checked against the page size when it is read, a broken page is BTREEPAGE_ERROR_BROKEN.
+* The pages are read through a cache: the pages in use are pinned, and the others are evicted by LRU.
+* So the search and the cursor work without the tree on memory, (larger than RAM)
+* and fs_btreepage_restore loads the image into FSBTREE by the bulk load. (restart without rebuild)
+*
+* Note: the image is read only. insert and remove are of FSBTREE on memory, and a checkpoint writes the whole image
+* again: there are no dirty pages written back one by one, and a tree to be changed has to fit in memory.
+* (the pages larger than RAM are for the search and the cursor)
+*
+*/
+
+#define BTREEPAGE_SIGNATURE "INDX"
+#define BTREEPAGE_CACHE_PAGES 64
+#define BTREEPAGE_HEADER_SIZE 12
+#define BTREEPAGE_LEAF 1
+#define BTREEPAGE_NODE 2
+#define BTREEPAGE_NONE ((counter_t)-1)
+#define BTREEPAGE_WRITE_PAGES 64
+#define BTREEPAGE_HEIGHT_MAX 64
+
+typedef enum _tag_btreepage_status {
+    BTREEPAGE_SUCCESS = 0,
+    BTREEPAGE_NO_DATA = 1,
+    BTREEPAGE_ERROR_MEMORY_ALLOCATE_FAILURE = 2,
+    BTREEPAGE_ERROR_DRIVE_RW_FAILURE = 3,
+    BTREEPAGE_ERROR_BROKEN = 4,
+    BTREEPAGE_ERROR_TOO_LARGE = 5,
+    BTREEPAGE_ERROR_ALL_PINNED = 6,
+} btreepage_status;
+
+typedef struct _tag_BTREE_PAGE {
+    counter_t id; /* -1: empty */
+    index_t pin;
+    counter_t used; /* LRU: tick of the last access */
+    byte_t data[BYTES_PER_CLUSTER];
+} BTREE_PAGE;
+
+typedef struct _tag_FSBTREEPAGE {
+    FSBITMAP *bp;
+    const BPB *bpb;
+    cluster_t area;
+    counter_t pages;
+    counter_t root;
+    counter_t num;
+    index_t height; /* 0: the root is a leaf page */
+    fsize_t ksize;
+    fsize_t dsize;
+    btree_keytype keytype;
+    index_t (*fkeyequ)(const str_t *a, const str_t *b);
+    index_t (*fkeylt)(const str_t *a, const str_t *b);
+    BTREE_PAGE *cache;
+    counter_t tick;
+    btreepage_status status;
+} FSBTREEPAGE;
+
+typedef struct _tag_BTREEPAGE_CURSOR {
+    FSBTREEPAGE *pp;
+    BTREE_PAGE *page; /* pinned, NULL: end */
+    index_t entry;
+    fsize_t pos;
+} BTREEPAGE_CURSOR;
+
+static inline bool_t fs_btreepage_setsuccess(FSBTREEPAGE *pp) {
+    pp->status = BTREEPAGE_SUCCESS;
+    return b_true;
+}
+
+static inline bool_t fs_btreepage_setsuccess_nodata(FSBTREEPAGE *pp) {
+    pp->status = BTREEPAGE_NO_DATA;
+    return b_true;
+}
+
+static inline bool_t fs_btreepage_seterror(FSBTREEPAGE *pp, btreepage_status status) {
+    pp->status = status;
+    return b_false;
+}
+
+static inline btreepage_status fs_btreepage_getstatus(FSBTREEPAGE *pp) {
+    return pp->status;
+}
+
+static inline counter_t fs_btreepage_getnum(const FSBTREEPAGE *pp) {
+    return pp->num;
+}
+
+static inline counter_t fs_btreepage_getpages(const FSBTREEPAGE *pp) {
+    return pp->pages;
+}
+
+static inline void fs_btreepage_dropcache(FSBTREEPAGE *pp) {
+    for(index_t i=0; i<BTREEPAGE_CACHE_PAGES; ++i) {
+        pp->cache[i].id = -1;
+        pp->cache[i].pin = 0;
+        pp->cache[i].used = 0;
+    }
+}
+
+static inline bool_t fs_btreepage_open(FSBTREEPAGE **pp, FSBITMAP *bp) {
+    *pp = (FSBTREEPAGE *)fs_malloc(sizeof(FSBTREEPAGE));
+    if(!*pp) return b_false;
+    (*pp)->cache = (BTREE_PAGE *)fs_malloc(sizeof(BTREE_PAGE)*BTREEPAGE_CACHE_PAGES);
+    if(!(*pp)->cache) return fs_free(*pp, b_false);
+    fs_btreepage_dropcache(*pp);
+    (*pp)->bp = bp;
+    (*pp)->bpb = NULL;
+    (*pp)->area = 0;
+    (*pp)->pages = 0;
+    (*pp)->root = BTREEPAGE_NONE;
+    (*pp)->num = 0;
+    (*pp)->height = 0;
+    (*pp)->ksize = 0;
+    (*pp)->dsize = 0;
+    (*pp)->keytype = btree_key_string;
+    (*pp)->fkeyequ = &fs_btree_default_fkeyequ;
+    (*pp)->fkeylt = &fs_btree_default_fkeylt;
+    (*pp)->tick = 0;
+    return fs_btreepage_setsuccess(*pp);
+}
+
+static inline bool_t fs_btreepage_close(FSBTREEPAGE *pp, bool_t ret) {
+    return fs_free(pp, fs_free(pp->cache, ret));
+}
+
+static inline void fs_btreepage_setfunc(FSBTREEPAGE *pp, index_t (*fkeyequ)(const str_t *a, const str_t *b), index_t (*fkeylt)(const str_t *a, const str_t *b)) {
+    if(fkeyequ) pp->fkeyequ=fkeyequ;
+    if(fkeylt) pp->fkeylt=fkeylt;
+}
+
+static inline index_t fs_btreepage_fkeylt(const FSBTREEPAGE *pp, const str_t *a, const str_t *b) {
+    return (pp->keytype==btree_key_string)? pp->fkeylt(a, b): fs_btree_typedcmp(pp->keytype, pp->ksize, a, b)<=0;
+}
+
+static inline index_t fs_btreepage_fkeyequ(const FSBTREEPAGE *pp, const str_t *a, const str_t *b) {
+    return (pp->keytype==btree_key_string)? pp->fkeyequ(a, b): fs_btree_typedcmp(pp->keytype, pp->ksize, a, b)==0;
+}
+
+/*
+* page cache: pinned while in use, LRU eviction of the unpinned pages. (read only, the image is written at checkpoint)
+*/
+static inline BTREE_PAGE *fs_btreepage_getpage(FSBTREEPAGE *pp, counter_t id) {
+    BTREE_PAGE *victim = NULL;
+    if(id<0 || pp->pages<=id) {
+        fs_btreepage_seterror(pp, BTREEPAGE_ERROR_BROKEN);
+        return NULL;
+    }
+    for(index_t i=0; i<BTREEPAGE_CACHE_PAGES; ++i) {
+        BTREE_PAGE *page = &pp->cache[i];
+        if(page->id==id) {
+            ++(page->pin);
+            page->used = ++(pp->tick);
+            return page;
+        }
+        if(page->pin==0 && (victim==NULL || page->used<victim->used)) victim = page;
+    }
+    if(!victim) {
+        fs_btreepage_seterror(pp, BTREEPAGE_ERROR_ALL_PINNED);
+        return NULL;
+    }
+    victim->id = -1;
+    if(!fs_cluster_diskread(pp->bp, pp->bpb, pp->area+(cluster_t)id, 1, victim->data)) {
+        fs_btreepage_seterror(pp, BTREEPAGE_ERROR_DRIVE_RW_FAILURE);
+        return NULL;
+    }
+    victim->id = id;
+    victim->pin = 1;
+    victim->used = ++(pp->tick);
+    return victim;
+}
+
+static inline void fs_btreepage_unpin(BTREE_PAGE *page) {
+    assert(0<page->pin);
+    --(page->pin);
+}
+
+static inline byte_t fs_btreepage_gettype(const byte_t *page) {
+    return page[0];
+}
+
+static inline index_t fs_btreepage_getcount(const byte_t *page) {
+    return (index_t)ReadLE16(page+2);
+}
+
+static inline counter_t fs_btreepage_getnext(const byte_t *page) {
+    return (counter_t)ReadLE64(page+4);
+}
+
+/* entry at pos: the key, and the data (leaf) or the child (node). return: the next pos, 0: broken (out of the page) */
+static inline fsize_t fs_btreepage_getentry(const FSBTREEPAGE *pp, const byte_t *page, fsize_t pos, const str_t **key, const byte_t **data, counter_t *child) {
+    *key = NULL;
+    *data = NULL;
+    *child = BTREEPAGE_NONE;
+    if(pos<BTREEPAGE_HEADER_SIZE || BYTES_PER_CLUSTER<=pos) return 0;
+    if(fs_btreepage_gettype(page)==BTREEPAGE_NODE) {
+        if(BYTES_PER_CLUSTER-pos<8) return 0;
+        *child = (counter_t)ReadLE64(page+pos);
+        pos += 8;
+    }
+    fsize_t ksize;
+    const fsize_t hsize = fs_keyarena_getsize2(page+pos, BYTES_PER_CLUSTER-pos, &ksize);
+    if(hsize==0) return 0;
+    pos += hsize;
+    if(BYTES_PER_CLUSTER-pos<ksize) return 0;
+    *key = (const str_t *)(page+pos);
+    if(pp->keytype==btree_key_string && !memchr(*key, '\0', (size_t)ksize)) return 0;
+    if(pp->keytype!=btree_key_string && ksize!=pp->ksize) return 0;
+    pos += ksize;
+    if(fs_btreepage_gettype(page)==BTREEPAGE_LEAF) {
+        if(BYTES_PER_CLUSTER-pos<pp->dsize) return 0;
+        *data = page+pos;
+        pos += pp->dsize;
+    }
+    return pos;
+}
+
+/* the page is not the type, or the entry at pos is broken: BTREEPAGE_ERROR_BROKEN and unpinned. */
+static inline bool_t fs_btreepage_broken(FSBTREEPAGE *pp, BTREE_PAGE *page) {
+    fs_btreepage_unpin(page);
+    return fs_btreepage_seterror(pp, BTREEPAGE_ERROR_BROKEN);
+}
+
+/* the leaf page of key: (descend by the first key of each child) key NULL: the first leaf page */
+static inline BTREE_PAGE *fs_btreepage_getleaf(FSBTREEPAGE *pp, const str_t *key) {
+    counter_t id = pp->root;
+    for(index_t h=pp->height; 0<h; --h) {
+        BTREE_PAGE *page = fs_btreepage_getpage(pp, id);
+        if(!page) return NULL;
+        const index_t count = fs_btreepage_getcount(page->data);
+        fsize_t pos = BTREEPAGE_HEADER_SIZE;
+        const str_t *ekey;
+        const byte_t *data;
+        counter_t child;
+        if(fs_btreepage_gettype(page->data)!=BTREEPAGE_NODE || count==0) {
+            fs_btreepage_broken(pp, page);
+            return NULL;
+        }
+        pos = fs_btreepage_getentry(pp, page->data, pos, &ekey, &data, &id);
+        for(index_t i=1; pos && key && i<count; ++i) {
+            pos = fs_btreepage_getentry(pp, page->data, pos, &ekey, &data, &child);
+            if(!pos || !fs_btreepage_fkeylt(pp, ekey, key)) break;
+            id = child;
+        }
+        if(!pos) {
+            fs_btreepage_broken(pp, page);
+            return NULL;
+        }
+        fs_btreepage_unpin(page);
+    }
+    BTREE_PAGE *page = fs_btreepage_getpage(pp, id);
+    if(page && fs_btreepage_gettype(page->data)!=BTREEPAGE_LEAF) {
+        fs_btreepage_broken(pp, page);
+        return NULL;
+    }
+    return page;
+}
+
+/* data: dsize bytes are copied. status BTREEPAGE_NO_DATA: not found */
+static inline bool_t fs_btreepage_getdata(FSBTREEPAGE *pp, const str_t *key, byte_t *data) {
+    if(pp->root==BTREEPAGE_NONE) return fs_btreepage_setsuccess_nodata(pp);
+    BTREE_PAGE *page = fs_btreepage_getleaf(pp, key);
+    if(!page) return b_false;
+    const index_t count = fs_btreepage_getcount(page->data);
+    fsize_t pos = BTREEPAGE_HEADER_SIZE;
+    for(index_t i=0; i<count; ++i) {
+        const str_t *ekey;
+        const byte_t *edata = NULL;
+        counter_t child;
+        pos = fs_btreepage_getentry(pp, page->data, pos, &ekey, &edata, &child);
+        if(!pos) return fs_btreepage_broken(pp, page);
+        if(fs_btreepage_fkeyequ(pp, key, ekey)) {
+            memcpy(data, edata, pp->dsize);
+            fs_btreepage_unpin(page);
+            return fs_btreepage_setsuccess(pp);
+        }
+    }
+    fs_btreepage_unpin(page);
+    return fs_btreepage_setsuccess_nodata(pp);
+}
+
+/*
+* cursor: the leaf page is pinned, the key and the data are in the page. (valid until next)
+* The entry of the cursor is checked when the cursor comes to it, so fs_btreepage_cursor_get does not fail.
+*/
+static inline void fs_btreepage_cursor_close(BTREEPAGE_CURSOR *cp) {
+    if(cp->page) fs_btreepage_unpin(cp->page);
+    cp->page = NULL;
+}
+
+static inline bool_t fs_btreepage_cursor_valid(const BTREEPAGE_CURSOR *cp) {
+    return cp->page!=NULL;
+}
+
+/* the end of the page: to the next leaf page */
+static inline bool_t fs_btreepage_cursor_settle(BTREEPAGE_CURSOR *cp) {
+    FSBTREEPAGE *pp = cp->pp;
+    while(cp->page && fs_btreepage_getcount(cp->page->data)<=cp->entry) {
+        const counter_t next = fs_btreepage_getnext(cp->page->data);
+        fs_btreepage_cursor_close(cp);
+        if(next==BTREEPAGE_NONE) break;
+        cp->page = fs_btreepage_getpage(pp, next);
+        if(!cp->page) return b_false;
+        cp->entry = 0;
+        cp->pos = BTREEPAGE_HEADER_SIZE;
+        if(fs_btreepage_gettype(cp->page->data)!=BTREEPAGE_LEAF) {
+            fs_btreepage_cursor_close(cp);
+            return fs_btreepage_seterror(pp, BTREEPAGE_ERROR_BROKEN);
+        }
+    }
+    if(cp->page) {
+        const str_t *key;
+        const byte_t *data;
+        counter_t child;
+        if(!fs_btreepage_getentry(pp, cp->page->data, cp->pos, &key, &data, &child)) {
+            fs_btreepage_cursor_close(cp);
+            return fs_btreepage_seterror(pp, BTREEPAGE_ERROR_BROKEN);
+        }
+    }
+    return (cp->page)? fs_btreepage_setsuccess(pp): fs_btreepage_setsuccess_nodata(pp);
+}
+
+static inline void fs_btreepage_cursor_get(const BTREEPAGE_CURSOR *cp, const str_t **key, const byte_t **data) {
+    counter_t child;
+    fs_btreepage_getentry(cp->pp, cp->page->data, cp->pos, key, data, &child);
+}
+
+static inline bool_t fs_btreepage_next(BTREEPAGE_CURSOR *cp) {
+    if(!cp->page) return fs_btreepage_setsuccess_nodata(cp->pp);
+    const str_t *key;
+    const byte_t *data;
+    counter_t child;
+    cp->pos = fs_btreepage_getentry(cp->pp, cp->page->data, cp->pos, &key, &data, &child);
+    ++(cp->entry);
+    return fs_btreepage_cursor_settle(cp);
+}
+
+/* seek: the first key of key<=entry. (key NULL: the first) Note: fs_btreepage_cursor_close after use. */
+static inline bool_t fs_btreepage_seek(FSBTREEPAGE *pp, BTREEPAGE_CURSOR *cp, const str_t *key) {
+    cp->pp = pp;
+    cp->page = NULL;
+    cp->entry = 0;
+    cp->pos = BTREEPAGE_HEADER_SIZE;
+    if(pp->root==BTREEPAGE_NONE) return fs_btreepage_setsuccess_nodata(pp);
+    cp->page = fs_btreepage_getleaf(pp, key);
+    if(!cp->page) return b_false;
+    if(key) {
+        const index_t count = fs_btreepage_getcount(cp->page->data);
+        for(; cp->entry<count; ++(cp->entry)) {
+            const str_t *ekey;
+            const byte_t *data;
+            counter_t child;
+            const fsize_t next = fs_btreepage_getentry(pp, cp->page->data, cp->pos, &ekey, &data, &child);
+            if(!next) {
+                fs_btreepage_cursor_close(cp);
+                return fs_btreepage_seterror(pp, BTREEPAGE_ERROR_BROKEN);
+            }
+            if(fs_btreepage_fkeylt(pp, key, ekey)) break;
+            cp->pos = next;
+        }
+    }
+    return fs_btreepage_cursor_settle(cp);
+}
+
+/*
+* suffix truncation: (strcmp descending) the bytes of last up to the first one that is not in first, if last has more.
+* The key is after last and before or equal to first. return: its size without '\0', 0: first as it is.
+*/
+static inline fsize_t fs_btreepage_separator(const str_t *last, const str_t *first) {
+    fsize_t n = 0;
+    while(last[n]==first[n] && last[n]!='\0') ++n;
+    return (last[n]!='\0' && last[n+1]!='\0')? n+1: 0;
+}
+
+/*
+* checkpoint: the pages of all levels are made at once from the leaves, a new page of a level is an entry of the level above.
+* In a level, the pages are [base, base+total), so the first pass only counts them (buf NULL), and the second one writes them.
+*/
+typedef struct _tag_BTREEPAGE_LEVEL {
+    counter_t base; /* the first page of the level */
+    counter_t total; /* the pages of the level, by the first pass */
+    counter_t pages; /* the pages made */
+    counter_t written; /* the pages written, buf: the pages [written, pages) */
+    fsize_t pos; /* the used bytes of the last page */
+    byte_t *buf;
+} BTREEPAGE_LEVEL;
+
+typedef struct _tag_BTREEPAGE_IMAGE {
+    BTREEPAGE_LEVEL level[BTREEPAGE_HEIGHT_MAX];
+    index_t height; /* the levels made */
+    cluster_t area;
+    bool_t truncate;
+    fsize_t first_size;
+    str_t first[BYTES_PER_CLUSTER]; /* the first key, the first entry of every level */
+    str_t prev[BYTES_PER_CLUSTER]; /* the key before */
+    str_t sep[BYTES_PER_CLUSTER]; /* the key of a new leaf page in the levels above */
+} BTREEPAGE_IMAGE;
+
+static inline void fs_btreepage_image_reset(BTREEPAGE_IMAGE *img) {
+    for(index_t h=0; h<BTREEPAGE_HEIGHT_MAX; ++h) {
+        img->level[h].pages = 0;
+        img->level[h].written = 0;
+        img->level[h].pos = 0;
+    }
+    img->height = 0;
+}
+
+static inline bool_t fs_btreepage_image_free(BTREEPAGE_IMAGE *img, bool_t ret) {
+    for(index_t h=0; h<BTREEPAGE_HEIGHT_MAX; ++h) {
+        if(img->level[h].buf) fs_free(img->level[h].buf, b_true);
+    }
+    return fs_free(img, ret);
+}
+
+/* the second pass: the buffer of each level, and the layout of the area. */
+static inline bool_t fs_btreepage_image_alloc(BTREEPAGE_IMAGE *img) {
+    counter_t base = 0;
+    for(index_t h=0; h<img->height; ++h) {
+        BTREEPAGE_LEVEL *lv = &img->level[h];
+        const counter_t n = (lv->pages<BTREEPAGE_WRITE_PAGES)? lv->pages: BTREEPAGE_WRITE_PAGES;
+        lv->base = base;
+        lv->total = lv->pages;
+        base += lv->pages;
+        lv->buf = (byte_t *)fs_malloc((fsize_t)(n*BYTES_PER_CLUSTER));
+        if(!lv->buf) return b_false;
+    }
+    fs_btreepage_image_reset(img);
+    return b_true;
+}
+
+static inline byte_t *fs_btreepage_image_getlast(BTREEPAGE_IMAGE *img, index_t h) {
+    BTREEPAGE_LEVEL *lv = &img->level[h];
+    return lv->buf+(lv->pages-1-lv->written)*BYTES_PER_CLUSTER;
+}
+
+static inline bool_t fs_btreepage_image_flush(FSBTREEPAGE *pp, BTREEPAGE_IMAGE *img, index_t h) {
+    BTREEPAGE_LEVEL *lv = &img->level[h];
+    if(!lv->buf || lv->pages==lv->written) return fs_btreepage_setsuccess(pp);
+    if(!fs_cluster_diskwrite(pp->bp, pp->bpb, img->area+(cluster_t)(lv->base+lv->written), lv->pages-lv->written, lv->buf)) return fs_btreepage_seterror(pp, BTREEPAGE_ERROR_DRIVE_RW_FAILURE);
+    lv->written = lv->pages;
+    return fs_btreepage_setsuccess(pp);
+}
+
+static inline bool_t fs_btreepage_image_newpage(FSBTREEPAGE *pp, BTREEPAGE_IMAGE *img, index_t h, byte_t type) {
+    BTREEPAGE_LEVEL *lv = &img->level[h];
+    if(lv->buf && lv->pages-lv->written==BTREEPAGE_WRITE_PAGES && !fs_btreepage_image_flush(pp, img, h)) return b_false;
+    if(img->height<=h) img->height = h+1;
+    ++(lv->pages);
+    lv->pos = BTREEPAGE_HEADER_SIZE;
+    if(lv->buf) {
+        const counter_t id = lv->base+lv->pages-1;
+        byte_t *page = fs_btreepage_image_getlast(img, h);
+        memset(page, 0x00, BYTES_PER_CLUSTER);
+        page[0] = type;
+        WriteLE64(page+4, (uint64_t)((lv->pages<lv->total)? id+1: BTREEPAGE_NONE));
+    }
+    return fs_btreepage_setsuccess(pp);
+}
+
+/*
+* entry: [child(node)][key size][key][data(leaf)] to the last page of level h.
+* A new page is an entry of the level above: (key is its first key) the first page of a level is added with the second one,
+* so the top level has one page, the root.
+*/
+static inline bool_t fs_btreepage_image_add(FSBTREEPAGE *pp, BTREEPAGE_IMAGE *img, index_t h, counter_t child, const str_t *key, fsize_t ksize, const byte_t *data) {
+    const byte_t type = (h==0)? BTREEPAGE_LEAF: BTREEPAGE_NODE;
+    byte_t head[KEYARENA_VARINT_MAX];
+    const fsize_t hsize = fs_keyarena_putsize(head, ksize);
+    const fsize_t size = ((type==BTREEPAGE_NODE)? 8: 0)+hsize+ksize+((type==BTREEPAGE_LEAF)? pp->dsize: 0);
+    if(BYTES_PER_CLUSTER-BTREEPAGE_HEADER_SIZE<size) return fs_btreepage_seterror(pp, BTREEPAGE_ERROR_TOO_LARGE);
+    if(type==BTREEPAGE_LEAF && BYTES_PER_CLUSTER-BTREEPAGE_HEADER_SIZE<2*(8+hsize+ksize)) return fs_btreepage_seterror(pp, BTREEPAGE_ERROR_TOO_LARGE); /* a node page has 2 entries at least */
+    BTREEPAGE_LEVEL *lv = &img->level[h];
+    if(lv->pages==0 || BYTES_PER_CLUSTER-lv->pos<size) {
+        if(BTREEPAGE_HEIGHT_MAX<=h+1) return fs_btreepage_seterror(pp, BTREEPAGE_ERROR_TOO_LARGE);
+        if(!fs_btreepage_image_newpage(pp, img, h, type)) return b_false;
+        if(lv->pages==2 && !fs_btreepage_image_add(pp, img, h+1, lv->base, img->first, img->first_size, NULL)) return b_false;
+        if(2<=lv->pages) {
+            const str_t *pkey = key;
+            fsize_t psize = ksize;
+            if(type==BTREEPAGE_LEAF && img->truncate) {
+                const fsize_t n = fs_btreepage_separator(img->prev, key);
+                if(0<n && n+1<ksize) {
+                    memcpy(img->sep, img->prev, n);
+                    img->sep[n] = '\0';
+                    pkey = img->sep;
+                    psize = n+1;
+                }
+            }
+            if(!fs_btreepage_image_add(pp, img, h+1, lv->base+lv->pages-1, pkey, psize, NULL)) return b_false;
+        }
+    }
+    if(lv->buf) {
+        byte_t *page = fs_btreepage_image_getlast(img, h);
+        byte_t *ptr = page+lv->pos;
+        if(type==BTREEPAGE_NODE) {
+            WriteLE64(ptr, (uint64_t)child);
+            ptr += 8;
+        }
+        memcpy(ptr, head, hsize);
+        memcpy(ptr+hsize, key, ksize);
+        ptr += hsize+ksize;
+        if(type==BTREEPAGE_LEAF) memcpy(ptr, data, pp->dsize);
+        WriteLE16(page+2, (uint16_t)(fs_btreepage_getcount(page)+1));
+    }
+    lv->pos += size;
+    return fs_btreepage_setsuccess(pp);
+}
+
+/* one pass over the leaves of FSBTREE, the data is read by the second pass only. */
+static inline bool_t fs_btreepage_image_leaves(FSBTREEPAGE *pp, BTREEPAGE_IMAGE *img, FSBTREE *fbp) {
+    BTREE_CURSOR cursor;
+    pp->num = 0;
+    for(fs_btree_seek(fbp, &cursor, NULL); fs_btree_cursor_valid(&cursor); fs_btree_next(&cursor)) {
+        const str_t *key = fs_btree_cursor_getkey(&cursor);
+        const fsize_t ksize = fs_btree_getkeysize(fbp, key);
+        SRND *srnd = NULL;
+        if(img->level[0].buf && !fs_btree_cursor_getdata(&cursor, &srnd)) return fs_btreepage_seterror(pp, BTREEPAGE_ERROR_MEMORY_ALLOCATE_FAILURE);
+        if(pp->num==0) {
+            memcpy(img->first, key, ksize);
+            img->first_size = ksize;
+        }
+        const bool_t ret = fs_btreepage_image_add(pp, img, 0, 0, key, ksize, (srnd)? fs_datastream_getdata(srnd): NULL);
+        if(srnd) fs_btree_free(srnd, b_true);
+        if(!ret) return b_false;
+        if(img->truncate) memcpy(img->prev, key, ksize);
+        ++(pp->num);
+    }
+    for(index_t h=0; h<img->height; ++h) {
+        if(!fs_btreepage_image_flush(pp, img, h)) return b_false;
+    }
+    return fs_btreepage_setsuccess(pp);
+}
+
+static inline bool_t fs_btreepage_writeheader(FSBTREEPAGE *pp) {
+    byte_t buf[BYTES_PER_CLUSTER];
+    memset(buf, 0x00, sizeof(buf));
+    memcpy(buf, BTREEPAGE_SIGNATURE, 4);
+    WriteLE64(buf+4, (uint64_t)pp->area);
+    WriteLE64(buf+12, (uint64_t)pp->pages);
+    WriteLE64(buf+20, (uint64_t)pp->root);
+    WriteLE64(buf+28, (uint64_t)pp->num);
+    WriteLE32(buf+36, (uint32_t)pp->height);
+    WriteLE32(buf+40, (uint32_t)pp->ksize);
+    WriteLE32(buf+44, (uint32_t)pp->dsize);
+    WriteLE32(buf+48, (uint32_t)pp->keytype);
+    return fs_cluster_diskwrite(pp->bp, pp->bpb, pp->bpb->index_root_offset, 1, buf)? fs_btreepage_setsuccess(pp): fs_btreepage_seterror(pp, BTREEPAGE_ERROR_DRIVE_RW_FAILURE);
+}
+
+/* a failed checkpoint: the new area (pages, if allocated) is released, and pp is the old image again. */
+static inline bool_t fs_btreepage_checkpointfail(FSBTREEPAGE *pp, const FSBTREEPAGE *old, BTREEPAGE_IMAGE *img, counter_t pages, btreepage_status status) {
+    if(0<pages) fs_cluster_erasebitmap(pp->bp, pp->bpb, img->area, pages);
+    fs_btreepage_image_free(img, b_true);
+    *pp = *old;
+    return fs_btreepage_seterror(pp, status);
+}
+
+/* FSBTREE to a new image at bpb->index_root_offset, then the old image (if any) is released. */
+static inline bool_t fs_btreepage_checkpoint(FSBTREEPAGE *pp, const BPB *bpb, FSBTREE *fbp) {
+    FSBTREEPAGE old = *pp;
+    BTREEPAGE_IMAGE *img = (BTREEPAGE_IMAGE *)fs_malloc(sizeof(BTREEPAGE_IMAGE));
+    if(!img) return fs_btreepage_seterror(pp, BTREEPAGE_ERROR_MEMORY_ALLOCATE_FAILURE);
+    for(index_t h=0; h<BTREEPAGE_HEIGHT_MAX; ++h) img->level[h].buf = NULL;
+    fs_btreepage_image_reset(img);
+    pp->bpb = bpb;
+    pp->ksize = fbp->ksize;
+    pp->dsize = fbp->dsize;
+    pp->keytype = fbp->keytype;
+    pp->fkeyequ = fbp->fkeyequ;
+    pp->fkeylt = fbp->fkeylt;
+    img->truncate = (pp->keytype==btree_key_string && pp->fkeylt==&fs_btree_default_fkeylt && pp->fkeyequ==&fs_btree_default_fkeyequ);
+    if(!fs_btreepage_image_leaves(pp, img, fbp)) return fs_btreepage_checkpointfail(pp, &old, img, 0, fs_btreepage_getstatus(pp));
+    const index_t height = img->height;
+    if(!fs_btreepage_image_alloc(img)) return fs_btreepage_checkpointfail(pp, &old, img, 0, BTREEPAGE_ERROR_MEMORY_ALLOCATE_FAILURE);
+    pp->pages = (0<height)? img->level[height-1].base+1: 0;
+    pp->root = (0<height)? img->level[height-1].base: BTREEPAGE_NONE;
+    pp->height = (0<height)? height-1: 0;
+    if(0<pp->pages) {
+        if(old.bpb!=bpb) { /* the header is used before the area is allocated. */
+            byte_t head[BYTES_PER_CLUSTER];
+            memset(head, 0x00, sizeof(head));
+            if(!fs_cluster_diskwrite(pp->bp, bpb, bpb->index_root_offset, 1, head)) return fs_btreepage_checkpointfail(pp, &old, img, 0, BTREEPAGE_ERROR_DRIVE_RW_FAILURE);
+        }
+        if(!fs_cluster_getfreecluster(pp->bp, bpb, pp->pages, &img->area)) return fs_btreepage_checkpointfail(pp, &old, img, 0, BTREEPAGE_ERROR_DRIVE_RW_FAILURE);
+        pp->area = img->area;
+        if(!fs_btreepage_image_leaves(pp, img, fbp)) return fs_btreepage_checkpointfail(pp, &old, img, pp->pages, fs_btreepage_getstatus(pp));
+        assert(img->height==height);
+    }
+    if(!fs_btreepage_writeheader(pp)) return fs_btreepage_checkpointfail(pp, &old, img, pp->pages, BTREEPAGE_ERROR_DRIVE_RW_FAILURE);
+    fs_btreepage_image_free(img, b_true);
+    fs_btreepage_dropcache(pp);
+    if(0<old.pages && !fs_cluster_erasebitmap(pp->bp, old.bpb, old.area, old.pages)) return fs_btreepage_seterror(pp, BTREEPAGE_ERROR_DRIVE_RW_FAILURE);
+    return fs_btreepage_setsuccess(pp);
+}
+
+/* the header at bpb->index_root_offset. Note: the comparators are not on disk, fs_btreepage_setfunc if they are not default. */
+static inline bool_t fs_btreepage_load(FSBTREEPAGE *pp, const BPB *bpb) {
+    byte_t buf[BYTES_PER_CLUSTER];
+    fs_btreepage_dropcache(pp);
+    pp->bpb = bpb;
+    if(!fs_cluster_diskread(pp->bp, bpb, bpb->index_root_offset, 1, buf)) return fs_btreepage_seterror(pp, BTREEPAGE_ERROR_DRIVE_RW_FAILURE);
+    if(memcmp(buf, BTREEPAGE_SIGNATURE, 4)!=0) return fs_btreepage_seterror(pp, BTREEPAGE_ERROR_BROKEN);
+    pp->area = (cluster_t)ReadLE64(buf+4);
+    pp->pages = (counter_t)ReadLE64(buf+12);
+    pp->root = (counter_t)ReadLE64(buf+20);
+    pp->num = (counter_t)ReadLE64(buf+28);
+    pp->height = (index_t)ReadLE32(buf+36);
+    pp->ksize = (fsize_t)ReadLE32(buf+40);
+    pp->dsize = (fsize_t)ReadLE32(buf+44);
+    pp->keytype = (btree_keytype)ReadLE32(buf+48);
+    if(pp->pages<0 || (pp->root!=BTREEPAGE_NONE && pp->pages<=pp->root) || pp->height<0 || BTREEPAGE_HEIGHT_MAX<=pp->height) return fs_btreepage_seterror(pp, BTREEPAGE_ERROR_BROKEN);
+    return fs_btreepage_setsuccess(pp);
+}
+
+/* image to FSBTREE (empty, opened by the same ksize and dsize), by the bulk load. */
+static inline bool_t fs_btreepage_restore(FSBTREEPAGE *pp, FSBTREE *fbp, index_t fill) {
+    if(fbp->ksize!=pp->ksize || fbp->dsize!=pp->dsize || fbp->keytype!=pp->keytype) return fs_btreepage_seterror(pp, BTREEPAGE_ERROR_BROKEN);
+    BTREE_BULK bulk;
+    if(!fs_btree_bulk_begin(fbp, &bulk, fill)) return fs_btreepage_seterror(pp, BTREEPAGE_ERROR_BROKEN);
+    BTREEPAGE_CURSOR cursor;
+    for(fs_btreepage_seek(pp, &cursor, NULL); fs_btreepage_cursor_valid(&cursor); fs_btreepage_next(&cursor)) {
+        const str_t *key;
+        const byte_t *data;
+        fs_btreepage_cursor_get(&cursor, &key, &data);
+        if(!fs_btree_bulk_add(&bulk, key, data)) {
+            fs_btreepage_cursor_close(&cursor);
+            return fs_btreepage_seterror(pp, (fs_btree_getstatus(fbp)==BTREE_ERROR_UNSORTED)? BTREEPAGE_ERROR_BROKEN: BTREEPAGE_ERROR_MEMORY_ALLOCATE_FAILURE);
+        }
+    }
+    if(fs_btreepage_getstatus(pp)!=BTREEPAGE_NO_DATA) {
+        fs_btree_bulk_end(&bulk);
+        fs_btree_clear(fbp);
+        return b_false;
+    }
+    return fs_btree_bulk_end(&bulk)? fs_btreepage_setsuccess(pp): fs_btreepage_seterror(pp, BTREEPAGE_ERROR_MEMORY_ALLOCATE_FAILURE);
+}
+
+#endif
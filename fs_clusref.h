@@ -0,0 +1,184 @@
+// Copyright (c) 2020 The SorachanCoin Developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SORACHANCOIN_FS_CLUSREF
+#define SORACHANCOIN_FS_CLUSREF
+
+#include "fs_const.h"
+#include "fs_memory.h"
+#include "fs_types.h"
+
+/*
+* ** fs_clusref **
+*
+* Reference count of shared clusters, on memory.
+* Only the extra references are recorded. (no entry: referenced once)
+* So a cluster that is not shared costs nothing.
+*
+* When it is attached to FSBITMAP(fs_cluster_setref), fs_cluster_erasebitmap releases one reference,
+* and only the clusters that lost the last reference are erased. ffree(ctx, clus) is called for them.
+* fwrite(ctx, clus) is called before fs_cluster_cowwrite overwrites a cluster in place.
+*
+* The counts are not on disk. At mount, they are rebuilt from the objects (fs_extent_mountref):
+* fs_clusref_addref once per reference found, and then fs_clusref_settle.
+*
+*/
+
+#define CLUSREF_EMPTY -1
+#define CLUSREF_DELETED -2
+#define CLUSREF_FIRST_SIZE 1024
+
+typedef enum _tag_clusref_status {
+    CLUSREF_SUCCESS = 0,
+    CLUSREF_ERROR_MEMORY_ALLOCATE_FAILURE = 1,
+} clusref_status;
+
+typedef struct _tag_CLUSREF_ENTRY {
+    cluster_t clus;
+    counter_t extra;
+} CLUSREF_ENTRY;
+
+typedef struct _tag_FSCLUSREF {
+    CLUSREF_ENTRY *table;
+    counter_t size; /* power of 2 */
+    counter_t used; /* include CLUSREF_DELETED */
+    counter_t count;
+    void (*ffree)(void *ctx, cluster_t clus);
+    void (*fwrite)(void *ctx, cluster_t clus);
+    void *ctx;
+    clusref_status status;
+} FSCLUSREF;
+
+static inline bool_t fs_clusref_setsuccess(FSCLUSREF *ref) {
+    ref->status = CLUSREF_SUCCESS;
+    return b_true;
+}
+
+static inline bool_t fs_clusref_seterror(FSCLUSREF *ref, clusref_status status) {
+    ref->status = status;
+    return b_false;
+}
+
+static inline counter_t fs_clusref_hash(cluster_t clus, counter_t size) {
+    return (counter_t)(((uint64_t)clus*0x9E3779B97F4A7C15ull)>>32)&(size-1);
+}
+
+static inline bool_t fs_clusref_alloctable(FSCLUSREF *ref, counter_t size) {
+    CLUSREF_ENTRY *table = (CLUSREF_ENTRY *)fs_malloc((fsize_t)(sizeof(CLUSREF_ENTRY)*size));
+    if(!table) return fs_clusref_seterror(ref, CLUSREF_ERROR_MEMORY_ALLOCATE_FAILURE);
+    for(counter_t i=0; i<size; ++i) {
+        table[i].clus = CLUSREF_EMPTY;
+        table[i].extra = 0;
+    }
+    CLUSREF_ENTRY *old = ref->table;
+    const counter_t oldsize = ref->size;
+    ref->table = table;
+    ref->size = size;
+    ref->used = 0;
+    ref->count = 0;
+    for(counter_t i=0; i<oldsize; ++i) {
+        if(old[i].clus<0) continue;
+        counter_t h = fs_clusref_hash(old[i].clus, size);
+        while(table[h].clus!=CLUSREF_EMPTY) h = (h+1)&(size-1);
+        table[h] = old[i];
+        ++(ref->used);
+        ++(ref->count);
+    }
+    fs_free(old, b_true);
+    return fs_clusref_setsuccess(ref);
+}
+
+static inline bool_t fs_clusref_open(FSCLUSREF **ref) {
+    *ref = (FSCLUSREF *)fs_malloc(sizeof(FSCLUSREF));
+    if(!*ref) return b_false;
+    (*ref)->table = NULL;
+    (*ref)->size = 0;
+    (*ref)->used = 0;
+    (*ref)->count = 0;
+    (*ref)->ffree = NULL;
+    (*ref)->fwrite = NULL;
+    (*ref)->ctx = NULL;
+    if(!fs_clusref_alloctable(*ref, CLUSREF_FIRST_SIZE)) return fs_free(*ref, b_false);
+    return fs_clusref_setsuccess(*ref);
+}
+
+static inline bool_t fs_clusref_close(FSCLUSREF *ref, bool_t ret) {
+    return fs_free(ref, fs_free(ref->table, ret));
+}
+
+static inline void fs_clusref_setfunc(FSCLUSREF *ref, void (*ffree)(void *ctx, cluster_t clus), void (*fwrite)(void *ctx, cluster_t clus), void *ctx) {
+    ref->ffree = ffree;
+    ref->fwrite = fwrite;
+    ref->ctx = ctx;
+}
+
+static inline CLUSREF_ENTRY *fs_clusref_find(FSCLUSREF *ref, cluster_t clus) {
+    for(counter_t h=fs_clusref_hash(clus, ref->size);; h=(h+1)&(ref->size-1)) {
+        if(ref->table[h].clus==clus) return &ref->table[h];
+        if(ref->table[h].clus==CLUSREF_EMPTY) return NULL;
+    }
+}
+
+static inline counter_t fs_clusref_getcount(FSCLUSREF *ref, cluster_t clus) { /* references, 1 or more */
+    const CLUSREF_ENTRY *entry = fs_clusref_find(ref, clus);
+    return (entry)? entry->extra+1: 1;
+}
+
+static inline bool_t fs_clusref_isshared(FSCLUSREF *ref, cluster_t clus) {
+    return fs_clusref_find(ref, clus)!=NULL;
+}
+
+/* last: b_true, no reference remains. (the cluster should be erased) */
+static inline bool_t fs_clusref_release(FSCLUSREF *ref, cluster_t clus, bool_t *last) {
+    CLUSREF_ENTRY *entry = fs_clusref_find(ref, clus);
+    *last = (entry==NULL);
+    if(entry && --(entry->extra)==0) {
+        entry->clus = CLUSREF_DELETED;
+        --(ref->count);
+    }
+    return fs_clusref_setsuccess(ref);
+}
+
+static inline void fs_clusref_clear(FSCLUSREF *ref) { /* no allocation, never fails. */
+    for(counter_t i=0; i<ref->size; ++i) {
+        ref->table[i].clus = CLUSREF_EMPTY;
+        ref->table[i].extra = 0;
+    }
+    ref->used = ref->count = 0;
+}
+
+/* the rebuild: extra was the number of references, one is taken off. (no entry: referenced once) */
+static inline void fs_clusref_settle(FSCLUSREF *ref) {
+    for(counter_t i=0; i<ref->size; ++i) {
+        if(ref->table[i].clus<0) continue;
+        if(--(ref->table[i].extra)==0) {
+            ref->table[i].clus = CLUSREF_DELETED;
+            --(ref->count);
+        }
+    }
+}
+
+/* all or nothing: if it fails, the references added to [clus, c) are released. */
+static inline bool_t fs_clusref_addref(FSCLUSREF *ref, cluster_t clus, counter_t num) {
+    for(cluster_t c=clus; c<clus+num; ++c) {
+        CLUSREF_ENTRY *entry = fs_clusref_find(ref, c);
+        if(entry) {++(entry->extra); continue;}
+        if(ref->size<=(ref->used+1)*2 && !fs_clusref_alloctable(ref, (ref->size<=ref->count*4)? ref->size*2: ref->size)) {
+            for(cluster_t k=clus; k<c; ++k) {
+                bool_t last;
+                fs_clusref_release(ref, k, &last);
+            }
+            return fs_clusref_seterror(ref, CLUSREF_ERROR_MEMORY_ALLOCATE_FAILURE);
+        }
+        counter_t h = fs_clusref_hash(c, ref->size);
+        while(0<=ref->table[h].clus) h = (h+1)&(ref->size-1);
+        if(ref->table[h].clus==CLUSREF_EMPTY) ++(ref->used);
+        ref->table[h].clus = c;
+        ref->table[h].extra = 1;
+        ++(ref->count);
+    }
+    return fs_clusref_setsuccess(ref);
+}
+
+#endif
@@ -9,6 +9,9 @@
 #include "fs_disk.h"
 #include "fs_bitmap.h"
 #include "fs_bpb.h"
+#include "fs_sha256.h"
+#include "fs_thread.h"
+#include "fs_clusref.h"
 
 /**
 * ** fs_cluster **
@@ -20,8 +23,55 @@
 *
 * 3, Use fs_bitmap(FSBITMAP) for error status.
 *
+* 4, Freed clusters can give back the host storage. (punch hole)
+* fs_cluster_erasebitmap_punch does it inline, FSHOLEBATCH defers the ranges and frees them together.
+* If the host cannot punch holes, the clusters are still erased and FS_BITMAP_ERROR_PUNCH_UNSUPPORTED is returned.
+*
+* 5, fs_cluster_diskwrite_hash returns SHA256 of each cluster, hashed on worker threads while writing.
+*
+* 6, Shared clusters: if fs_clusref(FSCLUSREF) is attached by fs_cluster_setref,
+* the erase functions release one reference and erase only the clusters that lost the last one.
+*
+* 7, Copy on write: fs_cluster_clone shares clusters (O(1) per cluster, no copy),
+* and fs_cluster_cowwrite moves a range that includes a shared cluster to a new range on the first write.
+*
+* 8, fs_cluster_treehash: one digest of a large range. Each CLUSTER_HASH_SEGMENT is hashed on worker threads,
+* and the segment digests are combined as a Merkle tree (fs_sha256d64). The result does not depend on the workers.
+*
 */
 
+#define CLUSTER_HASH_SEGMENT 64 /* 256KB: unit written by the caller and hashed by a worker. */
+#define CLUSTER_HASH_SIZE 32
+#define CLUSTER_TREEHASH_GROUP 8 /* segments read at once by a worker: 2MB */
+
+typedef struct _tag_CLUSTER_HASHJOB {
+    const byte_t *buf;
+    counter_t num;
+    byte_t *digest;
+} CLUSTER_HASHJOB;
+
+typedef struct _tag_CLUSTER_HASHWORKER {
+    CLUSTER_HASHJOB *job;
+    index_t worker;
+    num_t workers;
+} CLUSTER_HASHWORKER;
+
+#pragma pack(push, 1)
+typedef struct _tag_HOLE_RANGE {
+    sector_t begin;
+    counter_t num;
+} HOLE_RANGE;
+#pragma pack(pop)
+
+#define HOLEBATCH_ALLOC_UNIT 256
+
+typedef struct _tag_FSHOLEBATCH {
+    FSBITMAP *bp;
+    HOLE_RANGE *range;
+    index_t count;
+    index_t capacity;
+} FSHOLEBATCH;
+
 static inline sector_t fs_cluster_getsector(const BPB *bpb, cluster_t clus) {
     assert(clus>=0);
     return bpb->bpb_offset+clus*SECTORS_PER_CLUSTER;
@@ -40,8 +90,110 @@ static inline bool_t fs_cluster_diskwrite(FSBITMAP *bp, const BPB *bpb, cluster_
     return fs_diskwith_bitmap_write(bp, fs_cluster_getsector(bpb, begin), num*SECTORS_PER_CLUSTER, buf);
 }
 
-static inline bool_t fs_cluster_erasebitmap(FSBITMAP *bp, const BPB *bpb, cluster_t begin, counter_t num) {
-    return fs_diskwith_bitmap_erase(bp, fs_cluster_getsector(bpb, begin), num*SECTORS_PER_CLUSTER);
+static inline void fs_cluster_hashjob(void *arg, index_t worker, num_t workers) { /* segment: worker, worker+workers, ... same order as writing. */
+    const CLUSTER_HASHJOB *job = (const CLUSTER_HASHJOB *)arg;
+    for(counter_t seg=worker*CLUSTER_HASH_SEGMENT; seg<job->num; seg+=workers*CLUSTER_HASH_SEGMENT) {
+        const counter_t end = (seg+CLUSTER_HASH_SEGMENT<job->num)? seg+CLUSTER_HASH_SEGMENT: job->num;
+        fs_sha256_digest_array(job->buf+seg*BYTES_PER_CLUSTER, (index_t)(end-seg), BYTES_PER_CLUSTER, job->digest+seg*CLUSTER_HASH_SIZE);
+    }
+}
+
+static inline void fs_cluster_hashworker(void *arg) {
+    const CLUSTER_HASHWORKER *wp = (const CLUSTER_HASHWORKER *)arg;
+    fs_cluster_hashjob(wp->job, wp->worker, wp->workers);
+}
+
+/* digest: num*CLUSTER_HASH_SIZE bytes, SHA256 of each cluster. */
+static inline bool_t fs_cluster_diskwrite_hash(FSBITMAP *bp, const BPB *bpb, cluster_t begin, counter_t num, const byte_t *buf, byte_t *digest) {
+    FSTHREAD th[THREAD_WORKERS_MAX];
+    CLUSTER_HASHWORKER param[THREAD_WORKERS_MAX];
+    CLUSTER_HASHJOB job;
+    job.buf = buf;
+    job.num = num;
+    job.digest = digest;
+    const counter_t segments = (num+CLUSTER_HASH_SEGMENT-1)/CLUSTER_HASH_SEGMENT;
+    num_t workers = fs_thread_getcpus()-1; /* the caller writes. */
+    if(workers<1) workers = 1;
+    if(THREAD_WORKERS_MAX<workers) workers = THREAD_WORKERS_MAX;
+    if(segments<workers) workers = (num_t)segments;
+    fs_sha256_initimpl(); /* before the workers */
+    for(index_t i=0; i<workers; ++i) {
+        param[i].job = &job;
+        param[i].worker = i;
+        param[i].workers = workers;
+        fs_thread_create(&th[i], fs_cluster_hashworker, &param[i]);
+    }
+    bool_t ret = b_true;
+    for(counter_t seg=0; seg<num && ret; seg+=CLUSTER_HASH_SEGMENT) {
+        const counter_t wnum = (seg+CLUSTER_HASH_SEGMENT<num)? CLUSTER_HASH_SEGMENT: num-seg;
+        ret = fs_disk_write(bp->fdp, fs_cluster_getsector(bpb, begin+seg), wnum*SECTORS_PER_CLUSTER, buf+seg*BYTES_PER_CLUSTER);
+    }
+    for(index_t i=0; i<workers; ++i) {
+        if(!fs_thread_join(&th[i])) fs_cluster_hashjob(&job, i, workers);
+    }
+    if(!ret) return fs_bitmap_seterror(bp, FS_BITMAP_ERROR_DRIVE_RW_FAILURE);
+    return fs_diskwith_bitmap_func(bp, fs_cluster_getsector(bpb, begin), num*SECTORS_PER_CLUSTER, fs_bitmap_setmask);
+}
+
+typedef struct _tag_CLUSTER_TREEHASHJOB {
+    FSBITMAP *bp;
+    const BPB *bpb;
+    cluster_t begin;
+    counter_t num;
+    byte_t *digest; /* segments*CLUSTER_HASH_SIZE */
+    FSMUTEX mutex; /* the disk is read by one worker at a time, the others are hashing. */
+    bool_t ret;
+} CLUSTER_TREEHASHJOB;
+
+static inline void fs_cluster_treehashjob(void *arg, index_t worker, num_t workers) { /* group: worker, worker+workers, ... */
+    CLUSTER_TREEHASHJOB *job = (CLUSTER_TREEHASHJOB *)arg;
+    const counter_t group = CLUSTER_TREEHASH_GROUP*CLUSTER_HASH_SEGMENT;
+    byte_t *buf = fs_malloc((fsize_t)(group*BYTES_PER_CLUSTER));
+    for(counter_t offset=worker*group; offset<job->num; offset+=workers*group) {
+        const counter_t num = (offset+group<job->num)? group: job->num-offset;
+        bool_t ret = (buf!=NULL);
+        fs_mutex_lock(&job->mutex);
+        ret = ret && job->ret && fs_cluster_diskread(job->bp, job->bpb, job->begin+offset, num, buf);
+        if(!ret) job->ret = b_false;
+        fs_mutex_unlock(&job->mutex);
+        if(!ret) break;
+        const counter_t full = num/CLUSTER_HASH_SEGMENT, tail = num%CLUSTER_HASH_SEGMENT;
+        byte_t *digest = job->digest+(offset/CLUSTER_HASH_SEGMENT)*CLUSTER_HASH_SIZE;
+        fs_sha256_digest_array(buf, (index_t)full, CLUSTER_HASH_SEGMENT*BYTES_PER_CLUSTER, digest);
+        if(0<tail) fs_sha256_digest(buf+full*CLUSTER_HASH_SEGMENT*BYTES_PER_CLUSTER, tail*BYTES_PER_CLUSTER, digest+full*CLUSTER_HASH_SIZE);
+    }
+    fs_free(buf, b_true);
+}
+
+/*
+* hash: SHA256 tree of [begin, begin+num). leaves: SHA256 of each segment, inner nodes: fs_sha256d64(left || right),
+* and the last node of an odd level goes up as is. (a range within one segment: the SHA256 of the range)
+*/
+static inline bool_t fs_cluster_treehash(FSBITMAP *bp, const BPB *bpb, cluster_t begin, counter_t num, byte_t *hash) {
+    if(num<=0) return fs_bitmap_seterror(bp, FS_BITMAP_ERROR_OUT_OF_RANGE);
+    counter_t n = (num+CLUSTER_HASH_SEGMENT-1)/CLUSTER_HASH_SEGMENT;
+    CLUSTER_TREEHASHJOB job;
+    job.bp = bp;
+    job.bpb = bpb;
+    job.begin = begin;
+    job.num = num;
+    job.digest = fs_malloc((fsize_t)(n*CLUSTER_HASH_SIZE));
+    job.ret = b_true;
+    if(!job.digest) return fs_bitmap_seterror(bp, FS_BITMAP_ERROR_MEMORY_ALLOCATE_FAILURE);
+    const counter_t groups = (n+CLUSTER_TREEHASH_GROUP-1)/CLUSTER_TREEHASH_GROUP;
+    num_t workers = fs_thread_getcpus();
+    if(groups<workers) workers = (num_t)groups;
+    fs_mutex_init(&job.mutex);
+    fs_sha256_initimpl(); /* before the workers */
+    fs_thread_parallel(workers, fs_cluster_treehashjob, &job);
+    fs_mutex_destroy(&job.mutex);
+    if(!job.ret) return fs_free(job.digest, fs_bitmap_seterror(bp, FS_BITMAP_ERROR_DRIVE_RW_FAILURE));
+    for(; 1<n; n=(n+1)/2) { /* in place: the parents are written over the children already read. */
+        fs_sha256d64(job.digest, job.digest, (size_t)(n/2));
+        if(n&1) memmove(job.digest+(n/2)*CLUSTER_HASH_SIZE, job.digest+(n-1)*CLUSTER_HASH_SIZE, CLUSTER_HASH_SIZE);
+    }
+    memcpy(hash, job.digest, CLUSTER_HASH_SIZE);
+    return fs_free(job.digest, fs_bitmap_setsuccess(bp));
 }
 
 static inline bool_t fs_cluster_someusedrange(FSBITMAP *bp, const BPB *bpb, cluster_t begin, counter_t num, bool_t *used) {
@@ -56,4 +208,191 @@ static inline bool_t fs_cluster_getfreecluster(FSBITMAP *bp, const BPB *bpb, cou
     return b_true;
 }
 
+static inline bool_t fs_cluster_punchhole(FSBITMAP *bp, const BPB *bpb, cluster_t begin, counter_t num) {
+    if(fs_disk_punchhole(bp->fdp, fs_cluster_getsector(bpb, begin), num*SECTORS_PER_CLUSTER)) return fs_bitmap_setsuccess(bp);
+    return fs_bitmap_seterror(bp, (fs_disk_getstatus(bp->fdp)==FS_DISK_ERROR_UNSUPPORTED)? FS_BITMAP_ERROR_PUNCH_UNSUPPORTED: FS_BITMAP_ERROR_DRIVE_RW_FAILURE);
+}
+
+/* the punch is unsupported: the clusters are erased, so it goes on and reports it at the end. */
+static inline bool_t fs_cluster_punchskip(FSBITMAP *bp, bool_t *unsupported) {
+    if(fs_bitmap_getstatus(bp)!=FS_BITMAP_ERROR_PUNCH_UNSUPPORTED) return b_false;
+    *unsupported = b_true;
+    return b_true;
+}
+
+static inline bool_t fs_cluster_trimchunk(FSBITMAP *bp) { /* delete the trailing chunks that are entirely free. */
+    num_t fnum=bp->fdp->io.fp_num;
+    while(1<fnum) {
+        bool_t used=b_true;
+        if(!fs_bitmap_getmask_chunkused(bp, fnum-1, &used)) return b_false;
+        if(used) break;
+        --fnum;
+    }
+    if(fnum==bp->fdp->io.fp_num) return fs_bitmap_setsuccess(bp);
+    return fs_disk_truncate(bp->fdp, fnum)? fs_bitmap_setsuccess(bp): fs_bitmap_seterror(bp, FS_BITMAP_ERROR_DRIVE_RW_FAILURE);
+}
+
+static inline void fs_cluster_setref(FSBITMAP *bp, FSCLUSREF *ref) {
+    bp->ref = ref;
+}
+
+static inline bool_t fs_cluster_erase1(FSBITMAP *bp, const BPB *bpb, cluster_t begin, counter_t num, bool_t punch) {
+    if(!fs_diskwith_bitmap_erase(bp, fs_cluster_getsector(bpb, begin), num*SECTORS_PER_CLUSTER)) return b_false;
+    return (punch)? fs_cluster_punchhole(bp, bpb, begin, num): fs_bitmap_setsuccess(bp);
+}
+
+/* with FSCLUSREF: one reference is released, and the runs that lost the last reference are erased. */
+static inline bool_t fs_cluster_erasebitmap2(FSBITMAP *bp, const BPB *bpb, cluster_t begin, counter_t num, bool_t punch) {
+    FSCLUSREF *ref = bp->ref;
+    if(ref==NULL) return fs_cluster_erase1(bp, bpb, begin, num, punch);
+    cluster_t run = begin;
+    counter_t rnum = 0;
+    bool_t unsupported = b_false;
+    for(cluster_t clus=begin; clus<begin+num; ++clus) {
+        bool_t last;
+        fs_clusref_release(ref, clus, &last);
+        if(last) {
+            if(rnum==0) run = clus;
+            ++rnum;
+            if(ref->ffree) ref->ffree(ref->ctx, clus);
+        } else if(0<rnum) {
+            if(!fs_cluster_erase1(bp, bpb, run, rnum, punch) && !fs_cluster_punchskip(bp, &unsupported)) return b_false;
+            rnum = 0;
+        }
+    }
+    if(0<rnum && !fs_cluster_erase1(bp, bpb, run, rnum, punch) && !fs_cluster_punchskip(bp, &unsupported)) return b_false;
+    return (unsupported)? fs_bitmap_seterror(bp, FS_BITMAP_ERROR_PUNCH_UNSUPPORTED): fs_bitmap_setsuccess(bp);
+}
+
+static inline bool_t fs_cluster_erasebitmap(FSBITMAP *bp, const BPB *bpb, cluster_t begin, counter_t num) {
+    return fs_cluster_erasebitmap2(bp, bpb, begin, num, b_false);
+}
+
+static inline bool_t fs_cluster_erasebitmap_punch(FSBITMAP *bp, const BPB *bpb, cluster_t begin, counter_t num) {
+    bool_t unsupported = b_false;
+    if(!fs_cluster_erasebitmap2(bp, bpb, begin, num, b_true) && !fs_cluster_punchskip(bp, &unsupported)) return b_false;
+    if(!fs_cluster_trimchunk(bp)) return b_false;
+    return (unsupported)? fs_bitmap_seterror(bp, FS_BITMAP_ERROR_PUNCH_UNSUPPORTED): b_true;
+}
+
+static inline bool_t fs_cluster_clone(FSBITMAP *bp, cluster_t begin, counter_t num) { /* one more reference, released by fs_cluster_erasebitmap. */
+    if(bp->ref==NULL) return fs_bitmap_seterror(bp, FS_BITMAP_ERROR_NO_REFERENCE);
+    return fs_clusref_addref(bp->ref, begin, num)? fs_bitmap_setsuccess(bp): fs_bitmap_seterror(bp, FS_BITMAP_ERROR_MEMORY_ALLOCATE_FAILURE);
+}
+
+static inline bool_t fs_cluster_someshared(FSBITMAP *bp, cluster_t begin, counter_t num, bool_t *shared) {
+    *shared = b_false;
+    if(bp->ref==NULL || bp->ref->count==0) return fs_bitmap_setsuccess(bp);
+    for(cluster_t clus=begin; clus<begin+num && !*shared; ++clus)
+        *shared = fs_clusref_isshared(bp->ref, clus);
+    return fs_bitmap_setsuccess(bp);
+}
+
+/*
+* Copy on write: if no cluster in the range is shared, it is written in place. (*newbegin==begin)
+* Before that, fwrite of fs_clusref is called for each cluster, so an index of the old contents can forget them.
+* Otherwise the range is written to a new range (*newbegin), and the old one loses a reference.
+* The caller remaps its object to *newbegin.
+*/
+static inline bool_t fs_cluster_cowwrite(FSBITMAP *bp, const BPB *bpb, cluster_t begin, counter_t num, const byte_t *buf, cluster_t *newbegin) {
+    bool_t shared;
+    *newbegin = begin;
+    if(!fs_cluster_someshared(bp, begin, num, &shared)) return b_false;
+    if(!shared) {
+        if(bp->ref && bp->ref->fwrite) {
+            for(cluster_t clus=begin; clus<begin+num; ++clus) bp->ref->fwrite(bp->ref->ctx, clus);
+        }
+        return fs_cluster_diskwrite(bp, bpb, begin, num, buf);
+    }
+    if(!fs_cluster_getfreecluster(bp, bpb, num, newbegin)) return b_false;
+    if(!fs_cluster_diskwrite(bp, bpb, *newbegin, num, buf)) return b_false;
+    return fs_cluster_erasebitmap(bp, bpb, begin, num);
+}
+
+/*
+* FSHOLEBATCH: the ranges stay used in the bitmap until fs_cluster_holebatch_flush,
+* so that they are never reallocated before the hole is punched.
+*/
+static inline bool_t fs_cluster_holebatch_open(FSHOLEBATCH **hbp, FSBITMAP *bp) {
+    *hbp=(FSHOLEBATCH *)fs_malloc(sizeof(FSHOLEBATCH));
+    if(!*hbp) return fs_bitmap_seterror(bp, FS_BITMAP_ERROR_MEMORY_ALLOCATE_FAILURE);
+    (*hbp)->bp=bp;
+    (*hbp)->range=NULL;
+    (*hbp)->count=0;
+    (*hbp)->capacity=0;
+    return fs_bitmap_setsuccess(bp);
+}
+
+static inline bool_t fs_cluster_holebatch_close(FSHOLEBATCH *hbp, bool_t ret) {
+    return fs_free(hbp, fs_free(hbp->range, ret));
+}
+
+static inline bool_t fs_cluster_holebatch_add1(FSHOLEBATCH *hbp, const BPB *bpb, cluster_t begin, counter_t num) {
+    if(hbp->count==hbp->capacity) {
+        const fsize_t alsize=(fsize_t)(sizeof(HOLE_RANGE)*(hbp->capacity+HOLEBATCH_ALLOC_UNIT));
+        HOLE_RANGE *tmp=(HOLE_RANGE *)fs_malloc(alsize);
+        if(!tmp) return fs_bitmap_seterror(hbp->bp, FS_BITMAP_ERROR_MEMORY_ALLOCATE_FAILURE);
+        if(hbp->range) memcpy_s(tmp, alsize, hbp->range, (fsize_t)(sizeof(HOLE_RANGE)*hbp->count));
+        fs_free(hbp->range, b_true);
+        hbp->range=tmp;
+        hbp->capacity+=HOLEBATCH_ALLOC_UNIT;
+    }
+    hbp->range[hbp->count].begin=fs_cluster_getsector(bpb, begin);
+    hbp->range[hbp->count].num=num*SECTORS_PER_CLUSTER;
+    ++(hbp->count);
+    return fs_bitmap_setsuccess(hbp->bp);
+}
+
+/* with FSCLUSREF: one reference is released now, and only the runs that lost the last reference are added. */
+static inline bool_t fs_cluster_holebatch_add(FSHOLEBATCH *hbp, const BPB *bpb, cluster_t begin, counter_t num) {
+    FSCLUSREF *ref = hbp->bp->ref;
+    if(ref==NULL) return fs_cluster_holebatch_add1(hbp, bpb, begin, num);
+    cluster_t run = begin;
+    counter_t rnum = 0;
+    for(cluster_t clus=begin; clus<begin+num; ++clus) {
+        bool_t last;
+        fs_clusref_release(ref, clus, &last);
+        if(last) {
+            if(rnum==0) run = clus;
+            ++rnum;
+            if(ref->ffree) ref->ffree(ref->ctx, clus);
+        } else if(0<rnum) {
+            if(!fs_cluster_holebatch_add1(hbp, bpb, run, rnum)) return b_false;
+            rnum = 0;
+        }
+    }
+    return (0<rnum)? fs_cluster_holebatch_add1(hbp, bpb, run, rnum): fs_bitmap_setsuccess(hbp->bp);
+}
+
+static inline int fs_cluster_holebatch_cmp(const void *a, const void *b) {
+    const sector_t x=((const HOLE_RANGE *)a)->begin, y=((const HOLE_RANGE *)b)->begin;
+    return (x<y)? -1: (x>y)? 1: 0;
+}
+
+static inline bool_t fs_cluster_holebatch_flush(FSHOLEBATCH *hbp) { /* adjacent ranges are coalesced, so that more whole blocks are punched. */
+    if(hbp->count==0) return fs_bitmap_setsuccess(hbp->bp);
+    qsort(hbp->range, (size_t)hbp->count, sizeof(HOLE_RANGE), fs_cluster_holebatch_cmp);
+    index_t n=0;
+    for(index_t i=1; i<hbp->count; ++i) {
+        HOLE_RANGE *last=&hbp->range[n];
+        if(hbp->range[i].begin<=last->begin+last->num) {
+            const sector_t end=hbp->range[i].begin+hbp->range[i].num;
+            if(last->begin+last->num<end) last->num=end-last->begin;
+        } else
+            hbp->range[++n]=hbp->range[i];
+    }
+    hbp->count=n+1;
+    bool_t unsupported=b_false;
+    for(index_t i=0; i<hbp->count; ++i) {
+        if(!fs_diskwith_bitmap_erase(hbp->bp, hbp->range[i].begin, hbp->range[i].num)) return b_false;
+        if(!fs_disk_punchhole(hbp->bp->fdp, hbp->range[i].begin, hbp->range[i].num)) {
+            if(fs_disk_getstatus(hbp->bp->fdp)!=FS_DISK_ERROR_UNSUPPORTED) return fs_bitmap_seterror(hbp->bp, FS_BITMAP_ERROR_DRIVE_RW_FAILURE);
+            unsupported=b_true;
+        }
+    }
+    hbp->count=0;
+    if(!fs_cluster_trimchunk(hbp->bp)) return b_false;
+    return (unsupported)? fs_bitmap_seterror(hbp->bp, FS_BITMAP_ERROR_PUNCH_UNSUPPORTED): b_true;
+}
+
 #endif
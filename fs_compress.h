@@ -0,0 +1,370 @@
+// Copyright (c) 2020 The SorachanCoin Developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SORACHANCOIN_FS_COMPRESS
+#define SORACHANCOIN_FS_COMPRESS
+
+#include "fs_const.h"
+#include "fs_memory.h"
+#include "fs_types.h"
+#include "fs_endian.h"
+#include "fs_bpb.h"
+#include "fs_cluster.h"
+
+/*
+* ** fs_compress **
+*
+* Transparent per-cluster compression. It is selected by BPB.compress_type.
+*
+* fs_lz: built-in LZ77 codec (LZ4 block like format), one cluster is one block.
+* [token: literal(4bit) | match-4(4bit)] [literal ext] [literals] [offset LE16] [match ext] ...
+* The last sequence has literals only.
+*
+* FSCMAP: compressed cluster map, logical cluster to (physical sector, compressed bytes).
+* A compressed cluster is packed into ceil(bytes/BYTES_PER_SECTOR) sectors.
+* If it does not save a sector, it is stored raw. (bytes==BYTES_PER_CLUSTER)
+* The map itself: the cluster at BPB.cmap_offset is [CMAP][num(LE64)][area(LE64)][area clusters(LE64)],
+* and the entries [sector(LE64)][bytes(LE16)] ... are stored in the area, allocated from the bitmap.
+* When the map outgrows its area, a new area is written and the header points at it before the old one is freed.
+* Note: The cluster at BPB.cmap_offset is reserved by the caller, e.g, the first fs_cmap_diskwrite_map before any data.
+*
+* compress_none: logical cluster is physical cluster, the map is not used.
+*
+*/
+
+#define LZ_MINMATCH 4
+#define LZ_LAST_LITERALS 5
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 65535
+#define LZ_BOUND(n) ((n)+(n)/255+16)
+
+#define CMAP_SIGNATURE "CMAP"
+#define CMAP_HEADER_SIZE 28
+#define CMAP_ENTRY_SIZE 10
+#define CMAP_ALLOC_UNIT 1024
+#define CMAP_AREA_MAX ((counter_t)1<<32) /* clusters, more is broken */
+
+typedef enum _tag_cmap_status {
+    CMAP_SUCCESS = 0,
+    CMAP_ERROR_PARAM = 1,
+    CMAP_ERROR_MEMORY_ALLOCATE_FAILURE = 2,
+    CMAP_ERROR_DRIVE_RW_FAILURE = 3,
+    CMAP_ERROR_BROKEN = 4,
+} cmap_status;
+
+typedef struct _tag_CMAP_ENTRY {
+    sector_t sector;
+    uint16_t bytes; /* 0: unmapped */
+} CMAP_ENTRY;
+
+typedef struct _tag_FSCMAP {
+    CMAP_ENTRY *entry;
+    counter_t num;
+    counter_t capacity;
+    cluster_t area; /* on disk: the entries */
+    counter_t area_clusters; /* 0: no area */
+    cmap_status status;
+} FSCMAP;
+
+/*
+* fs_lz
+*/
+static inline uint32_t fs_lz_read32(const byte_t *p) {
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+static inline byte_t *fs_lz_putlength(byte_t *op, fsize_t len) {
+    for(; 255<=len; len-=255) *op++ = 255;
+    *op++ = (byte_t)len;
+    return op;
+}
+
+/* return: compressed size, 0: dst is too small. dst should be LZ_BOUND(n) bytes. */
+static inline fsize_t fs_lz_compress(const byte_t *src, fsize_t n, byte_t *dst, fsize_t dstsize) {
+    int32_t table[1<<LZ_HASH_BITS];
+    for(index_t i=0; i<(index_t)ARRAYLEN(table); ++i) table[i] = -1;
+    byte_t *op = dst;
+    const byte_t *oend = dst + dstsize;
+    fsize_t ip = 0, anchor = 0;
+    while(ip+LZ_MINMATCH+LZ_LAST_LITERALS<=n) {
+        const uint32_t seq = fs_lz_read32(src+ip);
+        const uint32_t h = (seq*2654435761u)>>(32-LZ_HASH_BITS);
+        const int32_t ref = table[h];
+        table[h] = ip;
+        if(ref<0 || LZ_MAX_OFFSET<ip-ref || fs_lz_read32(src+ref)!=seq) {++ip; continue;}
+        fsize_t len = LZ_MINMATCH;
+        while(ip+len<n-LZ_LAST_LITERALS && src[ref+len]==src[ip+len]) ++len;
+        const fsize_t lit = ip - anchor;
+        if(oend-op < 1+lit+lit/255+1+2+(len-LZ_MINMATCH)/255+1) return 0;
+        byte_t *token = op++;
+        *token = (byte_t)(((lit<15)? lit: 15)<<4);
+        if(15<=lit) op = fs_lz_putlength(op, lit-15);
+        memcpy(op, src+anchor, lit); op += lit;
+        *op++ = (byte_t)((ip-ref)&0xFF);
+        *op++ = (byte_t)((ip-ref)>>8);
+        *token |= (byte_t)((len-LZ_MINMATCH<15)? len-LZ_MINMATCH: 15);
+        if(15<=len-LZ_MINMATCH) op = fs_lz_putlength(op, len-LZ_MINMATCH-15);
+        ip += len;
+        anchor = ip;
+    }
+    const fsize_t lit = n - anchor;
+    if(oend-op < 1+lit+lit/255+1) return 0;
+    *op++ = (byte_t)(((lit<15)? lit: 15)<<4);
+    if(15<=lit) op = fs_lz_putlength(op, lit-15);
+    memcpy(op, src+anchor, lit); op += lit;
+    return (fsize_t)(op - dst);
+}
+
+/* return: decompressed size, -1: broken. */
+static inline fsize_t fs_lz_decompress(const byte_t *src, fsize_t n, byte_t *dst, fsize_t dstsize) {
+    const byte_t *ip = src, *iend = src + n;
+    byte_t *op = dst, *oend = dst + dstsize;
+    while(ip<iend) {
+        const byte_t token = *ip++;
+        fsize_t lit = token>>4;
+        if(lit==15) {
+            byte_t c;
+            do { if(iend<=ip) return -1; c = *ip++; lit += c; } while(c==255);
+        }
+        if(iend-ip<lit || oend-op<lit) return -1;
+        memcpy(op, ip, lit); op += lit; ip += lit;
+        if(ip==iend) break;
+        if(iend-ip<2) return -1;
+        const fsize_t offset = ip[0] | (ip[1]<<8);
+        ip += 2;
+        fsize_t len = (token&0x0F);
+        if(len==15) {
+            byte_t c;
+            do { if(iend<=ip) return -1; c = *ip++; len += c; } while(c==255);
+        }
+        len += LZ_MINMATCH;
+        if(offset==0 || op-dst<offset || oend-op<len) return -1;
+        const byte_t *ref = op - offset;
+        while(len--) *op++ = *ref++;
+    }
+    return (fsize_t)(op - dst);
+}
+
+/*
+* FSCMAP
+*/
+static inline bool_t fs_cmap_setsuccess(FSCMAP *cmp) {
+    cmp->status = CMAP_SUCCESS;
+    return b_true;
+}
+
+static inline bool_t fs_cmap_seterror(FSCMAP *cmp, cmap_status status) {
+    cmp->status = status;
+    return b_false;
+}
+
+static inline cmap_status fs_cmap_getstatus(FSCMAP *cmp) {
+    return cmp->status;
+}
+
+static inline bool_t fs_cmap_open(FSCMAP **cmp) {
+    *cmp = (FSCMAP *)fs_malloc(sizeof(FSCMAP));
+    if(!*cmp) return b_false;
+    (*cmp)->entry = NULL;
+    (*cmp)->num = 0;
+    (*cmp)->capacity = 0;
+    (*cmp)->area = 0;
+    (*cmp)->area_clusters = 0;
+    return fs_cmap_setsuccess(*cmp);
+}
+
+static inline bool_t fs_cmap_close(FSCMAP *cmp, bool_t ret) {
+    return fs_free(cmp, fs_free(cmp->entry, ret));
+}
+
+static inline bool_t fs_cmap_reserve(FSCMAP *cmp, counter_t num) { /* unmapped entries are added. */
+    if(num<=cmp->num) return fs_cmap_setsuccess(cmp);
+    if(cmp->capacity<num) {
+        const counter_t capacity = (num+CMAP_ALLOC_UNIT-1)/CMAP_ALLOC_UNIT*CMAP_ALLOC_UNIT;
+        const fsize_t alsize = (fsize_t)(sizeof(CMAP_ENTRY)*capacity);
+        CMAP_ENTRY *tmp = (CMAP_ENTRY *)fs_malloc(alsize);
+        if(!tmp) return fs_cmap_seterror(cmp, CMAP_ERROR_MEMORY_ALLOCATE_FAILURE);
+        if(cmp->entry) memcpy_s(tmp, alsize, cmp->entry, (fsize_t)(sizeof(CMAP_ENTRY)*cmp->num));
+        fs_free(cmp->entry, b_true);
+        cmp->entry = tmp;
+        cmp->capacity = capacity;
+    }
+    for(counter_t i=cmp->num; i<num; ++i) {
+        cmp->entry[i].sector = 0;
+        cmp->entry[i].bytes = 0;
+    }
+    cmp->num = num;
+    return fs_cmap_setsuccess(cmp);
+}
+
+static inline counter_t fs_cmap_getsectors(const CMAP_ENTRY *entry) {
+    return (entry->bytes+BYTES_PER_SECTOR-1)/BYTES_PER_SECTOR;
+}
+
+static inline bool_t fs_cmap_release(FSCMAP *cmp, FSBITMAP *bp, cluster_t logical) {
+    if(logical<0 || cmp->num<=logical || cmp->entry[logical].bytes==0) return fs_cmap_setsuccess(cmp);
+    CMAP_ENTRY *entry = &cmp->entry[logical];
+    if(!fs_diskwith_bitmap_erase(bp, entry->sector, fs_cmap_getsectors(entry))) return fs_cmap_seterror(cmp, CMAP_ERROR_DRIVE_RW_FAILURE);
+    entry->sector = 0;
+    entry->bytes = 0;
+    return fs_cmap_setsuccess(cmp);
+}
+
+/*
+* Note: The compressed clusters in one call are packed into one contiguous sector range.
+* The new range is written before the old sectors are released, so a failed write keeps the old mapping.
+*/
+static inline bool_t fs_cmap_diskwrite(FSCMAP *cmp, FSBITMAP *bp, const BPB *bpb, cluster_t logical, counter_t num, const byte_t *buf) {
+    if(logical<0 || num<=0) return fs_cmap_seterror(cmp, CMAP_ERROR_PARAM);
+    if(bpb->compress_type==compress_none)
+        return fs_cluster_diskwrite(bp, bpb, logical, num, buf)? fs_cmap_setsuccess(cmp): fs_cmap_seterror(cmp, CMAP_ERROR_DRIVE_RW_FAILURE);
+    if(!fs_cmap_reserve(cmp, logical+num)) return b_false;
+    byte_t *stage = fs_malloc((fsize_t)(num*BYTES_PER_CLUSTER));
+    if(!stage) return fs_cmap_seterror(cmp, CMAP_ERROR_MEMORY_ALLOCATE_FAILURE);
+    CMAP_ENTRY *packed = (CMAP_ENTRY *)fs_malloc((fsize_t)(num*sizeof(CMAP_ENTRY)));
+    if(!packed) return fs_free(stage, fs_cmap_seterror(cmp, CMAP_ERROR_MEMORY_ALLOCATE_FAILURE));
+    byte_t cbuf[LZ_BOUND(BYTES_PER_CLUSTER)];
+    sector_t sectors = 0;
+    for(counter_t i=0; i<num; ++i) {
+        const byte_t *src = buf+i*BYTES_PER_CLUSTER;
+        fsize_t csize = fs_lz_compress(src, BYTES_PER_CLUSTER, cbuf, sizeof(cbuf));
+        if(csize==0 || SECTORS_PER_CLUSTER<=(csize+BYTES_PER_SECTOR-1)/BYTES_PER_SECTOR) {
+            csize = BYTES_PER_CLUSTER;
+            src = buf+i*BYTES_PER_CLUSTER;
+        } else
+            src = cbuf;
+        packed[i].sector = sectors;
+        packed[i].bytes = (uint16_t)csize;
+        byte_t *dst = stage+sectors*BYTES_PER_SECTOR;
+        const counter_t sec = fs_cmap_getsectors(&packed[i]);
+        memcpy(dst, src, csize);
+        memset(dst+csize, 0x00, (size_t)(sec*BYTES_PER_SECTOR-csize));
+        sectors += sec;
+    }
+    sector_t begin;
+    if(!fs_bitmap_getmask_freesector(bp, sectors, bpb->bpb_offset, &begin)) return fs_free(packed, fs_free(stage, fs_cmap_seterror(cmp, CMAP_ERROR_DRIVE_RW_FAILURE)));
+    if(!fs_diskwith_bitmap_write(bp, begin, sectors, stage)) return fs_free(packed, fs_free(stage, fs_cmap_seterror(cmp, CMAP_ERROR_DRIVE_RW_FAILURE)));
+    for(counter_t i=0; i<num; ++i) {
+        if(!fs_cmap_release(cmp, bp, logical+i)) { /* [0, i) are new, [i, num) keep the old mapping, and the rest of the new range is given back. */
+            fs_diskwith_bitmap_erase(bp, begin+packed[i].sector, sectors-packed[i].sector);
+            return fs_free(packed, fs_free(stage, fs_cmap_seterror(cmp, CMAP_ERROR_DRIVE_RW_FAILURE)));
+        }
+        cmp->entry[logical+i].sector = begin+packed[i].sector;
+        cmp->entry[logical+i].bytes = packed[i].bytes;
+    }
+    return fs_free(packed, fs_free(stage, fs_cmap_setsuccess(cmp)));
+}
+
+/* Note: Physically contiguous clusters are read by one request. Unmapped cluster is zero. */
+static inline bool_t fs_cmap_diskread(FSCMAP *cmp, FSBITMAP *bp, const BPB *bpb, cluster_t logical, counter_t num, byte_t *buf) {
+    if(logical<0 || num<=0) return fs_cmap_seterror(cmp, CMAP_ERROR_PARAM);
+    if(bpb->compress_type==compress_none)
+        return fs_cluster_diskread(bp, bpb, logical, num, buf)? fs_cmap_setsuccess(cmp): fs_cmap_seterror(cmp, CMAP_ERROR_DRIVE_RW_FAILURE);
+    byte_t *stage = fs_malloc((fsize_t)(num*BYTES_PER_CLUSTER));
+    if(!stage) return fs_cmap_seterror(cmp, CMAP_ERROR_MEMORY_ALLOCATE_FAILURE);
+    for(counter_t i=0; i<num;) {
+        const cluster_t clus = logical+i;
+        if(cmp->num<=clus || cmp->entry[clus].bytes==0) {
+            memset(buf+i*BYTES_PER_CLUSTER, 0x00, BYTES_PER_CLUSTER);
+            ++i;
+            continue;
+        }
+        const sector_t begin = cmp->entry[clus].sector;
+        counter_t sectors = fs_cmap_getsectors(&cmp->entry[clus]);
+        counter_t n = 1;
+        while(i+n<num && clus+n<cmp->num && cmp->entry[clus+n].bytes!=0 && cmp->entry[clus+n].sector==begin+sectors)
+            sectors += fs_cmap_getsectors(&cmp->entry[clus+n++]);
+        if(!fs_diskwith_bitmap_read(bp, begin, sectors, stage)) return fs_free(stage, fs_cmap_seterror(cmp, CMAP_ERROR_DRIVE_RW_FAILURE));
+        for(counter_t k=0; k<n; ++k) {
+            const CMAP_ENTRY *entry = &cmp->entry[clus+k];
+            const byte_t *src = stage+(entry->sector-begin)*BYTES_PER_SECTOR;
+            byte_t *dst = buf+(i+k)*BYTES_PER_CLUSTER;
+            if(entry->bytes==BYTES_PER_CLUSTER) memcpy(dst, src, BYTES_PER_CLUSTER);
+            else if(fs_lz_decompress(src, entry->bytes, dst, BYTES_PER_CLUSTER)!=BYTES_PER_CLUSTER) return fs_free(stage, fs_cmap_seterror(cmp, CMAP_ERROR_BROKEN));
+        }
+        i += n;
+    }
+    return fs_free(stage, fs_cmap_setsuccess(cmp));
+}
+
+/*
+* map: the header at BPB.cmap_offset, and the entries in fs_cmap_getdiskclusters(cmp) clusters of the area.
+*/
+static inline counter_t fs_cmap_getareaclusters(counter_t num) {
+    return (num*CMAP_ENTRY_SIZE+BYTES_PER_CLUSTER-1)/BYTES_PER_CLUSTER;
+}
+
+static inline counter_t fs_cmap_getdiskclusters(const FSCMAP *cmp) {
+    return fs_cmap_getareaclusters(cmp->num);
+}
+
+static inline bool_t fs_cmap_diskwrite_map(FSCMAP *cmp, FSBITMAP *bp, const BPB *bpb) {
+    const counter_t clus = fs_cmap_getdiskclusters(cmp);
+    cluster_t area = cmp->area;
+    counter_t area_clusters = cmp->area_clusters;
+    if(area_clusters<clus) { /* grown: a new area */
+        if(!fs_cluster_getfreecluster(bp, bpb, clus, &area)) return fs_cmap_seterror(cmp, CMAP_ERROR_DRIVE_RW_FAILURE);
+        area_clusters = clus;
+    }
+    const fsize_t bufsize = (fsize_t)((area_clusters+1)*BYTES_PER_CLUSTER);
+    byte_t *buf = fs_malloc(bufsize);
+    if(!buf) return fs_cmap_seterror(cmp, CMAP_ERROR_MEMORY_ALLOCATE_FAILURE);
+    memset(buf, 0x00, bufsize);
+    byte_t *p = buf+BYTES_PER_CLUSTER;
+    for(counter_t i=0; i<cmp->num; ++i, p+=CMAP_ENTRY_SIZE) {
+        WriteLE64(p, (uint64_t)cmp->entry[i].sector);
+        WriteLE16(p+8, cmp->entry[i].bytes);
+    }
+    if(0<area_clusters && !fs_cluster_diskwrite(bp, bpb, area, area_clusters, buf+BYTES_PER_CLUSTER)) {
+        if(area!=cmp->area) fs_cluster_erasebitmap(bp, bpb, area, area_clusters);
+        return fs_free(buf, fs_cmap_seterror(cmp, CMAP_ERROR_DRIVE_RW_FAILURE));
+    }
+    memcpy(buf, CMAP_SIGNATURE, 4);
+    WriteLE64(buf+4, (uint64_t)cmp->num);
+    WriteLE64(buf+12, (uint64_t)area);
+    WriteLE64(buf+20, (uint64_t)area_clusters);
+    if(!fs_cluster_diskwrite(bp, bpb, bpb->cmap_offset, 1, buf)) {
+        if(area!=cmp->area) fs_cluster_erasebitmap(bp, bpb, area, area_clusters);
+        return fs_free(buf, fs_cmap_seterror(cmp, CMAP_ERROR_DRIVE_RW_FAILURE));
+    }
+    if(area!=cmp->area && 0<cmp->area_clusters && !fs_cluster_erasebitmap(bp, bpb, cmp->area, cmp->area_clusters)) { /* the header points at the new one. */
+        cmp->area = area;
+        cmp->area_clusters = area_clusters;
+        return fs_free(buf, fs_cmap_seterror(cmp, CMAP_ERROR_DRIVE_RW_FAILURE));
+    }
+    cmp->area = area;
+    cmp->area_clusters = area_clusters;
+    return fs_free(buf, fs_cmap_setsuccess(cmp));
+}
+
+static inline bool_t fs_cmap_diskread_map(FSCMAP *cmp, FSBITMAP *bp, const BPB *bpb) {
+    byte_t head[BYTES_PER_CLUSTER];
+    if(!fs_cluster_diskread(bp, bpb, bpb->cmap_offset, 1, head)) return fs_cmap_seterror(cmp, CMAP_ERROR_DRIVE_RW_FAILURE);
+    if(memcmp(head, CMAP_SIGNATURE, 4)!=0) return fs_cmap_seterror(cmp, CMAP_ERROR_BROKEN);
+    const counter_t num = (counter_t)ReadLE64(head+4);
+    const cluster_t area = (cluster_t)ReadLE64(head+12);
+    const counter_t area_clusters = (counter_t)ReadLE64(head+20);
+    if(num<0 || area<0 || area_clusters<0 || CMAP_AREA_MAX<area_clusters) return fs_cmap_seterror(cmp, CMAP_ERROR_BROKEN);
+    if(area_clusters*BYTES_PER_CLUSTER/CMAP_ENTRY_SIZE<num) return fs_cmap_seterror(cmp, CMAP_ERROR_BROKEN); /* more entries than the area has */
+    cmp->num = 0;
+    if(!fs_cmap_reserve(cmp, num)) return b_false;
+    cmp->area = area;
+    cmp->area_clusters = area_clusters;
+    const counter_t clus = fs_cmap_getdiskclusters(cmp);
+    if(clus==0) return fs_cmap_setsuccess(cmp);
+    byte_t *buf = fs_malloc((fsize_t)(clus*BYTES_PER_CLUSTER));
+    if(!buf) return fs_cmap_seterror(cmp, CMAP_ERROR_MEMORY_ALLOCATE_FAILURE);
+    if(!fs_cluster_diskread(bp, bpb, area, clus, buf)) return fs_free(buf, fs_cmap_seterror(cmp, CMAP_ERROR_DRIVE_RW_FAILURE));
+    const byte_t *p = buf;
+    for(counter_t i=0; i<num; ++i, p+=CMAP_ENTRY_SIZE) {
+        cmp->entry[i].sector = (sector_t)ReadLE64(p);
+        cmp->entry[i].bytes = ReadLE16(p+8);
+        if(BYTES_PER_CLUSTER<cmp->entry[i].bytes) return fs_free(buf, fs_cmap_seterror(cmp, CMAP_ERROR_BROKEN));
+    }
+    return fs_free(buf, fs_cmap_setsuccess(cmp));
+}
+
+#endif
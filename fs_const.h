@@ -8,11 +8,11 @@
 #ifndef __STDC_WAIT_LIB_EXT1__
 # define __STDC_WAIT_LIB_EXT1__ 1
 #endif
+#include "fs_types.h" /* first: _GNU_SOURCE */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
-#include "fs_types.h"
 
 /*
 ** Note: Must NOT change values below.
@@ -0,0 +1,133 @@
+// Copyright (c) 2020 The SorachanCoin Developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SORACHANCOIN_FS_CPU
+#define SORACHANCOIN_FS_CPU
+
+#include "fs_types.h"
+#include "fs_thread.h"
+
+/*
+* ** fs_cpu **
+*
+* CPU features at runtime, detected once. (CPUID and XGETBV on x86, HWCAP on ARMv8)
+* fs_cpu_init at startup, before the threads. (fs_cpu_has detects them too if not, and stores them atomically)
+* The SIMD kernels are compiled with FS_TARGET, so the build needs no -m options,
+* and they are called only when fs_cpu_has says so.
+*
+* fs_cpu_prefetch: a hint to load the cache line of an address that is used soon. (no fault on any address)
+*
+*/
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+# define FS_CPU_X86
+#elif defined(__aarch64__) || defined(_M_ARM64)
+# define FS_CPU_ARM64
+#endif
+
+#if defined(COMPILER_GNU) || defined(COMPILER_CLANG)
+# define FS_TARGET(X) __attribute__((target(X)))
+#else
+# define FS_TARGET(X)
+#endif
+
+#if defined(FS_CPU_X86)
+# if defined(COMPILER_MSC) || defined(COMPILER_INTEL)
+#  include <intrin.h>
+# else
+#  include <cpuid.h>
+# endif
+#elif defined(FS_CPU_ARM64) && defined(__linux__)
+# include <sys/auxv.h>
+# include <asm/hwcap.h>
+#endif
+
+typedef enum _tag_cpu_feature {
+    CPU_SSSE3 = 1<<0,
+    CPU_SSE41 = 1<<1,
+    CPU_AVX = 1<<2,
+    CPU_AVX2 = 1<<3,
+    CPU_AVX512F = 1<<4,
+    CPU_SHANI = 1<<5,
+    CPU_ARMV8_SHA2 = 1<<6,
+    CPU_DETECTED = 1<<30,
+} cpu_feature;
+
+#if defined(FS_CPU_X86)
+static inline void fs_cpu_cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d) {
+# if defined(COMPILER_MSC) || defined(COMPILER_INTEL)
+    int info[4];
+    __cpuidex(info, (int)leaf, (int)subleaf);
+    *a = (uint32_t)info[0]; *b = (uint32_t)info[1]; *c = (uint32_t)info[2]; *d = (uint32_t)info[3];
+# else
+    __cpuid_count(leaf, subleaf, *a, *b, *c, *d);
+# endif
+}
+
+static inline uint64_t fs_cpu_xgetbv() { /* the register states saved by OS */
+# if defined(COMPILER_MSC) || defined(COMPILER_INTEL)
+    return (uint64_t)_xgetbv(0);
+# else
+    uint32_t a, d;
+    __asm__ volatile("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return ((uint64_t)d<<32)|a;
+# endif
+}
+#endif
+
+static inline uint32_t fs_cpu_detect() {
+    uint32_t features = CPU_DETECTED;
+#if defined(FS_CPU_X86)
+    uint32_t a, b, c, d;
+    fs_cpu_cpuid(0, 0, &a, &b, &c, &d);
+    const uint32_t maxleaf = a;
+    if(maxleaf<1) return features;
+    fs_cpu_cpuid(1, 0, &a, &b, &c, &d);
+    if(c&(1<<9)) features |= CPU_SSSE3;
+    if(c&(1<<19)) features |= CPU_SSE41;
+    const bool_t osxsave = (c&(1<<27)) && (c&(1<<28)); /* OSXSAVE and AVX */
+    const uint64_t xcr0 = (osxsave)? fs_cpu_xgetbv(): 0;
+    if(osxsave && (xcr0&0x06)==0x06) features |= CPU_AVX;
+    if(7<=maxleaf) {
+        fs_cpu_cpuid(7, 0, &a, &b, &c, &d);
+        if((features&CPU_AVX) && (b&(1<<5))) features |= CPU_AVX2;
+        if((features&CPU_AVX) && (b&(1<<16)) && (xcr0&0xE0)==0xE0) features |= CPU_AVX512F;
+        if((features&CPU_SSE41) && (features&CPU_SSSE3) && (b&(1<<29))) features |= CPU_SHANI;
+    }
+#elif defined(FS_CPU_ARM64)
+# if defined(__linux__) && defined(HWCAP_SHA2)
+    if(getauxval(AT_HWCAP)&HWCAP_SHA2) features |= CPU_ARMV8_SHA2;
+# elif defined(__APPLE__)
+    features |= CPU_ARMV8_SHA2; /* every Apple arm64 has it. */
+# elif defined(WIN32)
+    if(IsProcessorFeaturePresent(PF_ARM_V8_CRYPTO_INSTRUCTIONS_AVAILABLE)) features |= CPU_ARMV8_SHA2;
+# endif
+#endif
+    return features;
+}
+
+FS_SHARED volatile counter_t fs_cpu_features = 0; /* 0: not detected yet, CPU_DETECTED after */
+
+static inline void fs_cpu_init() {
+    if(fs_atomic_load(&fs_cpu_features)==0) fs_atomic_store(&fs_cpu_features, (counter_t)fs_cpu_detect());
+}
+
+static inline bool_t fs_cpu_has(cpu_feature feature) {
+    fs_cpu_init();
+    return (fs_atomic_load(&fs_cpu_features)&feature)!=0;
+}
+
+static inline void fs_cpu_prefetch(const void *ptr) {
+#if defined(COMPILER_MSC) || defined(COMPILER_INTEL)
+# if defined(FS_CPU_X86)
+    _mm_prefetch((const char *)ptr, _MM_HINT_T0);
+# else
+    (void)ptr;
+# endif
+#else
+    __builtin_prefetch(ptr);
+#endif
+}
+
+#endif
@@ -12,12 +12,18 @@
 * 
 * There are lshift(like <<) and rshift(like >>). 
 * 
+* slot: (the records of the same size) lstore returns the index of the record, and release gives it back.
+* The released indices are used again by lstore before the stream grows.
+* 
 */
 
 #include <stdlib.h>
 #include "fs_memory.h"
 #include "fs_fragment_vector.h"
 
+#define DATASTREAM_FREE_ALLOC_UNIT 256
+#define DATASTREAM_DATA_SIZE ((fsize_t)sizeof(((VECTOR_DATA *)NULL)->data)) /* fsize_t: compared with the signed size */
+
 typedef enum _tag_datastream_status {
     DATASTREAM_SUCCESS = 0,
     DATASTREAM_ERROR_MEMORY_ALLOCATE_FAILURE = 1,
@@ -27,6 +33,9 @@ typedef struct _tag_FSDATASTREAM {
     FSFRAGVECTOR *vch;
     fsize_t current_size;
     index_t dest_index;
+    index_t *free_index; /* the released slots */
+    index_t free_num;
+    index_t free_capacity;
     datastream_status status;
 } FSDATASTREAM;
 
@@ -51,6 +60,9 @@ static inline bool_t fs_datastream_open(FSDATASTREAM **dsp) {
     if(!fs_fragvector_open(&(*dsp)->vch, 0, sizeof(VECTOR_DATA))) return fs_free(*dsp, fs_datastream_seterror(*dsp, DATASTREAM_ERROR_MEMORY_ALLOCATE_FAILURE));
     (*dsp)->current_size=0;
     (*dsp)->dest_index=0;
+    (*dsp)->free_index=NULL;
+    (*dsp)->free_num=0;
+    (*dsp)->free_capacity=0;
     return fs_datastream_setsuccess(*dsp);
 }
 
@@ -59,7 +71,7 @@ static inline bool_t fs_datastream_lshift(FSDATASTREAM *dsp, const byte_t *data,
     while(size>0){
         VECTOR_DATA *vch;
         if(!fs_fragvector_insert2(dsp->vch, &vch)) return fs_datastream_seterror(dsp, DATASTREAM_ERROR_MEMORY_ALLOCATE_FAILURE);
-        fsize_t cpsize=(size>sizeof(vch->data))? sizeof(vch->data): size;
+        fsize_t cpsize=(size>DATASTREAM_DATA_SIZE)? DATASTREAM_DATA_SIZE: size;
         memcpy(vch->data, data, cpsize);
         size-=cpsize;
         data+=cpsize;
@@ -68,11 +80,52 @@ static inline bool_t fs_datastream_lshift(FSDATASTREAM *dsp, const byte_t *data,
     return fs_datastream_setsuccess(dsp);
 }
 
+/* the slots of size: index is the first VECTOR_DATA of the record, a released one if any. */
+static inline bool_t fs_datastream_lstore(FSDATASTREAM *dsp, const byte_t *data, fsize_t size, index_t *index) {
+    if(dsp->free_num==0) {
+        *index=fs_fragvector_getsize(dsp->vch);
+        return fs_datastream_lshift(dsp, data, size);
+    }
+    *index=dsp->free_index[--(dsp->free_num)];
+    dsp->current_size+=size;
+    for(index_t i=*index; 0<size; ++i) {
+        fsize_t cpsize=(size>DATASTREAM_DATA_SIZE)? DATASTREAM_DATA_SIZE: size;
+        memcpy(fs_fragvector_getdata(dsp->vch, i)->data, data, cpsize);
+        size-=cpsize;
+        data+=cpsize;
+    }
+    return fs_datastream_setsuccess(dsp);
+}
+
+/* the slot of lstore is given back. */
+static inline bool_t fs_datastream_release(FSDATASTREAM *dsp, index_t index) {
+    if(dsp->free_num==dsp->free_capacity) {
+        const index_t capacity=dsp->free_capacity+DATASTREAM_FREE_ALLOC_UNIT;
+        index_t *tmp=(index_t *)fs_malloc((fsize_t)(sizeof(index_t)*capacity));
+        if(!tmp) return fs_datastream_seterror(dsp, DATASTREAM_ERROR_MEMORY_ALLOCATE_FAILURE);
+        if(dsp->free_index) memcpy(tmp, dsp->free_index, sizeof(index_t)*dsp->free_num);
+        fs_free(dsp->free_index, b_true);
+        dsp->free_index=tmp;
+        dsp->free_capacity=capacity;
+    }
+    dsp->free_index[dsp->free_num++]=index;
+    return fs_datastream_setsuccess(dsp);
+}
+
+static inline index_t fs_datastream_getfree(const FSDATASTREAM *dsp) {
+    return dsp->free_num;
+}
+
+/* the VECTOR_DATA slots of a record of size (lstore) */
+static inline index_t fs_datastream_getslots(fsize_t size) {
+    return (index_t)((size+DATASTREAM_DATA_SIZE-1)/DATASTREAM_DATA_SIZE);
+}
+
 static inline bool_t fs_datastream_rstream(FSDATASTREAM *dsp, SRND **srnd, fsize_t size, index_t *index) {
     if(!index) index=&dsp->dest_index;
     *srnd=(SRND *)fs_malloc(sizeof(SRND));
     if(!*srnd) return fs_datastream_seterror(dsp, DATASTREAM_ERROR_MEMORY_ALLOCATE_FAILURE);
-    if(size<=sizeof(((VECTOR_DATA *)NULL)->data)) {
+    if(size<=DATASTREAM_DATA_SIZE) {
         (*srnd)->size=size;
         (*srnd)->dest=(byte_t *)fs_fragvector_getdata(dsp->vch, (*index)++)+sizeof(byte_t)*offsetof(VECTOR_DATA,data);
         dsp->current_size-=size;
@@ -80,10 +133,14 @@ static inline bool_t fs_datastream_rstream(FSDATASTREAM *dsp, SRND **srnd, fsize
     } else {
         (*srnd)->size=size;
         (*srnd)->dest=(byte_t *)fs_malloc(size);
-        if(!(*srnd)->dest) return fs_datastream_seterror(dsp, DATASTREAM_ERROR_MEMORY_ALLOCATE_FAILURE);
+        if(!(*srnd)->dest) {
+            fs_free(*srnd, b_true);
+            *srnd=NULL;
+            return fs_datastream_seterror(dsp, DATASTREAM_ERROR_MEMORY_ALLOCATE_FAILURE);
+        }
         byte_t *buf=(*srnd)->dest;
         while(size>0) {
-            fsize_t cpsize=(size>sizeof(((VECTOR_DATA *)NULL)->data))? sizeof(((VECTOR_DATA *)NULL)->data): size;
+            fsize_t cpsize=(size>DATASTREAM_DATA_SIZE)? DATASTREAM_DATA_SIZE: size;
             memcpy(buf, fs_fragvector_getdata(dsp->vch, (*index)++), cpsize);
             size-=cpsize;
             buf+=cpsize;
@@ -112,11 +169,20 @@ static inline byte_t *fs_datastream_getdata(SRND *srnd) {
 }
 
 static inline bool_t fs_datastream_free(SRND *srnd, bool_t ret) {
-    return (srnd->size<=sizeof(((VECTOR_DATA *)NULL)->data))? ret: fs_free(srnd->dest,ret);
+    if(DATASTREAM_DATA_SIZE<srnd->size) fs_free(srnd->dest, b_true);
+    return fs_free(srnd, ret);
+}
+
+static inline bool_t fs_datastream_clear(FSDATASTREAM *dsp) {
+    fs_fragvector_clear(dsp->vch);
+    dsp->current_size=0;
+    dsp->dest_index=0;
+    dsp->free_num=0;
+    return fs_datastream_setsuccess(dsp);
 }
 
 static inline bool_t fs_datastream_close(FSDATASTREAM *dsp, bool_t ret) {
-    return fs_free(dsp, fs_fragvector_close(dsp->vch, ret));
+    return fs_free(dsp, fs_free(dsp->free_index, fs_fragvector_close(dsp->vch, ret)));
 }
 
 #endif
@@ -0,0 +1,329 @@
+// Copyright (c) 2020 The SorachanCoin Developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SORACHANCOIN_FS_DEDUP
+#define SORACHANCOIN_FS_DEDUP
+
+#include "fs_const.h"
+#include "fs_memory.h"
+#include "fs_types.h"
+#include "fs_endian.h"
+#include "fs_sha256.h"
+#include "fs_cluster.h"
+#include "fs_clusref.h"
+#include "fs_extent.h"
+
+/*
+* ** fs_dedup **
+*
+* Content-addressed cluster deduplication.
+*
+* digest index: SHA256 of the cluster (fixed 32 bytes key) to physical cluster.
+* fs_dedup_diskwrite: a cluster whose content is already stored refers to that cluster. (fs_clusref + 1)
+* Only new contents are written, the physical runs are appended to FSEXTENT.
+*
+* fs_dedup_open attaches fs_clusref to FSBITMAP, so fs_cluster_erasebitmap decrements the count,
+* and the digest is removed from the index when the cluster is really freed,
+* or when fs_cluster_cowwrite overwrites it in place. (the new content is not indexed)
+*
+* Note: The index and the counts are on memory. At mount, fs_dedup_mount rebuilds them from the objects,
+* right after fs_dedup_open. (otherwise fs_cluster_erasebitmap frees the shared clusters)
+*
+*/
+
+#define DEDUP_HASH_SIZE 32
+#define DEDUP_EMPTY -1
+#define DEDUP_DELETED -2
+#define DEDUP_FIRST_SIZE 4096
+#define DEDUP_MOUNT_CHUNK 64
+
+typedef enum _tag_dedup_status {
+    DEDUP_SUCCESS = 0,
+    DEDUP_ERROR_PARAM = 1,
+    DEDUP_ERROR_MEMORY_ALLOCATE_FAILURE = 2,
+    DEDUP_ERROR_DRIVE_RW_FAILURE = 3,
+} dedup_status;
+
+typedef struct _tag_DEDUP_ENTRY {
+    byte_t digest[DEDUP_HASH_SIZE];
+    cluster_t clus;
+} DEDUP_ENTRY;
+
+typedef struct _tag_DEDUP_TABLE {
+    DEDUP_ENTRY *entry;
+    counter_t size; /* power of 2 */
+    counter_t used; /* include DEDUP_DELETED */
+    counter_t count;
+} DEDUP_TABLE;
+
+typedef struct _tag_FSDEDUP {
+    FSBITMAP *bp;
+    FSCLUSREF *ref;
+    DEDUP_TABLE index;   /* key: digest */
+    DEDUP_TABLE reverse; /* key: clus */
+    counter_t hit;
+    dedup_status status;
+} FSDEDUP;
+
+static inline bool_t fs_dedup_setsuccess(FSDEDUP *dp) {
+    dp->status = DEDUP_SUCCESS;
+    return b_true;
+}
+
+static inline bool_t fs_dedup_seterror(FSDEDUP *dp, dedup_status status) {
+    dp->status = status;
+    return b_false;
+}
+
+static inline dedup_status fs_dedup_getstatus(FSDEDUP *dp) {
+    return dp->status;
+}
+
+/*
+* DEDUP_TABLE: open addressing. bydigest: key is digest, or key is clus.
+*/
+static inline counter_t fs_dedup_hash(const DEDUP_ENTRY *entry, bool_t bydigest, counter_t size) {
+    const uint64_t key = (bydigest)? ReadLE64(entry->digest): (uint64_t)entry->clus*0x9E3779B97F4A7C15ull;
+    return (counter_t)(key>>32)&(size-1);
+}
+
+static inline bool_t fs_dedup_keyequ(const DEDUP_ENTRY *a, const DEDUP_ENTRY *b, bool_t bydigest) {
+    return (bydigest)? memcmp(a->digest, b->digest, DEDUP_HASH_SIZE)==0: a->clus==b->clus;
+}
+
+static inline bool_t fs_dedup_table_alloc(DEDUP_TABLE *tp, counter_t size, bool_t bydigest) {
+    DEDUP_ENTRY *entry = (DEDUP_ENTRY *)fs_malloc((fsize_t)(sizeof(DEDUP_ENTRY)*size));
+    if(!entry) return b_false;
+    for(counter_t i=0; i<size; ++i) entry[i].clus = DEDUP_EMPTY;
+    DEDUP_ENTRY *old = tp->entry;
+    const counter_t oldsize = tp->size;
+    tp->entry = entry;
+    tp->size = size;
+    tp->used = tp->count = 0;
+    for(counter_t i=0; i<oldsize; ++i) {
+        if(old[i].clus<0) continue;
+        counter_t h = fs_dedup_hash(&old[i], bydigest, size);
+        while(entry[h].clus!=DEDUP_EMPTY) h = (h+1)&(size-1);
+        entry[h] = old[i];
+        ++(tp->used);
+        ++(tp->count);
+    }
+    fs_free(old, b_true);
+    return b_true;
+}
+
+static inline DEDUP_ENTRY *fs_dedup_table_find(DEDUP_TABLE *tp, const DEDUP_ENTRY *key, bool_t bydigest) {
+    for(counter_t h=fs_dedup_hash(key, bydigest, tp->size);; h=(h+1)&(tp->size-1)) {
+        if(tp->entry[h].clus==DEDUP_EMPTY) return NULL;
+        if(0<=tp->entry[h].clus && fs_dedup_keyequ(&tp->entry[h], key, bydigest)) return &tp->entry[h];
+    }
+}
+
+static inline bool_t fs_dedup_table_insert(DEDUP_TABLE *tp, const DEDUP_ENTRY *value, bool_t bydigest) { /* Note: key must not exist. */
+    if(tp->size<=(tp->used+1)*2 && !fs_dedup_table_alloc(tp, (tp->size<=tp->count*4)? tp->size*2: tp->size, bydigest)) return b_false;
+    counter_t h = fs_dedup_hash(value, bydigest, tp->size);
+    while(0<=tp->entry[h].clus) h = (h+1)&(tp->size-1);
+    if(tp->entry[h].clus==DEDUP_EMPTY) ++(tp->used);
+    tp->entry[h] = *value;
+    ++(tp->count);
+    return b_true;
+}
+
+static inline void fs_dedup_table_clear(DEDUP_TABLE *tp) { /* no allocation, never fails. */
+    for(counter_t i=0; i<tp->size; ++i) tp->entry[i].clus = DEDUP_EMPTY;
+    tp->used = tp->count = 0;
+}
+
+static inline void fs_dedup_table_delete(DEDUP_TABLE *tp, DEDUP_ENTRY *entry) {
+    entry->clus = DEDUP_DELETED;
+    --(tp->count);
+}
+
+/* ffree and fwrite of fs_clusref: the cluster lost the last reference, or its content is overwritten in place. */
+static inline void fs_dedup_onfree(void *ctx, cluster_t clus) {
+    FSDEDUP *dp = (FSDEDUP *)ctx;
+    DEDUP_ENTRY key;
+    key.clus = clus;
+    DEDUP_ENTRY *rev = fs_dedup_table_find(&dp->reverse, &key, b_false);
+    if(!rev) return;
+    DEDUP_ENTRY *ent = fs_dedup_table_find(&dp->index, rev, b_true);
+    if(ent && ent->clus==clus) fs_dedup_table_delete(&dp->index, ent);
+    fs_dedup_table_delete(&dp->reverse, rev);
+}
+
+static inline bool_t fs_dedup_open(FSDEDUP **dp, FSBITMAP *bp) {
+    *dp = (FSDEDUP *)fs_malloc(sizeof(FSDEDUP));
+    if(!*dp) return b_false;
+    (*dp)->bp = bp;
+    (*dp)->hit = 0;
+    (*dp)->index.entry = (*dp)->reverse.entry = NULL;
+    (*dp)->index.size = (*dp)->reverse.size = 0;
+    if(!fs_clusref_open(&(*dp)->ref)) return fs_free(*dp, b_false);
+    if(!fs_dedup_table_alloc(&(*dp)->index, DEDUP_FIRST_SIZE, b_true)) return fs_free(*dp, fs_clusref_close((*dp)->ref, b_false));
+    if(!fs_dedup_table_alloc(&(*dp)->reverse, DEDUP_FIRST_SIZE, b_false)) return fs_free(*dp, fs_free((*dp)->index.entry, fs_clusref_close((*dp)->ref, b_false)));
+    fs_clusref_setfunc((*dp)->ref, fs_dedup_onfree, fs_dedup_onfree, *dp);
+    fs_cluster_setref(bp, (*dp)->ref);
+    return fs_dedup_setsuccess(*dp);
+}
+
+static inline bool_t fs_dedup_close(FSDEDUP *dp, bool_t ret) {
+    if(dp->bp->ref==dp->ref) fs_cluster_setref(dp->bp, NULL);
+    return fs_free(dp, fs_free(dp->reverse.entry, fs_free(dp->index.entry, fs_clusref_close(dp->ref, ret))));
+}
+
+static inline counter_t fs_dedup_gethit(FSDEDUP *dp) { /* clusters that were not written */
+    return dp->hit;
+}
+
+static inline bool_t fs_dedup_lookup(FSDEDUP *dp, const byte_t *digest, cluster_t *clus) {
+    DEDUP_ENTRY key;
+    memcpy(key.digest, digest, DEDUP_HASH_SIZE);
+    const DEDUP_ENTRY *ent = fs_dedup_table_find(&dp->index, &key, b_true);
+    *clus = (ent)? ent->clus: -1;
+    return ent!=NULL;
+}
+
+static inline bool_t fs_dedup_register(FSDEDUP *dp, const byte_t *digest, cluster_t clus) {
+    DEDUP_ENTRY value;
+    memcpy(value.digest, digest, DEDUP_HASH_SIZE);
+    value.clus = clus;
+    if(!fs_dedup_table_insert(&dp->index, &value, b_true)) return fs_dedup_seterror(dp, DEDUP_ERROR_MEMORY_ALLOCATE_FAILURE);
+    if(!fs_dedup_table_insert(&dp->reverse, &value, b_false)) return fs_dedup_seterror(dp, DEDUP_ERROR_MEMORY_ALLOCATE_FAILURE);
+    return fs_dedup_setsuccess(dp);
+}
+
+/* the failed fs_dedup_register is undone, the entries that are there. */
+static inline void fs_dedup_unregister(FSDEDUP *dp, const byte_t *digest, cluster_t clus) {
+    DEDUP_ENTRY key;
+    memcpy(key.digest, digest, DEDUP_HASH_SIZE);
+    key.clus = clus;
+    DEDUP_ENTRY *ent = fs_dedup_table_find(&dp->index, &key, b_true);
+    if(ent && ent->clus==clus) fs_dedup_table_delete(&dp->index, ent);
+    DEDUP_ENTRY *rev = fs_dedup_table_find(&dp->reverse, &key, b_false);
+    if(rev) fs_dedup_table_delete(&dp->reverse, rev);
+}
+
+/*
+* Write num clusters of buf as an object: the physical runs are appended to fep.
+* The new contents are written to one contiguous free range first, and then they are registered
+* and the stored contents get one more reference. If it fails partway, the index, the counts and the range are rolled back.
+*/
+static inline bool_t fs_dedup_diskwrite(FSDEDUP *dp, const BPB *bpb, const byte_t *buf, counter_t num, FSEXTENT *fep) {
+    if(num<=0) return fs_dedup_seterror(dp, DEDUP_ERROR_PARAM);
+    FSBITMAP *bp = dp->bp;
+    if(!fs_extent_reserve(fep, fep->num+(index_t)num)) return fs_dedup_seterror(dp, DEDUP_ERROR_MEMORY_ALLOCATE_FAILURE); /* the appends never fail. */
+    byte_t *digest = fs_malloc((fsize_t)(num*DEDUP_HASH_SIZE));
+    if(!digest) return fs_dedup_seterror(dp, DEDUP_ERROR_MEMORY_ALLOCATE_FAILURE);
+    cluster_t *phys = (cluster_t *)fs_malloc((fsize_t)(num*(sizeof(cluster_t)+sizeof(bool_t))));
+    if(!phys) return fs_free(digest, fs_dedup_seterror(dp, DEDUP_ERROR_MEMORY_ALLOCATE_FAILURE));
+    bool_t *fresh = (bool_t *)(phys+num); /* a new content, written and registered by this call */
+    byte_t *stage = fs_malloc((fsize_t)(num*BYTES_PER_CLUSTER));
+    if(!stage) return fs_free(phys, fs_free(digest, fs_dedup_seterror(dp, DEDUP_ERROR_MEMORY_ALLOCATE_FAILURE)));
+    DEDUP_TABLE batch; /* the new contents of this call, so that the same content is written once. */
+    counter_t bsize = 16;
+    while(bsize<=(num+1)*2) bsize <<= 1;
+    batch.entry = NULL;
+    batch.size = 0;
+    if(!fs_dedup_table_alloc(&batch, bsize, b_true)) return fs_free(stage, fs_free(phys, fs_free(digest, fs_dedup_seterror(dp, DEDUP_ERROR_MEMORY_ALLOCATE_FAILURE))));
+    fs_sha256_digest_array(buf, (index_t)num, BYTES_PER_CLUSTER, digest);
+    cluster_t begin;
+    if(!fs_cluster_getfreecluster(bp, bpb, num, &begin)) return fs_free(batch.entry, fs_free(stage, fs_free(phys, fs_free(digest, fs_dedup_seterror(dp, DEDUP_ERROR_DRIVE_RW_FAILURE)))));
+    counter_t unique = 0;
+    bool_t ret = b_true;
+    for(counter_t i=0; i<num && ret; ++i) {
+        DEDUP_ENTRY value;
+        fresh[i] = b_false;
+        if(fs_dedup_lookup(dp, digest+i*DEDUP_HASH_SIZE, &phys[i])) continue;
+        memcpy(value.digest, digest+i*DEDUP_HASH_SIZE, DEDUP_HASH_SIZE);
+        const DEDUP_ENTRY *ent = fs_dedup_table_find(&batch, &value, b_true);
+        if(ent) {phys[i] = ent->clus; continue;}
+        value.clus = phys[i] = begin+unique;
+        fresh[i] = b_true;
+        memcpy(stage+unique*BYTES_PER_CLUSTER, buf+i*BYTES_PER_CLUSTER, BYTES_PER_CLUSTER);
+        ++unique;
+        if(!fs_dedup_table_insert(&batch, &value, b_true)) ret = fs_dedup_seterror(dp, DEDUP_ERROR_MEMORY_ALLOCATE_FAILURE);
+    }
+    const bool_t written = ret && 0<unique;
+    if(written && !fs_cluster_diskwrite(bp, bpb, begin, unique, stage)) ret = fs_dedup_seterror(dp, DEDUP_ERROR_DRIVE_RW_FAILURE);
+    counter_t done = 0;
+    while(ret && done<num) {
+        if(fresh[done]) ret = fs_dedup_register(dp, digest+done*DEDUP_HASH_SIZE, phys[done]);
+        else if(!fs_clusref_addref(dp->ref, phys[done], 1)) ret = fs_dedup_seterror(dp, DEDUP_ERROR_MEMORY_ALLOCATE_FAILURE);
+        if(ret) ++done;
+    }
+    if(!ret) { /* rollback: [0, done) and the failed register */
+        for(counter_t i=0; i<done; ++i) {
+            if(fresh[i]) fs_dedup_unregister(dp, digest+i*DEDUP_HASH_SIZE, phys[i]);
+            else {
+                bool_t last;
+                fs_clusref_release(dp->ref, phys[i], &last);
+            }
+        }
+        if(done<num && fresh[done]) fs_dedup_unregister(dp, digest+done*DEDUP_HASH_SIZE, phys[done]);
+        if(written) fs_diskwith_bitmap_erase(bp, fs_cluster_getsector(bpb, begin), unique*SECTORS_PER_CLUSTER);
+        return fs_free(batch.entry, fs_free(stage, fs_free(phys, fs_free(digest, b_false))));
+    }
+    dp->hit += num-unique;
+    for(counter_t i=0; i<num; ++i) fs_extent_append(fep, phys[i], 1);
+    return fs_free(batch.entry, fs_free(stage, fs_free(phys, fs_free(digest, fs_dedup_setsuccess(dp)))));
+}
+
+/*
+* mount: the counts (fs_extent_mountref) and the index are rebuilt from all the objects on the BPB.
+* Each referenced cluster is read and hashed, a chunk whose clusters are all indexed is skipped.
+* If two clusters have the same content, the first one is indexed.
+* If it fails, the index and the counts are left empty.
+*/
+static inline bool_t fs_dedup_mount(FSDEDUP *dp, const BPB *bpb, FSEXTENT **obj, index_t num) {
+    if(dp->bp->ref!=dp->ref || 0<dp->index.count || 0<dp->ref->count) return fs_dedup_seterror(dp, DEDUP_ERROR_PARAM);
+    if(!fs_extent_mountref(obj, num, dp->bp)) return fs_dedup_seterror(dp, DEDUP_ERROR_MEMORY_ALLOCATE_FAILURE);
+    byte_t *buf = fs_malloc((fsize_t)(DEDUP_MOUNT_CHUNK*BYTES_PER_CLUSTER));
+    byte_t *digest = fs_malloc((fsize_t)(DEDUP_MOUNT_CHUNK*DEDUP_HASH_SIZE));
+    bool_t ret = (buf && digest)? b_true: fs_dedup_seterror(dp, DEDUP_ERROR_MEMORY_ALLOCATE_FAILURE);
+    for(index_t i=0; i<num && ret; ++i) {
+        for(index_t k=0; k<fs_extent_getruns(obj[i]) && ret; ++k) {
+            const EXTENT *run = fs_extent_getrun(obj[i], k);
+            for(counter_t off=0; off<run->num && ret; off+=DEDUP_MOUNT_CHUNK) {
+                const cluster_t begin = run->physical+off;
+                const counter_t n = (run->num-off<DEDUP_MOUNT_CHUNK)? run->num-off: DEDUP_MOUNT_CHUNK;
+                DEDUP_ENTRY key;
+                bool_t known = b_true;
+                for(counter_t c=0; c<n && known; ++c) {
+                    key.clus = begin+c;
+                    known = fs_dedup_table_find(&dp->reverse, &key, b_false)!=NULL;
+                }
+                if(known) continue;
+                if(!fs_cluster_diskread(dp->bp, bpb, begin, n, buf)) {
+                    ret = fs_dedup_seterror(dp, DEDUP_ERROR_DRIVE_RW_FAILURE);
+                    break;
+                }
+                fs_sha256_digest_array(buf, (index_t)n, BYTES_PER_CLUSTER, digest);
+                for(counter_t c=0; c<n && ret; ++c) {
+                    cluster_t clus;
+                    key.clus = begin+c;
+                    if(fs_dedup_table_find(&dp->reverse, &key, b_false) || fs_dedup_lookup(dp, digest+c*DEDUP_HASH_SIZE, &clus)) continue;
+                    ret = fs_dedup_register(dp, digest+c*DEDUP_HASH_SIZE, begin+c);
+                }
+            }
+        }
+    }
+    if(!ret) {
+        fs_dedup_table_clear(&dp->index);
+        fs_dedup_table_clear(&dp->reverse);
+        fs_clusref_clear(dp->ref);
+    }
+    return fs_free(digest, fs_free(buf, (ret)? fs_dedup_setsuccess(dp): b_false));
+}
+
+/* release every run of the object. */
+static inline bool_t fs_dedup_erase(FSDEDUP *dp, const BPB *bpb, FSEXTENT *fep) {
+    for(index_t i=0; i<fs_extent_getruns(fep); ++i) {
+        const EXTENT *run = fs_extent_getrun(fep, i);
+        if(!fs_cluster_erasebitmap(dp->bp, bpb, run->physical, run->num)) return fs_dedup_seterror(dp, DEDUP_ERROR_DRIVE_RW_FAILURE);
+    }
+    fs_extent_clear(fep);
+    return fs_dedup_setsuccess(dp);
+}
+
+#endif
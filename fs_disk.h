@@ -25,6 +25,8 @@
 
 #define DISK_SET_ERROR_BY_FILE(fdp, i) fs_disk_seterror((fdp), (fs_file_getstatus((fdp)->io.fp[(i)]) == FS_FILE_ERROR_DRIVE_RW_FAILURE) ? FS_DISK_ERROR_DRIVE_RW_FAILURE : FS_DISK_ERROR_MEMORY_ALLOCATE_FAILURE)
 
+#define DISK_HOLE_ALIGNMENT BYTES_PER_CLUSTER /* host filesystem block: a hole is punched in this unit only. */
+
 static const str_t *metaformat = "%s\\fsimeta%04d.dat"; /* BCR and BPB, include fsmeta.dat, minus index. */
 static const str_t *fileformat = "%s\\fsindex%04d.dat"; /* size is fixed: SECTOR_SIZE * SECTORS_PER_CLUS * CLUSTER_CAPACITY */
 
@@ -34,6 +36,7 @@ typedef enum _tag_disk_status {
     FS_DISK_ERROR_LOCKED = 2,
     FS_DISK_ERROR_MEMORY_ALLOCATE_FAILURE = 3,
     FS_DISK_ERROR_DRIVE_RW_FAILURE = 4,
+    FS_DISK_ERROR_UNSUPPORTED = 5, /* Note: punch hole */
 } disk_status;
 
 typedef struct _tag_DISKIO {
@@ -262,4 +265,47 @@ static inline bool_t fs_disk_write(FSDISK *fdp, const sector_t begin, counter_t
     return fs_disk_setsuccess(fdp);
 }
 
+/*
+* Release the host storage of the data area [begin, begin+num).
+* Only whole DISK_HOLE_ALIGNMENT blocks are punched, so the partial blocks at both ends stay allocated.
+* Note: The caller must have erased the range in the bitmap. The range reads back as zero.
+* Note: FS_DISK_ERROR_UNSUPPORTED, the host cannot punch holes. (nothing is released)
+*/
+static inline bool_t fs_disk_punchhole(FSDISK *fdp, const sector_t begin, counter_t num) {
+    if(begin<0) return fs_disk_seterror(fdp, FS_DISK_ERROR_PARAM); /* No punch fsimeta */
+    const fsize_t fsize = fs_file_getsize();
+    const llsize_t pbegin = begin * BYTES_PER_SECTOR;
+    llsize_t remain = num * BYTES_PER_SECTOR;
+    for(index_t i=(index_t)(pbegin/fsize); i < fdp->io.fp_num && remain > 0; ++i) {
+        foffset_t offset = (i==pbegin/fsize) ? pbegin-(((index_t)(pbegin/fsize))*fsize): 0;
+        fsize_t psize = (fsize_t)((remain > fsize-offset) ? fsize - offset: remain);
+        const foffset_t hbegin = (offset+DISK_HOLE_ALIGNMENT-1)/DISK_HOLE_ALIGNMENT*DISK_HOLE_ALIGNMENT;
+        const foffset_t hend = (offset+psize)/DISK_HOLE_ALIGNMENT*DISK_HOLE_ALIGNMENT;
+        if(hbegin<hend && !fs_file_punchhole(fdp->io.fp[i], (index_t)hbegin, (fsize_t)(hend-hbegin))) {
+            if(fs_file_getstatus(fdp->io.fp[i])==FS_FILE_ERROR_UNSUPPORTED) return fs_disk_seterror(fdp, FS_DISK_ERROR_UNSUPPORTED);
+            return DISK_SET_ERROR_BY_FILE(fdp, i);
+        }
+        remain -= psize;
+    }
+    return fs_disk_setsuccess(fdp);
+}
+
+/*
+* Close and delete the trailing data chunks, "fsindex%04d.dat" [fnum+1, fp_num].
+* fs_disk_write creates them again when the area is written.
+* Note: The first chunk is never deleted. (BCR)
+*/
+static inline bool_t fs_disk_truncate(FSDISK *fdp, num_t fnum) {
+    if(fnum<1 || fdp->io.fp_num<fnum) return fs_disk_seterror(fdp, FS_DISK_ERROR_PARAM);
+    for(index_t i=fdp->io.fp_num-1; fnum<=i; --i) {
+        str_t path[MAX_PATH];
+        sprintf_s(path, ARRAYLEN(path), fileformat, fdp->io.dir, i + 1);
+        fs_file_close(fdp->io.fp[i], b_true);
+        fdp->io.fp[i] = NULL;
+        fdp->io.fp_num = i;
+        if(remove(path)!=0) return fs_disk_seterror(fdp, FS_DISK_ERROR_DRIVE_RW_FAILURE);
+    }
+    return fs_disk_setsuccess(fdp);
+}
+
 #endif
@@ -0,0 +1,443 @@
+// Copyright (c) 2020 The SorachanCoin Developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SORACHANCOIN_FS_EXTENT
+#define SORACHANCOIN_FS_EXTENT
+
+#include "fs_const.h"
+#include "fs_memory.h"
+#include "fs_types.h"
+#include "fs_endian.h"
+#include "fs_cluster.h"
+#include "fs_sha256.h"
+
+/*
+* ** fs_extent **
+*
+* Extent map: where a multi-run object lives.
+* Logical cluster offset (0, 1, 2, ...) to physical cluster run, (begin, num).
+*
+* on memory: sorted array of runs, lookup is binary search and append is amortized O(1).
+* on disk: [EXTM][bytes(LE32)][runs(LE32)] and then (zigzag physical delta, num) varint pairs, in clusters.
+* The logical offset is not stored, because runs are logically contiguous.
+*
+* copy on write: fs_extent_clone shares the runs of an object (fs_cluster_clone),
+* and fs_extent_objectwrite moves a shared range and remaps it. (fs_cluster_cowwrite)
+*
+* append-only object: fs_extent_beginhash, and then fs_extent_objectappend writes bytes at the end
+* and hashes only them. The SHA256 midstate is stored after the runs, so hashing continues after diskread.
+*
+*/
+
+#define EXTENT_SIGNATURE "EXTM"
+#define EXTENT_HEADER_SIZE 12
+#define EXTENT_ALLOC_UNIT 64
+#define EXTENT_VARINT_MAX 10
+
+typedef struct _tag_EXTENT {
+    cluster_t logical;
+    cluster_t physical;
+    counter_t num;
+} EXTENT;
+
+typedef enum _tag_extent_status {
+    EXTENT_SUCCESS = 0,
+    EXTENT_ERROR_PARAM = 1,
+    EXTENT_ERROR_MEMORY_ALLOCATE_FAILURE = 2,
+    EXTENT_ERROR_DRIVE_RW_FAILURE = 3,
+    EXTENT_ERROR_BROKEN = 4,
+} extent_status;
+
+typedef struct _tag_FSEXTENT {
+    EXTENT *run;
+    index_t num;
+    index_t capacity;
+    counter_t clusters;
+    bool_t hashed; /* append-only object: sha is the hash of all bytes, sha.bytes is the size. */
+    FSSHA256 sha;
+    extent_status status;
+} FSEXTENT;
+
+static inline bool_t fs_extent_setsuccess(FSEXTENT *fep) {
+    fep->status = EXTENT_SUCCESS;
+    return b_true;
+}
+
+static inline bool_t fs_extent_seterror(FSEXTENT *fep, extent_status status) {
+    fep->status = status;
+    return b_false;
+}
+
+static inline extent_status fs_extent_getstatus(FSEXTENT *fep) {
+    return fep->status;
+}
+
+static inline bool_t fs_extent_open(FSEXTENT **fep) {
+    *fep = (FSEXTENT *)fs_malloc(sizeof(FSEXTENT));
+    if(!*fep) return b_false;
+    (*fep)->run = NULL;
+    (*fep)->num = 0;
+    (*fep)->capacity = 0;
+    (*fep)->clusters = 0;
+    (*fep)->hashed = b_false;
+    return fs_extent_setsuccess(*fep);
+}
+
+static inline bool_t fs_extent_close(FSEXTENT *fep, bool_t ret) {
+    return fs_free(fep, fs_free(fep->run, ret));
+}
+
+static inline bool_t fs_extent_clear(FSEXTENT *fep) {
+    fep->num = 0;
+    fep->clusters = 0;
+    fep->hashed = b_false;
+    return fs_extent_setsuccess(fep);
+}
+
+static inline counter_t fs_extent_getclusters(const FSEXTENT *fep) { /* logical size */
+    return fep->clusters;
+}
+
+static inline index_t fs_extent_getruns(const FSEXTENT *fep) {
+    return fep->num;
+}
+
+static inline const EXTENT *fs_extent_getrun(const FSEXTENT *fep, index_t index) {
+    return (0<=index && index<fep->num)? &fep->run[index]: NULL;
+}
+
+static inline bool_t fs_extent_reserve(FSEXTENT *fep, index_t num) {
+    if(num<=fep->capacity) return fs_extent_setsuccess(fep);
+    const index_t capacity = (num+EXTENT_ALLOC_UNIT-1)/EXTENT_ALLOC_UNIT*EXTENT_ALLOC_UNIT;
+    const fsize_t alsize = (fsize_t)(sizeof(EXTENT)*capacity);
+    EXTENT *tmp = (EXTENT *)fs_malloc(alsize);
+    if(!tmp) return fs_extent_seterror(fep, EXTENT_ERROR_MEMORY_ALLOCATE_FAILURE);
+    if(fep->run) memcpy_s(tmp, alsize, fep->run, (fsize_t)(sizeof(EXTENT)*fep->num));
+    fs_free(fep->run, b_true);
+    fep->run = tmp;
+    fep->capacity = capacity;
+    return fs_extent_setsuccess(fep);
+}
+
+/* Note: physical run is appended to the logical end. If it continues the last run, the run is extended. */
+static inline bool_t fs_extent_append(FSEXTENT *fep, cluster_t physical, counter_t num) {
+    if(physical<0 || num<=0) return fs_extent_seterror(fep, EXTENT_ERROR_PARAM);
+    if(0<fep->num) {
+        EXTENT *last = &fep->run[fep->num-1];
+        if(last->physical+last->num==physical) {
+            last->num += num;
+            fep->clusters += num;
+            return fs_extent_setsuccess(fep);
+        }
+    }
+    if(!fs_extent_reserve(fep, fep->num+1)) return b_false;
+    fep->run[fep->num].logical = fep->clusters;
+    fep->run[fep->num].physical = physical;
+    fep->run[fep->num].num = num;
+    ++(fep->num);
+    fep->clusters += num;
+    return fs_extent_setsuccess(fep);
+}
+
+static inline index_t fs_extent_getindex(const FSEXTENT *fep, cluster_t logical) { /* run index including logical, or -1 */
+    if(logical<0 || fep->clusters<=logical) return -1;
+    index_t left=0, right=fep->num-1;
+    while(left<right) {
+        const index_t center = (left+right+1)>>1;
+        if(fep->run[center].logical<=logical) left=center;
+        else right=center-1;
+    }
+    return left;
+}
+
+/* physical: physical cluster of logical, remain: clusters that are contiguous from physical (include physical). */
+static inline bool_t fs_extent_lookup(FSEXTENT *fep, cluster_t logical, cluster_t *physical, counter_t *remain) {
+    const index_t index = fs_extent_getindex(fep, logical);
+    if(index<0) return fs_extent_seterror(fep, EXTENT_ERROR_PARAM);
+    const EXTENT *run = &fep->run[index];
+    *physical = run->physical + (logical - run->logical);
+    if(remain) *remain = run->num - (logical - run->logical);
+    return fs_extent_setsuccess(fep);
+}
+
+/* [logical, logical+num) is mapped to the physical run [physical, physical+num). */
+static inline bool_t fs_extent_remap(FSEXTENT *fep, cluster_t logical, counter_t num, cluster_t physical) {
+    if(logical<0 || num<=0 || physical<0 || fep->clusters<logical+num) return fs_extent_seterror(fep, EXTENT_ERROR_PARAM);
+    FSEXTENT tmp;
+    tmp.run = NULL;
+    tmp.num = tmp.capacity = 0;
+    tmp.clusters = 0;
+    if(!fs_extent_reserve(&tmp, fep->num+2)) return fs_extent_seterror(fep, EXTENT_ERROR_MEMORY_ALLOCATE_FAILURE);
+    bool_t ret = b_true;
+    for(index_t i=0; i<fep->num && ret; ++i) {
+        const EXTENT *run = &fep->run[i];
+        const cluster_t end = run->logical+run->num;
+        if(run->logical<logical) ret = fs_extent_append(&tmp, run->physical, ((end<logical)? end: logical)-run->logical);
+        if(ret && run->logical<=logical && logical<end) ret = fs_extent_append(&tmp, physical, num);
+        if(ret && logical+num<end) {
+            const cluster_t from = (run->logical<logical+num)? logical+num: run->logical;
+            ret = fs_extent_append(&tmp, run->physical+(from-run->logical), end-from);
+        }
+    }
+    if(!ret) return fs_free(tmp.run, fs_extent_seterror(fep, fs_extent_getstatus(&tmp))); /* the map is not changed. */
+    fs_free(fep->run, b_true);
+    fep->run = tmp.run;
+    fep->num = tmp.num;
+    fep->capacity = tmp.capacity;
+    return fs_extent_setsuccess(fep);
+}
+
+/* dest: the same object as src, sharing the clusters. (dest is cleared) */
+static inline bool_t fs_extent_clone(FSEXTENT *dest, const FSEXTENT *src, FSBITMAP *bp) {
+    fs_extent_clear(dest);
+    if(!fs_extent_reserve(dest, src->num)) return b_false;
+    for(index_t i=0; i<src->num; ++i) {
+        if(!fs_cluster_clone(bp, src->run[i].physical, src->run[i].num)) { /* run i took none. (fs_clusref_addref) */
+            for(index_t k=0; k<i; ++k) { /* the references taken are given back. (never the last one) */
+                for(cluster_t clus=src->run[k].physical; clus<src->run[k].physical+src->run[k].num && bp->ref; ++clus) {
+                    bool_t last;
+                    fs_clusref_release(bp->ref, clus, &last);
+                }
+            }
+            return fs_extent_seterror(dest, (bp->ref)? EXTENT_ERROR_MEMORY_ALLOCATE_FAILURE: EXTENT_ERROR_PARAM);
+        }
+        dest->run[i] = src->run[i];
+    }
+    dest->num = src->num;
+    dest->clusters = src->clusters;
+    dest->hashed = src->hashed;
+    dest->sha = src->sha;
+    return fs_extent_setsuccess(dest);
+}
+
+/*
+* mount: the counts of fs_clusref are rebuilt from all the objects on the BPB, before any clone or write.
+* bp->ref must be empty. If it fails, it is left empty. Note: every referenced cluster has an entry until fs_clusref_settle.
+*/
+static inline bool_t fs_extent_mountref(FSEXTENT **obj, index_t num, FSBITMAP *bp) {
+    FSCLUSREF *ref = bp->ref;
+    if(ref==NULL) return fs_bitmap_seterror(bp, FS_BITMAP_ERROR_NO_REFERENCE);
+    if(0<ref->count) return fs_bitmap_seterror(bp, FS_BITMAP_ERROR_REFERENCE_IN_USE);
+    for(index_t i=0; i<num; ++i) {
+        for(index_t k=0; k<obj[i]->num; ++k) {
+            if(!fs_clusref_addref(ref, obj[i]->run[k].physical, obj[i]->run[k].num)) {
+                fs_clusref_clear(ref);
+                return fs_bitmap_seterror(bp, FS_BITMAP_ERROR_MEMORY_ALLOCATE_FAILURE);
+            }
+        }
+    }
+    fs_clusref_settle(ref);
+    return fs_bitmap_setsuccess(bp);
+}
+
+/*
+* varint
+*/
+static inline fsize_t fs_extent_putvarint(byte_t *buf, uint64_t val) {
+    fsize_t size=0;
+    while(0x80<=val) {
+        buf[size++] = (byte_t)(val|0x80);
+        val >>= 7;
+    }
+    buf[size++] = (byte_t)val;
+    return size;
+}
+
+static inline fsize_t fs_extent_getvarint(const byte_t *buf, fsize_t bufsize, uint64_t *val) { /* 0: broken */
+    uint64_t ret=0;
+    for(fsize_t i=0, shift=0; i<bufsize && i<EXTENT_VARINT_MAX; ++i, shift+=7) {
+        ret |= (uint64_t)(buf[i]&0x7F)<<shift;
+        if((buf[i]&0x80)==0) {*val=ret; return i+1;}
+    }
+    return 0;
+}
+
+static inline uint64_t fs_extent_zigzag(int64_t val) {
+    return ((uint64_t)val<<1)^(uint64_t)(val>>63);
+}
+
+static inline int64_t fs_extent_unzigzag(uint64_t val) {
+    return (int64_t)(val>>1)^-(int64_t)(val&1);
+}
+
+static inline fsize_t fs_extent_getencsize(const FSEXTENT *fep) {
+    byte_t tmp[EXTENT_VARINT_MAX];
+    fsize_t size = EXTENT_HEADER_SIZE;
+    cluster_t prev = 0;
+    for(index_t i=0; i<fep->num; ++i) {
+        size += fs_extent_putvarint(tmp, fs_extent_zigzag(fep->run[i].physical-prev));
+        size += fs_extent_putvarint(tmp, (uint64_t)fep->run[i].num);
+        prev = fep->run[i].physical+fep->run[i].num;
+    }
+    return (fep->hashed)? size+SHA256_MIDSTATE_SIZE: size;
+}
+
+static inline counter_t fs_extent_getdiskclusters(const FSEXTENT *fep) {
+    return (fs_extent_getencsize(fep)+BYTES_PER_CLUSTER-1)/BYTES_PER_CLUSTER;
+}
+
+/* Note: buf size must be fs_extent_getencsize(fep) or more. */
+static inline fsize_t fs_extent_encode(const FSEXTENT *fep, byte_t *buf) {
+    fsize_t size = EXTENT_HEADER_SIZE;
+    cluster_t prev = 0;
+    for(index_t i=0; i<fep->num; ++i) {
+        size += fs_extent_putvarint(buf+size, fs_extent_zigzag(fep->run[i].physical-prev));
+        size += fs_extent_putvarint(buf+size, (uint64_t)fep->run[i].num);
+        prev = fep->run[i].physical+fep->run[i].num;
+    }
+    if(fep->hashed) {
+        fs_sha256_savestate(&fep->sha, buf+size);
+        size += SHA256_MIDSTATE_SIZE;
+    }
+    memcpy(buf, EXTENT_SIGNATURE, 4);
+    WriteLE32(buf+4, (uint32_t)size);
+    WriteLE32(buf+8, (uint32_t)fep->num);
+    return size;
+}
+
+static inline bool_t fs_extent_decode(FSEXTENT *fep, const byte_t *buf, fsize_t bufsize) {
+    fs_extent_clear(fep);
+    if(bufsize<EXTENT_HEADER_SIZE || memcmp(buf, EXTENT_SIGNATURE, 4)!=0) return fs_extent_seterror(fep, EXTENT_ERROR_BROKEN);
+    const fsize_t size = (fsize_t)ReadLE32(buf+4);
+    const index_t num = (index_t)ReadLE32(buf+8);
+    if(size<EXTENT_HEADER_SIZE || bufsize<size || num<0) return fs_extent_seterror(fep, EXTENT_ERROR_BROKEN);
+    if((size-EXTENT_HEADER_SIZE)/2<num) return fs_extent_seterror(fep, EXTENT_ERROR_BROKEN); /* a run is 2 bytes at least, before reserve. */
+    if(!fs_extent_reserve(fep, num)) return b_false;
+    fsize_t pos = EXTENT_HEADER_SIZE;
+    cluster_t prev = 0;
+    for(index_t i=0; i<num; ++i) {
+        uint64_t delta, clus;
+        fsize_t n;
+        if((n=fs_extent_getvarint(buf+pos, size-pos, &delta))==0) return fs_extent_seterror(fep, EXTENT_ERROR_BROKEN);
+        pos += n;
+        if((n=fs_extent_getvarint(buf+pos, size-pos, &clus))==0) return fs_extent_seterror(fep, EXTENT_ERROR_BROKEN);
+        pos += n;
+        EXTENT *run = &fep->run[i];
+        run->logical = fep->clusters;
+        run->physical = prev+fs_extent_unzigzag(delta);
+        run->num = (counter_t)clus;
+        if(run->physical<0 || run->num<=0) return fs_extent_seterror(fep, EXTENT_ERROR_BROKEN);
+        prev = run->physical+run->num;
+        fep->clusters += run->num;
+        fep->num = i+1;
+    }
+    if(pos+SHA256_MIDSTATE_SIZE==size) { /* append-only object */
+        if(!fs_sha256_loadstate(&fep->sha, buf+pos)) return fs_extent_seterror(fep, EXTENT_ERROR_BROKEN);
+        fep->hashed = b_true;
+        pos = size;
+    }
+    return (pos==size)? fs_extent_setsuccess(fep): fs_extent_seterror(fep, EXTENT_ERROR_BROKEN);
+}
+
+/*
+* disk: the map itself is stored in fs_extent_getdiskclusters(fep) clusters from begin.
+*/
+static inline bool_t fs_extent_diskwrite(FSEXTENT *fep, FSBITMAP *bp, const BPB *bpb, cluster_t begin) {
+    const counter_t clus = fs_extent_getdiskclusters(fep);
+    const fsize_t bufsize = (fsize_t)(clus*BYTES_PER_CLUSTER);
+    byte_t *buf = fs_malloc(bufsize);
+    if(!buf) return fs_extent_seterror(fep, EXTENT_ERROR_MEMORY_ALLOCATE_FAILURE);
+    memset(buf, 0x00, bufsize);
+    fs_extent_encode(fep, buf);
+    return fs_free(buf, fs_cluster_diskwrite(bp, bpb, begin, clus, buf)? fs_extent_setsuccess(fep): fs_extent_seterror(fep, EXTENT_ERROR_DRIVE_RW_FAILURE));
+}
+
+static inline bool_t fs_extent_diskread(FSEXTENT *fep, FSBITMAP *bp, const BPB *bpb, cluster_t begin) {
+    byte_t head[BYTES_PER_CLUSTER];
+    if(!fs_cluster_diskread(bp, bpb, begin, 1, head)) return fs_extent_seterror(fep, EXTENT_ERROR_DRIVE_RW_FAILURE);
+    if(memcmp(head, EXTENT_SIGNATURE, 4)!=0) return fs_extent_seterror(fep, EXTENT_ERROR_BROKEN);
+    const fsize_t size = (fsize_t)ReadLE32(head+4);
+    if(size<=BYTES_PER_CLUSTER) return fs_extent_decode(fep, head, size);
+    const counter_t clus = (size+BYTES_PER_CLUSTER-1)/BYTES_PER_CLUSTER;
+    byte_t *buf = fs_malloc((fsize_t)(clus*BYTES_PER_CLUSTER));
+    if(!buf) return fs_extent_seterror(fep, EXTENT_ERROR_MEMORY_ALLOCATE_FAILURE);
+    if(!fs_cluster_diskread(bp, bpb, begin, clus, buf)) return fs_free(buf, fs_extent_seterror(fep, EXTENT_ERROR_DRIVE_RW_FAILURE));
+    return fs_free(buf, fs_extent_decode(fep, buf, size));
+}
+
+/*
+* object I/O: logical [logical, logical+num) is split into one request per physical run.
+*/
+static inline bool_t fs_extent_objectio(FSEXTENT *fep, FSBITMAP *bp, const BPB *bpb, cluster_t logical, counter_t num, byte_t *rbuf, const byte_t *wbuf) {
+    if(num<=0 || fep->clusters<logical+num) return fs_extent_seterror(fep, EXTENT_ERROR_PARAM);
+    index_t index = fs_extent_getindex(fep, logical);
+    if(index<0) return fs_extent_seterror(fep, EXTENT_ERROR_PARAM);
+    while(0<num) {
+        const EXTENT *run = &fep->run[index++];
+        const counter_t offset = logical - run->logical;
+        const counter_t rwnum = (run->num-offset<num)? run->num-offset: num;
+        if(rbuf) {
+            if(!fs_cluster_diskread(bp, bpb, run->physical+offset, rwnum, rbuf)) return fs_extent_seterror(fep, EXTENT_ERROR_DRIVE_RW_FAILURE);
+            rbuf += rwnum*BYTES_PER_CLUSTER;
+        } else {
+            cluster_t physical;
+            if(!fs_cluster_cowwrite(bp, bpb, run->physical+offset, rwnum, wbuf, &physical)) return fs_extent_seterror(fep, EXTENT_ERROR_DRIVE_RW_FAILURE);
+            if(physical!=run->physical+offset) { /* moved: the runs are rebuilt. */
+                if(!fs_extent_remap(fep, logical, rwnum, physical)) return b_false;
+                index = fs_extent_getindex(fep, logical+rwnum);
+            }
+            wbuf += rwnum*BYTES_PER_CLUSTER;
+        }
+        logical += rwnum;
+        num -= rwnum;
+    }
+    return fs_extent_setsuccess(fep);
+}
+
+static inline bool_t fs_extent_objectread(FSEXTENT *fep, FSBITMAP *bp, const BPB *bpb, cluster_t logical, counter_t num, byte_t *buf) {
+    return fs_extent_objectio(fep, bp, bpb, logical, num, buf, NULL);
+}
+
+static inline bool_t fs_extent_objectwrite(FSEXTENT *fep, FSBITMAP *bp, const BPB *bpb, cluster_t logical, counter_t num, const byte_t *buf) {
+    return fs_extent_objectio(fep, bp, bpb, logical, num, NULL, buf);
+}
+
+/*
+* append-only object
+*/
+static inline bool_t fs_extent_beginhash(FSEXTENT *fep) { /* the object must be empty. */
+    if(0<fep->clusters) return fs_extent_seterror(fep, EXTENT_ERROR_PARAM);
+    fs_sha256_init(&fep->sha);
+    fep->hashed = b_true;
+    return fs_extent_setsuccess(fep);
+}
+
+static inline counter_t fs_extent_getbytes(const FSEXTENT *fep) {
+    return (fep->hashed)? (counter_t)fep->sha.bytes: fep->clusters*BYTES_PER_CLUSTER;
+}
+
+/* SHA256 of the bytes appended so far. (the midstate continues) */
+static inline bool_t fs_extent_gethash(const FSEXTENT *fep, byte_t *hash) {
+    if(!fep->hashed) return b_false;
+    FSSHA256 ctx = fep->sha;
+    fs_sha256_final(&ctx);
+    memcpy(hash, ctx.hash, sizeof(ctx.hash));
+    return b_true;
+}
+
+/* data: size bytes after the end. The clusters are allocated as needed, and the last partial cluster is rewritten. */
+static inline bool_t fs_extent_objectappend(FSEXTENT *fep, FSBITMAP *bp, const BPB *bpb, const byte_t *data, counter_t size) {
+    if(!fep->hashed || size<0) return fs_extent_seterror(fep, EXTENT_ERROR_PARAM);
+    if(size==0) return fs_extent_setsuccess(fep);
+    const counter_t bytes = (counter_t)fep->sha.bytes;
+    const counter_t offset = bytes%BYTES_PER_CLUSTER;
+    const cluster_t first = (cluster_t)(bytes/BYTES_PER_CLUSTER);
+    const counter_t clusters = (bytes+size+BYTES_PER_CLUSTER-1)/BYTES_PER_CLUSTER;
+    if(fep->clusters<clusters) {
+        cluster_t physical;
+        if(!fs_cluster_getfreecluster(bp, bpb, clusters-fep->clusters, &physical)) return fs_extent_seterror(fep, EXTENT_ERROR_DRIVE_RW_FAILURE);
+        if(!fs_extent_append(fep, physical, clusters-fep->clusters)) return b_false;
+    }
+    const counter_t num = clusters-first;
+    byte_t *buf = fs_malloc((fsize_t)(num*BYTES_PER_CLUSTER));
+    if(!buf) return fs_extent_seterror(fep, EXTENT_ERROR_MEMORY_ALLOCATE_FAILURE);
+    memset(buf, 0x00, (size_t)(num*BYTES_PER_CLUSTER));
+    if(0<offset && !fs_extent_objectread(fep, bp, bpb, first, 1, buf)) return fs_free(buf, b_false);
+    memcpy(buf+offset, data, (size_t)size);
+    if(!fs_extent_objectwrite(fep, bp, bpb, first, num, buf)) return fs_free(buf, b_false);
+    fs_sha256_update(&fep->sha, size, data);
+    return fs_free(buf, fs_extent_setsuccess(fep));
+}
+
+#endif
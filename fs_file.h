@@ -5,16 +5,33 @@
 #ifndef SORACHANCOIN_FS_FILE
 #define SORACHANCOIN_FS_FILE
 
+#include "fs_types.h" /* first: _GNU_SOURCE */
 #include <stdio.h>
+#include <errno.h>
 #include "fs_const.h"
 #include "fs_memory.h"
-#include "fs_types.h"
+
+#ifdef WIN32
+# include <windows.h>
+# include <winioctl.h>
+# include <io.h>
+#else
+# include <fcntl.h>
+# include <unistd.h>
+# if defined(__linux__)
+#  include <linux/falloc.h>
+# endif
+# if defined(__linux__) && defined(FALLOC_FL_PUNCH_HOLE)
+#  define FS_FILE_PUNCHHOLE
+# endif
+#endif
 
 typedef enum _tag_file_status {
     FS_FILE_SUCCESS = 0,
     FS_FILE_ERROR_PARAM = 1,
     FS_FILE_ERROR_MEMORY_ALLOCATE_FAILURE = 2,
     FS_FILE_ERROR_DRIVE_RW_FAILURE = 3,
+    FS_FILE_ERROR_UNSUPPORTED = 4, /* Note: punch hole, the platform or the host filesystem */
 } file_status;
 
 typedef struct _tag_FSFILE {
@@ -109,4 +126,27 @@ static inline index_t fs_file_getlastseek(FSFILE *fp) {
     return fp->seek_last_pos;
 }
 
+/*
+* Release the host storage of [pos, pos+size). The file size does not change and the range reads back as zero.
+* Note: If the platform or the host filesystem cannot punch holes, nothing is released and it returns FS_FILE_ERROR_UNSUPPORTED.
+*/
+static inline bool_t fs_file_punchhole(FSFILE *fp, index_t pos, fsize_t size) {
+    if(size<=0) return fs_file_setsuccess(fp);
+    if(fflush(fp->file_ptr)!=0) return fs_file_seterror(fp, FS_FILE_ERROR_DRIVE_RW_FAILURE);
+#if defined(WIN32)
+    HANDLE h=(HANDLE)_get_osfhandle(_fileno(fp->file_ptr));
+    DWORD ret=0;
+    FILE_ZERO_DATA_INFORMATION fz;
+    if(!DeviceIoControl(h, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &ret, NULL)) return fs_file_seterror(fp, FS_FILE_ERROR_UNSUPPORTED); /* e.g, FAT32 */
+    fz.FileOffset.QuadPart=(LONGLONG)pos;
+    fz.BeyondFinalZero.QuadPart=(LONGLONG)pos+size;
+    return DeviceIoControl(h, FSCTL_SET_ZERO_DATA, &fz, sizeof(fz), NULL, 0, &ret, NULL)? fs_file_setsuccess(fp): fs_file_seterror(fp, FS_FILE_ERROR_DRIVE_RW_FAILURE);
+#elif defined(FS_FILE_PUNCHHOLE)
+    if(fallocate(fileno(fp->file_ptr), FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, (off_t)pos, (off_t)size)==0) return fs_file_setsuccess(fp);
+    return (errno==EOPNOTSUPP || errno==ENOSYS)? fs_file_seterror(fp, FS_FILE_ERROR_UNSUPPORTED): fs_file_seterror(fp, FS_FILE_ERROR_DRIVE_RW_FAILURE);
+#else
+    return fs_file_seterror(fp, FS_FILE_ERROR_UNSUPPORTED);
+#endif
+}
+
 #endif
@@ -9,6 +9,7 @@
 #include "fs_types.h"
 #include "fs_const.h"
 #include "fs_endian.h"
+#include "fs_thread.h"
 
 typedef unsigned int uindex_t;
 #define V_ALIGNMENT sizeof(double)
@@ -24,6 +25,9 @@ typedef unsigned int uindex_t;
 * It's array that spreads data in a vacant memory with a minimum of effort.
 * An address continuity is NOT guaranteed due to fragmentation. (use function, fs_fragvector_getdata(fvp, index))
 * Please be careful only there.
+*
+* retire: (fs_fragvector_setretire) the old buffer table is passed to retire(ctx, table), not freed,
+* for the readers that may still hold it. (fs_btree concurrent mode)
 */
 
 /*
@@ -84,6 +88,8 @@ typedef struct _tag_FS_FRAGMENT_VECTOR {
     index_t currentIndex;
     fsize_t alignSize;
     fsize_t addSize;
+    void (*retire)(void *ctx, void *ptr); /* NULL: fs_free */
+    void *retire_ctx;
     fragvector_status status;
 } FSFRAGVECTOR;
 
@@ -113,6 +119,8 @@ static inline bool_t fs_fragvector_open(FSFRAGVECTOR **fvp, fsize_t first_size,
     (*fvp)->currentIndex = 0;
     (*fvp)->alignSize = 0;
     (*fvp)->addSize = 0;
+    (*fvp)->retire = NULL;
+    (*fvp)->retire_ctx = NULL;
 
     (*fvp)->alignSize = V_ALIGNMENT-(sizeof(VECTOR_DATA)&(V_ALIGNMENT-1));
     ((*fvp)->alignSize==V_ALIGNMENT)? (*fvp)->alignSize=0:0;
@@ -161,7 +169,10 @@ static inline bool_t fs_fragvector_realloc(FSFRAGVECTOR *fvp) {
         fvp->numOfBufferAry+=P_TABLE_NUM;
         byte_t **tmp = (byte_t **)fs_malloc(sizeof(byte_t *)*fvp->numOfBufferAry);
         memcpy(tmp, fvp->bufferArray, numofOldAry*sizeof(byte_t *));
-        fs_free(fvp->bufferArray, b_true); fvp->bufferArray = tmp;
+        byte_t **old = fvp->bufferArray;
+        fs_atomic_storeptr((void *volatile *)&fvp->bufferArray, tmp); /* a reader may follow the table */
+        if(fvp->retire) fvp->retire(fvp->retire_ctx, old);
+        else fs_free(old, b_true);
     }
     fvp->maxArraySize += fvp->reallocSize;
     ++(fvp->numOfUsedBufferAry);
@@ -169,16 +180,22 @@ static inline bool_t fs_fragvector_realloc(FSFRAGVECTOR *fvp) {
     return (fvp->bufferArray[fvp->numOfUsedBufferAry-1])? fs_fragvector_setsuccess(fvp): fs_fragvector_seterror(fvp, FRAGVECTOR_ERROR_MEMORY_ALLOCATE_FAILURE);
 }
 
+static inline void fs_fragvector_setretire(FSFRAGVECTOR *fvp, void (*retire)(void *ctx, void *ptr), void *ctx) {
+    fvp->retire = retire;
+    fvp->retire_ctx = ctx;
+}
+
 static inline byte_t *fs_fragvector_getaddr(FSFRAGVECTOR *fvp, index_t index) {
+    byte_t **table = (byte_t **)fs_atomic_loadptr((void *const volatile *)&fvp->bufferArray);
     index_t remain = (index+1) - fvp->firstArrayInsert;
     if(remain<=0) {
         remain+=fvp->firstArrayInsert;
-        return fvp->bufferArray[0]+fvp->addSize*(remain-1);
+        return table[0]+fvp->addSize*(remain-1);
     } else {
         remain-=1;
         const index_t split=remain>>fvp->reallocArrayShift;
         remain&=(1<<fvp->reallocArrayShift)-1;
-        return fvp->bufferArray[1+split]+fvp->addSize*remain;
+        return table[1+split]+fvp->addSize*remain;
     }
 }
 
@@ -0,0 +1,196 @@
+// Copyright (c) 2020 The SorachanCoin Developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SORACHANCOIN_FS_KEYARENA
+#define SORACHANCOIN_FS_KEYARENA
+
+#include "fs_types.h"
+#include "fs_memory.h"
+#include "fs_const.h"
+#include "fs_thread.h"
+
+/*
+* ** fs_keyarena **
+*
+* Packed key arena: variable length records, one after another in chunks.
+* record: [size(varint)][bytes], offset: (chunk<<32)|position, a record never moves. (the pointer is stable)
+* A record larger than KEYARENA_CHUNK_SIZE has a chunk of its own.
+*
+* retire: (fs_keyarena_setretire) the old chunk table is passed to retire(ctx, table), not freed,
+* for the readers that may still hold it. (fs_btree concurrent mode)
+*
+* release: a record is not used any more, its bytes are counted as dead. (the arena is compacted by its owner,
+* fs_btree_compact copies the live records to a new arena)
+*
+*/
+
+#define KEYARENA_CHUNK_SIZE 65536
+#define KEYARENA_ALLOC_UNIT 64
+#define KEYARENA_VARINT_MAX 5
+#define KEYARENA_SHIFT 32
+
+typedef enum _tag_keyarena_status {
+    KEYARENA_SUCCESS = 0,
+    KEYARENA_ERROR_MEMORY_ALLOCATE_FAILURE = 1,
+} keyarena_status;
+
+typedef struct _tag_FSKEYARENA {
+    byte_t **chunk;
+    index_t num;
+    index_t capacity;
+    fsize_t used; /* in the last chunk */
+    fsize_t last_size; /* size of the last chunk */
+    counter_t bytes; /* all records, with the size */
+    counter_t dead; /* the released records, with the size */
+    void (*retire)(void *ctx, void *ptr); /* NULL: fs_free */
+    void *retire_ctx;
+    keyarena_status status;
+} FSKEYARENA;
+
+static inline bool_t fs_keyarena_setsuccess(FSKEYARENA *ap) {
+    ap->status = KEYARENA_SUCCESS;
+    return b_true;
+}
+
+static inline bool_t fs_keyarena_seterror(FSKEYARENA *ap, keyarena_status status) {
+    ap->status = status;
+    return b_false;
+}
+
+static inline keyarena_status fs_keyarena_getstatus(FSKEYARENA *ap) {
+    return ap->status;
+}
+
+static inline bool_t fs_keyarena_open(FSKEYARENA **ap) {
+    *ap = (FSKEYARENA *)fs_malloc(sizeof(FSKEYARENA));
+    if(!*ap) return b_false;
+    (*ap)->chunk = NULL;
+    (*ap)->num = 0;
+    (*ap)->capacity = 0;
+    (*ap)->used = 0;
+    (*ap)->last_size = 0;
+    (*ap)->bytes = 0;
+    (*ap)->dead = 0;
+    (*ap)->retire = NULL;
+    (*ap)->retire_ctx = NULL;
+    return fs_keyarena_setsuccess(*ap);
+}
+
+static inline void fs_keyarena_setretire(FSKEYARENA *ap, void (*retire)(void *ctx, void *ptr), void *ctx) {
+    ap->retire = retire;
+    ap->retire_ctx = ctx;
+}
+
+static inline bool_t fs_keyarena_clear(FSKEYARENA *ap) {
+    for(index_t i=0; i<ap->num; ++i) fs_free(ap->chunk[i], b_true);
+    ap->num = 0;
+    ap->used = 0;
+    ap->last_size = 0;
+    ap->bytes = 0;
+    ap->dead = 0;
+    return fs_keyarena_setsuccess(ap);
+}
+
+static inline bool_t fs_keyarena_close(FSKEYARENA *ap, bool_t ret) {
+    fs_keyarena_clear(ap);
+    return fs_free(ap, fs_free(ap->chunk, ret));
+}
+
+static inline counter_t fs_keyarena_getbytes(const FSKEYARENA *ap) {
+    return ap->bytes;
+}
+
+static inline counter_t fs_keyarena_getdead(const FSKEYARENA *ap) {
+    return ap->dead;
+}
+
+static inline fsize_t fs_keyarena_putsize(byte_t *buf, fsize_t size) {
+    fsize_t n = 0;
+    uint32_t val = (uint32_t)size;
+    while(0x80<=val) {
+        buf[n++] = (byte_t)(val|0x80);
+        val >>= 7;
+    }
+    buf[n++] = (byte_t)val;
+    return n;
+}
+
+static inline fsize_t fs_keyarena_getsize(const byte_t *buf, fsize_t *size) {
+    fsize_t n = 0;
+    uint32_t val = 0;
+    for(index_t shift=0; ; shift+=7) {
+        const byte_t b = buf[n++];
+        val |= (uint32_t)(b&0x7F)<<shift;
+        if((b&0x80)==0) break;
+    }
+    *size = (fsize_t)val;
+    return n;
+}
+
+/* getsize from the bytes that may be broken: limit is the readable bytes. return: 0 (broken) or the bytes of the size */
+static inline fsize_t fs_keyarena_getsize2(const byte_t *buf, fsize_t limit, fsize_t *size) {
+    uint32_t val = 0;
+    for(fsize_t n=0; n<limit && n<KEYARENA_VARINT_MAX; ++n) {
+        val |= (uint32_t)(buf[n]&0x7F)<<(7*n);
+        if((buf[n]&0x80)==0) {
+            *size = (fsize_t)val;
+            return (*size<0)? 0: n+1;
+        }
+    }
+    return 0;
+}
+
+static inline bool_t fs_keyarena_newchunk(FSKEYARENA *ap, fsize_t size) {
+    if(ap->num==ap->capacity) {
+        const index_t capacity = ap->capacity+KEYARENA_ALLOC_UNIT;
+        byte_t **tmp = (byte_t **)fs_malloc((fsize_t)(sizeof(byte_t *)*capacity));
+        if(!tmp) return fs_keyarena_seterror(ap, KEYARENA_ERROR_MEMORY_ALLOCATE_FAILURE);
+        if(ap->chunk) memcpy(tmp, ap->chunk, sizeof(byte_t *)*ap->num);
+        byte_t **old = ap->chunk;
+        fs_atomic_storeptr((void *volatile *)&ap->chunk, tmp); /* a reader may follow the table */
+        if(ap->retire && old) ap->retire(ap->retire_ctx, old);
+        else fs_free(old, b_true);
+        ap->capacity = capacity;
+    }
+    if(size<KEYARENA_CHUNK_SIZE) size = KEYARENA_CHUNK_SIZE;
+    ap->chunk[ap->num] = (byte_t *)fs_malloc(size);
+    if(!ap->chunk[ap->num]) return fs_keyarena_seterror(ap, KEYARENA_ERROR_MEMORY_ALLOCATE_FAILURE);
+    ++(ap->num);
+    ap->used = 0;
+    ap->last_size = size;
+    return fs_keyarena_setsuccess(ap);
+}
+
+static inline bool_t fs_keyarena_add(FSKEYARENA *ap, const byte_t *key, fsize_t size, counter_t *offset) {
+    byte_t head[KEYARENA_VARINT_MAX];
+    const fsize_t hsize = fs_keyarena_putsize(head, size);
+    if(ap->num==0 || ap->last_size-ap->used<hsize+size) {
+        if(!fs_keyarena_newchunk(ap, hsize+size)) return b_false;
+    }
+    byte_t *ptr = ap->chunk[ap->num-1]+ap->used;
+    memcpy(ptr, head, hsize);
+    memcpy(ptr+hsize, key, size);
+    *offset = ((counter_t)(ap->num-1)<<KEYARENA_SHIFT)|ap->used;
+    ap->used += hsize+size;
+    ap->bytes += hsize+size;
+    return fs_keyarena_setsuccess(ap);
+}
+
+/* size: NULL is OK */
+static inline const byte_t *fs_keyarena_get(const FSKEYARENA *ap, counter_t offset, fsize_t *size) {
+    byte_t *const *chunk = (byte_t *const *)fs_atomic_loadptr((void *const volatile *)&ap->chunk);
+    const byte_t *ptr = chunk[offset>>KEYARENA_SHIFT]+(offset&(((counter_t)1<<KEYARENA_SHIFT)-1));
+    fsize_t tmp;
+    const fsize_t hsize = fs_keyarena_getsize(ptr, size? size: &tmp);
+    return ptr+hsize;
+}
+
+static inline void fs_keyarena_release(FSKEYARENA *ap, counter_t offset) {
+    const byte_t *ptr = ap->chunk[offset>>KEYARENA_SHIFT]+(offset&(((counter_t)1<<KEYARENA_SHIFT)-1));
+    fsize_t size;
+    const fsize_t hsize = fs_keyarena_getsize(ptr, &size);
+    ap->dead += hsize+size;
+}
+
+#endif
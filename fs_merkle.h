@@ -0,0 +1,612 @@
+// Copyright (c) 2020 The SorachanCoin Developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SORACHANCOIN_FS_MERKLE
+#define SORACHANCOIN_FS_MERKLE
+
+#include "fs_const.h"
+#include "fs_memory.h"
+#include "fs_types.h"
+#include "fs_endian.h"
+#include "fs_sha256.h"
+#include "fs_bpb.h"
+#include "fs_cluster.h"
+#include "fs_thread.h"
+
+/*
+* ** fs_merkle **
+*
+* Persistent Merkle tree over clusters. Level 0 has the SHA256 of each cluster, (index: cluster)
+* and the root is written to BPB.hash. The tree has capacity (power of 2) leaves, a leaf that is never written is 32 zero bytes.
+* domain tags: a leaf is hashed as SHA256(0x00 || digest), an inner node is SHA256(0x01 || fs_sha256d64(left || right)),
+* so that an inner node can never be passed off as a leaf. (the inner hashes are still batched by fs_sha256d64)
+*
+* on disk: header at BPB.merkle_root_offset: [HASH][capacity(LE64)][area(LE64)][root(32)]
+* and the nodes in "area": level 0 (leaves), level 1, ... level height (root), MERKLE_NODES_PER_PAGE nodes per cluster.
+*
+* fs_merkle_setleaf only records the leaf (dirty), and fs_merkle_commit updates the dirty paths together,
+* each level is hashed in one batch. The pages are read and written through a cache.
+* If a leaf is out of capacity, the tree grows: the old tree is the left half of the new one, so it is copied as is.
+* The area of the header on disk is released after the next header is written, (fs_merkle_commit) not by the grow.
+*
+* proof: fs_merkle_prove makes one proof for a set of leaves, (multiproof) a node that two paths need is included once,
+* and a node that can be computed from the leaves is not included. fs_merkle_verify_batch checks proofs with threads.
+* The verifier gives the capacity from the trusted header, the one in the proof is not trusted.
+*
+*/
+
+#define MERKLE_SIGNATURE "HASH"
+#define MERKLE_HASH_SIZE 32
+#define MERKLE_NODES_PER_PAGE (BYTES_PER_CLUSTER/MERKLE_HASH_SIZE)
+#define MERKLE_MIN_CAPACITY MERKLE_NODES_PER_PAGE
+#define MERKLE_HEIGHT_MAX 48
+#define MERKLE_CACHE_PAGES 64
+#define MERKLE_DIRTY_ALLOC_UNIT 1024
+#define MERKLE_BATCH 256
+#define MERKLE_TAG_LEAF 0x00
+#define MERKLE_TAG_INNER 0x01
+#define MERKLE_TAGGED_SIZE (1+MERKLE_HASH_SIZE)
+
+typedef enum _tag_merkle_status {
+    MERKLE_SUCCESS = 0,
+    MERKLE_ERROR_PARAM = 1,
+    MERKLE_ERROR_MEMORY_ALLOCATE_FAILURE = 2,
+    MERKLE_ERROR_DRIVE_RW_FAILURE = 3,
+    MERKLE_ERROR_BROKEN = 4,
+} merkle_status;
+
+typedef struct _tag_MERKLE_PAGE {
+    counter_t id; /* -1: empty */
+    bool_t dirty;
+    byte_t node[BYTES_PER_CLUSTER];
+} MERKLE_PAGE;
+
+typedef struct _tag_FSMERKLE {
+    FSBITMAP *bp;
+    const BPB *bpb;
+    counter_t capacity;
+    index_t height;
+    cluster_t area;
+    cluster_t old_area; /* the area of the header on disk after a grow, released by fs_merkle_commit */
+    counter_t old_clusters; /* 0: none */
+    counter_t base[MERKLE_HEIGHT_MAX+1]; /* the first page of each level */
+    byte_t zero[MERKLE_HEIGHT_MAX+1][MERKLE_HASH_SIZE]; /* the empty subtree of each level */
+    MERKLE_PAGE *cache;
+    counter_t *dirty;
+    counter_t dirty_num;
+    counter_t dirty_capacity;
+    merkle_status status;
+} FSMERKLE;
+
+static inline bool_t fs_merkle_setsuccess(FSMERKLE *mp) {
+    mp->status = MERKLE_SUCCESS;
+    return b_true;
+}
+
+static inline bool_t fs_merkle_seterror(FSMERKLE *mp, merkle_status status) {
+    mp->status = status;
+    return b_false;
+}
+
+static inline merkle_status fs_merkle_getstatus(FSMERKLE *mp) {
+    return mp->status;
+}
+
+static inline counter_t fs_merkle_getcapacity(const FSMERKLE *mp) {
+    return mp->capacity;
+}
+
+static inline index_t fs_merkle_getheight(const FSMERKLE *mp) {
+    return mp->height;
+}
+
+static inline counter_t fs_merkle_getlevelnodes(const FSMERKLE *mp, index_t level) {
+    return mp->capacity>>level;
+}
+
+static inline counter_t fs_merkle_getlevelpages(const FSMERKLE *mp, index_t level) {
+    return (fs_merkle_getlevelnodes(mp, level)+MERKLE_NODES_PER_PAGE-1)/MERKLE_NODES_PER_PAGE;
+}
+
+static inline counter_t fs_merkle_getareaclusters(const FSMERKLE *mp) {
+    return mp->base[mp->height]+1;
+}
+
+/* -1: capacity is not a power of 2, or too large. */
+static inline index_t fs_merkle_getheightof(counter_t capacity) {
+    index_t height = 0;
+    while(height<=MERKLE_HEIGHT_MAX && ((counter_t)1<<height)<capacity) ++height;
+    return (height<=MERKLE_HEIGHT_MAX && ((counter_t)1<<height)==capacity)? height: -1;
+}
+
+static inline bool_t fs_merkle_setcapacity(FSMERKLE *mp, counter_t capacity) { /* layout of the levels */
+    const index_t height = fs_merkle_getheightof(capacity);
+    if(height<0) return fs_merkle_seterror(mp, MERKLE_ERROR_PARAM);
+    mp->capacity = capacity;
+    mp->height = height;
+    mp->base[0] = 0;
+    for(index_t l=0; l<height; ++l) mp->base[l+1] = mp->base[l]+fs_merkle_getlevelpages(mp, l);
+    return fs_merkle_setsuccess(mp);
+}
+
+/* out[i] = SHA256(tag || in[i]) of num hashes, in place is OK. */
+static inline void fs_merkle_tag(byte_t tag, byte_t *out, const byte_t *in, counter_t num) {
+    byte_t buf[MERKLE_BATCH*MERKLE_TAGGED_SIZE];
+    for(counter_t i=0; i<num; i+=MERKLE_BATCH) {
+        const counter_t n = (num-i<MERKLE_BATCH)? num-i: MERKLE_BATCH;
+        for(counter_t k=0; k<n; ++k) {
+            buf[k*MERKLE_TAGGED_SIZE] = tag;
+            memcpy(buf+k*MERKLE_TAGGED_SIZE+1, in+(i+k)*MERKLE_HASH_SIZE, MERKLE_HASH_SIZE);
+        }
+        fs_sha256_digest_array(buf, (index_t)n, MERKLE_TAGGED_SIZE, out+i*MERKLE_HASH_SIZE);
+    }
+}
+
+/* the parents (level+1) of num pairs of children (level). pair is overwritten, out may be pair. */
+static inline void fs_merkle_parents(byte_t *out, byte_t *pair, counter_t num, index_t level) {
+    if(level==0) fs_merkle_tag(MERKLE_TAG_LEAF, pair, pair, num*2);
+    fs_sha256d64(out, pair, (size_t)num);
+    fs_merkle_tag(MERKLE_TAG_INNER, out, out, num);
+}
+
+static inline bool_t fs_merkle_open(FSMERKLE **mp, FSBITMAP *bp) {
+    *mp = (FSMERKLE *)fs_malloc(sizeof(FSMERKLE));
+    if(!*mp) return b_false;
+    (*mp)->cache = (MERKLE_PAGE *)fs_malloc(sizeof(MERKLE_PAGE)*MERKLE_CACHE_PAGES);
+    if(!(*mp)->cache) return fs_free(*mp, b_false);
+    for(index_t i=0; i<MERKLE_CACHE_PAGES; ++i) {
+        (*mp)->cache[i].id = -1;
+        (*mp)->cache[i].dirty = b_false;
+    }
+    (*mp)->bp = bp;
+    (*mp)->bpb = NULL;
+    (*mp)->area = 0;
+    (*mp)->old_area = 0;
+    (*mp)->old_clusters = 0;
+    (*mp)->dirty = NULL;
+    (*mp)->dirty_num = 0;
+    (*mp)->dirty_capacity = 0;
+    memset((*mp)->zero[0], 0x00, MERKLE_HASH_SIZE);
+    for(index_t l=0; l<MERKLE_HEIGHT_MAX; ++l) {
+        byte_t pair[MERKLE_HASH_SIZE*2];
+        memcpy(pair, (*mp)->zero[l], MERKLE_HASH_SIZE);
+        memcpy(pair+MERKLE_HASH_SIZE, (*mp)->zero[l], MERKLE_HASH_SIZE);
+        fs_merkle_parents((*mp)->zero[l+1], pair, 1, l);
+    }
+    fs_merkle_setcapacity(*mp, MERKLE_MIN_CAPACITY);
+    return fs_merkle_setsuccess(*mp);
+}
+
+static inline bool_t fs_merkle_close(FSMERKLE *mp, bool_t ret) { /* Note: not committed leaves are lost. */
+    return fs_free(mp, fs_free(mp->cache, fs_free(mp->dirty, ret)));
+}
+
+/*
+* page cache: direct mapped, a dirty page is written when it is evicted or flushed.
+*/
+static inline bool_t fs_merkle_writepage(FSMERKLE *mp, MERKLE_PAGE *page) {
+    if(!page->dirty) return fs_merkle_setsuccess(mp);
+    if(!fs_cluster_diskwrite(mp->bp, mp->bpb, mp->area+(cluster_t)page->id, 1, page->node)) return fs_merkle_seterror(mp, MERKLE_ERROR_DRIVE_RW_FAILURE);
+    page->dirty = b_false;
+    return fs_merkle_setsuccess(mp);
+}
+
+static inline bool_t fs_merkle_flush(FSMERKLE *mp) {
+    for(index_t i=0; i<MERKLE_CACHE_PAGES; ++i) {
+        if(!fs_merkle_writepage(mp, &mp->cache[i])) return b_false;
+    }
+    return fs_merkle_setsuccess(mp);
+}
+
+static inline void fs_merkle_dropcache(FSMERKLE *mp) {
+    for(index_t i=0; i<MERKLE_CACHE_PAGES; ++i) {
+        mp->cache[i].id = -1;
+        mp->cache[i].dirty = b_false;
+    }
+}
+
+static inline MERKLE_PAGE *fs_merkle_getpage(FSMERKLE *mp, counter_t id) {
+    MERKLE_PAGE *page = &mp->cache[id%MERKLE_CACHE_PAGES];
+    if(page->id==id) return page;
+    if(!fs_merkle_writepage(mp, page)) return NULL;
+    page->id = -1;
+    if(!fs_cluster_diskread(mp->bp, mp->bpb, mp->area+(cluster_t)id, 1, page->node)) {
+        fs_merkle_seterror(mp, MERKLE_ERROR_DRIVE_RW_FAILURE);
+        return NULL;
+    }
+    page->id = id;
+    return page;
+}
+
+static inline byte_t *fs_merkle_getnodeptr(FSMERKLE *mp, index_t level, counter_t index) { /* Note: valid until the next page access. */
+    MERKLE_PAGE *page = fs_merkle_getpage(mp, mp->base[level]+index/MERKLE_NODES_PER_PAGE);
+    return (page)? page->node+(index%MERKLE_NODES_PER_PAGE)*MERKLE_HASH_SIZE: NULL;
+}
+
+static inline bool_t fs_merkle_getnode(FSMERKLE *mp, index_t level, counter_t index, byte_t *hash) {
+    if(level<0 || mp->height<level || index<0 || fs_merkle_getlevelnodes(mp, level)<=index) return fs_merkle_seterror(mp, MERKLE_ERROR_PARAM);
+    const byte_t *node = fs_merkle_getnodeptr(mp, level, index);
+    if(!node) return b_false;
+    memcpy(hash, node, MERKLE_HASH_SIZE);
+    return fs_merkle_setsuccess(mp);
+}
+
+static inline bool_t fs_merkle_setnode(FSMERKLE *mp, index_t level, counter_t index, const byte_t *hash) {
+    MERKLE_PAGE *page = fs_merkle_getpage(mp, mp->base[level]+index/MERKLE_NODES_PER_PAGE);
+    if(!page) return b_false;
+    memcpy(page->node+(index%MERKLE_NODES_PER_PAGE)*MERKLE_HASH_SIZE, hash, MERKLE_HASH_SIZE);
+    page->dirty = b_true;
+    return fs_merkle_setsuccess(mp);
+}
+
+static inline bool_t fs_merkle_getroot(FSMERKLE *mp, byte_t *hash) {
+    return fs_merkle_getnode(mp, mp->height, 0, hash);
+}
+
+/*
+* header
+*/
+static inline bool_t fs_merkle_writeheader(FSMERKLE *mp) {
+    byte_t buf[BYTES_PER_CLUSTER];
+    memset(buf, 0x00, sizeof(buf));
+    memcpy(buf, MERKLE_SIGNATURE, 4);
+    WriteLE64(buf+4, (uint64_t)mp->capacity);
+    WriteLE64(buf+12, (uint64_t)mp->area);
+    if(!fs_merkle_getroot(mp, buf+20)) return b_false;
+    return fs_cluster_diskwrite(mp->bp, mp->bpb, mp->bpb->merkle_root_offset, 1, buf)? fs_merkle_setsuccess(mp): fs_merkle_seterror(mp, MERKLE_ERROR_DRIVE_RW_FAILURE);
+}
+
+/* the pages of the empty tree, from page "from" of each level. */
+static inline bool_t fs_merkle_writeempty(FSMERKLE *mp, const counter_t *from) {
+    byte_t *buf = fs_malloc(BYTES_PER_CLUSTER);
+    if(!buf) return fs_merkle_seterror(mp, MERKLE_ERROR_MEMORY_ALLOCATE_FAILURE);
+    for(index_t l=0; l<=mp->height; ++l) {
+        for(index_t i=0; i<MERKLE_NODES_PER_PAGE; ++i) memcpy(buf+i*MERKLE_HASH_SIZE, mp->zero[l], MERKLE_HASH_SIZE);
+        for(counter_t p=(from)? from[l]: 0; p<fs_merkle_getlevelpages(mp, l); ++p) {
+            if(!fs_cluster_diskwrite(mp->bp, mp->bpb, mp->area+(cluster_t)(mp->base[l]+p), 1, buf)) return fs_free(buf, fs_merkle_seterror(mp, MERKLE_ERROR_DRIVE_RW_FAILURE));
+        }
+    }
+    return fs_free(buf, fs_merkle_setsuccess(mp));
+}
+
+/* new empty tree: the header at bpb->merkle_root_offset, the nodes in free clusters. */
+static inline bool_t fs_merkle_create(FSMERKLE *mp, const BPB *bpb, counter_t capacity) {
+    if(capacity<MERKLE_MIN_CAPACITY) capacity = MERKLE_MIN_CAPACITY;
+    counter_t pow2 = MERKLE_MIN_CAPACITY;
+    while(pow2<capacity) pow2 <<= 1;
+    fs_merkle_dropcache(mp);
+    mp->bpb = bpb;
+    mp->dirty_num = 0;
+    mp->old_clusters = 0;
+    if(!fs_merkle_setcapacity(mp, pow2)) return b_false;
+    byte_t head[BYTES_PER_CLUSTER]; /* the header is used before the area is allocated. */
+    memset(head, 0x00, sizeof(head));
+    if(!fs_cluster_diskwrite(mp->bp, bpb, bpb->merkle_root_offset, 1, head)) return fs_merkle_seterror(mp, MERKLE_ERROR_DRIVE_RW_FAILURE);
+    if(!fs_cluster_getfreecluster(mp->bp, bpb, fs_merkle_getareaclusters(mp), &mp->area)) return fs_merkle_seterror(mp, MERKLE_ERROR_DRIVE_RW_FAILURE);
+    if(!fs_merkle_writeempty(mp, NULL)) return b_false;
+    return fs_merkle_writeheader(mp);
+}
+
+static inline bool_t fs_merkle_load(FSMERKLE *mp, const BPB *bpb) {
+    byte_t buf[BYTES_PER_CLUSTER];
+    fs_merkle_dropcache(mp);
+    mp->bpb = bpb;
+    mp->dirty_num = 0;
+    mp->old_clusters = 0;
+    if(!fs_cluster_diskread(mp->bp, bpb, bpb->merkle_root_offset, 1, buf)) return fs_merkle_seterror(mp, MERKLE_ERROR_DRIVE_RW_FAILURE);
+    if(memcmp(buf, MERKLE_SIGNATURE, 4)!=0) return fs_merkle_seterror(mp, MERKLE_ERROR_BROKEN);
+    if(!fs_merkle_setcapacity(mp, (counter_t)ReadLE64(buf+4))) return fs_merkle_seterror(mp, MERKLE_ERROR_BROKEN);
+    mp->area = (cluster_t)ReadLE64(buf+12);
+    return fs_merkle_setsuccess(mp);
+}
+
+/*
+* leaves: recorded now, hashed up at fs_merkle_commit.
+*/
+static inline bool_t fs_merkle_adddirty(FSMERKLE *mp, counter_t index) {
+    if(mp->dirty_num==mp->dirty_capacity) {
+        const counter_t capacity = mp->dirty_capacity+MERKLE_DIRTY_ALLOC_UNIT;
+        counter_t *tmp = (counter_t *)fs_malloc((fsize_t)(sizeof(counter_t)*capacity));
+        if(!tmp) return fs_merkle_seterror(mp, MERKLE_ERROR_MEMORY_ALLOCATE_FAILURE);
+        if(mp->dirty) memcpy(tmp, mp->dirty, (size_t)(sizeof(counter_t)*mp->dirty_num));
+        fs_free(mp->dirty, b_true);
+        mp->dirty = tmp;
+        mp->dirty_capacity = capacity;
+    }
+    mp->dirty[mp->dirty_num++] = index;
+    return fs_merkle_setsuccess(mp);
+}
+
+/* the grow failed: the new area is given back, and mp is the old tree again. */
+static inline bool_t fs_merkle_growfail(FSMERKLE *mp, const FSMERKLE *old, merkle_status status) {
+    fs_cluster_erasebitmap(mp->bp, mp->bpb, mp->area, fs_merkle_getareaclusters(mp));
+    fs_merkle_dropcache(mp);
+    *mp = *old;
+    return fs_merkle_seterror(mp, status);
+}
+
+/*
+* capacity*2 (or more): the old tree is the left subtree, every level is copied to the new area.
+* The old area stays until fs_merkle_commit writes the header of the new one, if the header on disk has it.
+*/
+static inline bool_t fs_merkle_grow(FSMERKLE *mp, counter_t capacity) {
+    if(!fs_merkle_flush(mp)) return b_false;
+    fs_merkle_dropcache(mp);
+    FSMERKLE old = *mp;
+    counter_t pow2 = mp->capacity;
+    while(pow2<capacity) pow2 <<= 1;
+    if(!fs_merkle_setcapacity(mp, pow2)) return b_false;
+    if(!fs_cluster_getfreecluster(mp->bp, mp->bpb, fs_merkle_getareaclusters(mp), &mp->area)) {
+        *mp = old;
+        return fs_merkle_seterror(mp, MERKLE_ERROR_DRIVE_RW_FAILURE);
+    }
+    byte_t *buf = fs_malloc(BYTES_PER_CLUSTER);
+    if(!buf) return fs_merkle_growfail(mp, &old, MERKLE_ERROR_MEMORY_ALLOCATE_FAILURE);
+    counter_t from[MERKLE_HEIGHT_MAX+1];
+    for(index_t l=0; l<=mp->height; ++l) {
+        from[l] = (l<=old.height)? fs_merkle_getlevelpages(&old, l): 0;
+        for(counter_t p=0; p<from[l]; ++p) {
+            if(!fs_cluster_diskread(mp->bp, mp->bpb, old.area+(cluster_t)(old.base[l]+p), 1, buf) ||
+               !fs_cluster_diskwrite(mp->bp, mp->bpb, mp->area+(cluster_t)(mp->base[l]+p), 1, buf)) return fs_free(buf, fs_merkle_growfail(mp, &old, MERKLE_ERROR_DRIVE_RW_FAILURE));
+        }
+    }
+    fs_free(buf, b_true);
+    if(!fs_merkle_writeempty(mp, from)) return fs_merkle_growfail(mp, &old, fs_merkle_getstatus(mp));
+    if(!fs_merkle_adddirty(mp, 0)) return fs_merkle_growfail(mp, &old, MERKLE_ERROR_MEMORY_ALLOCATE_FAILURE); /* the left edge: d64(old root, empty), ... up to the new root */
+    if(old.old_clusters==0) { /* the new tree is complete. */
+        mp->old_area = old.area;
+        mp->old_clusters = fs_merkle_getareaclusters(&old);
+    } else if(!fs_cluster_erasebitmap(mp->bp, mp->bpb, old.area, fs_merkle_getareaclusters(&old))) /* not in the header */
+        return fs_merkle_seterror(mp, MERKLE_ERROR_DRIVE_RW_FAILURE);
+    return fs_merkle_setsuccess(mp);
+}
+
+static inline bool_t fs_merkle_setleaves(FSMERKLE *mp, cluster_t begin, counter_t num, const byte_t *digest) {
+    if(begin<0 || num<=0) return fs_merkle_seterror(mp, MERKLE_ERROR_PARAM);
+    if(mp->capacity<begin+num && !fs_merkle_grow(mp, begin+num)) return b_false;
+    for(counter_t i=0; i<num; ++i) {
+        if(!fs_merkle_setnode(mp, 0, begin+i, digest+i*MERKLE_HASH_SIZE)) return b_false;
+        if(((begin+i)&1)==0 || i==0) { /* one per parent */
+            if(!fs_merkle_adddirty(mp, begin+i)) return b_false;
+        }
+    }
+    return fs_merkle_setsuccess(mp);
+}
+
+static inline bool_t fs_merkle_setleaf(FSMERKLE *mp, cluster_t index, const byte_t *digest) {
+    return fs_merkle_setleaves(mp, index, 1, digest);
+}
+
+/* write clusters, and their SHA256 become the leaves. */
+static inline bool_t fs_merkle_diskwrite(FSMERKLE *mp, cluster_t begin, counter_t num, const byte_t *buf) {
+    byte_t *digest = fs_malloc((fsize_t)(num*MERKLE_HASH_SIZE));
+    if(!digest) return fs_merkle_seterror(mp, MERKLE_ERROR_MEMORY_ALLOCATE_FAILURE);
+    if(!fs_cluster_diskwrite_hash(mp->bp, mp->bpb, begin, num, buf, digest)) return fs_free(digest, fs_merkle_seterror(mp, MERKLE_ERROR_DRIVE_RW_FAILURE));
+    return fs_free(digest, fs_merkle_setleaves(mp, begin, num, digest));
+}
+
+static inline int fs_merkle_cmp(const void *a, const void *b) {
+    const counter_t x=*(const counter_t *)a, y=*(const counter_t *)b;
+    return (x<y)? -1: (x>y)? 1: 0;
+}
+
+/*
+* Update the dirty paths: level by level, the parents of the dirty nodes are hashed in batches of MERKLE_BATCH.
+* The pages are written, and the root goes to the header and bpb->hash.
+* The dirty leaves are kept until all of them succeed, so a failed commit can be done again. (the same hashes)
+*/
+static inline bool_t fs_merkle_commit(FSMERKLE *mp, BPB *bpb) {
+    counter_t num = mp->dirty_num;
+    byte_t *in = fs_malloc(MERKLE_BATCH*MERKLE_HASH_SIZE*2);
+    byte_t *out = fs_malloc(MERKLE_BATCH*MERKLE_HASH_SIZE);
+    counter_t *dirty = (counter_t *)fs_malloc((fsize_t)(sizeof(counter_t)*((0<num)? num: 1))); /* becomes the parents, mp->dirty stays. */
+    if(!in || !out || !dirty) return fs_free(dirty, fs_free(out, fs_free(in, fs_merkle_seterror(mp, MERKLE_ERROR_MEMORY_ALLOCATE_FAILURE))));
+    if(0<num) memcpy(dirty, mp->dirty, (size_t)(sizeof(counter_t)*num));
+    if(0<num) qsort(dirty, (size_t)num, sizeof(counter_t), fs_merkle_cmp);
+    for(index_t l=0; l<mp->height && 0<num; ++l) {
+        counter_t pnum = 0; /* dirty[] becomes the parents, in place. (sorted and unique) */
+        for(counter_t i=0; i<num; ++i) {
+            const counter_t parent = dirty[i]>>1;
+            if(pnum==0 || dirty[pnum-1]!=parent) dirty[pnum++] = parent;
+        }
+        for(counter_t i=0; i<pnum; i+=MERKLE_BATCH) {
+            const counter_t n = (pnum-i<MERKLE_BATCH)? pnum-i: MERKLE_BATCH;
+            for(counter_t k=0; k<n; ++k) { /* the children are in the same page: 2*parent is even. */
+                const byte_t *child = fs_merkle_getnodeptr(mp, l, dirty[i+k]*2);
+                if(!child) return fs_free(dirty, fs_free(out, fs_free(in, b_false)));
+                memcpy(in+k*MERKLE_HASH_SIZE*2, child, MERKLE_HASH_SIZE*2);
+            }
+            fs_merkle_parents(out, in, n, l);
+            for(counter_t k=0; k<n; ++k) {
+                if(!fs_merkle_setnode(mp, l+1, dirty[i+k], out+k*MERKLE_HASH_SIZE)) return fs_free(dirty, fs_free(out, fs_free(in, b_false)));
+            }
+        }
+        num = pnum;
+    }
+    fs_free(dirty, fs_free(out, fs_free(in, b_true)));
+    if(!fs_merkle_flush(mp)) return b_false;
+    if(!fs_merkle_writeheader(mp)) return b_false;
+    if(!fs_merkle_getroot(mp, bpb->hash)) return b_false;
+    mp->dirty_num = 0;
+    if(0<mp->old_clusters) { /* the header has the new area now */
+        if(!fs_cluster_erasebitmap(mp->bp, mp->bpb, mp->old_area, mp->old_clusters)) return fs_merkle_seterror(mp, MERKLE_ERROR_DRIVE_RW_FAILURE);
+        mp->old_clusters = 0;
+    }
+    return fs_merkle_setsuccess(mp);
+}
+
+/* full rebuild of the root from the leaves, on memory. (for a check, fs_merkle_parents can hash in place) */
+static inline bool_t fs_merkle_rebuild(FSMERKLE *mp, byte_t *hash) {
+    const counter_t leaves = mp->capacity;
+    byte_t *level = fs_malloc((fsize_t)(leaves*MERKLE_HASH_SIZE));
+    if(!level) return fs_merkle_seterror(mp, MERKLE_ERROR_MEMORY_ALLOCATE_FAILURE);
+    for(counter_t i=0; i<leaves; ++i) {
+        if(!fs_merkle_getnode(mp, 0, i, level+i*MERKLE_HASH_SIZE)) return fs_free(level, b_false);
+    }
+    index_t l = 0;
+    for(counter_t n=leaves; 1<n; n>>=1) fs_merkle_parents(level, level, n>>1, l++);
+    memcpy(hash, level, MERKLE_HASH_SIZE);
+    return fs_free(level, fs_merkle_setsuccess(mp));
+}
+
+/*
+* MERKLE_PROOF: leaves index (sorted, unique) and their hashes, and the sibling nodes in the order of verification:
+* level 0, 1, ... and in each level, left to right. (fs_merkle_prove allocates it, fs_merkle_proof_free)
+*/
+typedef struct _tag_MERKLE_PROOF {
+    counter_t capacity; /* Note: not trusted by fs_merkle_verify */
+    counter_t num;
+    counter_t *index;
+    byte_t *leaf;
+    counter_t hash_num;
+    byte_t *hash;
+} MERKLE_PROOF;
+
+/*
+* Walk the paths of pos[num] (sorted, unique) up to the root, pos is overwritten.
+* The sibling that is not on the other paths is needed, hash==NULL: only counted.
+*/
+static inline bool_t fs_merkle_proof_walk(FSMERKLE *mp, counter_t *pos, counter_t num, byte_t *hash, counter_t *count) {
+    *count = 0;
+    for(index_t l=0; l<mp->height; ++l) {
+        counter_t pnum = 0;
+        for(counter_t i=0; i<num; ++i) {
+            const counter_t sibling = pos[i]^1;
+            if(i+1<num && pos[i+1]==sibling) ++i; /* both children are known */
+            else {
+                if(hash && !fs_merkle_getnode(mp, l, sibling, hash+(*count)*MERKLE_HASH_SIZE)) return b_false;
+                ++(*count);
+            }
+            pos[pnum++] = pos[i]>>1;
+        }
+        num = pnum;
+    }
+    return b_true;
+}
+
+static inline void fs_merkle_proof_free(MERKLE_PROOF *proof) {
+    fs_free(proof, b_true);
+}
+
+/* the committed tree only. index: num leaves, any order and may be repeated. */
+static inline bool_t fs_merkle_prove(FSMERKLE *mp, const counter_t *index, counter_t num, MERKLE_PROOF **proof) {
+    *proof = NULL;
+    if(num<=0 || 0<mp->dirty_num) return fs_merkle_seterror(mp, MERKLE_ERROR_PARAM);
+    counter_t *pos = (counter_t *)fs_malloc((fsize_t)(sizeof(counter_t)*num));
+    if(!pos) return fs_merkle_seterror(mp, MERKLE_ERROR_MEMORY_ALLOCATE_FAILURE);
+    memcpy(pos, index, (size_t)(sizeof(counter_t)*num));
+    qsort(pos, (size_t)num, sizeof(counter_t), fs_merkle_cmp);
+    counter_t unique = 0;
+    for(counter_t i=0; i<num; ++i) {
+        if(pos[i]<0 || mp->capacity<=pos[i]) return fs_free(pos, fs_merkle_seterror(mp, MERKLE_ERROR_PARAM));
+        if(unique==0 || pos[unique-1]!=pos[i]) pos[unique++] = pos[i];
+    }
+    num = unique;
+    counter_t *work = (counter_t *)fs_malloc((fsize_t)(sizeof(counter_t)*num));
+    if(!work) return fs_free(pos, fs_merkle_seterror(mp, MERKLE_ERROR_MEMORY_ALLOCATE_FAILURE));
+    memcpy(work, pos, (size_t)(sizeof(counter_t)*num));
+    counter_t hash_num;
+    fs_merkle_proof_walk(mp, work, num, NULL, &hash_num);
+
+    /* one block: MERKLE_PROOF, index, leaf, hash */
+    const size_t size = sizeof(MERKLE_PROOF)+sizeof(counter_t)*(size_t)num+MERKLE_HASH_SIZE*(size_t)(num+hash_num);
+    MERKLE_PROOF *pp = (MERKLE_PROOF *)fs_malloc((fsize_t)size);
+    if(!pp) return fs_free(work, fs_free(pos, fs_merkle_seterror(mp, MERKLE_ERROR_MEMORY_ALLOCATE_FAILURE)));
+    pp->capacity = mp->capacity;
+    pp->num = num;
+    pp->index = (counter_t *)(pp+1);
+    pp->leaf = (byte_t *)(pp->index+num);
+    pp->hash_num = hash_num;
+    pp->hash = pp->leaf+num*MERKLE_HASH_SIZE;
+    memcpy(pp->index, pos, (size_t)(sizeof(counter_t)*num));
+    for(counter_t i=0; i<num; ++i) {
+        if(!fs_merkle_getnode(mp, 0, pos[i], pp->leaf+i*MERKLE_HASH_SIZE)) {
+            fs_merkle_proof_free(pp);
+            return fs_free(work, fs_free(pos, b_false));
+        }
+    }
+    memcpy(work, pos, (size_t)(sizeof(counter_t)*num));
+    if(!fs_merkle_proof_walk(mp, work, num, pp->hash, &hash_num)) {
+        fs_merkle_proof_free(pp);
+        return fs_free(work, fs_free(pos, b_false));
+    }
+    *proof = pp;
+    return fs_free(work, fs_free(pos, fs_merkle_setsuccess(mp)));
+}
+
+/*
+* Recompute the root from the leaves and the siblings: each level is one fs_merkle_parents batch.
+* capacity: from the trusted header with the root, (fs_merkle_getcapacity) it gives the height.
+* Returns b_false if the proof is broken (memory allocation failure also b_false), or the root does not match.
+*/
+static inline bool_t fs_merkle_verify(const MERKLE_PROOF *proof, counter_t capacity, const byte_t *root) {
+    const counter_t num = proof->num;
+    const index_t height = fs_merkle_getheightof(capacity);
+    if(num<=0 || height<0 || proof->capacity!=capacity) return b_false;
+    counter_t *pos = (counter_t *)fs_malloc((fsize_t)(sizeof(counter_t)*num));
+    byte_t *node = fs_malloc((fsize_t)(num*MERKLE_HASH_SIZE));
+    byte_t *pair = fs_malloc((fsize_t)(num*MERKLE_HASH_SIZE*2));
+    if(!pos || !node || !pair) return fs_free(pair, fs_free(node, fs_free(pos, b_false)));
+    for(counter_t i=0; i<num; ++i) {
+        if(proof->index[i]<0 || capacity<=proof->index[i] || (0<i && proof->index[i]<=proof->index[i-1])) return fs_free(pair, fs_free(node, fs_free(pos, b_false)));
+    }
+    memcpy(pos, proof->index, (size_t)(sizeof(counter_t)*num));
+    memcpy(node, proof->leaf, (size_t)(num*MERKLE_HASH_SIZE));
+    counter_t n = num, used = 0;
+    for(index_t l=0; l<height; ++l) {
+        counter_t pnum = 0;
+        for(counter_t i=0; i<n; ++i) {
+            const byte_t *left, *right;
+            if(i+1<n && pos[i+1]==(pos[i]^1)) {
+                left = node+i*MERKLE_HASH_SIZE;
+                right = node+(i+1)*MERKLE_HASH_SIZE;
+                ++i;
+            } else {
+                if(proof->hash_num<=used) return fs_free(pair, fs_free(node, fs_free(pos, b_false)));
+                const byte_t *sibling = proof->hash+(used++)*MERKLE_HASH_SIZE;
+                left = (pos[i]&1)? sibling: node+i*MERKLE_HASH_SIZE;
+                right = (pos[i]&1)? node+i*MERKLE_HASH_SIZE: sibling;
+            }
+            memcpy(pair+pnum*MERKLE_HASH_SIZE*2, left, MERKLE_HASH_SIZE);
+            memcpy(pair+pnum*MERKLE_HASH_SIZE*2+MERKLE_HASH_SIZE, right, MERKLE_HASH_SIZE);
+            pos[pnum++] = pos[i]>>1;
+        }
+        fs_merkle_parents(node, pair, pnum, l);
+        n = pnum;
+    }
+    const bool_t ret = (n==1 && used==proof->hash_num && memcmp(node, root, MERKLE_HASH_SIZE)==0)? b_true: b_false;
+    return fs_free(pair, fs_free(node, fs_free(pos, ret)));
+}
+
+typedef struct _tag_MERKLE_VERIFYJOB {
+    const MERKLE_PROOF *const *proof;
+    counter_t num;
+    counter_t capacity;
+    const byte_t *root;
+    bool_t *result;
+} MERKLE_VERIFYJOB;
+
+static inline void fs_merkle_verifyjob(void *arg, index_t worker, num_t workers) {
+    const MERKLE_VERIFYJOB *job = (const MERKLE_VERIFYJOB *)arg;
+    for(counter_t i=worker; i<job->num; i+=workers) job->result[i] = fs_merkle_verify(job->proof[i], job->capacity, job->root);
+}
+
+/* num proofs against the same root (and its capacity), result[i]: each proof. Returns b_true if all are valid. */
+static inline bool_t fs_merkle_verify_batch(const MERKLE_PROOF *const *proof, counter_t num, counter_t capacity, const byte_t *root, bool_t *result) {
+    MERKLE_VERIFYJOB job;
+    job.proof = proof;
+    job.num = num;
+    job.capacity = capacity;
+    job.root = root;
+    job.result = result;
+    num_t workers = fs_thread_getcpus();
+    if(num<workers) workers = (num_t)num;
+    fs_sha256_initimpl(); /* before the workers */
+    fs_thread_parallel(workers, fs_merkle_verifyjob, &job);
+    bool_t ret = b_true;
+    for(counter_t i=0; i<num; ++i) ret = ret && result[i];
+    return ret;
+}
+
+#endif
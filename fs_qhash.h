@@ -0,0 +1,210 @@
+// Copyright (c) 2020 The SorachanCoin Developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SORACHANCOIN_FS_QHASH
+#define SORACHANCOIN_FS_QHASH
+
+#include "fs_const.h"
+#include "fs_memory.h"
+#include "fs_types.h"
+#include "fs_endian.h"
+#include "fs_sha256.h"
+#include "fs_thread.h"
+#include "fs_cluster.h"
+
+/*
+* ** fs_qhash **
+*
+* ver2 QHASH65536: the wide hash in BPB.qhash and BPT.qhash. (bpt_ver2)
+* 256 lanes of SHA256, 32 bytes each, 8KB in all. The data is cut into 64 bytes blocks,
+* and block j goes to lane j%256: lane l is the SHA256 of the blocks l, l+256, l+512, ... (the last partial block too)
+* So a broken block is found in its lane, without hashing again.
+*
+* A row (256 blocks, 16KB) is one block for every lane, the lanes are hashed by the multi-buffer
+* Transform (fs_sha256_gettransform_multi), and the chunks of lanes by worker threads.
+*
+*/
+
+#define QHASH_LANES 256
+#define QHASH_SIZE (32*QHASH_LANES)
+#define QHASH_ROW (64*QHASH_LANES) /* 16KB */
+#define QHASH_CHUNK_LANES SHA256_MULTI_LANES_MAX /* lanes of one job */
+#define QHASH_THREAD_ROWS 64 /* less than 1MB: no threads */
+#define QHASH_READ_CLUSTERS (4*QHASH_THREAD_ROWS*QHASH_ROW/BYTES_PER_CLUSTER) /* fs_qhash_cluster reads 4MB at once. */
+
+typedef enum _tag_qhash_status {
+    QHASH_SUCCESS = 0,
+    QHASH_ERROR_MEMORY_ALLOCATE_FAILURE = 1,
+    QHASH_ERROR_DRIVE_RW_FAILURE = 2,
+} qhash_status;
+
+typedef struct _tag_FSQHASH {
+    byte_t qhash[QHASH_SIZE];
+    uint32_t s[QHASH_LANES][8];
+    byte_t buf[QHASH_ROW];
+    uint64_t bytes;
+    sha256_multi multi; /* fs_sha256_getmulti, or fs_qhash_setmulti */
+    qhash_status status;
+} FSQHASH;
+
+typedef struct _tag_QHASH_JOB {
+    FSQHASH *qp;
+    const byte_t *data;
+    counter_t rows;
+    sha256_multi multi;
+} QHASH_JOB;
+
+static inline bool_t fs_qhash_setsuccess(FSQHASH *qp) {
+    qp->status = QHASH_SUCCESS;
+    return b_true;
+}
+
+static inline bool_t fs_qhash_seterror(FSQHASH *qp, qhash_status status) {
+    qp->status = status;
+    return b_false;
+}
+
+static inline qhash_status fs_qhash_getstatus(FSQHASH *qp) {
+    return qp->status;
+}
+
+static inline byte_t *fs_qhash_gethash(FSQHASH *qp) {
+    return qp->qhash;
+}
+
+static inline bool_t fs_qhash_init(FSQHASH *qp) {
+    for(index_t l=0; l<QHASH_LANES; ++l) memcpy(qp->s[l], fs_sha256_H0, sizeof(qp->s[l]));
+    memset(qp->qhash, 0x00, sizeof(qp->qhash));
+    qp->bytes = 0;
+    qp->multi = fs_sha256_getmulti(); /* also the autodetect of fs_sha256_transform, before the workers. */
+    return fs_qhash_setsuccess(qp);
+}
+
+static inline bool_t fs_qhash_setmulti(FSQHASH *qp, sha256_multi multi) { /* sha256_multi_none: fs_sha256_transform one lane at a time. */
+    index_t lanes;
+    if(multi!=sha256_multi_none && !fs_sha256_gettransform_multi(multi, &lanes)) return b_false;
+    qp->multi = multi;
+    return b_true;
+}
+
+static inline bool_t fs_qhash_open(FSQHASH **qp) {
+    *qp = (FSQHASH *)fs_malloc(sizeof(FSQHASH));
+    if(!*qp) return b_false;
+    return fs_qhash_init(*qp);
+}
+
+static inline bool_t fs_qhash_close(FSQHASH *qp, bool_t ret) {
+    return fs_free(qp, ret);
+}
+
+/* rows: lane l reads data+r*QHASH_ROW+l*64. chunk: QHASH_CHUNK_LANES lanes, worker, worker+workers, ... */
+static inline void fs_qhash_job(void *arg, index_t worker, num_t workers) {
+    const QHASH_JOB *job = (const QHASH_JOB *)arg;
+    index_t lanes;
+    const sha256_transform_multi_t transform = fs_sha256_gettransform_multi(job->multi, &lanes);
+    for(index_t chunk=worker*QHASH_CHUNK_LANES; chunk<QHASH_LANES; chunk+=workers*QHASH_CHUNK_LANES) {
+        if(transform) {
+            uint32_t state[8*SHA256_MULTI_LANES_MAX];
+            const byte_t *ptr[SHA256_MULTI_LANES_MAX];
+            for(index_t first=chunk; first<chunk+QHASH_CHUNK_LANES; first+=lanes) {
+                for(index_t l=0; l<lanes; ++l) { /* [8 words][lanes] */
+                    for(index_t i=0; i<8; ++i) state[i*lanes+l] = job->qp->s[first+l][i];
+                }
+                for(counter_t r=0; r<job->rows; ++r) {
+                    for(index_t l=0; l<lanes; ++l) ptr[l] = job->data+r*QHASH_ROW+(first+l)*64;
+                    transform(state, ptr, 1);
+                }
+                for(index_t l=0; l<lanes; ++l) {
+                    for(index_t i=0; i<8; ++i) job->qp->s[first+l][i] = state[i*lanes+l];
+                }
+            }
+        } else { /* one lane at a time: fs_sha256_transform (e.g. SHA-NI) */
+            for(index_t lane=chunk; lane<chunk+QHASH_CHUNK_LANES; ++lane) {
+                for(counter_t r=0; r<job->rows; ++r) fs_sha256_transform(job->qp->s[lane], job->data+r*QHASH_ROW+lane*64, 1);
+            }
+        }
+    }
+}
+
+static inline void fs_qhash_rows(FSQHASH *qp, const byte_t *data, counter_t rows) {
+    QHASH_JOB job;
+    job.qp = qp;
+    job.data = data;
+    job.rows = rows;
+    job.multi = qp->multi;
+    num_t workers = (rows<QHASH_THREAD_ROWS)? 1: fs_thread_getcpus();
+    if(QHASH_LANES/QHASH_CHUNK_LANES<workers) workers = QHASH_LANES/QHASH_CHUNK_LANES;
+    fs_thread_parallel(workers, fs_qhash_job, &job);
+    qp->bytes += (uint64_t)rows*QHASH_ROW;
+}
+
+static inline bool_t fs_qhash_update(FSQHASH *qp, counter_t num, const byte_t *data) {
+    size_t bufsize = (size_t)(qp->bytes % QHASH_ROW);
+    if(bufsize) { /* fill the row buffer */
+        const size_t n = ((counter_t)(QHASH_ROW-bufsize)<num)? QHASH_ROW-bufsize: (size_t)num;
+        memcpy(qp->buf+bufsize, data, n);
+        data += n;
+        num -= (counter_t)n;
+        if(bufsize+n<QHASH_ROW) {
+            qp->bytes += n;
+            return fs_qhash_setsuccess(qp);
+        }
+        qp->bytes -= bufsize;
+        fs_qhash_rows(qp, qp->buf, 1);
+    }
+    if(QHASH_ROW<=num) {
+        const counter_t rows = num/QHASH_ROW;
+        fs_qhash_rows(qp, data, rows);
+        data += rows*QHASH_ROW;
+        num -= rows*QHASH_ROW;
+    }
+    if(0<num) {
+        memcpy(qp->buf, data, (size_t)num);
+        qp->bytes += num;
+    }
+    return fs_qhash_setsuccess(qp);
+}
+
+/* the rest of the last row: lane l takes the block l of it, and the partial block goes to the next lane. */
+static inline bool_t fs_qhash_final(FSQHASH *qp) {
+    const counter_t rest = (counter_t)(qp->bytes % QHASH_ROW);
+    const uint64_t rowbytes = (qp->bytes/QHASH_ROW)*64; /* each lane */
+    for(index_t l=0; l<QHASH_LANES; ++l) {
+        FSSHA256 ctx;
+        memcpy(ctx.s, qp->s[l], sizeof(ctx.s));
+        ctx.bytes = rowbytes;
+        const counter_t offset = (counter_t)l*64;
+        if(offset<rest) fs_sha256_update(&ctx, (rest-offset<64)? rest-offset: 64, qp->buf+offset);
+        fs_sha256_final(&ctx);
+        memcpy(qp->qhash+32*l, ctx.hash, 32);
+    }
+    return fs_qhash_setsuccess(qp);
+}
+
+/* one-shot: qhash must be QHASH_SIZE bytes. */
+static inline bool_t fs_qhash_digest(const byte_t *data, counter_t num, byte_t *qhash) {
+    FSQHASH *qp;
+    if(!fs_qhash_open(&qp)) return b_false;
+    fs_qhash_update(qp, num, data);
+    fs_qhash_final(qp);
+    memcpy(qhash, qp->qhash, QHASH_SIZE);
+    return fs_qhash_close(qp, b_true);
+}
+
+/* qhash of the clusters [begin, begin+num), e.g. to BPB.qhash. */
+static inline bool_t fs_qhash_cluster(FSQHASH *qp, FSBITMAP *bp, const BPB *bpb, cluster_t begin, counter_t num, byte_t *qhash) {
+    byte_t *buf = fs_malloc(QHASH_READ_CLUSTERS*BYTES_PER_CLUSTER);
+    if(!buf) return fs_qhash_seterror(qp, QHASH_ERROR_MEMORY_ALLOCATE_FAILURE);
+    fs_qhash_init(qp);
+    for(counter_t offset=0; offset<num; offset+=QHASH_READ_CLUSTERS) {
+        const counter_t rnum = (offset+QHASH_READ_CLUSTERS<num)? QHASH_READ_CLUSTERS: num-offset;
+        if(!fs_cluster_diskread(bp, bpb, begin+offset, rnum, buf)) return fs_free(buf, fs_qhash_seterror(qp, QHASH_ERROR_DRIVE_RW_FAILURE));
+        fs_qhash_update(qp, rnum*BYTES_PER_CLUSTER, buf);
+    }
+    fs_qhash_final(qp);
+    memcpy(qhash, qp->qhash, QHASH_SIZE);
+    return fs_free(buf, fs_qhash_setsuccess(qp));
+}
+
+#endif
@@ -10,10 +10,12 @@
 #include "fs_const.h"
 #include "fs_memory.h"
 #include "fs_endian.h"
+#include "fs_cpu.h"
 
 typedef enum _tag_sha256_status {
     SHA256_SUCCESS = 0,
     SHA256_ERROR_MEMORY_ALLOCATE_FAILURE = 1,
+    SHA256_ERROR_BROKEN = 2,
 } sha256_status;
 
 typedef struct _tag_FSSHA256 {
@@ -143,6 +145,114 @@ static inline void Transform(uint32_t *s, const byte_t *chunk, size_t blocks)
     }
 }
 
+/*
+* Transform variants: the scalar one above, SHA-NI and ARMv8.
+* fs_sha256_initimpl chooses fs_sha256_transform once at startup, before the threads, from what the CPU supports,
+* and fs_sha256_setimpl overrides it. The choice is one for all the translation units and is published atomically,
+* so the first hash chooses it too if fs_sha256_initimpl was not called.
+*/
+static const uint32_t fs_sha256_K[64] = {
+    0x428a2f98ul, 0x71374491ul, 0xb5c0fbcful, 0xe9b5dba5ul, 0x3956c25bul, 0x59f111f1ul, 0x923f82a4ul, 0xab1c5ed5ul,
+    0xd807aa98ul, 0x12835b01ul, 0x243185beul, 0x550c7dc3ul, 0x72be5d74ul, 0x80deb1feul, 0x9bdc06a7ul, 0xc19bf174ul,
+    0xe49b69c1ul, 0xefbe4786ul, 0x0fc19dc6ul, 0x240ca1ccul, 0x2de92c6ful, 0x4a7484aaul, 0x5cb0a9dcul, 0x76f988daul,
+    0x983e5152ul, 0xa831c66dul, 0xb00327c8ul, 0xbf597fc7ul, 0xc6e00bf3ul, 0xd5a79147ul, 0x06ca6351ul, 0x14292967ul,
+    0x27b70a85ul, 0x2e1b2138ul, 0x4d2c6dfcul, 0x53380d13ul, 0x650a7354ul, 0x766a0abbul, 0x81c2c92eul, 0x92722c85ul,
+    0xa2bfe8a1ul, 0xa81a664bul, 0xc24b8b70ul, 0xc76c51a3ul, 0xd192e819ul, 0xd6990624ul, 0xf40e3585ul, 0x106aa070ul,
+    0x19a4c116ul, 0x1e376c08ul, 0x2748774cul, 0x34b0bcb5ul, 0x391c0cb3ul, 0x4ed8aa4aul, 0x5b9cca4ful, 0x682e6ff3ul,
+    0x748f82eeul, 0x78a5636ful, 0x84c87814ul, 0x8cc70208ul, 0x90befffaul, 0xa4506cebul, 0xbef9a3f7ul, 0xc67178f2ul,
+};
+
+static const uint32_t fs_sha256_H0[8] = {
+    0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul, 0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul,
+};
+
+/* K+W of the padding block of a 64 bytes message: the second block of fs_sha256d64 is constant. */
+static const uint32_t fs_sha256d64_KW[64] = {
+    0xc28a2f98ul, 0x71374491ul, 0xb5c0fbcful, 0xe9b5dba5ul, 0x3956c25bul, 0x59f111f1ul, 0x923f82a4ul, 0xab1c5ed5ul,
+    0xd807aa98ul, 0x12835b01ul, 0x243185beul, 0x550c7dc3ul, 0x72be5d74ul, 0x80deb1feul, 0x9bdc06a7ul, 0xc19bf374ul,
+    0x649b69c1ul, 0xf0fe4786ul, 0x0fe1edc6ul, 0x240cf254ul, 0x4fe9346ful, 0x6cc984beul, 0x61b9411eul, 0x16f988faul,
+    0xf2c65152ul, 0xa88e5a6dul, 0xb019fc65ul, 0xb9d99ec7ul, 0x9a1231c3ul, 0xe70eeaa0ul, 0xfdb1232bul, 0xc7353eb0ul,
+    0x3069bad5ul, 0xcb976d5ful, 0x5a0f118ful, 0xdc1eeefdul, 0x0a35b689ul, 0xde0b7a04ul, 0x58f4ca9dul, 0xe15d5b16ul,
+    0x007f3e86ul, 0x37088980ul, 0xa507ea32ul, 0x6fab9537ul, 0x17406110ul, 0x0d8cd6f1ul, 0xcdaa3b6dul, 0xc0bbbe37ul,
+    0x83613bdaul, 0xdb48a363ul, 0x0b02e931ul, 0x6fd15ca7ul, 0x521afacaul, 0x31338431ul, 0x6ed41a95ul, 0x6d437890ul,
+    0xc39c91f2ul, 0x9eccabbdul, 0xb5c9a0e6ul, 0x532fb63cul, 0xd2c741c6ul, 0x07237ea3ul, 0xa4954b68ul, 0x4c191d76ul,
+};
+
+#include "fs_sha256_shani.h"
+#include "fs_sha256_armv8.h"
+#include "fs_sha256_sse41.h"
+#include "fs_sha256_avx2.h"
+#include "fs_sha256_avx512.h"
+
+typedef enum _tag_sha256_impl {
+    sha256_impl_scalar = 0,
+    sha256_impl_shani = 1,
+    sha256_impl_armv8 = 2,
+    sha256_impl_max = 3,
+} sha256_impl;
+
+typedef void (*sha256_transform_t)(uint32_t *s, const byte_t *chunk, size_t blocks);
+
+static inline sha256_transform_t fs_sha256_gettransform(sha256_impl impl) { /* NULL: not built in, or the CPU does not support. */
+    switch(impl) {
+    case sha256_impl_scalar:
+        return Transform;
+#ifdef FS_SHA256_SHANI
+    case sha256_impl_shani:
+        return fs_cpu_has(CPU_SHANI)? TransformSHANI: NULL;
+#endif
+#ifdef FS_SHA256_ARMV8
+    case sha256_impl_armv8:
+        return fs_cpu_has(CPU_ARMV8_SHA2)? TransformARMV8: NULL;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+FS_SHARED void *volatile fs_sha256_transform_ptr = NULL; /* sha256_transform_t, NULL: not chosen yet */
+FS_SHARED volatile counter_t fs_sha256_impl_index = sha256_impl_scalar;
+
+static inline bool_t fs_sha256_setimpl(sha256_impl impl) {
+    const sha256_transform_t transform = fs_sha256_gettransform(impl);
+    if(!transform) return b_false;
+    fs_atomic_store(&fs_sha256_impl_index, impl);
+    fs_atomic_storeptr(&fs_sha256_transform_ptr, (void *)transform);
+    return b_true;
+}
+
+static inline sha256_impl fs_sha256_autodetect() { /* the fastest variant */
+    index_t impl = sha256_impl_max-1;
+    while(0<impl && !fs_sha256_gettransform((sha256_impl)impl)) --impl;
+    fs_sha256_setimpl((sha256_impl)impl);
+    return (sha256_impl)impl;
+}
+
+/* once at startup, before the threads: the CPU features and the fastest Transform (if not set by fs_sha256_setimpl) */
+static inline void fs_sha256_initimpl() {
+    fs_cpu_init();
+    if(!fs_atomic_loadptr(&fs_sha256_transform_ptr)) fs_sha256_autodetect();
+}
+
+static inline sha256_impl fs_sha256_getimpl() {
+    fs_sha256_initimpl();
+    return (sha256_impl)fs_atomic_load(&fs_sha256_impl_index);
+}
+
+static inline const char *fs_sha256_getimplname(sha256_impl impl) {
+    static const char *name[sha256_impl_max] = { "scalar", "shani", "armv8" };
+    return (0<=impl && impl<sha256_impl_max)? name[impl]: "unknown";
+}
+
+static inline void fs_sha256_transform(uint32_t *s, const byte_t *chunk, size_t blocks) {
+    sha256_transform_t transform = (sha256_transform_t)fs_atomic_loadptr(&fs_sha256_transform_ptr);
+    if(!transform) {
+        fs_sha256_initimpl();
+        transform = (sha256_transform_t)fs_atomic_loadptr(&fs_sha256_transform_ptr);
+    }
+    transform(s, chunk, blocks);
+}
+
 static inline bool_t fs_sha256_setsuccess(FSSHA256 *sp) {
     sp->status = SHA256_SUCCESS;
     return b_true;
@@ -186,12 +296,12 @@ static inline bool_t fs_sha256_update(FSSHA256 *sp, counter_t num, const byte_t
         memcpy(sp->buf + bufsize, data, 64 - bufsize);
         sp->bytes += 64 - bufsize;
         data += 64 - bufsize;
-        Transform(sp->s, sp->buf, 1);
+        fs_sha256_transform(sp->s, sp->buf, 1);
         bufsize = 0;
     }
     if(end - data >= 64) {
         size_t blocks = (end - data) / 64;
-        Transform(sp->s, data, blocks);
+        fs_sha256_transform(sp->s, data, blocks);
         data += 64 * blocks;
         sp->bytes += 64 * blocks;
     }
@@ -220,6 +330,246 @@ static inline bool_t fs_sha256_final(FSSHA256 *sp) {
     return fs_sha256_setsuccess(sp);
 }
 
+/*
+* midstate: the running state between fs_sha256_update calls, to continue hashing later. (e.g. after a restart)
+* [SHAM][bytes(LE64)][s(BE32 * 8)][buf(64)], the unused part of buf is 0.
+*/
+#define SHA256_MIDSTATE_SIGNATURE "SHAM"
+#define SHA256_MIDSTATE_SIZE 108
+
+static inline void fs_sha256_savestate(const FSSHA256 *sp, byte_t *midstate) {
+    memcpy(midstate, SHA256_MIDSTATE_SIGNATURE, 4);
+    WriteLE64(midstate + 4, sp->bytes);
+    for(int i = 0; i < 8; ++i) WriteBE32(midstate + 12 + 4 * i, sp->s[i]);
+    memset(midstate + 44, 0x00, 64);
+    memcpy(midstate + 44, sp->buf, (size_t)(sp->bytes % 64));
+}
+
+static inline bool_t fs_sha256_loadstate(FSSHA256 *sp, const byte_t *midstate) {
+    if(memcmp(midstate, SHA256_MIDSTATE_SIGNATURE, 4) != 0) return fs_sha256_seterror(sp, SHA256_ERROR_BROKEN);
+    sp->bytes = ReadLE64(midstate + 4);
+    for(int i = 0; i < 8; ++i) sp->s[i] = ReadBE32(midstate + 12 + 4 * i);
+    memcpy(sp->buf, midstate + 44, 64);
+    memset(sp->hash, 0x00, sizeof(sp->hash));
+    return fs_sha256_setsuccess(sp);
+}
+
+/* one-shot: hash must be 32 bytes. */
+static inline void fs_sha256_digest(const byte_t *data, counter_t num, byte_t *hash) {
+    FSSHA256 ctx;
+    fs_sha256_init(&ctx);
+    fs_sha256_update(&ctx, num, data);
+    fs_sha256_final(&ctx);
+    memcpy(hash, ctx.hash, sizeof(ctx.hash));
+}
+
+/*
+* Multi-buffer: many messages of the same size, one message per SIMD lane. (AVX-512: 16, AVX2: 8)
+* For cluster hashing and Merkle leaves, where the sizes are uniform.
+*/
+#define SHA256_MULTI_LANES_MAX 16
+
+typedef enum _tag_sha256_multi {
+    sha256_multi_none = 0,
+    sha256_multi_sse41 = 1,
+    sha256_multi_avx2 = 2,
+    sha256_multi_avx512 = 3,
+    sha256_multi_max = 4,
+} sha256_multi;
+
+typedef void (*sha256_transform_multi_t)(uint32_t *state, const byte_t *const *data, size_t blocks);
+
+static inline sha256_transform_multi_t fs_sha256_gettransform_multi(sha256_multi multi, index_t *lanes) { /* NULL: not built in, or the CPU does not support. */
+    switch(multi) {
+#ifdef FS_SHA256_SSE41
+    case sha256_multi_sse41:
+        *lanes = SHA256_SSE41_LANES;
+        return fs_cpu_has(CPU_SSE41)? TransformSSE41x4: NULL;
+#endif
+#ifdef FS_SHA256_AVX2
+    case sha256_multi_avx2:
+        *lanes = SHA256_AVX2_LANES;
+        return fs_cpu_has(CPU_AVX2)? TransformAVX2x8: NULL;
+#endif
+#ifdef FS_SHA256_AVX512
+    case sha256_multi_avx512:
+        *lanes = SHA256_AVX512_LANES;
+        return fs_cpu_has(CPU_AVX512F)? TransformAVX512x16: NULL;
+#endif
+    default:
+        *lanes = 1;
+        return NULL;
+    }
+}
+
+static inline sha256_multi fs_sha256_getmulti() { /* Note: SHA-NI one by one is faster than AVX2 8 lanes, but not than AVX-512 16 lanes. */
+    index_t lanes;
+    if(fs_sha256_gettransform_multi(sha256_multi_avx512, &lanes)) return sha256_multi_avx512;
+    if(fs_sha256_getimpl()!=sha256_impl_scalar) return sha256_multi_none;
+    if(fs_sha256_gettransform_multi(sha256_multi_avx2, &lanes)) return sha256_multi_avx2;
+    return fs_sha256_gettransform_multi(sha256_multi_sse41, &lanes)? sha256_multi_sse41: sha256_multi_none;
+}
+
+/* data: lanes messages of size bytes, hash: lanes*32 bytes. */
+static inline void fs_sha256_digest_lanes(sha256_transform_multi_t transform, index_t lanes, const byte_t *const *data, counter_t size, byte_t *hash) {
+    static const uint32_t init[8] = {
+        0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul, 0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul
+    };
+    uint32_t state[8*SHA256_MULTI_LANES_MAX];
+    byte_t tail[SHA256_MULTI_LANES_MAX][128];
+    const byte_t *ptr[SHA256_MULTI_LANES_MAX];
+    for(index_t i=0; i<8; ++i) {
+        for(index_t l=0; l<lanes; ++l) state[i*lanes+l] = init[i];
+    }
+    transform(state, data, (size_t)(size/64));
+    const size_t rest = (size_t)(size%64), tblocks = (rest<56)? 1: 2;
+    for(index_t l=0; l<lanes; ++l) { /* padding: the same length, so the same for every lane. */
+        memcpy(tail[l], data[l]+(size-rest), rest);
+        tail[l][rest] = 0x80;
+        memset(tail[l]+rest+1, 0x00, tblocks*64-8-rest-1);
+        WriteBE64(tail[l]+tblocks*64-8, (uint64_t)size<<3);
+        ptr[l] = tail[l];
+    }
+    transform(state, ptr, tblocks);
+    for(index_t l=0; l<lanes; ++l) {
+        for(index_t i=0; i<8; ++i) WriteBE32(hash+32*l+4*i, state[i*lanes+l]);
+    }
+}
+
+/* data: num messages of size bytes, hash: num*32 bytes. */
+static inline void fs_sha256_digest_multi2(sha256_multi multi, const byte_t *const *data, index_t num, counter_t size, byte_t *hash) {
+    index_t lanes;
+    const sha256_transform_multi_t transform = fs_sha256_gettransform_multi(multi, &lanes);
+    index_t i=0;
+    if(transform) {
+        for(; i+lanes<=num; i+=lanes) fs_sha256_digest_lanes(transform, lanes, data+i, size, hash+32*i);
+        if(lanes/4<=num-i && i<num) { /* the rest fills the lanes with the last message. */
+            const byte_t *ptr[SHA256_MULTI_LANES_MAX];
+            byte_t tmp[32*SHA256_MULTI_LANES_MAX];
+            for(index_t l=0; l<lanes; ++l) ptr[l] = data[(i+l<num)? i+l: num-1];
+            fs_sha256_digest_lanes(transform, lanes, ptr, size, tmp);
+            memcpy(hash+32*i, tmp, (size_t)(32*(num-i)));
+            i = num;
+        }
+    }
+    for(; i<num; ++i) fs_sha256_digest(data[i], size, hash+32*i);
+}
+
+static inline void fs_sha256_digest_multi(const byte_t *const *data, index_t num, counter_t size, byte_t *hash) {
+    fs_sha256_digest_multi2(fs_sha256_getmulti(), data, num, size, hash);
+}
+
+/* num messages of size bytes, one after another in buf. (e.g. clusters) */
+static inline void fs_sha256_digest_array(const byte_t *buf, index_t num, counter_t size, byte_t *hash) {
+    const byte_t *ptr[SHA256_MULTI_LANES_MAX*4];
+    for(index_t i=0; i<num; i+=ARRAYLEN(ptr)) {
+        const index_t n = (num-i<(index_t)ARRAYLEN(ptr))? num-i: (index_t)ARRAYLEN(ptr);
+        for(index_t k=0; k<n; ++k) ptr[k] = buf+(i+k)*size;
+        fs_sha256_digest_multi(ptr, n, size, hash+32*i);
+    }
+}
+
+/*
+* fs_sha256d64: SHA256(SHA256(x)) of many 64 bytes inputs. (Merkle inner node: two 32 bytes children)
+* No buffering of fs_sha256_update/fs_sha256_final: the padding block is constant, so its K+W is precomputed,
+* and the second hash is one block with the constant padding.
+*/
+typedef enum _tag_sha256_d64 {
+    sha256_d64_scalar = 0,
+    sha256_d64_sse41 = 1,
+    sha256_d64_avx2 = 2,
+    sha256_d64_shani = 3,
+    sha256_d64_avx512 = 4,
+    sha256_d64_max = 5,
+} sha256_d64;
+
+typedef void (*sha256_transform_d64_t)(byte_t *out, const byte_t *in);
+
+/* one input, scalar: 64 rounds with the message schedule, or with the constant K+W. */
+static inline void fs_sha256_compress(uint32_t *s, uint32_t *w, const uint32_t *kw) {
+    uint32_t a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for(index_t i = 0; i < 64; ++i) {
+        uint32_t wk;
+        if(w) {
+            if(16 <= i) w[i & 15] += sigma1(w[(i + 14) & 15]) + w[(i + 9) & 15] + sigma0(w[(i + 1) & 15]);
+            wk = fs_sha256_K[i] + w[i & 15];
+        } else {
+            wk = kw[i];
+        }
+        const uint32_t t1 = h + Sigma1(e) + Ch(e, f, g) + wk;
+        const uint32_t t2 = Sigma0(a) + Maj(a, b, c);
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    s[0] += a; s[1] += b; s[2] += c; s[3] += d;
+    s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+}
+
+static inline void TransformD64(byte_t *out, const byte_t *in) {
+    uint32_t s[8], w[16];
+    memcpy(s, fs_sha256_H0, sizeof(s));
+    Transform(s, in, 1);
+    fs_sha256_compress(s, NULL, fs_sha256d64_KW);
+    memcpy(w, s, sizeof(s));
+    memset(w + 8, 0x00, sizeof(uint32_t) * 8);
+    w[8] = 0x80000000ul;
+    w[15] = 256;
+    memcpy(s, fs_sha256_H0, sizeof(s));
+    fs_sha256_compress(s, w, NULL);
+    for(index_t i = 0; i < 8; ++i) WriteBE32(out + 4 * i, s[i]);
+}
+
+static inline sha256_transform_d64_t fs_sha256_gettransform_d64(sha256_d64 d64, index_t *ways) { /* NULL: not built in, or the CPU does not support. */
+    *ways = 1;
+    switch(d64) {
+    case sha256_d64_scalar:
+        return TransformD64;
+#ifdef FS_SHA256_SSE41
+    case sha256_d64_sse41:
+        *ways = SHA256_SSE41_LANES;
+        return fs_cpu_has(CPU_SSE41)? TransformD64SSE41x4: NULL;
+#endif
+#ifdef FS_SHA256_AVX2
+    case sha256_d64_avx2:
+        *ways = SHA256_AVX2_LANES;
+        return fs_cpu_has(CPU_AVX2)? TransformD64AVX2x8: NULL;
+#endif
+#ifdef FS_SHA256_SHANI
+    case sha256_d64_shani:
+        *ways = 2;
+        return fs_cpu_has(CPU_SHANI)? TransformD64SHANIx2: NULL;
+#endif
+#ifdef FS_SHA256_AVX512
+    case sha256_d64_avx512:
+        *ways = SHA256_AVX512_LANES;
+        return fs_cpu_has(CPU_AVX512F)? TransformD64AVX512x16: NULL;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+/* in: blocks*64 bytes, out: blocks*32 bytes. The widest first, and the rest goes to narrower ones. */
+static inline void fs_sha256d64_2(sha256_d64 d64, byte_t *out, const byte_t *in, size_t blocks) {
+    for(index_t k = d64; 0 <= k && 0 < blocks; --k) {
+        index_t ways;
+        const sha256_transform_d64_t transform = fs_sha256_gettransform_d64((sha256_d64)k, &ways);
+        if(!transform) continue;
+        for(; (size_t)ways <= blocks; blocks -= ways) {
+            transform(out, in);
+            out += 32 * ways;
+            in += 64 * ways;
+        }
+    }
+}
+
+static inline void fs_sha256d64(byte_t *out, const byte_t *in, size_t blocks) { /* Note: SHA-NI 2 ways is faster than AVX2 8 lanes. */
+    index_t ways;
+    if(fs_sha256_gettransform_d64(sha256_d64_avx512, &ways)) fs_sha256d64_2(sha256_d64_avx512, out, in, blocks);
+    else if(fs_sha256_gettransform_d64(sha256_d64_shani, &ways)) fs_sha256d64_2(sha256_d64_shani, out, in, blocks);
+    else fs_sha256d64_2(sha256_d64_avx2, out, in, blocks);
+}
+
 /* [OK] */
 # ifdef DEBUG
 static inline void fs_sha256_test() {
@@ -249,12 +599,49 @@ static inline void fs_sha256_test() {
         { 0x3e4c4039ul, 0xbb6fca8cul, 0x6f27d2f7ul, 0x301e44a4ul, 0x8352ba14ul, 0x5769ce37ul, 0x48a1155ful, 0xc0e1c4c6ul },
         { 0xfe2fa9ddul, 0x69d0862bul, 0x1ae0db23ul, 0x471f9244ul, 0xf55c0145ul, 0xc30f9c3bul, 0x40a84ea0ul, 0x5b8a266cul },
     };
-    // Test Transform() for 0 through 8 transformations.
-    for(size_t i = 0; i <= 8; ++i) {
-        uint32_t state[8];
-        memcpy(state, init, sizeof(state));
-        Transform(state, data + 1, i);
-        assert(memcmp(state, result[i], sizeof(state))==0);
+    // Test every Transform() variant that this CPU supports, for 0 through 8 transformations.
+    const sha256_impl current = fs_sha256_getimpl();
+    for(index_t impl = 0; impl < sha256_impl_max; ++impl) {
+        const sha256_transform_t transform = fs_sha256_gettransform((sha256_impl)impl);
+        if(!transform) continue;
+        fs_printf("sha256 Transform: %s\n", fs_sha256_getimplname((sha256_impl)impl));
+        for(size_t i = 0; i <= 8; ++i) {
+            uint32_t state[8];
+            memcpy(state, init, sizeof(state));
+            transform(state, data + 1, i);
+            assert(memcmp(state, result[i], sizeof(state))==0);
+        }
+    }
+    fs_sha256_setimpl(current);
+    // Test every multi-buffer variant: each lane has another message, of 0 through 192 bytes.
+    for(index_t multi = 0; multi < sha256_multi_max; ++multi) {
+        index_t lanes;
+        if(multi!=sha256_multi_none && !fs_sha256_gettransform_multi((sha256_multi)multi, &lanes)) continue;
+        for(counter_t size = 0; size <= 192; size += 3) {
+            const byte_t *ptr[37];
+            byte_t hash[32*37], expect[32];
+            for(index_t k = 0; k < 37; ++k) ptr[k] = data + (k*11 % (641 - 192));
+            fs_sha256_digest_multi2((sha256_multi)multi, ptr, 37, size, hash);
+            for(index_t k = 0; k < 37; ++k) {
+                fs_sha256_digest(ptr[k], size, expect);
+                assert(memcmp(hash + 32*k, expect, 32)==0);
+            }
+        }
+    }
+    // Test every fs_sha256d64 path: 0 through 40 inputs of 64 bytes, against two fs_sha256_digest.
+    for(index_t d64 = 0; d64 < sha256_d64_max; ++d64) {
+        index_t ways;
+        if(!fs_sha256_gettransform_d64((sha256_d64)d64, &ways)) continue;
+        for(size_t blocks = 0; blocks <= 40; ++blocks) {
+            byte_t in[64*40], out[32*40], expect[32];
+            for(size_t k = 0; k < sizeof(in); ++k) in[k] = data[(k*7 + blocks) % 640];
+            fs_sha256d64_2((sha256_d64)d64, out, in, blocks);
+            for(size_t k = 0; k < blocks; ++k) {
+                fs_sha256_digest(in + 64*k, 64, expect);
+                fs_sha256_digest(expect, 32, expect);
+                assert(memcmp(out + 32*k, expect, 32)==0);
+            }
+        }
     }
 }
 # endif
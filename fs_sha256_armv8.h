@@ -0,0 +1,57 @@
+// Copyright (c) 2022 The Bitcoin Core developers
+// Copyright (c) 2020 The SorachanCoin Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SORACHANCOIN_FS_SHA256_ARMV8
+#define SORACHANCOIN_FS_SHA256_ARMV8
+
+#include "fs_types.h"
+#include "fs_cpu.h"
+
+/*
+* ** fs_sha256_armv8 **
+*
+* SHA256 Transform with the ARMv8 crypto extensions. (SHA256H, SHA256H2, SHA256SU0, SHA256SU1)
+* Compiled when the compiler targets them (-march=armv8-a+crypto), and called only when fs_cpu_has(CPU_ARMV8_SHA2).
+* (included by fs_sha256.h, uses fs_sha256_K)
+*
+*/
+
+#if defined(FS_CPU_ARM64) && (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_SHA2) || defined(_M_ARM64))
+# define FS_SHA256_ARMV8
+#endif
+
+#ifdef FS_SHA256_ARMV8
+# include <arm_neon.h>
+
+static inline void TransformARMV8(uint32_t *s, const byte_t *chunk, size_t blocks)
+{
+    uint32x4_t STATE0 = vld1q_u32(&s[0]);
+    uint32x4_t STATE1 = vld1q_u32(&s[4]);
+
+    while(blocks--) {
+        const uint32x4_t ABCD_SAVE = STATE0, EFGH_SAVE = STATE1;
+        uint32x4_t MSG[4];
+        for(int i = 0; i < 16; ++i) {
+            if(i < 4) {
+                MSG[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(chunk + 16 * i)));
+            } else { /* W[i] from W[i-4], W[i-3], W[i-2], W[i-1] */
+                MSG[i & 3] = vsha256su1q_u32(vsha256su0q_u32(MSG[i & 3], MSG[(i + 1) & 3]), MSG[(i + 2) & 3], MSG[(i + 3) & 3]);
+            }
+            const uint32x4_t WK = vaddq_u32(MSG[i & 3], vld1q_u32(&fs_sha256_K[4 * i]));
+            const uint32x4_t TMP = STATE0;
+            STATE0 = vsha256hq_u32(STATE0, STATE1, WK);
+            STATE1 = vsha256h2q_u32(STATE1, TMP, WK);
+        }
+        STATE0 = vaddq_u32(STATE0, ABCD_SAVE);
+        STATE1 = vaddq_u32(STATE1, EFGH_SAVE);
+        chunk += 64;
+    }
+
+    vst1q_u32(&s[0], STATE0);
+    vst1q_u32(&s[4], STATE1);
+}
+#endif
+
+#endif
@@ -0,0 +1,127 @@
+// Copyright (c) 2020 The SorachanCoin Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SORACHANCOIN_FS_SHA256_AVX2
+#define SORACHANCOIN_FS_SHA256_AVX2
+
+#include "fs_types.h"
+#include "fs_cpu.h"
+#include "fs_endian.h"
+
+/*
+* ** fs_sha256_avx2 **
+*
+* Multi-buffer SHA256 Transform: 8 independent messages, one per 32-bit lane of AVX2.
+* state: [8 words][8 lanes], data: 8 pointers that advance 64 bytes per block.
+* TransformD64AVX2x8: double SHA256 of 64 bytes inputs. (Merkle inner nodes)
+* Only called when fs_cpu_has(CPU_AVX2). (included by fs_sha256.h, uses fs_sha256_K)
+*
+*/
+
+#if defined(FS_CPU_X86) && (defined(COMPILER_MSC) || defined(COMPILER_INTEL) || defined(COMPILER_CLANG) || (defined(COMPILER_GNU) && 5<=__GNUC__))
+# define FS_SHA256_AVX2
+#endif
+
+#define SHA256_AVX2_LANES 8
+
+#ifdef FS_SHA256_AVX2
+# include <immintrin.h>
+
+FS_TARGET("avx2") static inline __m256i fs_avx2_ror(__m256i x, int n) { return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n)); }
+FS_TARGET("avx2") static inline __m256i fs_avx2_add3(__m256i x, __m256i y, __m256i z) { return _mm256_add_epi32(_mm256_add_epi32(x, y), z); }
+FS_TARGET("avx2") static inline __m256i fs_avx2_Ch(__m256i x, __m256i y, __m256i z) { return _mm256_xor_si256(z, _mm256_and_si256(x, _mm256_xor_si256(y, z))); }
+FS_TARGET("avx2") static inline __m256i fs_avx2_Maj(__m256i x, __m256i y, __m256i z) { return _mm256_or_si256(_mm256_and_si256(x, y), _mm256_and_si256(z, _mm256_or_si256(x, y))); }
+FS_TARGET("avx2") static inline __m256i fs_avx2_Sigma0(__m256i x) { return _mm256_xor_si256(_mm256_xor_si256(fs_avx2_ror(x, 2), fs_avx2_ror(x, 13)), fs_avx2_ror(x, 22)); }
+FS_TARGET("avx2") static inline __m256i fs_avx2_Sigma1(__m256i x) { return _mm256_xor_si256(_mm256_xor_si256(fs_avx2_ror(x, 6), fs_avx2_ror(x, 11)), fs_avx2_ror(x, 25)); }
+FS_TARGET("avx2") static inline __m256i fs_avx2_sigma0(__m256i x) { return _mm256_xor_si256(_mm256_xor_si256(fs_avx2_ror(x, 7), fs_avx2_ror(x, 18)), _mm256_srli_epi32(x, 3)); }
+FS_TARGET("avx2") static inline __m256i fs_avx2_sigma1(__m256i x) { return _mm256_xor_si256(_mm256_xor_si256(fs_avx2_ror(x, 17), fs_avx2_ror(x, 19)), _mm256_srli_epi32(x, 10)); }
+
+/* the message words of 8 blocks, [word][lane]: one 8x8 transpose for each half block. */
+FS_TARGET("avx2") static inline void fs_avx2_loadblock(__m256i *w, const byte_t *const *data, size_t offset)
+{
+    const __m256i BSWAP = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3, 12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    for(int half = 0; half < 2; ++half) {
+        __m256i r[8], t[8];
+        for(int l = 0; l < 8; ++l)
+            r[l] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(data[l] + offset + 32 * half)), BSWAP);
+        for(int l = 0; l < 8; l += 2) {
+            t[l] = _mm256_unpacklo_epi32(r[l], r[l + 1]);
+            t[l + 1] = _mm256_unpackhi_epi32(r[l], r[l + 1]);
+        }
+        for(int l = 0; l < 8; l += 4) {
+            r[l] = _mm256_unpacklo_epi64(t[l], t[l + 2]);
+            r[l + 1] = _mm256_unpackhi_epi64(t[l], t[l + 2]);
+            r[l + 2] = _mm256_unpacklo_epi64(t[l + 1], t[l + 3]);
+            r[l + 3] = _mm256_unpackhi_epi64(t[l + 1], t[l + 3]);
+        }
+        for(int l = 0; l < 4; ++l) {
+            w[8 * half + l] = _mm256_permute2x128_si256(r[l], r[l + 4], 0x20);
+            w[8 * half + l + 4] = _mm256_permute2x128_si256(r[l], r[l + 4], 0x31);
+        }
+    }
+}
+
+/* 64 rounds added to s. w: the message words, or NULL with kw: K+W of a constant block. (the schedule is skipped) */
+FS_TARGET("avx2") static inline void fs_avx2_compress(__m256i *s, __m256i *w, const uint32_t *kw)
+{
+    __m256i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for(int i = 0; i < 64; ++i) {
+        __m256i wk;
+        if(w) {
+            if(16 <= i) w[i & 15] = _mm256_add_epi32(fs_avx2_add3(w[i & 15], fs_avx2_sigma0(w[(i + 1) & 15]), w[(i + 9) & 15]), fs_avx2_sigma1(w[(i + 14) & 15]));
+            wk = _mm256_add_epi32(_mm256_set1_epi32((int)fs_sha256_K[i]), w[i & 15]);
+        } else {
+            wk = _mm256_set1_epi32((int)kw[i]);
+        }
+        const __m256i t1 = _mm256_add_epi32(fs_avx2_add3(h, fs_avx2_Sigma1(e), fs_avx2_Ch(e, f, g)), wk);
+        const __m256i t2 = _mm256_add_epi32(fs_avx2_Sigma0(a), fs_avx2_Maj(a, b, c));
+        h = g; g = f; f = e; e = _mm256_add_epi32(d, t1);
+        d = c; c = b; b = a; a = _mm256_add_epi32(t1, t2);
+    }
+    s[0] = _mm256_add_epi32(s[0], a); s[1] = _mm256_add_epi32(s[1], b);
+    s[2] = _mm256_add_epi32(s[2], c); s[3] = _mm256_add_epi32(s[3], d);
+    s[4] = _mm256_add_epi32(s[4], e); s[5] = _mm256_add_epi32(s[5], f);
+    s[6] = _mm256_add_epi32(s[6], g); s[7] = _mm256_add_epi32(s[7], h);
+}
+
+FS_TARGET("avx2")
+static inline void TransformAVX2x8(uint32_t *state, const byte_t *const *data, size_t blocks)
+{
+    __m256i s[8], w[16];
+    for(int i = 0; i < 8; ++i) s[i] = _mm256_loadu_si256((const __m256i *)(state + 8 * i));
+    for(size_t offset = 0; offset < blocks * 64; offset += 64) {
+        fs_avx2_loadblock(w, data, offset);
+        fs_avx2_compress(s, w, NULL);
+    }
+    for(int i = 0; i < 8; ++i) _mm256_storeu_si256((__m256i *)(state + 8 * i), s[i]);
+}
+
+/* double SHA256 of 8 inputs of 64 bytes: in 8*64 bytes, out 8*32 bytes. */
+FS_TARGET("avx2")
+static inline void TransformD64AVX2x8(byte_t *out, const byte_t *in)
+{
+    const byte_t *ptr[8];
+    __m256i s[8], w[16];
+    uint32_t word[8][8];
+    for(int l = 0; l < 8; ++l) ptr[l] = in + 64 * l;
+    for(int i = 0; i < 8; ++i) s[i] = _mm256_set1_epi32((int)fs_sha256_H0[i]);
+    fs_avx2_loadblock(w, ptr, 0);
+    fs_avx2_compress(s, w, NULL);
+    fs_avx2_compress(s, NULL, fs_sha256d64_KW);
+    for(int i = 0; i < 8; ++i) { /* the second: 32 bytes digest and the constant padding */
+        w[i] = s[i];
+        w[i + 8] = _mm256_setzero_si256();
+        s[i] = _mm256_set1_epi32((int)fs_sha256_H0[i]);
+    }
+    w[8] = _mm256_set1_epi32((int)0x80000000ul);
+    w[15] = _mm256_set1_epi32(256);
+    fs_avx2_compress(s, w, NULL);
+    for(int i = 0; i < 8; ++i) _mm256_storeu_si256((__m256i *)word[i], s[i]);
+    for(int l = 0; l < 8; ++l) {
+        for(int i = 0; i < 8; ++i) WriteBE32(out + 32 * l + 4 * i, word[i][l]);
+    }
+}
+#endif
+
+#endif
@@ -0,0 +1,109 @@
+// Copyright (c) 2020 The SorachanCoin Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SORACHANCOIN_FS_SHA256_AVX512
+#define SORACHANCOIN_FS_SHA256_AVX512
+
+#include "fs_types.h"
+#include "fs_cpu.h"
+#include "fs_sha256_avx2.h"
+
+/*
+* ** fs_sha256_avx512 **
+*
+* Multi-buffer SHA256 Transform: 16 independent messages, one per 32-bit lane of AVX-512.
+* Same layout as fs_sha256_avx2, state: [8 words][16 lanes].
+* The rotations are VPRORD and the three input functions are VPTERNLOGD.
+* TransformD64AVX512x16: double SHA256 of 64 bytes inputs.
+* Only called when fs_cpu_has(CPU_AVX512F). (included by fs_sha256.h, uses fs_sha256_K)
+*
+*/
+
+#if defined(FS_SHA256_AVX2)
+# define FS_SHA256_AVX512
+#endif
+
+#define SHA256_AVX512_LANES 16
+
+#ifdef FS_SHA256_AVX512
+# include <immintrin.h>
+
+FS_TARGET("avx512f") static inline __m512i fs_avx512_Ch(__m512i x, __m512i y, __m512i z) { return _mm512_ternarylogic_epi32(x, y, z, 0xCA); }
+FS_TARGET("avx512f") static inline __m512i fs_avx512_Maj(__m512i x, __m512i y, __m512i z) { return _mm512_ternarylogic_epi32(x, y, z, 0xE8); }
+FS_TARGET("avx512f") static inline __m512i fs_avx512_xor3(__m512i x, __m512i y, __m512i z) { return _mm512_ternarylogic_epi32(x, y, z, 0x96); }
+FS_TARGET("avx512f") static inline __m512i fs_avx512_Sigma0(__m512i x) { return fs_avx512_xor3(_mm512_ror_epi32(x, 2), _mm512_ror_epi32(x, 13), _mm512_ror_epi32(x, 22)); }
+FS_TARGET("avx512f") static inline __m512i fs_avx512_Sigma1(__m512i x) { return fs_avx512_xor3(_mm512_ror_epi32(x, 6), _mm512_ror_epi32(x, 11), _mm512_ror_epi32(x, 25)); }
+FS_TARGET("avx512f") static inline __m512i fs_avx512_sigma0(__m512i x) { return fs_avx512_xor3(_mm512_ror_epi32(x, 7), _mm512_ror_epi32(x, 18), _mm512_srli_epi32(x, 3)); }
+FS_TARGET("avx512f") static inline __m512i fs_avx512_sigma1(__m512i x) { return fs_avx512_xor3(_mm512_ror_epi32(x, 17), _mm512_ror_epi32(x, 19), _mm512_srli_epi32(x, 10)); }
+
+FS_TARGET("avx512f") static inline void fs_avx512_compress(__m512i *s, __m512i *w, const uint32_t *kw)
+{
+    __m512i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for(int i = 0; i < 64; ++i) {
+        __m512i wk;
+        if(w) {
+            if(16 <= i) w[i & 15] = _mm512_add_epi32(_mm512_add_epi32(w[i & 15], fs_avx512_sigma0(w[(i + 1) & 15])), _mm512_add_epi32(w[(i + 9) & 15], fs_avx512_sigma1(w[(i + 14) & 15])));
+            wk = _mm512_add_epi32(_mm512_set1_epi32((int)fs_sha256_K[i]), w[i & 15]);
+        } else {
+            wk = _mm512_set1_epi32((int)kw[i]);
+        }
+        const __m512i t1 = _mm512_add_epi32(_mm512_add_epi32(h, fs_avx512_Sigma1(e)), _mm512_add_epi32(fs_avx512_Ch(e, f, g), wk));
+        const __m512i t2 = _mm512_add_epi32(fs_avx512_Sigma0(a), fs_avx512_Maj(a, b, c));
+        h = g; g = f; f = e; e = _mm512_add_epi32(d, t1);
+        d = c; c = b; b = a; a = _mm512_add_epi32(t1, t2);
+    }
+    s[0] = _mm512_add_epi32(s[0], a); s[1] = _mm512_add_epi32(s[1], b);
+    s[2] = _mm512_add_epi32(s[2], c); s[3] = _mm512_add_epi32(s[3], d);
+    s[4] = _mm512_add_epi32(s[4], e); s[5] = _mm512_add_epi32(s[5], f);
+    s[6] = _mm512_add_epi32(s[6], g); s[7] = _mm512_add_epi32(s[7], h);
+}
+
+FS_TARGET("avx512f") static inline void fs_avx512_loadblock(__m512i *w, const byte_t *const *data, size_t offset)
+{
+    __m256i lo[16], hi[16];
+    fs_avx2_loadblock(lo, data, offset);
+    fs_avx2_loadblock(hi, data + 8, offset);
+    for(int i = 0; i < 16; ++i) w[i] = _mm512_inserti64x4(_mm512_castsi256_si512(lo[i]), hi[i], 1);
+}
+
+FS_TARGET("avx512f")
+static inline void TransformAVX512x16(uint32_t *state, const byte_t *const *data, size_t blocks)
+{
+    __m512i s[8], w[16];
+    for(int i = 0; i < 8; ++i) s[i] = _mm512_loadu_si512((const void *)(state + 16 * i));
+    for(size_t offset = 0; offset < blocks * 64; offset += 64) {
+        fs_avx512_loadblock(w, data, offset);
+        fs_avx512_compress(s, w, NULL);
+    }
+    for(int i = 0; i < 8; ++i) _mm512_storeu_si512((void *)(state + 16 * i), s[i]);
+}
+
+/* double SHA256 of 16 inputs of 64 bytes: in 16*64 bytes, out 16*32 bytes. */
+FS_TARGET("avx512f")
+static inline void TransformD64AVX512x16(byte_t *out, const byte_t *in)
+{
+    const byte_t *ptr[16];
+    __m512i s[8], w[16];
+    uint32_t word[8][16];
+    for(int l = 0; l < 16; ++l) ptr[l] = in + 64 * l;
+    for(int i = 0; i < 8; ++i) s[i] = _mm512_set1_epi32((int)fs_sha256_H0[i]);
+    fs_avx512_loadblock(w, ptr, 0);
+    fs_avx512_compress(s, w, NULL);
+    fs_avx512_compress(s, NULL, fs_sha256d64_KW);
+    for(int i = 0; i < 8; ++i) {
+        w[i] = s[i];
+        w[i + 8] = _mm512_setzero_si512();
+        s[i] = _mm512_set1_epi32((int)fs_sha256_H0[i]);
+    }
+    w[8] = _mm512_set1_epi32((int)0x80000000ul);
+    w[15] = _mm512_set1_epi32(256);
+    fs_avx512_compress(s, w, NULL);
+    for(int i = 0; i < 8; ++i) _mm512_storeu_si512((void *)word[i], s[i]);
+    for(int l = 0; l < 16; ++l) {
+        for(int i = 0; i < 8; ++i) WriteBE32(out + 32 * l + 4 * i, word[i][l]);
+    }
+}
+#endif
+
+#endif
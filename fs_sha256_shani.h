@@ -0,0 +1,128 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Copyright (c) 2020 The SorachanCoin Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SORACHANCOIN_FS_SHA256_SHANI
+#define SORACHANCOIN_FS_SHA256_SHANI
+
+#include "fs_types.h"
+#include "fs_cpu.h"
+
+/*
+* ** fs_sha256_shani **
+*
+* SHA256 Transform with the x86 SHA extensions. (SHA-NI)
+* Based on the Intel reference, the state is kept as ABEF and CDGH.
+* TransformD64SHANIx2: double SHA256 of 64 bytes inputs, two at once.
+* Only called when fs_cpu_has(CPU_SHANI). (included by fs_sha256.h, uses fs_sha256_K)
+*
+*/
+
+#if defined(FS_CPU_X86) && (defined(COMPILER_MSC) || defined(COMPILER_INTEL) || defined(COMPILER_CLANG) || (defined(COMPILER_GNU) && 5<=__GNUC__))
+# define FS_SHA256_SHANI
+#endif
+
+#ifdef FS_SHA256_SHANI
+# include <immintrin.h>
+
+/* standard s[8] to ABEF, CDGH */
+FS_TARGET("sse4.1,sha") static inline void fs_shani_load(const uint32_t *s, __m128i *STATE0, __m128i *STATE1)
+{
+    __m128i TMP = _mm_loadu_si128((const __m128i *)&s[0]);
+    *STATE1 = _mm_loadu_si128((const __m128i *)&s[4]);
+    TMP = _mm_shuffle_epi32(TMP, 0xB1);             /* CDAB */
+    *STATE1 = _mm_shuffle_epi32(*STATE1, 0x1B);     /* EFGH */
+    *STATE0 = _mm_alignr_epi8(TMP, *STATE1, 8);     /* ABEF */
+    *STATE1 = _mm_blend_epi16(*STATE1, TMP, 0xF0);  /* CDGH */
+}
+
+/* ABEF, CDGH to the words: X = s[0..3], Y = s[4..7] */
+FS_TARGET("sse4.1,sha") static inline void fs_shani_words(__m128i STATE0, __m128i STATE1, __m128i *X, __m128i *Y)
+{
+    const __m128i TMP = _mm_shuffle_epi32(STATE0, 0x1B); /* FEBA */
+    STATE1 = _mm_shuffle_epi32(STATE1, 0xB1);            /* DCHG */
+    *X = _mm_blend_epi16(TMP, STATE1, 0xF0);             /* DCBA */
+    *Y = _mm_alignr_epi8(STATE1, TMP, 8);                /* HGFE */
+}
+
+/*
+* 64 rounds added to (STATE0, STATE1) of "ways" independent messages, interleaved for the latency.
+* MSG: the first 16 words of each, or NULL with kw: K+W of a constant block. (the schedule is skipped)
+*/
+FS_TARGET("sse4.1,sha") static inline void fs_shani_compress(int ways, __m128i *STATE0, __m128i *STATE1, __m128i (*MSG)[4], const uint32_t *kw)
+{
+    __m128i ABEF_SAVE[2], CDGH_SAVE[2];
+    for(int k = 0; k < ways; ++k) {
+        ABEF_SAVE[k] = STATE0[k];
+        CDGH_SAVE[k] = STATE1[k];
+    }
+    for(int i = 0; i < 16; ++i) {
+        for(int k = 0; k < ways; ++k) {
+            __m128i WK;
+            if(MSG) {
+                if(4 <= i) { /* W[i] from W[i-4], W[i-3], W[i-2], W[i-1] */
+                    __m128i W = _mm_sha256msg1_epu32(MSG[k][i & 3], MSG[k][(i + 1) & 3]);
+                    W = _mm_add_epi32(W, _mm_alignr_epi8(MSG[k][(i + 3) & 3], MSG[k][(i + 2) & 3], 4));
+                    MSG[k][i & 3] = _mm_sha256msg2_epu32(W, MSG[k][(i + 3) & 3]);
+                }
+                WK = _mm_add_epi32(MSG[k][i & 3], _mm_loadu_si128((const __m128i *)&fs_sha256_K[4 * i]));
+            } else {
+                WK = _mm_loadu_si128((const __m128i *)&kw[4 * i]);
+            }
+            STATE1[k] = _mm_sha256rnds2_epu32(STATE1[k], STATE0[k], WK);
+            STATE0[k] = _mm_sha256rnds2_epu32(STATE0[k], STATE1[k], _mm_shuffle_epi32(WK, 0x0E));
+        }
+    }
+    for(int k = 0; k < ways; ++k) {
+        STATE0[k] = _mm_add_epi32(STATE0[k], ABEF_SAVE[k]);
+        STATE1[k] = _mm_add_epi32(STATE1[k], CDGH_SAVE[k]);
+    }
+}
+
+FS_TARGET("sse4.1,sha")
+static inline void TransformSHANI(uint32_t *s, const byte_t *chunk, size_t blocks)
+{
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bull, 0x0405060700010203ull);
+    __m128i STATE0, STATE1, X, Y;
+    fs_shani_load(s, &STATE0, &STATE1);
+    while(blocks--) {
+        __m128i MSG[1][4];
+        for(int i = 0; i < 4; ++i) MSG[0][i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(chunk + 16 * i)), MASK);
+        fs_shani_compress(1, &STATE0, &STATE1, MSG, NULL);
+        chunk += 64;
+    }
+    fs_shani_words(STATE0, STATE1, &X, &Y);
+    _mm_storeu_si128((__m128i *)&s[0], X);
+    _mm_storeu_si128((__m128i *)&s[4], Y);
+}
+
+/* double SHA256 of 2 inputs of 64 bytes: in 2*64 bytes, out 2*32 bytes. */
+FS_TARGET("sse4.1,sha")
+static inline void TransformD64SHANIx2(byte_t *out, const byte_t *in)
+{
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bull, 0x0405060700010203ull);
+    __m128i STATE0[2], STATE1[2], MSG[2][4];
+    for(int k = 0; k < 2; ++k) {
+        fs_shani_load(fs_sha256_H0, &STATE0[k], &STATE1[k]);
+        for(int i = 0; i < 4; ++i) MSG[k][i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 64 * k + 16 * i)), MASK);
+    }
+    fs_shani_compress(2, STATE0, STATE1, MSG, NULL);
+    fs_shani_compress(2, STATE0, STATE1, NULL, fs_sha256d64_KW);
+    for(int k = 0; k < 2; ++k) { /* the second: 32 bytes digest and the constant padding */
+        fs_shani_words(STATE0[k], STATE1[k], &MSG[k][0], &MSG[k][1]);
+        MSG[k][2] = _mm_set_epi32(0, 0, 0, (int)0x80000000ul);
+        MSG[k][3] = _mm_set_epi32(256, 0, 0, 0);
+        fs_shani_load(fs_sha256_H0, &STATE0[k], &STATE1[k]);
+    }
+    fs_shani_compress(2, STATE0, STATE1, MSG, NULL);
+    for(int k = 0; k < 2; ++k) {
+        __m128i X, Y;
+        fs_shani_words(STATE0[k], STATE1[k], &X, &Y);
+        _mm_storeu_si128((__m128i *)(out + 32 * k), _mm_shuffle_epi8(X, MASK));
+        _mm_storeu_si128((__m128i *)(out + 32 * k + 16), _mm_shuffle_epi8(Y, MASK));
+    }
+}
+#endif
+
+#endif
@@ -0,0 +1,122 @@
+// Copyright (c) 2020 The SorachanCoin Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SORACHANCOIN_FS_SHA256_SSE41
+#define SORACHANCOIN_FS_SHA256_SSE41
+
+#include "fs_types.h"
+#include "fs_cpu.h"
+#include "fs_endian.h"
+
+/*
+* ** fs_sha256_sse41 **
+*
+* Multi-buffer SHA256 Transform: 4 independent messages, one per 32-bit lane of SSE.
+* Same layout as fs_sha256_avx2, state: [8 words][4 lanes].
+* TransformD64SSE41x4: double SHA256 of 64 bytes inputs.
+* Only called when fs_cpu_has(CPU_SSE41). (included by fs_sha256.h, uses fs_sha256_K)
+*
+*/
+
+#if defined(FS_CPU_X86) && (defined(COMPILER_MSC) || defined(COMPILER_INTEL) || defined(COMPILER_CLANG) || (defined(COMPILER_GNU) && 5<=__GNUC__))
+# define FS_SHA256_SSE41
+#endif
+
+#define SHA256_SSE41_LANES 4
+
+#ifdef FS_SHA256_SSE41
+# include <immintrin.h>
+
+FS_TARGET("sse4.1") static inline __m128i fs_sse41_ror(__m128i x, int n) { return _mm_or_si128(_mm_srli_epi32(x, n), _mm_slli_epi32(x, 32 - n)); }
+FS_TARGET("sse4.1") static inline __m128i fs_sse41_add3(__m128i x, __m128i y, __m128i z) { return _mm_add_epi32(_mm_add_epi32(x, y), z); }
+FS_TARGET("sse4.1") static inline __m128i fs_sse41_Ch(__m128i x, __m128i y, __m128i z) { return _mm_xor_si128(z, _mm_and_si128(x, _mm_xor_si128(y, z))); }
+FS_TARGET("sse4.1") static inline __m128i fs_sse41_Maj(__m128i x, __m128i y, __m128i z) { return _mm_or_si128(_mm_and_si128(x, y), _mm_and_si128(z, _mm_or_si128(x, y))); }
+FS_TARGET("sse4.1") static inline __m128i fs_sse41_Sigma0(__m128i x) { return _mm_xor_si128(_mm_xor_si128(fs_sse41_ror(x, 2), fs_sse41_ror(x, 13)), fs_sse41_ror(x, 22)); }
+FS_TARGET("sse4.1") static inline __m128i fs_sse41_Sigma1(__m128i x) { return _mm_xor_si128(_mm_xor_si128(fs_sse41_ror(x, 6), fs_sse41_ror(x, 11)), fs_sse41_ror(x, 25)); }
+FS_TARGET("sse4.1") static inline __m128i fs_sse41_sigma0(__m128i x) { return _mm_xor_si128(_mm_xor_si128(fs_sse41_ror(x, 7), fs_sse41_ror(x, 18)), _mm_srli_epi32(x, 3)); }
+FS_TARGET("sse4.1") static inline __m128i fs_sse41_sigma1(__m128i x) { return _mm_xor_si128(_mm_xor_si128(fs_sse41_ror(x, 17), fs_sse41_ror(x, 19)), _mm_srli_epi32(x, 10)); }
+
+/* the message words of 4 blocks, [word][lane]: one 4x4 transpose for each quarter block. */
+FS_TARGET("sse4.1") static inline void fs_sse41_loadblock(__m128i *w, const byte_t *const *data, size_t offset)
+{
+    const __m128i BSWAP = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    for(int q = 0; q < 4; ++q) {
+        __m128i r[4], t[4];
+        for(int l = 0; l < 4; ++l)
+            r[l] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data[l] + offset + 16 * q)), BSWAP);
+        t[0] = _mm_unpacklo_epi32(r[0], r[1]);
+        t[1] = _mm_unpackhi_epi32(r[0], r[1]);
+        t[2] = _mm_unpacklo_epi32(r[2], r[3]);
+        t[3] = _mm_unpackhi_epi32(r[2], r[3]);
+        w[4 * q + 0] = _mm_unpacklo_epi64(t[0], t[2]);
+        w[4 * q + 1] = _mm_unpackhi_epi64(t[0], t[2]);
+        w[4 * q + 2] = _mm_unpacklo_epi64(t[1], t[3]);
+        w[4 * q + 3] = _mm_unpackhi_epi64(t[1], t[3]);
+    }
+}
+
+/* 64 rounds added to s. w: the message words, or NULL with kw: K+W of a constant block. (the schedule is skipped) */
+FS_TARGET("sse4.1") static inline void fs_sse41_compress(__m128i *s, __m128i *w, const uint32_t *kw)
+{
+    __m128i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for(int i = 0; i < 64; ++i) {
+        __m128i wk;
+        if(w) {
+            if(16 <= i) w[i & 15] = _mm_add_epi32(fs_sse41_add3(w[i & 15], fs_sse41_sigma0(w[(i + 1) & 15]), w[(i + 9) & 15]), fs_sse41_sigma1(w[(i + 14) & 15]));
+            wk = _mm_add_epi32(_mm_set1_epi32((int)fs_sha256_K[i]), w[i & 15]);
+        } else {
+            wk = _mm_set1_epi32((int)kw[i]);
+        }
+        const __m128i t1 = _mm_add_epi32(fs_sse41_add3(h, fs_sse41_Sigma1(e), fs_sse41_Ch(e, f, g)), wk);
+        const __m128i t2 = _mm_add_epi32(fs_sse41_Sigma0(a), fs_sse41_Maj(a, b, c));
+        h = g; g = f; f = e; e = _mm_add_epi32(d, t1);
+        d = c; c = b; b = a; a = _mm_add_epi32(t1, t2);
+    }
+    s[0] = _mm_add_epi32(s[0], a); s[1] = _mm_add_epi32(s[1], b);
+    s[2] = _mm_add_epi32(s[2], c); s[3] = _mm_add_epi32(s[3], d);
+    s[4] = _mm_add_epi32(s[4], e); s[5] = _mm_add_epi32(s[5], f);
+    s[6] = _mm_add_epi32(s[6], g); s[7] = _mm_add_epi32(s[7], h);
+}
+
+FS_TARGET("sse4.1")
+static inline void TransformSSE41x4(uint32_t *state, const byte_t *const *data, size_t blocks)
+{
+    __m128i s[8], w[16];
+    for(int i = 0; i < 8; ++i) s[i] = _mm_loadu_si128((const __m128i *)(state + 4 * i));
+    for(size_t offset = 0; offset < blocks * 64; offset += 64) {
+        fs_sse41_loadblock(w, data, offset);
+        fs_sse41_compress(s, w, NULL);
+    }
+    for(int i = 0; i < 8; ++i) _mm_storeu_si128((__m128i *)(state + 4 * i), s[i]);
+}
+
+/* double SHA256 of 4 inputs of 64 bytes: in 4*64 bytes, out 4*32 bytes. */
+FS_TARGET("sse4.1")
+static inline void TransformD64SSE41x4(byte_t *out, const byte_t *in)
+{
+    const byte_t *ptr[4];
+    __m128i s[8], w[16];
+    for(int l = 0; l < 4; ++l) ptr[l] = in + 64 * l;
+    for(int i = 0; i < 8; ++i) s[i] = _mm_set1_epi32((int)fs_sha256_H0[i]);
+    fs_sse41_loadblock(w, ptr, 0);
+    fs_sse41_compress(s, w, NULL);
+    fs_sse41_compress(s, NULL, fs_sha256d64_KW);
+    for(int i = 0; i < 8; ++i) { /* the second: 32 bytes digest and the constant padding */
+        w[i] = s[i];
+        w[i + 8] = _mm_setzero_si128();
+        s[i] = _mm_set1_epi32((int)fs_sha256_H0[i]);
+    }
+    w[8] = _mm_set1_epi32((int)0x80000000ul);
+    w[15] = _mm_set1_epi32(256);
+    fs_sse41_compress(s, w, NULL);
+    for(int i = 0; i < 8; ++i) {
+        WriteBE32(out + 4 * i, (uint32_t)_mm_extract_epi32(s[i], 0));
+        WriteBE32(out + 32 + 4 * i, (uint32_t)_mm_extract_epi32(s[i], 1));
+        WriteBE32(out + 64 + 4 * i, (uint32_t)_mm_extract_epi32(s[i], 2));
+        WriteBE32(out + 96 + 4 * i, (uint32_t)_mm_extract_epi32(s[i], 3));
+    }
+}
+#endif
+
+#endif
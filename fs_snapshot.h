@@ -0,0 +1,152 @@
+// Copyright (c) 2020 The SorachanCoin Developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SORACHANCOIN_FS_SNAPSHOT
+#define SORACHANCOIN_FS_SNAPSHOT
+
+#include "fs_const.h"
+#include "fs_memory.h"
+#include "fs_types.h"
+#include "fs_cluster.h"
+#include "fs_extent.h"
+
+/*
+* ** fs_snapshot **
+*
+* Point-in-time snapshot of the objects(FSEXTENT) on a BPB, for example before a chain reorg.
+* fs_snapshot_take clones the extent maps (copy on write, no data is copied),
+* so the objects can be written as usual (fs_extent_objectwrite) while the snapshot keeps the old clusters.
+*
+* fs_snapshot_rollback: the objects get back the snapshot. (the clusters written after it are released)
+*   All the objects are swapped first, so they never hold a mix of old and new maps.
+*   If a release fails, the objects are already rolled back; calling it again releases the rest.
+* fs_snapshot_discard: the snapshot is released.
+* Both are O(metadata).
+*
+* Note: FSBITMAP needs fs_clusref. (fs_cluster_setref)
+*
+*/
+
+typedef enum _tag_snapshot_status {
+    SNAPSHOT_SUCCESS = 0,
+    SNAPSHOT_ERROR_PARAM = 1,
+    SNAPSHOT_ERROR_MEMORY_ALLOCATE_FAILURE = 2,
+    SNAPSHOT_ERROR_DRIVE_RW_FAILURE = 3,
+} snapshot_status;
+
+typedef struct _tag_FSSNAPSHOT {
+    FSBITMAP *bp;
+    const BPB *bpb;
+    FSEXTENT **obj;  /* the objects, not owned */
+    FSEXTENT **copy; /* the cloned extent maps */
+    index_t num;
+    bool_t rolled; /* obj holds the snapshot, copy holds the maps to release */
+    snapshot_status status;
+} FSSNAPSHOT;
+
+static inline bool_t fs_snapshot_setsuccess(FSSNAPSHOT *sp) {
+    sp->status = SNAPSHOT_SUCCESS;
+    return b_true;
+}
+
+static inline bool_t fs_snapshot_seterror(FSSNAPSHOT *sp, snapshot_status status) {
+    sp->status = status;
+    return b_false;
+}
+
+static inline snapshot_status fs_snapshot_getstatus(FSSNAPSHOT *sp) {
+    return sp->status;
+}
+
+static inline bool_t fs_snapshot_release(FSSNAPSHOT *sp, FSEXTENT *fep) { /* one reference of each run, from the last. a released run is dropped, so it can be called again. */
+    while(0<fs_extent_getruns(fep)) {
+        const EXTENT *run = fs_extent_getrun(fep, fs_extent_getruns(fep)-1);
+        if(!fs_cluster_erasebitmap(sp->bp, sp->bpb, run->physical, run->num)) return fs_snapshot_seterror(sp, SNAPSHOT_ERROR_DRIVE_RW_FAILURE);
+        fep->clusters -= run->num;
+        --fep->num;
+    }
+    fs_extent_clear(fep);
+    return fs_snapshot_setsuccess(sp);
+}
+
+static inline bool_t fs_snapshot_freecopy(FSSNAPSHOT *sp, bool_t ret) {
+    for(index_t i=0; i<sp->num; ++i) {
+        if(sp->copy[i]) fs_extent_close(sp->copy[i], b_true);
+    }
+    fs_free(sp->copy, b_true);
+    fs_free(sp->obj, b_true);
+    sp->copy = sp->obj = NULL;
+    sp->num = 0;
+    sp->rolled = b_false;
+    return ret;
+}
+
+static inline bool_t fs_snapshot_open(FSSNAPSHOT **sp, FSBITMAP *bp, const BPB *bpb) {
+    *sp = (FSSNAPSHOT *)fs_malloc(sizeof(FSSNAPSHOT));
+    if(!*sp) return b_false;
+    (*sp)->bp = bp;
+    (*sp)->bpb = bpb;
+    (*sp)->obj = (*sp)->copy = NULL;
+    (*sp)->num = 0;
+    (*sp)->rolled = b_false;
+    return fs_snapshot_setsuccess(*sp);
+}
+
+/* Note: a snapshot that is neither rolled back nor discarded holds its references. */
+static inline bool_t fs_snapshot_close(FSSNAPSHOT *sp, bool_t ret) {
+    return fs_free(sp, fs_snapshot_freecopy(sp, ret));
+}
+
+static inline index_t fs_snapshot_getnum(const FSSNAPSHOT *sp) { /* 0: no snapshot */
+    return sp->num;
+}
+
+static inline bool_t fs_snapshot_take(FSSNAPSHOT *sp, FSEXTENT **obj, index_t num) {
+    if(0<sp->num || num<=0) return fs_snapshot_seterror(sp, SNAPSHOT_ERROR_PARAM);
+    if(sp->bp->ref==NULL) return fs_snapshot_seterror(sp, SNAPSHOT_ERROR_PARAM);
+    sp->obj = (FSEXTENT **)fs_malloc((fsize_t)(sizeof(FSEXTENT *)*num));
+    sp->copy = (FSEXTENT **)fs_malloc((fsize_t)(sizeof(FSEXTENT *)*num));
+    if(!sp->obj || !sp->copy) {
+        fs_free(sp->copy, b_true);
+        fs_free(sp->obj, b_true);
+        sp->copy = sp->obj = NULL;
+        return fs_snapshot_seterror(sp, SNAPSHOT_ERROR_MEMORY_ALLOCATE_FAILURE);
+    }
+    for(index_t i=0; i<num; ++i) sp->copy[i] = NULL;
+    sp->num = num;
+    for(index_t i=0; i<num; ++i) {
+        sp->obj[i] = obj[i];
+        if(!fs_extent_open(&sp->copy[i]) || !fs_extent_clone(sp->copy[i], obj[i], sp->bp)) {
+            for(index_t k=0; k<i; ++k) fs_snapshot_release(sp, sp->copy[k]);
+            return fs_snapshot_freecopy(sp, fs_snapshot_seterror(sp, SNAPSHOT_ERROR_MEMORY_ALLOCATE_FAILURE));
+        }
+    }
+    return fs_snapshot_setsuccess(sp);
+}
+
+static inline bool_t fs_snapshot_rollback(FSSNAPSHOT *sp) {
+    if(sp->num==0) return fs_snapshot_seterror(sp, SNAPSHOT_ERROR_PARAM);
+    if(!sp->rolled) {
+        for(index_t i=0; i<sp->num; ++i) { /* memory only: the references of the copy move to the object. */
+            FSEXTENT tmp = *sp->obj[i];
+            *sp->obj[i] = *sp->copy[i];
+            *sp->copy[i] = tmp;
+        }
+        sp->rolled = b_true;
+    }
+    for(index_t i=0; i<sp->num; ++i) {
+        if(!fs_snapshot_release(sp, sp->copy[i])) return b_false;
+    }
+    return fs_snapshot_freecopy(sp, fs_snapshot_setsuccess(sp));
+}
+
+static inline bool_t fs_snapshot_discard(FSSNAPSHOT *sp) { /* after a failed rollback, it finishes the rollback. */
+    if(sp->num==0) return fs_snapshot_seterror(sp, SNAPSHOT_ERROR_PARAM);
+    for(index_t i=0; i<sp->num; ++i) {
+        if(!fs_snapshot_release(sp, sp->copy[i])) return b_false;
+    }
+    return fs_snapshot_freecopy(sp, fs_snapshot_setsuccess(sp));
+}
+
+#endif
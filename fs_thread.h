@@ -0,0 +1,312 @@
+// Copyright (c) 2020 The SorachanCoin Developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SORACHANCOIN_FS_THREAD
+#define SORACHANCOIN_FS_THREAD
+
+#include "fs_types.h"
+#include "fs_const.h"
+
+#ifdef WIN32
+# include <windows.h>
+#else
+# include <pthread.h>
+# include <unistd.h>
+#endif
+
+/*
+* ** fs_thread **
+*
+* Worker thread and mutex. (Win32 API or POSIX threads)
+*
+* fs_thread_parallel: func(arg, worker, workers) runs on "workers" threads, the caller is worker 0.
+* If a thread cannot be created, its share runs on the caller. So the result never depends on it.
+*
+* atomic: 64-bit load (acquire), store (release), exchange, add, compare and swap, and the fences.
+* (Interlocked on MSC/Intel, __atomic builtins on the others)
+*
+*/
+
+#define THREAD_WORKERS_MAX 64
+
+typedef struct _tag_FSTHREAD {
+#ifdef WIN32
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+    void (*func)(void *arg);
+    void *arg;
+    bool_t created;
+} FSTHREAD;
+
+typedef struct _tag_FSMUTEX {
+#ifdef WIN32
+    CRITICAL_SECTION cs;
+#else
+    pthread_mutex_t mutex;
+#endif
+} FSMUTEX;
+
+#ifdef WIN32
+static DWORD WINAPI fs_thread_proc(LPVOID param) {
+    FSTHREAD *tp = (FSTHREAD *)param;
+    tp->func(tp->arg);
+    return 0;
+}
+#else
+static inline void *fs_thread_proc(void *param) {
+    FSTHREAD *tp = (FSTHREAD *)param;
+    tp->func(tp->arg);
+    return NULL;
+}
+#endif
+
+static inline bool_t fs_thread_create(FSTHREAD *tp, void (*func)(void *arg), void *arg) {
+    tp->func = func;
+    tp->arg = arg;
+#ifdef WIN32
+    tp->handle = CreateThread(NULL, 0, fs_thread_proc, tp, 0, NULL);
+    tp->created = (tp->handle!=NULL);
+#else
+    tp->created = (pthread_create(&tp->handle, NULL, fs_thread_proc, tp)==0);
+#endif
+    return tp->created;
+}
+
+static inline bool_t fs_thread_join(FSTHREAD *tp) {
+    if(!tp->created) return b_false;
+    tp->created = b_false;
+#ifdef WIN32
+    const bool_t ret = (WaitForSingleObject(tp->handle, INFINITE)==WAIT_OBJECT_0);
+    CloseHandle(tp->handle);
+    return ret;
+#else
+    return pthread_join(tp->handle, NULL)==0;
+#endif
+}
+
+static inline num_t fs_thread_getcpus() {
+#ifdef WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (num_t)info.dwNumberOfProcessors;
+#else
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return (cpus<1)? 1: (num_t)cpus;
+#endif
+}
+
+static inline void fs_mutex_init(FSMUTEX *mp) {
+#ifdef WIN32
+    InitializeCriticalSection(&mp->cs);
+#else
+    pthread_mutex_init(&mp->mutex, NULL);
+#endif
+}
+
+static inline void fs_mutex_lock(FSMUTEX *mp) {
+#ifdef WIN32
+    EnterCriticalSection(&mp->cs);
+#else
+    pthread_mutex_lock(&mp->mutex);
+#endif
+}
+
+static inline void fs_mutex_unlock(FSMUTEX *mp) {
+#ifdef WIN32
+    LeaveCriticalSection(&mp->cs);
+#else
+    pthread_mutex_unlock(&mp->mutex);
+#endif
+}
+
+static inline void fs_mutex_destroy(FSMUTEX *mp) {
+#ifdef WIN32
+    DeleteCriticalSection(&mp->cs);
+#else
+    pthread_mutex_destroy(&mp->mutex);
+#endif
+}
+
+/*
+* atomic
+*/
+#if defined(COMPILER_MSC) || defined(COMPILER_INTEL)
+static inline counter_t fs_atomic_load(const volatile counter_t *p) {
+    const counter_t v = *p;
+    _ReadWriteBarrier();
+    return v;
+}
+
+static inline void fs_atomic_store(volatile counter_t *p, counter_t v) {
+    _ReadWriteBarrier();
+    *p = v;
+}
+
+/* no order: for the optimistic reads, validated after by fs_atomic_acquire and a version. */
+static inline counter_t fs_atomic_load_relaxed(const volatile counter_t *p) {
+    return *p;
+}
+
+static inline void *fs_atomic_loadptr_relaxed(void *const volatile *p) {
+    return *p;
+}
+
+static inline void fs_atomic_store_relaxed(volatile counter_t *p, counter_t v) {
+    *p = v;
+}
+
+static inline void fs_atomic_storeptr_relaxed(void *volatile *p, void *v) {
+    *p = v;
+}
+
+/* a table that the readers follow: published by storeptr (release), read by loadptr (acquire) */
+static inline void *fs_atomic_loadptr(void *const volatile *p) {
+    void *v = *p;
+    _ReadWriteBarrier();
+    return v;
+}
+
+static inline void fs_atomic_storeptr(void *volatile *p, void *v) {
+    _ReadWriteBarrier();
+    *p = v;
+}
+
+static inline counter_t fs_atomic_exchange(volatile counter_t *p, counter_t v) {
+    return InterlockedExchange64(p, v);
+}
+
+/* return: the new value */
+static inline counter_t fs_atomic_add(volatile counter_t *p, counter_t v) {
+    return InterlockedExchangeAdd64(p, v)+v;
+}
+
+static inline bool_t fs_atomic_cas(volatile counter_t *p, counter_t expected, counter_t desired) {
+    return InterlockedCompareExchange64(p, desired, expected)==expected;
+}
+
+/* the loads before are not moved after */
+static inline void fs_atomic_acquire(void) {
+    _ReadWriteBarrier();
+}
+
+static inline void fs_atomic_fence(void) {
+    MemoryBarrier();
+}
+
+static inline void fs_thread_pause(void) {
+    YieldProcessor();
+}
+#else
+static inline counter_t fs_atomic_load(const volatile counter_t *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void fs_atomic_store(volatile counter_t *p, counter_t v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+/* no order: for the optimistic reads, validated after by fs_atomic_acquire and a version. */
+static inline counter_t fs_atomic_load_relaxed(const volatile counter_t *p) {
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static inline void *fs_atomic_loadptr_relaxed(void *const volatile *p) {
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static inline void fs_atomic_store_relaxed(volatile counter_t *p, counter_t v) {
+    __atomic_store_n(p, v, __ATOMIC_RELAXED);
+}
+
+static inline void fs_atomic_storeptr_relaxed(void *volatile *p, void *v) {
+    __atomic_store_n(p, v, __ATOMIC_RELAXED);
+}
+
+/* a table that the readers follow: published by storeptr (release), read by loadptr (acquire) */
+static inline void *fs_atomic_loadptr(void *const volatile *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void fs_atomic_storeptr(void *volatile *p, void *v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static inline counter_t fs_atomic_exchange(volatile counter_t *p, counter_t v) {
+    return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST);
+}
+
+/* return: the new value */
+static inline counter_t fs_atomic_add(volatile counter_t *p, counter_t v) {
+    return __atomic_add_fetch(p, v, __ATOMIC_SEQ_CST);
+}
+
+static inline bool_t fs_atomic_cas(volatile counter_t *p, counter_t expected, counter_t desired) {
+    return __atomic_compare_exchange_n(p, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+/* the loads before are not moved after */
+static inline void fs_atomic_acquire(void) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
+
+static inline void fs_atomic_fence(void) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void fs_thread_pause(void) {
+# if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+# endif
+}
+#endif
+
+/* size bytes (a multiple of 8) by the relaxed words: read, src is shared and aligned to 8. write, dest is. */
+static inline void fs_atomic_read_relaxed(void *dest, const void *src, size_t size) {
+    for(size_t i=0; i<size; i+=sizeof(counter_t)) {
+        const counter_t w = fs_atomic_load_relaxed((const volatile counter_t *)((const byte_t *)src+i));
+        memcpy((byte_t *)dest+i, &w, sizeof(w));
+    }
+}
+
+static inline void fs_atomic_write_relaxed(void *dest, const void *src, size_t size) {
+    for(size_t i=0; i<size; i+=sizeof(counter_t)) {
+        counter_t w;
+        memcpy(&w, (const byte_t *)src+i, sizeof(w));
+        fs_atomic_store_relaxed((volatile counter_t *)((byte_t *)dest+i), w);
+    }
+}
+
+typedef struct _tag_THREAD_PARALLEL {
+    void (*func)(void *arg, index_t worker, num_t workers);
+    void *arg;
+    index_t worker;
+    num_t workers;
+} THREAD_PARALLEL;
+
+static inline void fs_thread_parallel_proc(void *param) {
+    THREAD_PARALLEL *pp = (THREAD_PARALLEL *)param;
+    pp->func(pp->arg, pp->worker, pp->workers);
+}
+
+static inline void fs_thread_parallel(num_t workers, void (*func)(void *arg, index_t worker, num_t workers), void *arg) {
+    FSTHREAD th[THREAD_WORKERS_MAX];
+    THREAD_PARALLEL param[THREAD_WORKERS_MAX];
+    if(workers<1) workers = 1;
+    if(THREAD_WORKERS_MAX<workers) workers = THREAD_WORKERS_MAX;
+    for(index_t i=1; i<workers; ++i) {
+        param[i].func = func;
+        param[i].arg = arg;
+        param[i].worker = i;
+        param[i].workers = workers;
+        fs_thread_create(&th[i], fs_thread_parallel_proc, &param[i]);
+    }
+    func(arg, 0, workers);
+    for(index_t i=1; i<workers; ++i) {
+        if(!fs_thread_join(&th[i])) func(arg, i, workers);
+    }
+}
+
+#endif
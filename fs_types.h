@@ -6,6 +6,9 @@
 #define SORACHANCOIN_FS_TYPES
 
 #define __STDC_WAIT_LIB_EXT1__ 1
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+# define _GNU_SOURCE /* fallocate, fs_file_punchhole */
+#endif
 #include <stdio.h>
 #include <stdarg.h>
 
@@ -31,6 +34,17 @@
 # define COMPILER_OTHER
 #endif
 
+/*
+** FS_SHARED: a variable defined in a header, one for all the translation units.
+*/
+#if defined(COMPILER_MSC) || defined(COMPILER_INTEL)
+# define FS_SHARED __declspec(selectany)
+#elif defined(COMPILER_GNU) || defined(COMPILER_CLANG) || defined(COMPILER_MINGW)
+# define FS_SHARED __attribute__((weak))
+#else
+# define FS_SHARED static
+#endif
+
 #ifdef WIN32
 typedef short int16_t;
 typedef unsigned short uint16_t;
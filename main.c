@@ -14,6 +14,13 @@
 #include "fs_sha256.h"
 #include "fs_bpb.h"
 #include "fs_cluster.h"
+#include "fs_extent.h"
+#include "fs_compress.h"
+#include "fs_dedup.h"
+#include "fs_snapshot.h"
+#include "fs_merkle.h"
+#include "fs_qhash.h"
+#include "fs_btree_page.h"
 
 //[OK]#define FS_TEST1
 //[OK]#define FS_TEST2
@@ -21,7 +28,29 @@
 //[OK]#define FS_TEST4
 //[OK]#define FS_TEST5
 //[OK]#define FS_TEST6
-#define FS_TEST7
+//[OK]#define FS_TEST7
+//[OK]#define FS_TEST8
+//[OK]#define FS_TEST9
+//[OK]#define FS_TEST10
+//[OK]#define FS_TEST11
+//[OK]#define FS_TEST12
+//[OK]#define FS_TEST13
+//[OK]#define FS_TEST14
+//[OK]#define FS_TEST15
+//[OK]#define FS_TEST16
+//[OK]#define FS_TEST17
+//[OK]#define FS_TEST18
+//[OK]#define FS_TEST19
+//[OK]#define FS_TEST20
+//[OK]#define FS_TEST21
+//[OK]#define FS_TEST22
+//[OK]#define FS_TEST23
+//[OK]#define FS_TEST24
+//[OK]#define FS_TEST25
+//[OK]#define FS_TEST26
+//[OK]#define FS_TEST27
+//[OK]#define FS_TEST28
+#define FS_TEST29
 
 #ifdef WIN32
 #include <windows.h>
@@ -29,7 +58,124 @@
 
 static const str_t *target_dir = "D:\\fsdisk";
 
+#ifdef FS_TEST8
+# ifndef WIN32
+#  include <sys/stat.h>
+/* the host storage of the data chunks, in 512 byte blocks. */
+static counter_t test_disk_blocks(FSDISK *fdp) {
+    counter_t blocks = 0;
+    for(index_t i=0; i<fdp->io.fp_num; ++i) {
+        struct stat st;
+        assert(fflush(fdp->io.fp[i]->file_ptr)==0);
+        assert(fstat(fileno(fdp->io.fp[i]->file_ptr), &st)==0);
+        blocks += (counter_t)st.st_blocks;
+    }
+    return blocks;
+}
+# endif
+#endif
+
+#if defined(FS_TEST12) || defined(FS_TEST14) || defined(FS_TEST23)
+static bool_t test_write_fail(FSFILE *fp, const byte_t *data, fsize_t size) { /* the data chunk is not written. */
+    (void)data; (void)size;
+    return fs_file_seterror(fp, FS_FILE_ERROR_DRIVE_RW_FAILURE);
+}
+#endif
+
+#if defined(FS_TEST19) || defined(FS_TEST20) || defined(FS_TEST21) || defined(FS_TEST22) || defined(FS_TEST23)
+static index_t test_fkeyequ(const str_t *a, const str_t *b) { return strcmp(a,b)==0; }
+static index_t test_fkeylt(const str_t *a, const str_t *b) { return strcmp(a,b)<=0; } /* ascending */
+#endif
+
+#if defined(FS_TEST26) || defined(FS_TEST27) || defined(FS_TEST28)
+static void test_olc_key(index_t test, index_t i, byte_t *key) {
+    if(test==0) {
+        const uint64_t val = (uint64_t)i*0x9E3779B97F4A7C15ULL;
+        memcpy(key, &val, sizeof(val));
+    } else
+        sprintf_s((str_t *)key, 32, "key%08d", i);
+}
+#endif
+
+#ifdef FS_TEST26
+typedef struct _tag_TEST_OLC_JOB {
+    FSBTREE *fbp;
+    index_t num;
+    index_t test; /* 0: u64, 1: string */
+    counter_t done;
+    counter_t errors;
+    counter_t found;
+} TEST_OLC_JOB;
+
+/* worker 0: the writer (the odd keys in, the keys of i%4==0 out), the others: the readers (the keys of i%4==2 stay) */
+static void test_olc_job(void *arg, index_t worker, num_t workers) {
+    TEST_OLC_JOB *job = (TEST_OLC_JOB *)arg;
+    byte_t key[32], data[16], expect[16];
+    if(worker==0) {
+        for(index_t i=1; i<job->num; i+=2) {
+            test_olc_key(job->test, i, key);
+            sprintf_s((str_t *)data, ARRAYLEN(data), "%d", i);
+            if(fs_btree_olc_insert(job->fbp, (const str_t *)key, data)!=BTREE_SUCCESS) fs_atomic_add(&job->errors, 1);
+            if(i%4==1) {
+                test_olc_key(job->test, i-1, key);
+                if(fs_btree_olc_remove(job->fbp, (const str_t *)key)!=BTREE_SUCCESS) fs_atomic_add(&job->errors, 1);
+            }
+        }
+        fs_atomic_store(&job->done, 1);
+        return;
+    }
+    counter_t found = 0;
+    for(bool_t last=b_false; !last; ) {
+        last = (fs_atomic_load(&job->done)!=0);
+        for(index_t i=worker-1; i<job->num; i+=(index_t)workers-1) { /* the readers share the keys */
+            test_olc_key(job->test, i, key);
+            const btree_status status = fs_btree_olc_getdata(job->fbp, worker, (const str_t *)key, data);
+            if(status==BTREE_SUCCESS) {
+                ++found;
+                sprintf_s((str_t *)expect, ARRAYLEN(expect), "%d", i);
+                if(strcmp((const str_t *)expect, (const str_t *)data)!=0) fs_atomic_add(&job->errors, 1);
+            } else if(status!=BTREE_NO_DATA || i%4==2)
+                fs_atomic_add(&job->errors, 1);
+        }
+    }
+    fs_atomic_add(&job->found, found);
+}
+#endif
+
+#ifdef FS_TEST29
+/* the slots have the common bytes of their node, and the prefix after them. return: the nodes with common bytes */
+static index_t test_common_check(FSBTREE *fbp, const B_NODE *p) {
+    if(p->type==n_leaf) return 0;
+    index_t count = (0<p->tree.node.common)? 1: 0;
+    const str_t *common = fs_btree_getkey(fbp, p->tree.node.common_offset);
+    for(counter_t i=0; i<p->tree.node.num; ++i) {
+        str_t prefix[BTREE_PREFIX_SIZE];
+        const str_t *key = fs_btree_getkey(fbp, p->tree.node.begin_ptr[i]);
+        assert(memcmp(common, key, (size_t)p->tree.node.common)==0);
+        fs_btree_setprefix(fbp, prefix, key+p->tree.node.common);
+        assert(memcmp(prefix, fs_btree_getprefix(p, i), BTREE_PREFIX_SIZE)==0);
+        count += test_common_check(fbp, p->tree.node.node_ptr[i]);
+    }
+    return count;
+}
+
+/* 0: a long namespace and the hash in hex (string), 1: hash32 of the same first 12 bytes */
+static void test_prefix_key(index_t test, index_t i, byte_t *key) {
+    byte_t hash[32];
+    fs_sha256_digest((const byte_t *)&i, sizeof(i), hash);
+    if(test==0) {
+        strcpy((str_t *)key, "utxo/0000000000000000000000000000/");
+        str_t *hex = (str_t *)key+strlen((const str_t *)key);
+        for(index_t k=0; k<32; ++k) sprintf_s(hex+2*k, 3, "%02x", hash[k]);
+    } else {
+        memset(key, 0x11, 12);
+        memcpy(key+12, hash, 20);
+    }
+}
+#endif
+
 int main(int argc, char *argv[]) {
+    fs_sha256_initimpl(); /* once, before the threads */
 #ifdef FS_TEST1
 # ifdef WIN32
     MessageBoxA(NULL, "memory test.", "test 1", MB_OK);
@@ -381,9 +527,1612 @@ Is that true? We always don't get reply that much, but ... this time was so earl
     }
 #endif
 
+#ifdef FS_TEST8
+# ifdef WIN32
+    MessageBoxA(NULL, "cluster punch hole test.", "test 8", MB_OK);
+# else
+    printf("test8: cluster punch hole test.\n");
+# endif
+    for(index_t test = 0; test < 10; ++test) {
+        const cluster_t begin = rand() % 10000;
+        const cluster_t num   = 2 + rand() % 4000;
+        const llsize_t bsize=num*BYTES_PER_CLUSTER;
+        byte_t *wbuf = fs_malloc((fsize_t)bsize);
+        byte_t *rbuf = fs_malloc((fsize_t)bsize);
+        assert(wbuf&&rbuf);
+        BPB bpb;
+        bpb.bpb_offset = _BITS_PER_SECTOR + rand() % 150000;
+        FSDISK *fdp;
+        FSBITMAP *bp;
+        assert(fs_disk_open(&fdp, target_dir));
+        assert(fs_bitmap_open(&bp, fdp));
+        for(index_t i=0; i<bsize; ++i) wbuf[i]=(byte_t)rand();
+        assert(fs_cluster_diskwrite(bp, &bpb, begin, num, wbuf));
+        bool_t used=b_false;
+# ifndef WIN32
+        const counter_t blocks = test_disk_blocks(fdp);
+# endif
+        const bool_t punched = fs_cluster_erasebitmap_punch(bp, &bpb, begin, num/2);
+        assert(punched || fs_bitmap_getstatus(bp)==FS_BITMAP_ERROR_PUNCH_UNSUPPORTED);
+        assert(fs_cluster_someusedrange(bp, &bpb, begin, num/2, &used));
+        assert(!used);
+        if(punched && 3<=num/2) { /* the whole clusters inside read back as zero, and their host storage is released. */
+            assert(fs_cluster_diskread(bp, &bpb, begin+1, num/2-2, rbuf));
+            for(index_t i=0; i<(num/2-2)*BYTES_PER_CLUSTER; ++i) assert(rbuf[i]==0);
+# ifndef WIN32
+            assert(test_disk_blocks(fdp)<blocks);
+# endif
+        }
+        assert(fs_cluster_diskread(bp, &bpb, begin+num/2, num-num/2, rbuf));
+        assert(memcmp(rbuf, wbuf+(num/2)*BYTES_PER_CLUSTER, (size_t)((num-num/2)*BYTES_PER_CLUSTER))==0);
+        {
+            FSHOLEBATCH *hbp;
+            assert(fs_cluster_holebatch_open(&hbp, bp));
+            for(cluster_t i=num/2; i<num; i+=2) assert(fs_cluster_holebatch_add(hbp, &bpb, i, 1));
+            for(cluster_t i=num/2+1; i<num; i+=2) assert(fs_cluster_holebatch_add(hbp, &bpb, i, 1));
+            assert(fs_cluster_someusedrange(bp, &bpb, begin+num/2, num-num/2, &used));
+            assert(used); /* deferred */
+            assert(fs_cluster_holebatch_flush(hbp) || fs_bitmap_getstatus(bp)==FS_BITMAP_ERROR_PUNCH_UNSUPPORTED);
+            fs_cluster_holebatch_close(hbp, b_true);
+        }
+        fs_free(rbuf, fs_free(wbuf, fs_disk_close(fdp, fs_bitmap_close(bp, b_true))));
+    }
+    {
+        FSDISK *fdp;
+        FSBITMAP *bp;
+        BPB bpb;
+        bpb.bpb_offset = _BITS_PER_SECTOR;
+        assert(fs_disk_open(&fdp, target_dir));
+        assert(fs_bitmap_open(&bp, fdp));
+        const num_t fnum = fdp->io.fp_num;
+        const cluster_t far = (cluster_t)(fnum+2)*CLUSTERS_PER_CHUNK;
+        byte_t *wbuf = fs_malloc(BYTES_PER_CLUSTER);
+        assert(wbuf);
+        memset(wbuf, 0xAB, BYTES_PER_CLUSTER);
+        assert(fs_cluster_diskwrite(bp, &bpb, far, 1, wbuf));
+        assert(fnum < fdp->io.fp_num);
+        assert(fs_cluster_erasebitmap_punch(bp, &bpb, far, 1) || fs_bitmap_getstatus(bp)==FS_BITMAP_ERROR_PUNCH_UNSUPPORTED);
+        assert(fdp->io.fp_num <= fnum+1); /* trailing free chunks are deleted. */
+        fs_free(wbuf, fs_disk_close(fdp, fs_bitmap_close(bp, b_true)));
+    }
+#endif
+
+#ifdef FS_TEST9
+# ifdef WIN32
+    MessageBoxA(NULL, "extent map test.", "test 9", MB_OK);
+# else
+    printf("test9: extent map test.\n");
+# endif
+    for(index_t test = 0; test < 10; ++test) {
+        FSDISK *fdp;
+        FSBITMAP *bp;
+        FSEXTENT *fep, *fep2;
+        BPB bpb;
+        bpb.bpb_offset = _BITS_PER_SECTOR + rand() % 150000;
+        assert(fs_disk_open(&fdp, target_dir));
+        assert(fs_bitmap_open(&bp, fdp));
+        assert(fs_extent_open(&fep));
+        assert(fs_extent_open(&fep2));
+        cluster_t physical = rand() % 10000;
+        for(index_t i=0; i<2000; ++i) {
+            const counter_t num = 1 + rand() % 8;
+            assert(fs_extent_append(fep, physical, num));
+            physical = (rand()%4==0)? physical+num: (physical+num+rand()%5000)%20000;
+        }
+        assert(fs_extent_getruns(fep) < 2000);
+        const cluster_t mapclus = 30000;
+        assert(fs_extent_diskwrite(fep, bp, &bpb, mapclus));
+        assert(fs_extent_diskread(fep2, bp, &bpb, mapclus));
+        assert(fs_extent_getruns(fep2)==fs_extent_getruns(fep));
+        assert(fs_extent_getclusters(fep2)==fs_extent_getclusters(fep));
+        for(cluster_t logical=0; logical<fs_extent_getclusters(fep); ++logical) {
+            cluster_t p1, p2;
+            counter_t r1, r2;
+            assert(fs_extent_lookup(fep, logical, &p1, &r1));
+            assert(fs_extent_lookup(fep2, logical, &p2, &r2));
+            assert(p1==p2 && r1==r2 && 0<r1);
+        }
+        {
+            byte_t head[EXTENT_HEADER_SIZE+2] = {'E','X','T','M'};
+            WriteLE32(head+4, sizeof(head));
+            WriteLE32(head+8, 0x7FFFFFFF); /* more runs than the bytes can have */
+            assert(!fs_extent_decode(fep2, head, sizeof(head)) && fs_extent_getstatus(fep2)==EXTENT_ERROR_BROKEN);
+        }
+        {
+            FSEXTENT *obj;
+            const counter_t num = 64;
+            byte_t *wbuf = fs_malloc(num*BYTES_PER_CLUSTER);
+            byte_t *rbuf = fs_malloc(num*BYTES_PER_CLUSTER);
+            assert(wbuf&&rbuf);
+            assert(fs_extent_open(&obj));
+            for(cluster_t i=0; i<num; i+=4) assert(fs_extent_append(obj, 40000+i*3, 4));
+            for(index_t i=0; i<num*BYTES_PER_CLUSTER; ++i) wbuf[i]=(byte_t)rand();
+            assert(fs_extent_objectwrite(obj, bp, &bpb, 0, num, wbuf));
+            assert(fs_extent_objectread(obj, bp, &bpb, 5, num-9, rbuf));
+            assert(memcmp(rbuf, wbuf+5*BYTES_PER_CLUSTER, (num-9)*BYTES_PER_CLUSTER)==0);
+            assert(!fs_extent_objectread(obj, bp, &bpb, 1, num, rbuf));
+            fs_free(rbuf, fs_free(wbuf, fs_extent_close(obj, b_true)));
+        }
+        fs_extent_close(fep2, fs_extent_close(fep, b_true));
+        fs_disk_close(fdp, fs_bitmap_close(bp, b_true));
+    }
+#endif
+
+#ifdef FS_TEST10
+# ifdef WIN32
+    MessageBoxA(NULL, "cluster write with hash test.", "test 10", MB_OK);
+# else
+    printf("test10: cluster write with hash test.\n");
+# endif
+    for(index_t test = 0; test < 10; ++test) {
+        const cluster_t begin = rand() % 10000;
+        const cluster_t num   = 1 + rand() % 2000;
+        byte_t *wbuf = fs_malloc((fsize_t)(num*BYTES_PER_CLUSTER));
+        byte_t *rbuf = fs_malloc((fsize_t)(num*BYTES_PER_CLUSTER));
+        byte_t *digest = fs_malloc((fsize_t)(num*CLUSTER_HASH_SIZE));
+        assert(wbuf&&rbuf&&digest);
+        BPB bpb;
+        bpb.bpb_offset = _BITS_PER_SECTOR + rand() % 150000;
+        FSDISK *fdp;
+        FSBITMAP *bp;
+        assert(fs_disk_open(&fdp, target_dir));
+        assert(fs_bitmap_open(&bp, fdp));
+        for(index_t i=0; i<num*BYTES_PER_CLUSTER; ++i) wbuf[i]=(byte_t)rand();
+        assert(fs_cluster_diskwrite_hash(bp, &bpb, begin, num, wbuf, digest));
+        bool_t used=b_false;
+        assert(fs_cluster_someusedrange(bp, &bpb, begin, num, &used));
+        assert(used);
+        assert(fs_cluster_diskread(bp, &bpb, begin, num, rbuf));
+        assert(memcmp(rbuf, wbuf, (size_t)(num*BYTES_PER_CLUSTER))==0);
+        for(cluster_t i=0; i<num; ++i) {
+            byte_t hash[CLUSTER_HASH_SIZE];
+            fs_sha256_digest(rbuf+i*BYTES_PER_CLUSTER, BYTES_PER_CLUSTER, hash);
+            assert(memcmp(hash, digest+i*CLUSTER_HASH_SIZE, CLUSTER_HASH_SIZE)==0);
+        }
+        fs_free(digest, fs_free(rbuf, fs_free(wbuf, fs_disk_close(fdp, fs_bitmap_close(bp, b_true)))));
+    }
+#endif
+
+#ifdef FS_TEST11
+# ifdef WIN32
+    MessageBoxA(NULL, "cluster compression test.", "test 11", MB_OK);
+# else
+    printf("test11: cluster compression test.\n");
+# endif
+    for(index_t test = 0; test < 10; ++test) {
+        const counter_t num = 1 + rand() % 500;
+        byte_t *wbuf = fs_malloc((fsize_t)(num*BYTES_PER_CLUSTER));
+        byte_t *rbuf = fs_malloc((fsize_t)(num*BYTES_PER_CLUSTER));
+        assert(wbuf&&rbuf);
+        for(counter_t i=0; i<num; ++i) { /* zero, text like and random clusters */
+            byte_t *p = wbuf+i*BYTES_PER_CLUSTER;
+            const index_t kind = rand()%3;
+            for(index_t k=0; k<BYTES_PER_CLUSTER; ++k)
+                p[k] = (kind==0)? 0: (kind==1)? (byte_t)("SORA blockchain "[(k/3)%16]^(rand()%8==0)): (byte_t)rand();
+        }
+        for(counter_t i=0; i<num; ++i) {
+            byte_t cbuf[LZ_BOUND(BYTES_PER_CLUSTER)], dbuf[BYTES_PER_CLUSTER];
+            const fsize_t csize = fs_lz_compress(wbuf+i*BYTES_PER_CLUSTER, BYTES_PER_CLUSTER, cbuf, sizeof(cbuf));
+            assert(0<csize);
+            assert(fs_lz_decompress(cbuf, csize, dbuf, sizeof(dbuf))==BYTES_PER_CLUSTER);
+            assert(memcmp(dbuf, wbuf+i*BYTES_PER_CLUSTER, BYTES_PER_CLUSTER)==0);
+        }
+        BPB bpb;
+        bpb.bpb_offset = _BITS_PER_SECTOR + rand() % 150000;
+        bpb.compress_type = (test%2==0)? compress_lz: compress_none;
+        bpb.cmap_offset = 40000;
+        FSDISK *fdp;
+        FSBITMAP *bp;
+        FSCMAP *cmp, *cmp2;
+        assert(fs_disk_open(&fdp, target_dir));
+        assert(fs_bitmap_open(&bp, fdp));
+        assert(fs_cmap_open(&cmp));
+        assert(fs_cmap_open(&cmp2));
+        if(bpb.compress_type==compress_lz) assert(fs_cmap_diskwrite_map(cmp, bp, &bpb)); /* the header cluster is reserved first. */
+        assert(fs_cmap_diskwrite(cmp, bp, &bpb, 10, num, wbuf));
+        assert(fs_cmap_diskwrite(cmp, bp, &bpb, 10, num/2+1, wbuf)); /* rewrite */
+        assert(fs_cmap_diskread(cmp, bp, &bpb, 10, num, rbuf));
+        assert(memcmp(rbuf, wbuf, (size_t)(num*BYTES_PER_CLUSTER))==0);
+        if(bpb.compress_type==compress_lz) {
+            assert(fs_cmap_diskwrite_map(cmp, bp, &bpb));
+            assert(fs_cmap_diskread_map(cmp2, bp, &bpb));
+            memset(rbuf, 0xFF, (size_t)(num*BYTES_PER_CLUSTER));
+            assert(fs_cmap_diskread(cmp2, bp, &bpb, 10, num, rbuf));
+            assert(memcmp(rbuf, wbuf, (size_t)(num*BYTES_PER_CLUSTER))==0);
+            const cluster_t far = 10+num+rand()%2000; /* the map grows into a new area, the data after the old one stays. */
+            assert(fs_cmap_diskwrite(cmp, bp, &bpb, far, num, wbuf));
+            const cluster_t area = cmp->area;
+            const counter_t area_clusters = cmp->area_clusters;
+            assert(fs_cmap_diskwrite_map(cmp, bp, &bpb));
+            assert((cmp->area==area)==(fs_cmap_getdiskclusters(cmp)<=area_clusters));
+            assert(fs_cmap_diskread_map(cmp2, bp, &bpb));
+            assert(cmp2->num==far+num);
+            memset(rbuf, 0xFF, (size_t)(num*BYTES_PER_CLUSTER));
+            assert(fs_cmap_diskread(cmp2, bp, &bpb, 10, num, rbuf));
+            assert(memcmp(rbuf, wbuf, (size_t)(num*BYTES_PER_CLUSTER))==0);
+            memset(rbuf, 0xFF, (size_t)(num*BYTES_PER_CLUSTER));
+            assert(fs_cmap_diskread(cmp2, bp, &bpb, far, num, rbuf));
+            assert(memcmp(rbuf, wbuf, (size_t)(num*BYTES_PER_CLUSTER))==0);
+            byte_t head[BYTES_PER_CLUSTER];
+            assert(fs_cluster_diskread(bp, &bpb, bpb.cmap_offset, 1, head));
+            WriteLE64(head+4, (uint64_t)(cmp->area_clusters*BYTES_PER_CLUSTER/CMAP_ENTRY_SIZE+1)); /* more entries than the area */
+            assert(fs_cluster_diskwrite(bp, &bpb, bpb.cmap_offset, 1, head));
+            assert(!fs_cmap_diskread_map(cmp2, bp, &bpb) && fs_cmap_getstatus(cmp2)==CMAP_ERROR_BROKEN);
+            assert(fs_cmap_diskwrite_map(cmp, bp, &bpb));
+        }
+        fs_cmap_close(cmp2, fs_cmap_close(cmp, b_true));
+        fs_free(rbuf, fs_free(wbuf, fs_disk_close(fdp, fs_bitmap_close(bp, b_true))));
+    }
+#endif
+
+#ifdef FS_TEST12
+# ifdef WIN32
+    MessageBoxA(NULL, "cluster deduplication test.", "test 12", MB_OK);
+# else
+    printf("test12: cluster deduplication test.\n");
+# endif
+    for(index_t test = 0; test < 10; ++test) {
+        const counter_t num = 1 + rand() % 300;
+        byte_t *wbuf = fs_malloc((fsize_t)(num*BYTES_PER_CLUSTER));
+        byte_t *rbuf = fs_malloc((fsize_t)(num*BYTES_PER_CLUSTER));
+        assert(wbuf&&rbuf);
+        for(counter_t i=0; i<num; ++i) { /* 8 kinds of contents */
+            const byte_t kind = (byte_t)(rand()%8);
+            for(index_t k=0; k<BYTES_PER_CLUSTER; ++k)
+                wbuf[i*BYTES_PER_CLUSTER+k] = (byte_t)(kind*31+k);
+        }
+        BPB bpb;
+        bpb.bpb_offset = _BITS_PER_SECTOR + rand() % 150000;
+        FSDISK *fdp;
+        FSBITMAP *bp;
+        FSDEDUP *dp;
+        FSEXTENT *fep, *fep2;
+        assert(fs_disk_open(&fdp, target_dir));
+        assert(fs_bitmap_open(&bp, fdp));
+        assert(fs_dedup_open(&dp, bp));
+        assert(fs_extent_open(&fep));
+        assert(fs_extent_open(&fep2));
+        assert(fs_dedup_diskwrite(dp, &bpb, wbuf, num, fep));
+        assert(fs_extent_getclusters(fep)==num);
+        assert(fs_dedup_gethit(dp)==num-dp->index.count);
+        assert(fs_extent_objectread(fep, bp, &bpb, 0, num, rbuf));
+        assert(memcmp(rbuf, wbuf, (size_t)(num*BYTES_PER_CLUSTER))==0);
+        {
+            byte_t pair[2*BYTES_PER_CLUSTER]; /* a stored content and a new one, the write fails: nothing is left. */
+            const counter_t count = dp->index.count, refs = dp->ref->count, hit = fs_dedup_gethit(dp);
+            memcpy(pair, wbuf, BYTES_PER_CLUSTER);
+            memset(pair+BYTES_PER_CLUSTER, 0xEE, BYTES_PER_CLUSTER);
+            fs_disk_setf_write(fdp, test_write_fail, b_true);
+            assert(!fs_dedup_diskwrite(dp, &bpb, pair, 2, fep2) && fs_dedup_getstatus(dp)==DEDUP_ERROR_DRIVE_RW_FAILURE);
+            fs_disk_setf_write(fdp, fs_file_write, b_true);
+            assert(dp->index.count==count && dp->ref->count==refs && fs_dedup_gethit(dp)==hit);
+            assert(fs_extent_getclusters(fep2)==0);
+        }
+        {
+            byte_t old[BYTES_PER_CLUSTER], cur[BYTES_PER_CLUSTER], back[BYTES_PER_CLUSTER]; /* overwritten in place: the old digest is not found any more. */
+            const counter_t count = dp->index.count;
+            memset(old, 0xA5, BYTES_PER_CLUSTER);
+            memset(cur, 0x5A, BYTES_PER_CLUSTER);
+            assert(fs_dedup_diskwrite(dp, &bpb, old, 1, fep2));
+            const cluster_t clus = fs_extent_getrun(fep2, 0)->physical;
+            assert(fs_extent_objectwrite(fep2, bp, &bpb, 0, 1, cur));
+            assert(fs_extent_getrun(fep2, 0)->physical==clus && dp->index.count==count);
+            FSEXTENT *fep3;
+            assert(fs_extent_open(&fep3));
+            assert(fs_dedup_diskwrite(dp, &bpb, old, 1, fep3));
+            assert(fs_extent_getrun(fep3, 0)->physical!=clus);
+            assert(fs_extent_objectread(fep3, bp, &bpb, 0, 1, back) && memcmp(back, old, BYTES_PER_CLUSTER)==0);
+            assert(fs_extent_objectread(fep2, bp, &bpb, 0, 1, back) && memcmp(back, cur, BYTES_PER_CLUSTER)==0);
+            assert(fs_dedup_erase(dp, &bpb, fep3) && fs_dedup_erase(dp, &bpb, fep2));
+            assert(dp->index.count==count);
+            fs_extent_close(fep3, b_true);
+        }
+        assert(fs_dedup_diskwrite(dp, &bpb, wbuf, num, fep2)); /* all clusters are shared. */
+        assert(fs_dedup_gethit(dp)==2*num-dp->index.count);
+        {
+            FSEXTENT *obj[2] = {fep, fep2}; /* remount: the index and the counts are rebuilt from the objects. */
+            const counter_t count = dp->index.count, refs = dp->ref->count;
+            fs_dedup_close(dp, b_true);
+            assert(fs_dedup_open(&dp, bp));
+            assert(fs_dedup_mount(dp, &bpb, obj, 2));
+            assert(dp->index.count==count && dp->ref->count==refs);
+            assert(!fs_dedup_mount(dp, &bpb, obj, 2) && fs_dedup_getstatus(dp)==DEDUP_ERROR_PARAM);
+            FSEXTENT *fep3;
+            assert(fs_extent_open(&fep3));
+            assert(fs_dedup_diskwrite(dp, &bpb, wbuf, num, fep3) && fs_dedup_gethit(dp)==num);
+            assert(fs_dedup_erase(dp, &bpb, fep3));
+            assert(dp->index.count==count && dp->ref->count==refs);
+            fs_extent_close(fep3, b_true);
+        }
+        const EXTENT *run = fs_extent_getrun(fep, 0);
+        const cluster_t first = run->physical;
+        assert(fs_dedup_erase(dp, &bpb, fep));
+        bool_t used;
+        assert(fs_cluster_someusedrange(bp, &bpb, first, 1, &used) && used);
+        memset(rbuf, 0xFF, (size_t)(num*BYTES_PER_CLUSTER));
+        assert(fs_extent_objectread(fep2, bp, &bpb, 0, num, rbuf));
+        assert(memcmp(rbuf, wbuf, (size_t)(num*BYTES_PER_CLUSTER))==0);
+        assert(fs_dedup_erase(dp, &bpb, fep2));
+        assert(fs_cluster_someusedrange(bp, &bpb, first, 1, &used) && !used);
+        assert(dp->index.count==0 && dp->ref->count==0);
+        fs_extent_close(fep2, fs_extent_close(fep, b_true));
+        fs_dedup_close(dp, b_true);
+        fs_free(rbuf, fs_free(wbuf, fs_disk_close(fdp, fs_bitmap_close(bp, b_true))));
+    }
+#endif
+
+#ifdef FS_TEST13
+# ifdef WIN32
+    MessageBoxA(NULL, "copy on write snapshot test.", "test 13", MB_OK);
+# else
+    printf("test13: copy on write snapshot test.\n");
+# endif
+    for(index_t test = 0; test < 10; ++test) {
+        const counter_t num = 2 + rand() % 300;
+        byte_t *obuf = fs_malloc((fsize_t)(num*BYTES_PER_CLUSTER));
+        byte_t *wbuf = fs_malloc((fsize_t)(num*BYTES_PER_CLUSTER));
+        byte_t *rbuf = fs_malloc((fsize_t)(num*BYTES_PER_CLUSTER));
+        assert(obuf&&wbuf&&rbuf);
+        for(index_t i=0; i<num*BYTES_PER_CLUSTER; ++i) {
+            obuf[i] = (byte_t)rand();
+            wbuf[i] = obuf[i];
+        }
+        BPB bpb;
+        bpb.bpb_offset = _BITS_PER_SECTOR + rand() % 150000;
+        FSDISK *fdp;
+        FSBITMAP *bp;
+        FSCLUSREF *ref;
+        FSEXTENT *fep;
+        FSSNAPSHOT *sp;
+        assert(fs_disk_open(&fdp, target_dir));
+        assert(fs_bitmap_open(&bp, fdp));
+        assert(fs_clusref_open(&ref));
+        fs_cluster_setref(bp, ref);
+        assert(fs_extent_open(&fep));
+        for(counter_t written=0; written<num;) { /* the object has some runs. */
+            const counter_t wnum = (num-written<7)? num-written: 1+rand()%(num-written);
+            cluster_t begin;
+            assert(fs_cluster_getfreecluster(bp, &bpb, wnum, &begin));
+            assert(fs_cluster_diskwrite(bp, &bpb, begin, wnum, obuf+written*BYTES_PER_CLUSTER));
+            assert(fs_extent_append(fep, begin, wnum));
+            written += wnum;
+        }
+        const cluster_t first = fs_extent_getrun(fep, 0)->physical;
+        assert(fs_snapshot_open(&sp, bp, &bpb));
+        for(index_t pass=0; pass<2; ++pass) {
+            assert(fs_snapshot_take(sp, &fep, 1));
+            assert(ref->count==num);
+            const cluster_t logical = rand()%(num/2+1);
+            const counter_t wnum = 1+rand()%(num-logical);
+            for(index_t i=logical*BYTES_PER_CLUSTER; i<(logical+wnum)*BYTES_PER_CLUSTER; ++i) wbuf[i] = (byte_t)rand();
+            assert(fs_extent_objectwrite(fep, bp, &bpb, logical, wnum, wbuf+logical*BYTES_PER_CLUSTER));
+            assert(fs_extent_objectwrite(fep, bp, &bpb, logical, wnum, wbuf+logical*BYTES_PER_CLUSTER)); /* not shared any more: in place */
+            assert(fs_extent_getclusters(fep)==num);
+            assert(fs_extent_objectread(fep, bp, &bpb, 0, num, rbuf));
+            assert(memcmp(rbuf, wbuf, (size_t)(num*BYTES_PER_CLUSTER))==0);
+            if(pass==0) {
+                assert(fs_snapshot_rollback(sp));
+                memcpy(wbuf, obuf, (size_t)(num*BYTES_PER_CLUSTER));
+                assert(fs_extent_getrun(fep, 0)->physical==first);
+            } else {
+                assert(fs_snapshot_discard(sp));
+            }
+            assert(ref->count==0 && fs_snapshot_getnum(sp)==0);
+            assert(fs_extent_objectread(fep, bp, &bpb, 0, num, rbuf));
+            assert(memcmp(rbuf, wbuf, (size_t)(num*BYTES_PER_CLUSTER))==0);
+        }
+        fs_snapshot_close(sp, b_true);
+        for(index_t i=0; i<fs_extent_getruns(fep); ++i) {
+            const EXTENT *run = fs_extent_getrun(fep, i);
+            bool_t used;
+            assert(fs_cluster_erasebitmap(bp, &bpb, run->physical, run->num));
+            assert(fs_cluster_someusedrange(bp, &bpb, run->physical, run->num, &used) && !used);
+        }
+        fs_extent_close(fep, b_true);
+        fs_cluster_setref(bp, NULL);
+        fs_clusref_close(ref, b_true);
+        fs_free(rbuf, fs_free(wbuf, fs_free(obuf, fs_disk_close(fdp, fs_bitmap_close(bp, b_true)))));
+    }
+#endif
+
+#ifdef FS_TEST14
+# ifdef WIN32
+    MessageBoxA(NULL, "merkle tree test.", "test 14", MB_OK);
+# else
+    printf("test14: merkle tree test.\n");
+# endif
+    for(index_t test = 0; test < 5; ++test) {
+        BPB bpb;
+        bpb.bpb_offset = _BITS_PER_SECTOR + rand() % 150000;
+        bpb.merkle_root_offset = rand() % 100;
+        FSDISK *fdp;
+        FSBITMAP *bp;
+        FSMERKLE *mp, *mp2;
+        assert(fs_disk_open(&fdp, target_dir));
+        assert(fs_bitmap_open(&bp, fdp));
+        assert(fs_merkle_open(&mp, bp));
+        assert(fs_merkle_open(&mp2, bp));
+        assert(fs_merkle_create(mp, &bpb, 1 + rand() % 1000));
+        byte_t root[32], expect[32];
+        for(index_t round = 0; round < 4; ++round) {
+            for(index_t w = 0; w < 8; ++w) { /* some runs of clusters, the tree may grow. */
+                const counter_t num = 1 + rand() % 50;
+                byte_t *buf = fs_malloc((fsize_t)(num*BYTES_PER_CLUSTER));
+                assert(buf);
+                for(index_t i=0; i<num*BYTES_PER_CLUSTER; ++i) buf[i] = (byte_t)rand();
+                cluster_t begin;
+                assert(fs_cluster_getfreecluster(bp, &bpb, num, &begin));
+                assert(fs_merkle_diskwrite(mp, begin, num, buf));
+                fs_free(buf, b_true);
+            }
+            assert(fs_merkle_commit(mp, &bpb));
+            if(round==1) { /* the writes fail: the grow leaves the old tree, and the commit can be done again. */
+                const counter_t capacity = fs_merkle_getcapacity(mp);
+                const cluster_t area = mp->area;
+                byte_t leaf[32];
+                assert(fs_merkle_getnode(mp, 0, 0, leaf));
+                fs_disk_setf_write(fdp, test_write_fail, b_true);
+                assert(!fs_merkle_setleaf(mp, (cluster_t)capacity, leaf));
+                assert(fs_merkle_getcapacity(mp)==capacity && mp->area==area && mp->dirty_num==0);
+                assert(fs_merkle_setleaf(mp, 0, leaf));
+                assert(!fs_merkle_commit(mp, &bpb) && 0<mp->dirty_num);
+                fs_disk_setf_write(fdp, fs_file_write, b_true);
+                assert(fs_merkle_commit(mp, &bpb));
+            }
+            if(round==2) { /* a grow before the commit: the header on disk still has the old area, and it is not freed. */
+                const cluster_t area = mp->area;
+                const counter_t clusters = fs_merkle_getareaclusters(mp);
+                byte_t leaf[32];
+                bool_t used;
+                memset(leaf, 0x00, sizeof(leaf)); /* a leaf never written */
+                assert(fs_merkle_setleaf(mp, (cluster_t)fs_merkle_getcapacity(mp), leaf));
+                assert(mp->area!=area);
+                assert(fs_merkle_load(mp2, &bpb) && mp2->area==area);
+                assert(fs_merkle_getroot(mp2, expect) && memcmp(expect, bpb.hash, 32)==0);
+                assert(fs_bitmap_getmask_allusedrange(bp, fs_cluster_getsector(&bpb, area), clusters*SECTORS_PER_CLUSTER, &used) && used);
+                assert(fs_merkle_commit(mp, &bpb) && mp->old_clusters==0);
+            }
+            assert(fs_merkle_getroot(mp, root));
+            assert(memcmp(root, bpb.hash, 32)==0);
+            assert(fs_merkle_rebuild(mp, expect));
+            assert(memcmp(root, expect, 32)==0);
+        }
+        /* a leaf is the SHA256 of the cluster on disk. */
+        byte_t leaf[32], rbuf[BYTES_PER_CLUSTER];
+        for(counter_t i=0; i<fs_merkle_getcapacity(mp); ++i) {
+            assert(fs_merkle_getnode(mp, 0, i, leaf));
+            bool_t zero = b_true;
+            for(index_t k=0; k<32; ++k) zero = zero && leaf[k]==0;
+            if(zero) continue;
+            assert(fs_cluster_diskread(bp, &bpb, (cluster_t)i, 1, rbuf));
+            fs_sha256_digest(rbuf, BYTES_PER_CLUSTER, expect);
+            assert(memcmp(leaf, expect, 32)==0);
+        }
+        assert(fs_merkle_load(mp2, &bpb));
+        assert(fs_merkle_getroot(mp2, expect));
+        assert(memcmp(root, expect, 32)==0);
+        fs_merkle_close(mp2, fs_merkle_close(mp, b_true));
+        fs_disk_close(fdp, fs_bitmap_close(bp, b_true));
+    }
+#endif
+
+#ifdef FS_TEST15
+# ifdef WIN32
+    MessageBoxA(NULL, "merkle proof test.", "test 15", MB_OK);
+# else
+    printf("test15: merkle proof test.\n");
+# endif
+    {
+        BPB bpb;
+        bpb.bpb_offset = _BITS_PER_SECTOR + rand() % 150000;
+        bpb.merkle_root_offset = rand() % 100;
+        FSDISK *fdp;
+        FSBITMAP *bp;
+        FSMERKLE *mp;
+        assert(fs_disk_open(&fdp, target_dir));
+        assert(fs_bitmap_open(&bp, fdp));
+        assert(fs_merkle_open(&mp, bp));
+        assert(fs_merkle_create(mp, &bpb, 1000));
+        byte_t digest[32];
+        for(counter_t i=0; i<1000; ++i) {
+            for(index_t k=0; k<32; ++k) digest[k] = (byte_t)rand();
+            assert(fs_merkle_setleaf(mp, (cluster_t)i, digest));
+        }
+        assert(fs_merkle_commit(mp, &bpb));
+        const index_t height = fs_merkle_getheight(mp);
+
+        /* two neighbours share the whole path: height-1 siblings. */
+        counter_t pair[2] = {401, 400};
+        MERKLE_PROOF *proof;
+        assert(fs_merkle_prove(mp, pair, 2, &proof));
+        assert(proof->num==2 && proof->hash_num==height-1);
+        assert(fs_merkle_verify(proof, fs_merkle_getcapacity(mp), bpb.hash));
+
+        /* an inner node as a leaf of a half tree: the claimed capacity is not trusted, and a leaf is tagged. */
+        byte_t parent[64];
+        memcpy(parent, proof->leaf, 64);
+        fs_merkle_parents(parent, parent, 1, 0);
+        counter_t forged_index = 200;
+        MERKLE_PROOF forged = *proof;
+        forged.capacity = fs_merkle_getcapacity(mp)/2;
+        forged.num = 1;
+        forged.index = &forged_index;
+        forged.leaf = parent;
+        assert(!fs_merkle_verify(&forged, fs_merkle_getcapacity(mp), bpb.hash));
+        assert(!fs_merkle_verify(&forged, forged.capacity, bpb.hash));
+        assert(!fs_merkle_verify(proof, fs_merkle_getcapacity(mp)/2, bpb.hash));
+        fs_merkle_proof_free(proof);
+
+        MERKLE_PROOF *proofs[32];
+        bool_t result[32];
+        for(index_t p=0; p<32; ++p) {
+            counter_t index[64];
+            const counter_t num = 1 + rand() % 64;
+            for(counter_t i=0; i<num; ++i) index[i] = rand() % fs_merkle_getcapacity(mp);
+            assert(fs_merkle_prove(mp, index, num, &proofs[p]));
+            assert(proofs[p]->hash_num <= proofs[p]->num*height);
+            assert(fs_merkle_verify(proofs[p], fs_merkle_getcapacity(mp), bpb.hash));
+        }
+        assert(fs_merkle_verify_batch((const MERKLE_PROOF *const *)proofs, 32, fs_merkle_getcapacity(mp), bpb.hash, result));
+
+        /* a changed leaf or sibling is found, and only that proof fails. */
+        proofs[3]->leaf[5] ^= 1;
+        if(0<proofs[7]->hash_num) proofs[7]->hash[0] ^= 1;
+        assert(!fs_merkle_verify_batch((const MERKLE_PROOF *const *)proofs, 32, fs_merkle_getcapacity(mp), bpb.hash, result));
+        for(index_t p=0; p<32; ++p) assert(result[p]==(p!=3 && (p!=7 || proofs[7]->hash_num==0)));
+        digest[0] = bpb.hash[0]^1;
+        memcpy(digest+1, bpb.hash+1, 31);
+        assert(!fs_merkle_verify(proofs[0], fs_merkle_getcapacity(mp), digest));
+        for(index_t p=0; p<32; ++p) fs_merkle_proof_free(proofs[p]);
+        fs_merkle_close(mp, b_true);
+        fs_disk_close(fdp, fs_bitmap_close(bp, b_true));
+    }
+#endif
+
+#ifdef FS_TEST16
+# ifdef WIN32
+    MessageBoxA(NULL, "append-only object test.", "test 16", MB_OK);
+# else
+    printf("test16: append-only object test.\n");
+# endif
+    for(index_t test = 0; test < 5; ++test) {
+        /* midstate: save, load and continue is the same as one pass. */
+        byte_t data[1000], expect[32];
+        byte_t *midstate = fs_malloc(SHA256_MIDSTATE_SIZE);
+        assert(midstate);
+        for(index_t i=0; i<(index_t)ARRAYLEN(data); ++i) data[i] = (byte_t)rand();
+        const counter_t cut = rand() % ARRAYLEN(data);
+        FSSHA256 sha, sha2;
+        fs_sha256_init(&sha);
+        fs_sha256_update(&sha, cut, data);
+        fs_sha256_savestate(&sha, midstate);
+        assert(fs_sha256_loadstate(&sha2, midstate));
+        fs_sha256_update(&sha2, ARRAYLEN(data)-cut, data+cut);
+        fs_sha256_final(&sha2);
+        fs_sha256_digest(data, ARRAYLEN(data), expect);
+        assert(memcmp(sha2.hash, expect, 32)==0);
+        midstate[0] ^= 1;
+        assert(!fs_sha256_loadstate(&sha2, midstate));
+        fs_free(midstate, b_true);
+
+        BPB bpb;
+        bpb.bpb_offset = _BITS_PER_SECTOR + rand() % 150000;
+        FSDISK *fdp;
+        FSBITMAP *bp;
+        FSEXTENT *fep, *fep2;
+        assert(fs_disk_open(&fdp, target_dir));
+        assert(fs_bitmap_open(&bp, fdp));
+        assert(fs_extent_open(&fep));
+        assert(fs_extent_open(&fep2));
+        assert(fs_extent_beginhash(fep));
+        cluster_t mapclus;
+        assert(fs_cluster_getfreecluster(bp, &bpb, 1, &mapclus));
+        assert(fs_extent_diskwrite(fep, bp, &bpb, mapclus));
+
+        const counter_t total = 50000 + rand() % 50000;
+        byte_t *all = fs_malloc((fsize_t)total);
+        assert(all);
+        for(counter_t i=0; i<total; ++i) all[i] = (byte_t)rand();
+        counter_t written = 0;
+        FSEXTENT *cur = fep;
+        while(written<total) {
+            counter_t size = (rand()%4==0)? rand() % (3*BYTES_PER_CLUSTER): rand() % 300;
+            if(total-written<size) size = total-written;
+            assert(fs_extent_objectappend(cur, bp, &bpb, all+written, size));
+            written += size;
+            if(rand()%4==0) { /* restart: the midstate comes back with the map. */
+                assert(fs_extent_diskwrite(cur, bp, &bpb, mapclus));
+                FSEXTENT *next = (cur==fep)? fep2: fep;
+                assert(fs_extent_diskread(next, bp, &bpb, mapclus));
+                assert(fs_extent_getbytes(next)==written);
+                cur = next;
+            }
+        }
+        byte_t hash[32];
+        assert(fs_extent_gethash(cur, hash));
+        fs_sha256_digest(all, total, expect);
+        assert(memcmp(hash, expect, 32)==0);
+        const counter_t clusters = fs_extent_getclusters(cur);
+        assert(clusters==(total+BYTES_PER_CLUSTER-1)/BYTES_PER_CLUSTER);
+        byte_t *rbuf = fs_malloc((fsize_t)(clusters*BYTES_PER_CLUSTER));
+        assert(rbuf);
+        assert(fs_extent_objectread(cur, bp, &bpb, 0, clusters, rbuf));
+        assert(memcmp(rbuf, all, (size_t)total)==0);
+        for(index_t i=0; i<fs_extent_getruns(cur); ++i) assert(fs_cluster_erasebitmap(bp, &bpb, fs_extent_getrun(cur, i)->physical, fs_extent_getrun(cur, i)->num));
+        assert(fs_cluster_erasebitmap(bp, &bpb, mapclus, 1));
+        fs_free(rbuf, b_true);
+        fs_free(all, b_true);
+        fs_extent_close(fep2, fs_extent_close(fep, b_true));
+        fs_disk_close(fdp, fs_bitmap_close(bp, b_true));
+    }
+#endif
+
+#ifdef FS_TEST17
+# ifdef WIN32
+    MessageBoxA(NULL, "tree hash test.", "test 17", MB_OK);
+# else
+    printf("test17: tree hash test.\n");
+# endif
+    for(index_t test = 0; test < 5; ++test) {
+        BPB bpb;
+        bpb.bpb_offset = _BITS_PER_SECTOR + rand() % 150000;
+        FSDISK *fdp;
+        FSBITMAP *bp;
+        assert(fs_disk_open(&fdp, target_dir));
+        assert(fs_bitmap_open(&bp, fdp));
+        const counter_t num = (test==0)? 1 + rand() % CLUSTER_HASH_SEGMENT: 1 + rand() % (CLUSTER_HASH_SEGMENT*40);
+        byte_t *buf = fs_malloc((fsize_t)(num*BYTES_PER_CLUSTER));
+        assert(buf);
+        for(index_t i=0; i<num*BYTES_PER_CLUSTER; ++i) buf[i] = (byte_t)rand();
+        cluster_t begin;
+        assert(fs_cluster_getfreecluster(bp, &bpb, num, &begin));
+        assert(fs_cluster_diskwrite(bp, &bpb, begin, num, buf));
+        byte_t hash[32], expect[32];
+        assert(fs_cluster_treehash(bp, &bpb, begin, num, hash));
+
+        /* the same tree, one node at a time. */
+        counter_t n = (num+CLUSTER_HASH_SEGMENT-1)/CLUSTER_HASH_SEGMENT;
+        byte_t *node = fs_malloc((fsize_t)(n*32));
+        assert(node);
+        for(counter_t i=0; i<n; ++i) {
+            const counter_t size = (i+1<n)? CLUSTER_HASH_SEGMENT: num-i*CLUSTER_HASH_SEGMENT;
+            fs_sha256_digest(buf+i*CLUSTER_HASH_SEGMENT*BYTES_PER_CLUSTER, size*BYTES_PER_CLUSTER, node+i*32);
+        }
+        while(1<n) {
+            counter_t k = 0;
+            for(counter_t i=0; i<n; i+=2, ++k) {
+                if(i+1<n) TransformD64(node+k*32, node+i*32);
+                else memmove(node+k*32, node+i*32, 32);
+            }
+            n = k;
+        }
+        memcpy(expect, node, 32);
+        assert(memcmp(hash, expect, 32)==0);
+        if(num<=CLUSTER_HASH_SEGMENT) {
+            fs_sha256_digest(buf, num*BYTES_PER_CLUSTER, expect);
+            assert(memcmp(hash, expect, 32)==0);
+        }
+        assert(fs_cluster_erasebitmap(bp, &bpb, begin, num));
+        fs_free(node, fs_free(buf, b_true));
+        fs_disk_close(fdp, fs_bitmap_close(bp, b_true));
+    }
+#endif
+
+#ifdef FS_TEST18
+# ifdef WIN32
+    MessageBoxA(NULL, "qhash65536 test.", "test 18", MB_OK);
+# else
+    printf("test18: qhash65536 test.\n");
+# endif
+    for(index_t test = 0; test < 4; ++test) {
+        const counter_t size = (test==0)? rand() % QHASH_ROW: rand() % (QHASH_ROW*(QHASH_THREAD_ROWS+8));
+        byte_t *data = fs_malloc((fsize_t)(size+1));
+        byte_t *lane = fs_malloc((fsize_t)(size/QHASH_LANES+64));
+        byte_t *expect = fs_malloc(QHASH_SIZE);
+        assert(data && lane && expect);
+        for(counter_t i=0; i<size; ++i) data[i] = (byte_t)rand();
+
+        /* lane l: the blocks l, l+256, ... one after another. */
+        for(index_t l=0; l<QHASH_LANES; ++l) {
+            counter_t n = 0;
+            for(counter_t offset=(counter_t)l*64; offset<size; offset+=QHASH_ROW) {
+                const counter_t len = (size-offset<64)? size-offset: 64;
+                memcpy(lane+n, data+offset, (size_t)len);
+                n += len;
+            }
+            fs_sha256_digest(lane, n, expect+32*l);
+        }
+        for(index_t multi = 0; multi < sha256_multi_max; ++multi) {
+            FSQHASH *qp;
+            assert(fs_qhash_open(&qp));
+            if(!fs_qhash_setmulti(qp, (sha256_multi)multi)) {
+                fs_qhash_close(qp, b_true);
+                continue;
+            }
+            for(counter_t offset=0; offset<size;) { /* in pieces: not on the rows */
+                counter_t n = 1 + rand() % (QHASH_ROW*3);
+                if(size-offset<n) n = size-offset;
+                assert(fs_qhash_update(qp, n, data+offset));
+                offset += n;
+            }
+            assert(fs_qhash_final(qp));
+            assert(memcmp(fs_qhash_gethash(qp), expect, QHASH_SIZE)==0);
+            fs_qhash_close(qp, b_true);
+        }
+        byte_t *qhash = fs_malloc(QHASH_SIZE);
+        assert(qhash);
+        assert(fs_qhash_digest(data, size, qhash));
+        assert(memcmp(qhash, expect, QHASH_SIZE)==0);
+        fs_free(qhash, fs_free(expect, fs_free(lane, fs_free(data, b_true))));
+    }
+    {
+        BPB bpb;
+        bpb.bpb_offset = _BITS_PER_SECTOR + rand() % 150000;
+        FSDISK *fdp;
+        FSBITMAP *bp;
+        FSQHASH *qp;
+        assert(fs_disk_open(&fdp, target_dir));
+        assert(fs_bitmap_open(&bp, fdp));
+        assert(fs_qhash_open(&qp));
+        const counter_t num = 1 + rand() % (QHASH_READ_CLUSTERS*2);
+        byte_t *buf = fs_malloc((fsize_t)(num*BYTES_PER_CLUSTER));
+        assert(buf);
+        for(counter_t i=0; i<num*BYTES_PER_CLUSTER; ++i) buf[i] = (byte_t)rand();
+        cluster_t begin;
+        assert(fs_cluster_getfreecluster(bp, &bpb, num, &begin));
+        assert(fs_cluster_diskwrite(bp, &bpb, begin, num, buf));
+        assert(fs_qhash_cluster(qp, bp, &bpb, begin, num, bpb.qhash));
+        byte_t *expect = fs_malloc(QHASH_SIZE);
+        assert(expect);
+        assert(fs_qhash_digest(buf, num*BYTES_PER_CLUSTER, expect));
+        assert(memcmp(bpb.qhash, expect, QHASH_SIZE)==0);
+        assert(fs_cluster_erasebitmap(bp, &bpb, begin, num));
+        fs_free(expect, fs_free(buf, b_true));
+        fs_qhash_close(qp, b_true);
+        fs_disk_close(fdp, fs_bitmap_close(bp, b_true));
+    }
+#endif
+
+#ifdef FS_TEST19
+# ifdef WIN32
+    MessageBoxA(NULL, "btree inline key test.", "test 19", MB_OK);
+# else
+    printf("test19: btree inline key test.\n");
+# endif
+    for(index_t test = 0; test < 2; ++test) {
+        /* the keys share more than BTREE_PREFIX_SIZE bytes: the prefix can not decide, the key is read in place. */
+        FSBTREE *fbp;
+        str_t _key[64];
+        byte_t _data[64];
+        assert(fs_btree_open(&fbp, 5 + rand() % 20, sizeof(_key), sizeof(_data)));
+        if(test==1) fs_btree_setfunc(fbp, test_fkeyequ, test_fkeylt);
+        const index_t num = 6000;
+        for(index_t i=0; i<num; ++i) {
+            const index_t k = (i*7919) % num;
+            memset(_key, 0x00, sizeof(_key));
+            memset(_data, 0x00, sizeof(_data));
+            sprintf_s(_key, ARRAYLEN(_key), (k%2)? "block/0000000000/%08d": "tx/%d", k);
+            sprintf_s((str_t *)_data, ARRAYLEN(_data), "%d__data", k);
+            assert(fs_btree_insert(fbp, _key, _data));
+            assert(fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+        }
+        for(index_t i=0; i<num; i+=3) {
+            memset(_key, 0x00, sizeof(_key));
+            sprintf_s(_key, ARRAYLEN(_key), (i%2)? "block/0000000000/%08d": "tx/%d", i);
+            assert(fs_btree_remove(fbp, _key));
+            assert(fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+        }
+        for(index_t i=0; i<num+100; ++i) {
+            memset(_key, 0x00, sizeof(_key));
+            sprintf_s(_key, ARRAYLEN(_key), (i%2)? "block/0000000000/%08d": "tx/%d", i);
+            SRND *srnd;
+            assert(fs_btree_getdata(fbp, _key, &srnd));
+            if(i%3==0 || num<=i) {
+                assert(fs_btree_getstatus(fbp)==BTREE_NO_DATA);
+            } else {
+                assert(fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+                sprintf_s((str_t *)_data, ARRAYLEN(_data), "%d__data", i);
+                assert(strcmp((const str_t *)_data, (const str_t *)fs_datastream_getdata(srnd))==0);
+                fs_btree_free(srnd, b_true);
+            }
+        }
+        fs_btree_close(fbp, b_true);
+    }
+#endif
+
+#ifdef FS_TEST20
+# ifdef WIN32
+    MessageBoxA(NULL, "btree variable-length key test.", "test 20", MB_OK);
+# else
+    printf("test20: btree variable-length key test.\n");
+# endif
+    for(index_t test = 0; test < 2; ++test) {
+        /* BTREE_KEY_VARIABLE: the arena has strlen+1 bytes of each key (and its size), not the ksize. */
+        FSBTREE *fbp;
+        str_t _key[128];
+        byte_t _data[32];
+        assert(fs_btree_open(&fbp, 5 + rand() % 20, BTREE_KEY_VARIABLE, sizeof(_data)));
+        if(test==1) fs_btree_setfunc(fbp, test_fkeyequ, test_fkeylt);
+        const index_t num = 8000;
+        counter_t keybytes = 0;
+        for(index_t i=0; i<num; ++i) {
+            const index_t k = (i*7919) % num;
+            memset(_data, 0x00, sizeof(_data));
+            sprintf_s(_key, ARRAYLEN(_key), (k%3==0)? "%d": (k%3==1)? "block/0000000000/%08d": "a/very/long/path/of/the/cluster/key/which/is/not/in/the/prefix/%d", k);
+            sprintf_s((str_t *)_data, ARRAYLEN(_data), "%d__data", k);
+            keybytes += strlen(_key)+1;
+            assert(fs_btree_insert(fbp, _key, _data));
+            assert(fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+        }
+        assert(keybytes<fs_btree_getkeybytes(fbp) && fs_btree_getkeybytes(fbp)<=keybytes+num); /* one byte of the size each */
+        sprintf_s(_key, ARRAYLEN(_key), "%d", 3);
+        assert(fs_btree_insert(fbp, _key, _data));
+        assert(fs_btree_getstatus(fbp)==BTREE_NO_ACCEPT); /* No double insert */
+        for(index_t i=0; i<num; i+=4) {
+            sprintf_s(_key, ARRAYLEN(_key), (i%3==0)? "%d": (i%3==1)? "block/0000000000/%08d": "a/very/long/path/of/the/cluster/key/which/is/not/in/the/prefix/%d", i);
+            assert(fs_btree_remove(fbp, _key));
+            assert(fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+        }
+        for(index_t i=0; i<num+100; ++i) {
+            sprintf_s(_key, ARRAYLEN(_key), (i%3==0)? "%d": (i%3==1)? "block/0000000000/%08d": "a/very/long/path/of/the/cluster/key/which/is/not/in/the/prefix/%d", i);
+            SRND *srnd;
+            assert(fs_btree_getdata(fbp, _key, &srnd));
+            if(i%4==0 || num<=i) {
+                assert(fs_btree_getstatus(fbp)==BTREE_NO_DATA);
+            } else {
+                assert(fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+                sprintf_s((str_t *)_data, ARRAYLEN(_data), "%d__data", i);
+                assert(strcmp((const str_t *)_data, (const str_t *)fs_datastream_getdata(srnd))==0);
+                fs_btree_free(srnd, b_true);
+            }
+        }
+        fs_btree_close(fbp, b_true);
+    }
+#endif
+
+#ifdef FS_TEST21
+# ifdef WIN32
+    MessageBoxA(NULL, "btree cursor test.", "test 21", MB_OK);
+# else
+    printf("test21: btree cursor test.\n");
+# endif
+    for(index_t test = 0; test < 2; ++test) {
+        /* test 0: default (descending), test 1: ascending */
+        FSBTREE *fbp;
+        str_t _key[32];
+        byte_t _data[32];
+        assert(fs_btree_open(&fbp, 5 + rand() % 20, BTREE_KEY_VARIABLE, sizeof(_data)));
+        if(test==1) fs_btree_setfunc(fbp, test_fkeyequ, test_fkeylt);
+        const index_t num = 5000; /* height/%05d/%d: 500 heights, 10 each */
+        for(index_t i=0; i<num; ++i) {
+            const index_t k = (i*7919) % num;
+            sprintf_s(_key, ARRAYLEN(_key), "height/%05d/%d", k/10, k%10);
+            sprintf_s((str_t *)_data, ARRAYLEN(_data), "%d__data", k);
+            assert(fs_btree_insert(fbp, _key, _data));
+            assert(fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+        }
+        for(index_t i=0; i<num; i+=7) {
+            sprintf_s(_key, ARRAYLEN(_key), "height/%05d/%d", i/10, i%10);
+            assert(fs_btree_remove(fbp, _key));
+            assert(fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+        }
+        /* all: in order, forward and backward */
+        BTREE_CURSOR cursor;
+        index_t count = 0;
+        str_t prev[32] = {0};
+        for(fs_btree_seek(fbp, &cursor, NULL); fs_btree_cursor_valid(&cursor); fs_btree_next(&cursor)) {
+            const str_t *key = fs_btree_cursor_getkey(&cursor);
+            if(count) assert((test==0)? 0<strcmp(prev, key): strcmp(prev, key)<0);
+            strcpy(prev, key);
+            SRND *srnd;
+            assert(fs_btree_cursor_getdata(&cursor, &srnd));
+            index_t h, n;
+            sscanf(key, "height/%d/%d", &h, &n);
+            sprintf_s((str_t *)_data, ARRAYLEN(_data), "%d__data", h*10+n);
+            assert(strcmp((const str_t *)_data, (const str_t *)fs_datastream_getdata(srnd))==0);
+            fs_btree_free(srnd, b_true);
+            ++count;
+        }
+        assert(fs_btree_getstatus(fbp)==BTREE_NO_DATA);
+        assert(count==num-(num+6)/7);
+        index_t rcount = 0;
+        for(fs_btree_seeklast(fbp, &cursor); fs_btree_cursor_valid(&cursor); fs_btree_prev(&cursor)) ++rcount;
+        assert(rcount==count);
+        /* range [lo, hi): one height */
+        for(index_t h=0; h<500; h+=37) {
+            str_t lo[32], hi[32];
+            sprintf_s(lo, ARRAYLEN(lo), (test==0)? "height/%05d/~": "height/%05d/", h); /* descending: "h/~" ... "h/" */
+            sprintf_s(hi, ARRAYLEN(hi), (test==0)? "height/%05d/": "height/%05d/~", h);
+            index_t expect = 0;
+            for(index_t n=0; n<10; ++n) expect += ((h*10+n)%7!=0);
+            index_t found = 0;
+            for(fs_btree_range(fbp, &cursor, lo, hi); fs_btree_cursor_valid(&cursor); fs_btree_next(&cursor)) {
+                sprintf_s(_key, ARRAYLEN(_key), "height/%05d/", h);
+                assert(strncmp(fs_btree_cursor_getkey(&cursor), _key, strlen(_key))==0);
+                ++found;
+            }
+            assert(found==expect);
+        }
+        /* seek: a removed key is skipped to the next */
+        sprintf_s(_key, ARRAYLEN(_key), "height/%05d/%d", 7/10, 7%10);
+        assert(fs_btree_seek(fbp, &cursor, _key) && fs_btree_cursor_valid(&cursor));
+        assert(strcmp(fs_btree_cursor_getkey(&cursor), _key)!=0);
+        fs_btree_close(fbp, b_true);
+    }
+#endif
+
+#ifdef FS_TEST22
+# ifdef WIN32
+    MessageBoxA(NULL, "btree bulk load test.", "test 22", MB_OK);
+# else
+    printf("test22: btree bulk load test.\n");
+# endif
+    for(index_t test = 0; test < 6; ++test) {
+        /* test%2==0: default (descending), 1: ascending. fill: 100, 70, 50 */
+        const index_t fill = (test<2)? 100: (test<4)? 70: 50;
+        FSBTREE *fbp;
+        str_t _key[32];
+        byte_t _data[32];
+        assert(fs_btree_open(&fbp, 3 + rand() % 20, BTREE_KEY_VARIABLE, sizeof(_data)));
+        if(test%2==1) fs_btree_setfunc(fbp, test_fkeyequ, test_fkeylt);
+        const index_t num = 1 + rand() % 20000;
+        BTREE_BULK bulk;
+        assert(fs_btree_bulk_begin(fbp, &bulk, fill));
+        for(index_t i=0; i<num; ++i) {
+            const index_t k = (test%2==0)? num-1-i: i;
+            sprintf_s(_key, ARRAYLEN(_key), "key/%08d", k);
+            sprintf_s((str_t *)_data, ARRAYLEN(_data), "%d__data", k);
+            assert(fs_btree_bulk_add(&bulk, _key, _data));
+        }
+        assert(fs_btree_bulk_end(&bulk));
+        for(index_t i=0; i<num+100; ++i) {
+            sprintf_s(_key, ARRAYLEN(_key), "key/%08d", i);
+            SRND *srnd;
+            assert(fs_btree_getdata(fbp, _key, &srnd));
+            if(num<=i) {
+                assert(fs_btree_getstatus(fbp)==BTREE_NO_DATA);
+            } else {
+                assert(fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+                sprintf_s((str_t *)_data, ARRAYLEN(_data), "%d__data", i);
+                assert(strcmp((const str_t *)_data, (const str_t *)fs_datastream_getdata(srnd))==0);
+                fs_btree_free(srnd, b_true);
+            }
+        }
+        BTREE_CURSOR cursor;
+        index_t count = 0;
+        for(fs_btree_seek(fbp, &cursor, NULL); fs_btree_cursor_valid(&cursor); fs_btree_next(&cursor)) ++count;
+        assert(count==num);
+        /* after bulk load: insert and remove as usual */
+        for(index_t i=0; i<num; i+=3) {
+            sprintf_s(_key, ARRAYLEN(_key), "key/%08d", i);
+            assert(fs_btree_remove(fbp, _key));
+            assert(fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+        }
+        for(index_t i=num; i<num+500; ++i) {
+            sprintf_s(_key, ARRAYLEN(_key), "key/%08d", i);
+            sprintf_s((str_t *)_data, ARRAYLEN(_data), "%d__data", i);
+            assert(fs_btree_insert(fbp, _key, _data));
+            assert(fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+        }
+        for(index_t i=0; i<num+500; ++i) {
+            sprintf_s(_key, ARRAYLEN(_key), "key/%08d", i);
+            SRND *srnd;
+            assert(fs_btree_getdata(fbp, _key, &srnd));
+            if(i<num && i%3==0) {
+                assert(fs_btree_getstatus(fbp)==BTREE_NO_DATA);
+            } else {
+                assert(fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+                fs_btree_free(srnd, b_true);
+            }
+        }
+        fs_btree_close(fbp, b_true);
+    }
+    {
+        /* unsorted: BTREE_ERROR_UNSORTED */
+        FSBTREE *fbp;
+        BTREE_BULK bulk;
+        byte_t _data[32] = {0};
+        assert(fs_btree_open(&fbp, 8, BTREE_KEY_VARIABLE, sizeof(_data)));
+        fs_btree_setfunc(fbp, test_fkeyequ, test_fkeylt);
+        assert(fs_btree_bulk_begin(fbp, &bulk, 100));
+        assert(fs_btree_bulk_add(&bulk, "a", _data));
+        assert(fs_btree_bulk_add(&bulk, "b", _data));
+        assert(!fs_btree_bulk_add(&bulk, "b", _data));
+        assert(fs_btree_getstatus(fbp)==BTREE_ERROR_UNSORTED);
+        assert(fs_btree_bulk_begin(fbp, &bulk, 100));
+        assert(fs_btree_bulk_add(&bulk, "b", _data));
+        assert(!fs_btree_bulk_add(&bulk, "a", _data));
+        assert(fs_btree_getstatus(fbp)==BTREE_ERROR_UNSORTED);
+        fs_btree_close(fbp, b_true);
+    }
+    for(index_t fill = 1; fill <= 100; fill += 49) {
+        /* dimension 2: a node has 2 children whatever fill is, and bulk_end ends. */
+        FSBTREE *fbp;
+        BTREE_BULK bulk;
+        str_t _key[32];
+        byte_t _data[32] = {0};
+        assert(fs_btree_open(&fbp, 2, BTREE_KEY_VARIABLE, sizeof(_data)));
+        fs_btree_setfunc(fbp, test_fkeyequ, test_fkeylt);
+        assert(fs_btree_bulk_begin(fbp, &bulk, fill));
+        for(index_t i=0; i<100; ++i) {
+            sprintf_s(_key, ARRAYLEN(_key), "key/%08d", i);
+            assert(fs_btree_bulk_add(&bulk, _key, _data));
+        }
+        assert(fs_btree_bulk_end(&bulk));
+        for(index_t i=0; i<100; ++i) {
+            SRND *srnd;
+            sprintf_s(_key, ARRAYLEN(_key), "key/%08d", i);
+            assert(fs_btree_getdata(fbp, _key, &srnd) && fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+            fs_btree_free(srnd, b_true);
+        }
+        fs_btree_close(fbp, b_true);
+    }
+#endif
+
+#ifdef FS_TEST23
+# ifdef WIN32
+    MessageBoxA(NULL, "btree on disk test.", "test 23", MB_OK);
+# else
+    printf("test23: btree on disk test.\n");
+# endif
+    for(index_t test = 0; test < 4; ++test) {
+        BPB bpb;
+        bpb.bpb_offset = _BITS_PER_SECTOR + rand() % 150000;
+        bpb.index_root_offset = rand() % 100;
+        FSDISK *fdp;
+        FSBITMAP *bp;
+        FSBTREE *fbp, *fbp2;
+        FSBTREEPAGE *pp, *pp2;
+        str_t _key[96];
+        byte_t _data[48], rdata[48];
+        assert(fs_disk_open(&fdp, target_dir));
+        assert(fs_bitmap_open(&bp, fdp));
+        assert(fs_btreepage_open(&pp, bp));
+        assert(fs_btreepage_open(&pp2, bp));
+        assert(fs_btree_open(&fbp, 5 + rand() % 20, BTREE_KEY_VARIABLE, sizeof(_data)));
+        if(test%2==1) fs_btree_setfunc(fbp, test_fkeyequ, test_fkeylt);
+        const index_t num = (test==0)? 0: 1 + rand() % 6000;
+        for(index_t i=0; i<num; ++i) {
+            sprintf_s(_key, ARRAYLEN(_key), (i%2)? "block/%d": "tx/0000000000000000000000000000000000/%d", i);
+            memset(_data, 0x00, sizeof(_data));
+            sprintf_s((str_t *)_data, ARRAYLEN(_data), "%d__data", i);
+            assert(fs_btree_insert(fbp, _key, _data));
+        }
+        for(index_t round = 0; round < 2; ++round) {
+            if(round==1) { /* remove some, and checkpoint again: the old image is released. */
+                for(index_t i=0; i<num; i+=5) {
+                    sprintf_s(_key, ARRAYLEN(_key), (i%2)? "block/%d": "tx/0000000000000000000000000000000000/%d", i);
+                    assert(fs_btree_remove(fbp, _key));
+                }
+            }
+            assert(fs_btreepage_checkpoint(pp, &bpb, fbp));
+            assert(fs_btreepage_load(pp2, &bpb));
+            if(test%2==1) fs_btreepage_setfunc(pp2, test_fkeyequ, test_fkeylt);
+            const index_t exist = (round==0)? num: num-(num+4)/5;
+            assert(fs_btreepage_getnum(pp2)==exist);
+            for(index_t i=0; i<num+50; ++i) {
+                sprintf_s(_key, ARRAYLEN(_key), (i%2)? "block/%d": "tx/0000000000000000000000000000000000/%d", i);
+                assert(fs_btreepage_getdata(pp2, _key, rdata));
+                if(num<=i || (round==1 && i%5==0)) {
+                    assert(fs_btreepage_getstatus(pp2)==BTREEPAGE_NO_DATA);
+                } else {
+                    assert(fs_btreepage_getstatus(pp2)==BTREEPAGE_SUCCESS);
+                    sprintf_s((str_t *)_data, ARRAYLEN(_data), "%d__data", i);
+                    assert(strcmp((const str_t *)_data, (const str_t *)rdata)==0);
+                }
+            }
+            /* cursor: the same order as the tree on memory */
+            BTREE_CURSOR mc;
+            BTREEPAGE_CURSOR dc;
+            index_t count = 0;
+            fs_btree_seek(fbp, &mc, NULL);
+            for(fs_btreepage_seek(pp2, &dc, NULL); fs_btreepage_cursor_valid(&dc); fs_btreepage_next(&dc)) {
+                const str_t *key;
+                const byte_t *data;
+                fs_btreepage_cursor_get(&dc, &key, &data);
+                assert(fs_btree_cursor_valid(&mc) && strcmp(key, fs_btree_cursor_getkey(&mc))==0);
+                fs_btree_next(&mc);
+                ++count;
+            }
+            assert(!fs_btree_cursor_valid(&mc) && count==exist);
+            if(0<exist) {
+                sprintf_s(_key, ARRAYLEN(_key), "block/%d", 1);
+                assert(fs_btreepage_seek(pp2, &dc, _key));
+                fs_btree_seek(fbp, &mc, _key);
+                assert(fs_btreepage_cursor_valid(&dc)==fs_btree_cursor_valid(&mc));
+                if(fs_btreepage_cursor_valid(&dc)) {
+                    const str_t *key;
+                    const byte_t *data;
+                    fs_btreepage_cursor_get(&dc, &key, &data);
+                    assert(strcmp(key, fs_btree_cursor_getkey(&mc))==0);
+                }
+                fs_btreepage_cursor_close(&dc);
+            }
+            /* restart: the image to the tree on memory */
+            assert(fs_btree_open(&fbp2, 5 + rand() % 20, BTREE_KEY_VARIABLE, sizeof(_data)));
+            if(test%2==1) fs_btree_setfunc(fbp2, test_fkeyequ, test_fkeylt);
+            assert(fs_btreepage_restore(pp2, fbp2, 90));
+            for(index_t i=0; i<num; ++i) {
+                sprintf_s(_key, ARRAYLEN(_key), (i%2)? "block/%d": "tx/0000000000000000000000000000000000/%d", i);
+                SRND *srnd;
+                assert(fs_btree_getdata(fbp2, _key, &srnd));
+                if(round==1 && i%5==0) {
+                    assert(fs_btree_getstatus(fbp2)==BTREE_NO_DATA);
+                } else {
+                    assert(fs_btree_getstatus(fbp2)==BTREE_SUCCESS);
+                    sprintf_s((str_t *)_data, ARRAYLEN(_data), "%d__data", i);
+                    assert(strcmp((const str_t *)_data, (const str_t *)fs_datastream_getdata(srnd))==0);
+                    fs_btree_free(srnd, b_true);
+                }
+            }
+            fs_btree_close(fbp2, b_true);
+        }
+        if(1<num) {
+            /* a failed checkpoint: pp is the old image, and the new area is released. */
+            const counter_t pages = fs_btreepage_getpages(pp), root = pp->root;
+            const cluster_t area = pp->area;
+            cluster_t free1, free2;
+            assert(fs_cluster_getfreecluster(bp, &bpb, 16, &free1));
+            fs_disk_setf_write(fdp, test_write_fail, b_true);
+            assert(!fs_btreepage_checkpoint(pp, &bpb, fbp) && fs_btreepage_getstatus(pp)==BTREEPAGE_ERROR_DRIVE_RW_FAILURE);
+            fs_disk_setf_write(fdp, fs_file_write, b_true);
+            assert(fs_btreepage_getpages(pp)==pages && pp->root==root && pp->area==area && fs_btreepage_getnum(pp)==num-(num+4)/5);
+            assert(fs_cluster_getfreecluster(bp, &bpb, 16, &free2) && free1==free2);
+            sprintf_s(_key, ARRAYLEN(_key), "block/%d", 1);
+            assert(fs_btreepage_getdata(pp, _key, rdata) && fs_btreepage_getstatus(pp)==BTREEPAGE_SUCCESS);
+
+            /* a broken page: the first leaf page, the size of the key is out of the page. */
+            byte_t broken[BYTES_PER_CLUSTER];
+            memset(broken, 0xFF, sizeof(broken));
+            broken[0] = BTREEPAGE_LEAF;
+            assert(fs_cluster_diskwrite(bp, &bpb, pp->area, 1, broken));
+            assert(fs_btreepage_load(pp2, &bpb));
+            BTREEPAGE_CURSOR dc;
+            assert(!fs_btreepage_seek(pp2, &dc, NULL) && fs_btreepage_getstatus(pp2)==BTREEPAGE_ERROR_BROKEN);
+            assert(!fs_btreepage_cursor_valid(&dc));
+        }
+        fs_btree_close(fbp, b_true);
+        fs_btreepage_close(pp2, fs_btreepage_close(pp, b_true));
+        fs_disk_close(fdp, fs_bitmap_close(bp, b_true));
+    }
+#endif
+
+#ifdef FS_TEST24
+# ifdef WIN32
+    MessageBoxA(NULL, "btree slab test.", "test 24", MB_OK);
+# else
+    printf("test24: btree slab test.\n");
+# endif
+    {
+        /* removed nodes are used again: the slabs do not grow in the same size of the tree. */
+        FSBTREE *fbp;
+        str_t _key[32];
+        byte_t _data[16];
+        assert(fs_btree_open(&fbp, 5 + rand() % 20, BTREE_KEY_VARIABLE, sizeof(_data)));
+        const index_t num = 20000;
+        counter_t slabs = 0;
+        for(index_t round = 0; round < 4; ++round) {
+            for(index_t i=0; i<num; ++i) {
+                const index_t k = (i*7919) % num;
+                sprintf_s(_key, ARRAYLEN(_key), "%d/%d", round, k);
+                sprintf_s((str_t *)_data, ARRAYLEN(_data), "%d", k);
+                assert(fs_btree_insert(fbp, _key, _data));
+                assert(fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+            }
+            if(round==0) slabs = fs_btree_getslabs(fbp);
+            else assert(fs_btree_getslabs(fbp)<=slabs+2);
+            for(index_t i=0; i<num; ++i) {
+                sprintf_s(_key, ARRAYLEN(_key), "%d/%d", round, i);
+                SRND *srnd;
+                assert(fs_btree_getdata(fbp, _key, &srnd));
+                assert(fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+                sprintf_s((str_t *)_data, ARRAYLEN(_data), "%d", i);
+                assert(strcmp((const str_t *)_data, (const str_t *)fs_datastream_getdata(srnd))==0);
+                fs_btree_free(srnd, b_true);
+            }
+            for(index_t i=0; i<num; ++i) {
+                sprintf_s(_key, ARRAYLEN(_key), "%d/%d", round, (i*104729) % num);
+                assert(fs_btree_remove(fbp, _key));
+                assert(fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+            }
+            assert(fbp->root==NULL);
+        }
+        /* clear: all slabs at once, and the tree can be used again. */
+        for(index_t i=0; i<1000; ++i) {
+            sprintf_s(_key, ARRAYLEN(_key), "c/%d", i);
+            assert(fs_btree_insert(fbp, _key, _data));
+        }
+        assert(fs_btree_clear(fbp));
+        assert(fbp->root==NULL && fs_btree_getslabs(fbp)==0);
+        for(index_t i=0; i<1000; ++i) {
+            sprintf_s(_key, ARRAYLEN(_key), "d/%d", i);
+            assert(fs_btree_insert(fbp, _key, _data));
+            assert(fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+        }
+        BTREE_CURSOR cursor;
+        index_t count = 0;
+        for(fs_btree_seek(fbp, &cursor, NULL); fs_btree_cursor_valid(&cursor); fs_btree_next(&cursor)) ++count;
+        assert(count==1000);
+        fs_btree_close(fbp, b_true);
+    }
+#endif
+
+#ifdef FS_TEST25
+# ifdef WIN32
+    MessageBoxA(NULL, "btree key type test.", "test 25", MB_OK);
+# else
+    printf("test25: btree key type test.\n");
+# endif
+    for(index_t test = 0; test < 3; ++test) {
+        /* 0: u64, 1: hash32, 2: memcmp (20 bytes, the same first 16 bytes) */
+        const btree_keytype type = (test==0)? btree_key_u64: (test==1)? btree_key_hash32: btree_key_memcmp;
+        const fsize_t ksize = (test==0)? 8: (test==1)? 32: 20;
+        FSBTREE *fbp;
+        byte_t _key[32], prev[32];
+        byte_t _data[16];
+        assert(fs_btree_open(&fbp, 3 + rand() % 30, ksize, sizeof(_data)));
+        assert(fs_btree_setkeytype(fbp, type));
+        const index_t num = 10000;
+        for(index_t r=0; r<2; ++r) {
+            for(index_t i=r; i<num; i+=2) {
+                memset(_key, 0x00, sizeof(_key));
+                if(test==0) {
+                    const uint64_t val = (uint64_t)i*0x9E3779B97F4A7C15ULL;
+                    memcpy(_key, &val, 8);
+                } else if(test==1)
+                    fs_sha256_digest((const byte_t *)&i, sizeof(i), _key);
+                else {
+                    memset(_key, 0x5A, 16);
+                    WriteBE32(_key+16, (uint32_t)(i*7919%num));
+                }
+                sprintf_s((str_t *)_data, ARRAYLEN(_data), "%d", i);
+                assert(fs_btree_insert(fbp, (const str_t *)_key, _data));
+                assert(fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+            }
+        }
+        assert(fs_btree_insert(fbp, (const str_t *)_key, _data));
+        assert(fs_btree_getstatus(fbp)==BTREE_NO_ACCEPT);
+        /* ascending order */
+        BTREE_CURSOR cursor;
+        index_t count = 0;
+        for(fs_btree_seek(fbp, &cursor, NULL); fs_btree_cursor_valid(&cursor); fs_btree_next(&cursor)) {
+            const str_t *key = fs_btree_cursor_getkey(&cursor);
+            if(count) assert(fs_btree_typedcmp(type, ksize, (const str_t *)prev, key)<0);
+            memcpy(prev, key, ksize);
+            ++count;
+        }
+        assert(count==num);
+        for(index_t i=0; i<num; i+=3) {
+            memset(_key, 0x00, sizeof(_key));
+            if(test==0) {
+                const uint64_t val = (uint64_t)i*0x9E3779B97F4A7C15ULL;
+                memcpy(_key, &val, 8);
+            } else if(test==1)
+                fs_sha256_digest((const byte_t *)&i, sizeof(i), _key);
+            else {
+                memset(_key, 0x5A, 16);
+                WriteBE32(_key+16, (uint32_t)(i*7919%num));
+            }
+            assert(fs_btree_remove(fbp, (const str_t *)_key));
+            assert(fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+        }
+        for(index_t i=0; i<num+100; ++i) {
+            memset(_key, 0x00, sizeof(_key));
+            if(test==0) {
+                const uint64_t val = (uint64_t)i*0x9E3779B97F4A7C15ULL;
+                memcpy(_key, &val, 8);
+            } else if(test==1)
+                fs_sha256_digest((const byte_t *)&i, sizeof(i), _key);
+            else {
+                memset(_key, 0x5A, 16);
+                WriteBE32(_key+16, (uint32_t)((num<=i)? i: i*7919%num));
+            }
+            SRND *srnd = NULL;
+            assert(fs_btree_getdata(fbp, (const str_t *)_key, &srnd));
+            if(i%3==0 || num<=i) {
+                assert(fs_btree_getstatus(fbp)==BTREE_NO_DATA);
+            } else {
+                assert(fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+                sprintf_s((str_t *)_data, ARRAYLEN(_data), "%d", i);
+                assert(strcmp((const str_t *)_data, (const str_t *)fs_datastream_getdata(srnd))==0);
+                fs_btree_free(srnd, b_true);
+            }
+        }
+        fs_btree_close(fbp, b_true);
+    }
+    {
+        /* the key type needs its ksize */
+        FSBTREE *fbp;
+        assert(fs_btree_open(&fbp, 8, 16, 16));
+        assert(!fs_btree_setkeytype(fbp, btree_key_hash32));
+        assert(!fs_btree_setkeytype(fbp, btree_key_u64));
+        assert(fs_btree_setkeytype(fbp, btree_key_memcmp));
+        fs_btree_close(fbp, b_true);
+    }
+#endif
+
+#ifdef FS_TEST26
+# ifdef WIN32
+    MessageBoxA(NULL, "btree concurrent test.", "test 26", MB_OK);
+# else
+    printf("test26: btree concurrent test.\n");
+# endif
+    for(index_t test = 0; test < 2; ++test) {
+        FSBTREE *fbp;
+        byte_t _key[32];
+        byte_t _data[16];
+        assert(fs_btree_open(&fbp, 3 + rand() % 30, (test==0)? 8: BTREE_KEY_VARIABLE, sizeof(_data)));
+        if(test==0) assert(fs_btree_setkeytype(fbp, btree_key_u64));
+        const index_t num = 20000;
+        for(index_t i=0; i<num; i+=2) {
+            test_olc_key(test, i, _key);
+            sprintf_s((str_t *)_data, ARRAYLEN(_data), "%d", i);
+            assert(fs_btree_insert(fbp, (const str_t *)_key, _data));
+        }
+        assert(fs_btree_setconcurrent(fbp));
+        TEST_OLC_JOB job;
+        job.fbp = fbp;
+        job.num = num;
+        job.test = test;
+        job.done = 0;
+        job.errors = 0;
+        job.found = 0;
+        num_t workers = fs_thread_getcpus();
+        if(workers<3) workers = 3;
+        if(9<workers) workers = 9;
+        fs_thread_parallel(workers, test_olc_job, &job);
+        assert(job.errors==0);
+        assert(0<job.found);
+        for(index_t i=0; i<num; ++i) {
+            test_olc_key(test, i, _key);
+            const btree_status status = fs_btree_olc_getdata(fbp, 0, (const str_t *)_key, _data);
+            if(i%4==0) {
+                assert(status==BTREE_NO_DATA);
+            } else {
+                byte_t expect[16];
+                assert(status==BTREE_SUCCESS);
+                sprintf_s((str_t *)expect, ARRAYLEN(expect), "%d", i);
+                assert(strcmp((const str_t *)expect, (const str_t *)_data)==0);
+            }
+        }
+        assert(fs_btree_olc_insert(fbp, (const str_t *)_key, _data)==BTREE_NO_ACCEPT);
+        fs_btree_close(fbp, b_true);
+    }
+#endif
 
+#ifdef FS_TEST27
+# ifdef WIN32
+    MessageBoxA(NULL, "btree batch test.", "test 27", MB_OK);
+# else
+    printf("test27: btree batch test.\n");
+# endif
+    for(index_t test = 0; test < 2; ++test) {
+        /* the same tree as the inserts one by one. the batches have the keys in the tree, and the same keys twice. */
+        FSBTREE *fbp, *fbs;
+        const index_t num = 20000;
+        const index_t dups = 64;
+        const index_t dimension = 3 + rand() % 30;
+        byte_t *keys = (byte_t *)fs_malloc((num+100)*32);
+        byte_t *data = (byte_t *)fs_malloc((num+100+dups)*16);
+        const str_t **kp = (const str_t **)fs_malloc((num+100+dups)*sizeof(const str_t *));
+        index_t *perm = (index_t *)fs_malloc(num*sizeof(index_t));
+        btree_status *status = (btree_status *)fs_malloc((num+dups)*sizeof(btree_status));
+        bool_t *found = (bool_t *)fs_malloc((num+100)*sizeof(bool_t));
+        assert(keys && data && kp && perm && status && found);
+        assert(fs_btree_open(&fbp, dimension, (test==0)? 8: BTREE_KEY_VARIABLE, 16));
+        assert(fs_btree_open(&fbs, dimension, (test==0)? 8: BTREE_KEY_VARIABLE, 16));
+        if(test==0) assert(fs_btree_setkeytype(fbp, btree_key_u64) && fs_btree_setkeytype(fbs, btree_key_u64));
+        for(index_t i=0; i<num+100; ++i) test_olc_key(test, i, keys+i*32);
+        for(index_t i=0; i<num; ++i) {
+            sprintf_s((str_t *)data, 16, "%d", i);
+            if(i%5==0) assert(fs_btree_insert(fbp, (const str_t *)(keys+i*32), data));
+            assert(fs_btree_insert(fbs, (const str_t *)(keys+i*32), data));
+            perm[i] = i;
+        }
+        for(index_t i=num-1; 0<i; --i) {
+            const index_t j = rand() % (i+1);
+            const index_t tmp = perm[i]; perm[i] = perm[j]; perm[j] = tmp;
+        }
+        for(index_t first=0; first<num; ) {
+            index_t n = 1 + rand() % 3000;
+            if(num-first<n) n = num-first;
+            index_t m = 0;
+            for(; m<n+dups && m<2*n; ++m) { /* n keys, and then the same keys again */
+                const index_t i = (m<n)? perm[first+m]: perm[first+rand()%n];
+                kp[m] = (const str_t *)(keys+i*32);
+                sprintf_s((str_t *)(data+m*16), 16, "%d", (m<n)? i: -1);
+            }
+            assert(fs_btree_insert_batch(fbp, m, kp, data, status));
+            for(index_t j=0; j<m; ++j) {
+                if(j<n && perm[first+j]%5!=0) assert(status[j]==BTREE_SUCCESS);
+                else assert(status[j]==BTREE_NO_ACCEPT);
+            }
+            first += n;
+        }
+        for(index_t round = 0; round < 2; ++round) {
+            BTREE_CURSOR cursor, cs;
+            index_t count = 0;
+            fs_btree_seek(fbs, &cs, NULL);
+            for(fs_btree_seek(fbp, &cursor, NULL); fs_btree_cursor_valid(&cursor); fs_btree_next(&cursor)) {
+                if(round==0) {
+                    assert(fs_btree_cursor_valid(&cs));
+                    assert(memcmp(fs_btree_cursor_getkey(&cursor), fs_btree_cursor_getkey(&cs), (test==0)? 8: 12)==0);
+                    fs_btree_next(&cs);
+                }
+                ++count;
+            }
+            assert(count==((round==0)? num: num-(num+2)/3));
+            for(index_t i=0; i<num+100; ++i) kp[i] = (const str_t *)(keys+((num+100-1-i)*7919%(num+100))*32);
+            assert(fs_btree_getdata_batch(fbp, num+100, kp, data, found));
+            for(index_t j=0; j<num+100; ++j) {
+                const index_t i = (num+100-1-j)*7919%(num+100);
+                SRND *srnd;
+                assert(fs_btree_getdata(fbp, kp[j], &srnd));
+                if(num<=i || (round==1 && i%3==0)) {
+                    assert(!found[j] && fs_btree_getstatus(fbp)==BTREE_NO_DATA);
+                } else {
+                    byte_t expect[16];
+                    assert(found[j] && fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+                    sprintf_s((str_t *)expect, ARRAYLEN(expect), "%d", i);
+                    assert(strcmp((const str_t *)expect, (const str_t *)(data+j*16))==0);
+                    assert(strcmp((const str_t *)expect, (const str_t *)fs_datastream_getdata(srnd))==0);
+                    fs_btree_free(srnd, b_true);
+                }
+            }
+            if(round==0) {
+                for(index_t i=0; i<num; i+=3) {
+                    assert(fs_btree_remove(fbp, (const str_t *)(keys+i*32)));
+                    assert(fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+                }
+            }
+        }
+        fs_free(found, fs_free(status, fs_free(perm, fs_free(kp, fs_free(data, fs_free(keys, b_true))))));
+        fs_btree_close(fbs, fs_btree_close(fbp, b_true));
+    }
+#endif
 
+#ifdef FS_TEST28
+# ifdef WIN32
+    MessageBoxA(NULL, "btree reclaim test.", "test 28", MB_OK);
+# else
+    printf("test28: btree reclaim test.\n");
+# endif
+    for(index_t test = 0; test < 2; ++test) {
+        /* churn: the removed slots are used again, and compact releases the dead keys. */
+        FSBTREE *fbp;
+        byte_t _key[32];
+        byte_t _data[16];
+        assert(fs_btree_open(&fbp, 3 + rand() % 30, (test==0)? 8: BTREE_KEY_VARIABLE, sizeof(_data)));
+        if(test==0) assert(fs_btree_setkeytype(fbp, btree_key_u64));
+        const index_t num = 10000;
+        for(index_t round = 0; round < 5; ++round) {
+            for(index_t i=0; i<num; ++i) {
+                test_olc_key(test, round*num+i, _key);
+                sprintf_s((str_t *)_data, ARRAYLEN(_data), "%d", round*num+i);
+                assert(fs_btree_insert(fbp, (const str_t *)_key, _data));
+                assert(fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+            }
+            assert(fs_fragvector_getsize(fbp->vch->vch)==round*100+num); /* only the keys that stay need new slots */
+            for(index_t i=0; i<num; ++i) { /* the last 100 keys of the round stay */
+                if(num-100<=i) continue;
+                test_olc_key(test, round*num+i, _key);
+                assert(fs_btree_remove(fbp, (const str_t *)_key));
+                assert(fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+            }
+            if(round==3) {
+                const counter_t bytes = fs_btree_getkeybytes(fbp);
+                assert(0<fs_btree_getdeadbytes(fbp));
+                assert(fs_btree_getdeadbytes(fbp)==fs_keyarena_getdead(fbp->key)+(counter_t)fs_datastream_getfree(fbp->vch)*(counter_t)sizeof(VECTOR_DATA)); /* a slot each */
+                assert(fs_btree_compact(fbp));
+                assert(fs_btree_getdeadbytes(fbp)==0);
+                assert(fs_btree_getkeybytes(fbp)<bytes);
+                assert(fs_fragvector_getsize(fbp->vch->vch)==(round+1)*100);
+            }
+        }
+        for(index_t i=0; i<5*num+100; ++i) {
+            test_olc_key(test, i, _key);
+            SRND *srnd;
+            assert(fs_btree_getdata(fbp, (const str_t *)_key, &srnd));
+            if(i<5*num && num-100<=i%num) {
+                assert(fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+                sprintf_s((str_t *)_data, ARRAYLEN(_data), "%d", i);
+                assert(strcmp((const str_t *)_data, (const str_t *)fs_datastream_getdata(srnd))==0);
+                fs_btree_free(srnd, b_true);
+            } else
+                assert(fs_btree_getstatus(fbp)==BTREE_NO_DATA);
+        }
+        BTREE_CURSOR cursor;
+        index_t count = 0;
+        for(fs_btree_seek(fbp, &cursor, NULL); fs_btree_cursor_valid(&cursor); fs_btree_next(&cursor)) ++count;
+        assert(count==5*100);
+        assert(fs_btree_clear(fbp));
+        assert(fs_btree_getkeybytes(fbp)==0 && fs_fragvector_getsize(fbp->vch->vch)==0);
+        fs_btree_close(fbp, b_true);
+    }
+#endif
 
+#ifdef FS_TEST29
+# ifdef WIN32
+    MessageBoxA(NULL, "btree prefix compression test.", "test 29", MB_OK);
+# else
+    printf("test29: btree prefix compression test.\n");
+# endif
+    for(index_t test = 0; test < 2; ++test) {
+        /* the keys of a long common head: the nodes keep the bytes after it, and the node pages the short separators. */
+        FSBTREE *fbp;
+        byte_t _key[128];
+        byte_t _data[16], rdata[16];
+        assert(fs_btree_open(&fbp, 5 + rand() % 30, (test==0)? BTREE_KEY_VARIABLE: 32, sizeof(_data)));
+        if(test==1) assert(fs_btree_setkeytype(fbp, btree_key_hash32));
+        const index_t num = 8000;
+        for(index_t i=0; i<num; ++i) {
+            test_prefix_key(test, i, _key);
+            sprintf_s((str_t *)_data, ARRAYLEN(_data), "%d", i);
+            assert(fs_btree_insert(fbp, (const str_t *)_key, _data));
+            assert(fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+        }
+        for(index_t i=0; i<num; i+=3) {
+            test_prefix_key(test, i, _key);
+            assert(fs_btree_remove(fbp, (const str_t *)_key));
+            assert(fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+        }
+        assert(0<test_common_check(fbp, fbp->root));
+        for(index_t i=0; i<num+100; ++i) {
+            test_prefix_key(test, i, _key);
+            SRND *srnd;
+            assert(fs_btree_getdata(fbp, (const str_t *)_key, &srnd));
+            if(num<=i || i%3==0) {
+                assert(fs_btree_getstatus(fbp)==BTREE_NO_DATA);
+            } else {
+                assert(fs_btree_getstatus(fbp)==BTREE_SUCCESS);
+                sprintf_s((str_t *)_data, ARRAYLEN(_data), "%d", i);
+                assert(strcmp((const str_t *)_data, (const str_t *)fs_datastream_getdata(srnd))==0);
+                fs_btree_free(srnd, b_true);
+            }
+        }
+        if(test==0) {
+            BPB bpb;
+            bpb.bpb_offset = _BITS_PER_SECTOR + rand() % 150000;
+            bpb.index_root_offset = rand() % 100;
+            FSDISK *fdp;
+            FSBITMAP *bp;
+            FSBTREEPAGE *pp, *pp2;
+            assert(fs_disk_open(&fdp, target_dir));
+            assert(fs_bitmap_open(&bp, fdp));
+            assert(fs_btreepage_open(&pp, bp));
+            assert(fs_btreepage_open(&pp2, bp));
+            assert(fs_btreepage_checkpoint(pp, &bpb, fbp));
+            assert(fs_btreepage_load(pp2, &bpb));
+            assert(0<pp2->height);
+            for(index_t i=0; i<num+100; ++i) {
+                test_prefix_key(test, i, _key);
+                assert(fs_btreepage_getdata(pp2, (const str_t *)_key, rdata));
+                if(num<=i || i%3==0) {
+                    assert(fs_btreepage_getstatus(pp2)==BTREEPAGE_NO_DATA);
+                } else {
+                    assert(fs_btreepage_getstatus(pp2)==BTREEPAGE_SUCCESS);
+                    sprintf_s((str_t *)_data, ARRAYLEN(_data), "%d", i);
+                    assert(strcmp((const str_t *)_data, (const str_t *)rdata)==0);
+                }
+            }
+            /* the separators of the root page: the namespace and a few bytes of the hash */
+            BTREE_PAGE *page = fs_btreepage_getpage(pp2, pp2->root);
+            assert(page);
+            fsize_t pos = BTREEPAGE_HEADER_SIZE;
+            for(index_t i=0; i<fs_btreepage_getcount(page->data); ++i) {
+                const str_t *key;
+                const byte_t *data;
+                counter_t child;
+                pos = fs_btreepage_getentry(pp2, page->data, pos, &key, &data, &child);
+                if(0<i) assert(strlen(key)<strlen((const str_t *)_key)/2);
+            }
+            fs_btreepage_unpin(page);
+            fs_btreepage_close(pp2, fs_btreepage_close(pp, b_true));
+            fs_disk_close(fdp, fs_bitmap_close(bp, b_true));
+        }
+        fs_btree_close(fbp, b_true);
+    }
+#endif
 
 #ifdef WIN32
     MessageBoxA(NULL, "all test.", "complete success.", MB_OK);